@@ -0,0 +1,91 @@
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Compressed trace archive: an archive_header_t, then chunks, each an
+ * archive_chunk_t and its bytes in the LZ4 block format, or stored as they
+ * are when they do not compress. Every chunk decompresses on its own and
+ * starts where decoding can: at a formatter frame for formatted trace
+ * (csc trace.dat), at an A-sync packet for the bytes of one trace ID
+ * (deformat trc_N.dat), so chunks can be decoded in parallel as segments
+ * of the plain file are. The readers below take plain files as well.
+ */
+#define ARCHIVE_MAGIC       0x43524154  // "TARC"
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_ALIGN_FRAME 0           // formatted trace, chunks of whole frames
+#define ARCHIVE_ALIGN_ASYNC 1           // unformatted trace, chunks start at an A-sync
+#define ARCHIVE_CHUNK_SIZE  (1024 * 1024)
+// an A-sync may come this much past ARCHIVE_CHUNK_SIZE, the chunk is cut at the limit without one
+#define ARCHIVE_CHUNK_MAX   (2 * ARCHIVE_CHUNK_SIZE)
+#define ARCHIVE_CHUNK_STORED 0x1        // the bytes are not compressed
+#define ARCHIVE_CHUNK_SYNC   0x2        // the chunk starts at a frame or an A-sync
+
+typedef struct archive_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t align;
+    uint32_t chunk_max;     // raw bytes of the largest chunk
+} archive_header_t;
+
+typedef struct archive_chunk {
+    uint32_t raw_len;
+    uint32_t comp_len;
+    uint32_t flags;
+} archive_chunk_t;
+
+// Writer, on a file or a pipe; the bytes may come in pieces of any size
+typedef struct archive_out {
+    int fd;
+    uint32_t align;
+    uint8_t * raw;          // ARCHIVE_CHUNK_MAX bytes not written yet
+    size_t fill;
+    size_t scanned;         // raw bytes searched for an A-sync
+    uint8_t * comp;
+    uint32_t * table;       // match finder of the compressor
+    uint32_t next_flags;    // ARCHIVE_CHUNK_SYNC when the cut was at a sync point
+    uint64_t raw_bytes;
+    uint64_t comp_bytes;    // with the headers
+    uint64_t chunks;
+} archive_out_t;
+
+archive_out_t* archive_out_open(int fd, uint32_t align);
+void archive_out_write(archive_out_t* out, const void* data, size_t len);
+void archive_out_flush(archive_out_t* out);
+void archive_out_close(archive_out_t* out);
+
+/*
+ * Reader with the semantics of read(2) on fd, the plain bytes of an
+ * archive or of any other file. A chunk that is not complete yet is kept,
+ * so a growing archive can be followed by reading again after 0.
+ */
+#define ARCHIVE_IN_PROBE    0   // the first bytes decide
+#define ARCHIVE_IN_PLAIN    1
+#define ARCHIVE_IN_ARCHIVE  2
+
+typedef struct archive_in {
+    int fd;
+    int mode;               // ARCHIVE_IN_*
+    uint8_t * src;          // the header or chunk being read
+    size_t src_len;
+    size_t src_want;
+    uint8_t * raw;          // the last chunk, decompressed
+    size_t raw_len;
+    size_t raw_pos;
+    uint32_t chunk_max;
+    archive_chunk_t chunk;
+    uint64_t chunks;
+} archive_in_t;
+
+archive_in_t* archive_in_open(int fd);
+ssize_t archive_in_read(archive_in_t* in, void* buf, size_t len);
+void archive_in_close(archive_in_t* in);
+
+int archive_is(const uint8_t* data, size_t size);
+// the plain bytes of an archive in memory, NULL if it is corrupt
+uint8_t* archive_unpack(const uint8_t* data, size_t size, size_t* raw_size);
+
+#endif // ARCHIVE_H_
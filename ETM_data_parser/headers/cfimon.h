@@ -0,0 +1,49 @@
+#ifndef CFIMON_H_
+#define CFIMON_H_
+
+#include <stdint.h>
+
+#include "handlers.h"
+#include "sink.h"
+
+/*
+ * Control-flow integrity monitor: the checks of handlers.c (block lookup,
+ * c/s/l/r bits, return address stack) on a basicblock_t table compiled
+ * into a transition table once, without a report() per step. Atoms are
+ * checked four at a time where the path has no call or return. A
+ * violation goes to the callback, then the monitor leaves the scope and
+ * resynchronises at the next address packet; nothing exits.
+ */
+enum cfimon_kind {
+    CFIMON_NOT_CONDITIONAL = 1,  // N atom on a block without a conditional branch
+    CFIMON_UNKNOWN_BLOCK,        // address in scope but at no block
+    CFIMON_RETURN_MISMATCH,      // return to another address than the one pushed
+    CFIMON_STACK_OVERFLOW,       // more than ADDRESS_STACK_SIZE nested calls
+};
+
+typedef struct cfimon_violation {
+    uint8_t kind;           // CFIMON_*
+    uint32_t block;         // start address of the current block, 0 for none
+    uint64_t address;       // the address packet, 0 for atom violations
+    uint32_t expected;      // the return address popped, CFIMON_RETURN_MISMATCH only
+    uint64_t atoms;         // atoms checked before it
+} cfimon_violation_t;
+
+typedef void (*cfimon_violation_cb)(void* ctx, const cfimon_violation_t* violation);
+
+typedef struct cfimon cfimon_t;
+
+cfimon_t * cfimon_open(const basicblock_t* table, uint32_t entries, cfimon_violation_cb on_violation, void* ctx);
+void cfimon_event(cfimon_t* mon, const trace_event_t* event);
+void cfimon_atoms(cfimon_t* mon, uint64_t mask, uint16_t count);
+void cfimon_address(cfimon_t* mon, uint64_t address);
+void cfimon_reset(cfimon_t* mon);
+uint64_t cfimon_checked_atoms(const cfimon_t* mon);
+uint64_t cfimon_violations(const cfimon_t* mon);
+void cfimon_close(cfimon_t* mon);
+const char * cfimon_kind_name(uint8_t kind);
+
+// feeds mon from the subscribers of the decoder, see subscriber.h
+void cfimon_attach(cfimon_t* mon);
+
+#endif // CFIMON_H_
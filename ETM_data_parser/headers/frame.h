@@ -0,0 +1,60 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CoreSight formatter frame: 8 even bytes carrying an ID or data, 7 odd data bytes and the auxiliary byte 15
+#define FRAME_SIZE 16
+// Trace IDs are 7 bits: 0 is the null ID used for padding, 0x70 to 0x7f are reserved
+#define FRAME_IDS 128
+#define FRAME_ID_NULL 0x00
+#define FRAME_ID_MAX 0x6f
+// cur_id before the first ID byte
+#define FRAME_ID_UNKNOWN (-1)
+// Frame synchronization packet between frames in continuous mode, bytes ff ff ff 7f
+#define FRAME_FSYNC 0x7fffffff
+#define FRAME_FSYNC_SIZE 4
+
+// Called with the demultiplexed bytes of trace ID id, or FRAME_ID_UNKNOWN
+typedef void (*frame_flush_t)(void* ctx, int id, const uint8_t* data, size_t len);
+
+typedef struct frame_out {
+    uint8_t * buf;
+    size_t len;
+} frame_out_t;
+
+/*
+ * Splits formatted trace into one byte stream per trace ID. Only the IDs
+ * passed to deformat_keep_id() are kept, or every valid ID with keep_all;
+ * each has a buffer of buf_size bytes handed to flush when full and on
+ * deformat_flush(). Bytes of the null and reserved IDs count as padding,
+ * those of other IDs as dropped. cur_id carries over between calls, so the
+ * input can come in any number of whole frames. With keep_unknown set, the
+ * bytes seen before the first ID byte are kept as FRAME_ID_UNKNOWN instead
+ * of being dropped, for whoever knows the ID that was current at the start.
+ */
+typedef struct deformatter {
+    frame_out_t * outs[FRAME_IDS];      // NULL for IDs not kept
+    frame_out_t * unknown;
+    int cur_id;
+    int keep_all;
+    int keep_unknown;
+    size_t buf_size;
+    size_t dropped;
+    size_t padding;
+    uint64_t padding_frames;
+    uint64_t fsyncs;
+    frame_flush_t flush;
+    void * ctx;
+} deformatter_t;
+
+void deformat_init(deformatter_t* d, size_t buf_size, frame_flush_t flush, void* ctx);
+void deformat_keep_id(deformatter_t* d, int id);
+void deformat_frames(deformatter_t* d, const uint8_t* frames, size_t n_frames);
+size_t deformat_stream(deformatter_t* d, const uint8_t* buf, size_t size);
+size_t frame_find_sync(const uint8_t* buf, size_t size);
+void deformat_flush(deformatter_t* d);
+void deformat_free(deformatter_t* d);
+
+#endif // FRAME_H_
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include "sink.h"
+
 #define CTL_STATE_OUTSCOPE 0
 #define CTL_STATE_INSCOPE 1
 #define CTL_STATE_POP_COMP 2
@@ -23,10 +25,8 @@ typedef struct basicblock {
     uint16_t offset: 16;
 } __attribute__((packed)) basicblock_t;
 
-void report(const char* format, ... );
-
-void set_ctl_buff(void*, uint16_t);
+void set_ctl_buff(void*, uint32_t);
 void report_addres(uint64_t, uint8_t);
-void report_atom(uint8_t);
+void report_atoms(uint32_t, uint8_t);
 
 #endif // HANDLERS_H_
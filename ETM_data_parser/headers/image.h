@@ -0,0 +1,35 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_IMAGE_SECTIONS 64
+
+// One executable section of a loaded ELF file, as seen at run time
+typedef struct image_section {
+    uint64_t start;
+    uint64_t end;
+    const uint8_t * data;
+} image_section_t;
+
+// A function of the symbol table, start moved by load_base like the sections
+typedef struct image_symbol {
+    uint64_t start;
+    uint64_t size;          // 0 when the table has none, it then runs to the next symbol in its section
+    const char * name;
+} image_symbol_t;
+
+/*
+ * Code of the traced program. image_load() maps an ELF file and records its
+ * executable sections, moved by load_base (0 for non-PIE executables).
+ * Several files can be loaded (e.g. a program and its libraries).
+ * image_symbol() finds the function of an address, from the symbol tables
+ * of the files, or NULL when stripped.
+ */
+void image_load(const char* path, uint64_t load_base);
+uint8_t image_fetch(uint64_t address, uint32_t* instruction);
+const image_section_t* image_find(uint64_t address);
+const image_symbol_t* image_symbol(uint64_t address);
+
+#endif // IMAGE_H_
@@ -0,0 +1,32 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest peek_data request of any packet handler, with some room
+#define INPUT_MAX_PEEK          64
+#define INPUT_STREAM_SIZE       (1024 * 1024)
+#define INPUT_FOLLOW_DELAY_US   10000
+
+/*
+ * Trace input behind peek_data/consume_data/data_available (trace.h).
+ *
+ * In-memory input decodes a complete buffer. The position is per thread,
+ * so several threads can decode different parts of the same buffer.
+ *
+ * Stream input reads a file descriptor (pipe, socket, file) through a ring
+ * of fixed size, so memory use does not grow with the trace. With follow
+ * set, the end of the file is not the end of the trace: the decoder waits
+ * for more data until input_stop_stream() is called.
+ */
+void input_set_buffer(const uint8_t* buffer, size_t size);
+void input_seek(size_t position);
+size_t input_position(void);
+void input_set_stop(size_t stop);
+
+void input_set_stream(int fd, size_t capacity, uint8_t follow);
+void input_close_stream(void);
+void input_stop_stream(void);
+
+#endif // INPUT_H_
@@ -0,0 +1,15 @@
+#ifndef MERGE_H_
+#define MERGE_H_
+
+#include <stdint.h>
+
+/*
+ * One timeline of several binary event files (-m binary, e.g. the
+ * <prefix>_<n>.evt of -F): the events of every file stay in order, the
+ * files are interleaved by their timestamps, converted with
+ * trace_set_timestamp_freq(). The result goes to the open sink and the
+ * subscribers, an EV_STREAM before every change of file.
+ */
+void merge_event_files(char * const paths[], int count);
+
+#endif // MERGE_H_
@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Input bytes per segment, segments start at the first A-sync past each multiple
+#define PARALLEL_SEGMENT_SIZE (1024 * 1024)
+
+uint32_t parallel_decode(const uint8_t* buffer, size_t size, unsigned int threads);
+
+#endif // PARALLEL_H_
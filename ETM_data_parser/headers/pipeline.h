@@ -0,0 +1,26 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <stdint.h>
+
+// Formatted input read per call, and the pipe capacity asked for per trace ID
+#define PIPELINE_READ_SIZE  (1024 * 1024)
+#define PIPELINE_PIPE_SIZE  (1024 * 1024)
+// Demultiplexed bytes collected per trace ID before they go down its pipe
+#define PIPELINE_OUT_SIZE   (64 * 1024)
+
+/*
+ * Decode formatted trace (ETR/ETF memory, several trace IDs interleaved in
+ * 16 byte frames) as it is read from fd. The frames are split by trace ID
+ * as in deformat and every ID 1 to n_ids gets its own decoder thread, fed
+ * through a pipe and the stream input, so nothing is written to disk.
+ * With one ID the decode goes to this thread's sink; otherwise ID i + 1
+ * goes to <prefix>_<i>.txt, or .evt for binary events.
+ * Returns the number of formatted bytes read.
+ */
+uint64_t pipeline_decode(int fd, int n_ids, uint8_t mode, const char* prefix);
+
+// Trace ID decoded by the calling thread, 0 outside the decoders of pipeline_decode()
+int pipeline_id(void);
+
+#endif // PIPELINE_H_
@@ -0,0 +1,53 @@
+#ifndef RECONSTRUCT_H_
+#define RECONSTRUCT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// How a basic block ends
+enum branch_kind {
+    BRANCH_NONE,            // runs off the loaded code, no branch found
+    BRANCH_DIRECT,          // B, BL
+    BRANCH_CONDITIONAL,     // B.cond, CBZ, CBNZ, TBZ, TBNZ
+    BRANCH_INDIRECT,        // BR, BLR, RET, ERET, target comes in an address packet
+};
+
+#define BRANCH_LINK         0x1     // BL, BLR
+#define BRANCH_RETURN       0x2     // RET, ERET
+
+// A straight run of instructions ending with its only branch
+typedef struct basic_block {
+    uint64_t start;
+    uint64_t target;        // BRANCH_DIRECT and BRANCH_CONDITIONAL only
+    uint32_t length;        // instructions, the branch included; 0 for a free cache slot
+    uint32_t id;            // 0, 1, ... in the order the blocks were first decoded
+    uint8_t kind;
+    uint8_t flags;
+} basic_block_t;
+
+// Instructions the core executed: [start, end), the last one is a branch unless ended by an exception
+typedef struct exec_range {
+    uint64_t start;
+    uint64_t end;
+    uint64_t target;        // of the branch, as in basic_block_t
+    uint32_t block;         // id of the basic block the range is in
+    uint8_t kind;
+    uint8_t taken;
+} exec_range_t;
+
+typedef void (*range_handler_t)(const exec_range_t*);
+
+/*
+ * Follows atoms and addresses through the code loaded with image_load(),
+ * decoding every basic block once. reconstruct_open() adds the subscriber;
+ * executed ranges go to the handlers, in the order they were added, and,
+ * unless path is NULL, one line each to a file.
+ */
+#define MAX_RANGE_HANDLERS 4
+
+void reconstruct_open(const char* path);
+void reconstruct_add_handler(range_handler_t handler);
+const basic_block_t* reconstruct_block(uint64_t address);
+uint32_t reconstruct_block_count(void);
+
+#endif // RECONSTRUCT_H_
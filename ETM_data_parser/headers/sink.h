@@ -0,0 +1,70 @@
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+/*
+ * Where the decoder output goes. SINK_TEXT is the human readable log of
+ * report(), SINK_BINARY a stream of fixed size trace_event_t records and
+ * SINK_NONE drops everything (for timing the decoder itself).
+ */
+#define SINK_TEXT   0
+#define SINK_BINARY 1
+#define SINK_NONE   2
+
+#define SINK_BUFFER_SIZE (1024 * 1024)
+
+/*
+ * Binary event file: one event_file_header_t followed by trace_event_t
+ * records back to back, little endian, so the file can be mmapped and
+ * indexed as an array of records.
+ */
+#define EVENT_FILE_MAGIC    "ETMEVT01"
+#define EVENT_FILE_VERSION  1
+
+typedef struct event_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} event_file_header_t;
+
+enum event_type {
+    EV_SYNC = 1,        // A-sync found, trace (re)started
+    EV_OVERFLOW,        // A-sync after a trace unit overflow
+    EV_ADDRESS,         // value: address, flags: IS
+    EV_ATOM,            // value: atoms, bit i = 1 when atom i is E; count: number of atoms
+    EV_CONTEXT,         // data: context ID, value: VMID, flags: EVENT_CONTEXT_*
+    EV_TIMESTAMP,       // value: timestamp, data: cycle count, flags: 1 when data is valid
+    EV_EVENT,           // data: event field
+    EV_EXCEPTION,       // data: exception type, flags: E field
+    EV_EXCEPTION_RETURN,
+    EV_CYCLECOUNT,      // data: cycle count
+    EV_TRACE_ON,
+    EV_TRACE_START,     // first A-sync, or the first one after the trace was paused
+    EV_STREAM,          // merged files only: data: stream, value: its time in ns; the events up to the next one are of that stream
+};
+
+#define EVENT_CONTEXT_VMID  0x1
+#define EVENT_CONTEXT_CID   0x2
+
+typedef struct trace_event {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t count;
+    uint32_t data;
+    uint64_t value;
+} trace_event_t;
+
+void sink_open(uint8_t mode, const char* path);
+void sink_close(void);
+void sink_set_mode(uint8_t mode);
+uint8_t sink_get_mode(void);
+void sink_use_stream(uint8_t mode, FILE* out);
+FILE* sink_stream(void);
+
+void report(const char* format, ... );
+void emit_event(uint8_t type, uint8_t flags, uint16_t count, uint32_t data, uint64_t value);
+
+#endif // SINK_H_
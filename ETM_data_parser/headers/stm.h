@@ -0,0 +1,50 @@
+#ifndef STM_H_
+#define STM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// an ASYNC packet is at least 21 F nibbles and a 0
+#define STM_ASYNC_NIBBLES 21
+
+/*
+ * Streaming decoder of the STPv2 packets of an STM trace ID, as deformat
+ * writes them. The stream is read in nibbles, the low one of each byte
+ * first, and ignored up to the first ASYNC packet. Master and channel
+ * carry over between packets; a timestamp only sends the nibbles that
+ * changed, so timestamp is the full value after the last one. Every data,
+ * flag, trigger and error packet is one line of out, NULL only counts.
+ */
+typedef struct stm_decoder {
+    FILE* out;
+    int synced;
+    int state;
+    int f_run;              // F nibbles in a row
+    int op;                 // opcode nibbles so far
+    int op_nibbles;
+    int code;               // of the packet being read, an index of stm_ops
+    int need;               // payload nibbles left
+    int ts_need;            // timestamp nibbles left, -1 for the length nibble
+    int ts_nibbles;
+    uint64_t payload;
+    uint64_t ts_payload;
+    uint16_t master;
+    uint16_t channel;
+    uint64_t timestamp;
+    uint32_t freq;          // of the timestamps, from the last FREQ packet
+    uint8_t version;
+    uint64_t packets;
+    uint64_t data;
+    uint64_t markers;       // marked data packets
+    uint64_t flags;
+    uint64_t triggers;
+    uint64_t errors;
+    uint64_t asyncs;
+} stm_decoder_t;
+
+void stm_init(stm_decoder_t* s, FILE* out);
+void stm_decode(stm_decoder_t* s, const uint8_t* data, size_t len);
+void stm_report(const stm_decoder_t* s, FILE* fp);
+
+#endif // STM_H_
@@ -0,0 +1,49 @@
+#ifndef SUBSCRIBER_H_
+#define SUBSCRIBER_H_
+
+#include <stdint.h>
+
+#include "sink.h"
+
+#define MAX_SUBSCRIBERS 8
+
+/*
+ * Consumers of decoded events. Every event that emit_event() produces is
+ * handed to all subscribers in the order they were added, right where the
+ * decoder produces it, so a single pass over the trace feeds all of them.
+ * on_finish is called once when decoding is over and may be NULL.
+ */
+typedef struct subscriber {
+    const char * name;
+    void (*on_event)(const trace_event_t*);
+    void (*on_finish)(void);
+} subscriber_t;
+
+void subscriber_add(const subscriber_t*);
+uint8_t subscribers_active(void);
+void subscribers_notify(const trace_event_t*);
+void subscribers_finish(void);
+
+// Subscribers shipped with the decoder
+extern const subscriber_t ctl_subscriber;     // handlers.c, needs set_ctl_buff()
+extern const subscriber_t strip_subscriber;   // strip.c, needs strip_open()
+extern const subscriber_t stats_subscriber;   // stats.c
+extern const subscriber_t reconstruct_subscriber; // reconstruct.c, needs image_load()
+extern const subscriber_t latency_subscriber; // latency.c, needs latency_open()
+extern const subscriber_t hotspot_subscriber; // hotspot.c, needs hotspot_open()
+extern const subscriber_t profile_subscriber; // profile.c, needs profile_open() and image_load()
+extern const subscriber_t blockcount_subscriber; // blockcount.c, needs blockcount_open() and image_load()
+extern const subscriber_t demux_subscriber;   // demux.c, needs demux_open()
+extern const subscriber_t calibrate_subscriber; // calibrate.c, needs calibrate_open()
+extern const subscriber_t cfimon_subscriber;  // cfimon.c, needs cfimon_attach()
+
+void strip_open(const char* path);
+void latency_open(const char* path);
+void hotspot_open(const char* path, uint32_t region_bytes, uint32_t pmu_period);
+void profile_open(const char* path, uint32_t region_bytes);
+void blockcount_open(const char* prefix);
+void demux_open(const char* prefix);
+void calibrate_open(const char* graph, const char* out, uint32_t nominal_pct, uint32_t tail_pct);
+void calibrate_next_run(void);
+
+#endif // SUBSCRIBER_H_
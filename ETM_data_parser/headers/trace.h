@@ -49,14 +49,77 @@
 #define CCF20                   0b00001101 
 #define CCF21                   0b00001100
 
+// default cycle count threshold, trace_set_cc_threshold() for another session
 #define CC_THRESHOLD 4
 
+#define TRACE_DISPATCH_TABLE    0
+#define TRACE_DISPATCH_SWITCH   1
+
+enum packet_class {
+    PKT_UNDEFINED = 0,
+    PKT_SYNC,
+    PKT_TRACEINFO,
+    PKT_ADDRESS,
+    PKT_CONTEXT,
+    PKT_TIMESTAMP,
+    PKT_ATOM,
+    PKT_EVENT,
+    PKT_EXCEPTION,
+    PKT_CYCLECOUNT,
+    PKT_OTHER,
+    PKT_CLASS_COUNT
+};
+
+typedef void (*packet_handler_t)(uint8_t);
+
+// the function of address and the offset into it, NULL outside any
+typedef const char* (*trace_symbolizer_t)(uint64_t address, uint64_t* offset);
+
+typedef struct header_entry {
+    packet_handler_t handler;
+    uint8_t packet_class;
+} header_entry_t;
+
 typedef struct address_reg {
     uint64_t address;
     uint8_t is;
 } address_reg_t;
 
+// Everything a decode depends on from the packets before the current one
+typedef struct decoder_state {
+    address_reg_t address_regs[3];
+    uint8_t trace_state;
+    uint8_t regs_written;       // address registers written since trace_set_state
+    uint8_t regs_inherited;     // a packet read a register not written since trace_set_state
+    uint32_t packet_counter;
+    uint64_t timestamp;         // the full value, packets only carry the low bits that changed
+} decoder_state_t;
+
+/*
+ * Input interface of the decoder, provided by the program that owns the trace buffer.
+ * peek_data returns a pointer to up to `wanted` contiguous bytes at the current
+ * position and stores how many are actually there in `available`; consume_data
+ * moves the position forward.
+ */
+const uint8_t* peek_data(uint32_t wanted, uint32_t* available);
+void consume_data(uint32_t bytes);
+uint8_t data_available(void);
+
 void trace_loop(void);
+uint32_t trace_loop_dispatch(uint8_t);
+void trace_reset(void);
+uint32_t trace_run(uint8_t);
+void trace_get_state(decoder_state_t*);
+void trace_set_state(const decoder_state_t*);
+void trace_set_end_on_loss(uint8_t);
+void trace_set_cc_threshold(uint32_t);
+void trace_set_timestamp_freq(uint32_t);
+void trace_set_symbolizer(trace_symbolizer_t);
+uint64_t trace_timestamp_ns(uint64_t);
+const uint64_t* trace_class_counts(void);
+const char* exception_name(uint16_t);
+void init_header_table(void);
+const header_entry_t* get_header_entry(uint8_t);
 
 void handle_async(void);
 void handle_resync(void);
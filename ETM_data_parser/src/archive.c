@@ -0,0 +1,497 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+/*
+ * LZ4 block format: a token with the literal and match length in its two
+ * nibbles, 255 bytes extending a nibble of 15, the literals, a 16 bit little
+ * endian offset, the match length minus LZ_MINMATCH. The last 5 bytes are
+ * literals and no match starts in the last 12, as the format requires.
+ */
+#define LZ_MINMATCH     4
+#define LZ_LASTLITERALS 5
+#define LZ_MFLIMIT      12
+#define LZ_MAX_OFFSET   65535
+#define LZ_HASH_LOG     14
+
+// an A-sync packet is eleven 0x00 and a 0x80
+#define ASYNC_ZEROS     11
+
+static inline uint32_t read32(const uint8_t * p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+static uint8_t * put_length(uint8_t * op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+// the size of the block, 0 if it does not fit in cap
+static size_t lz_compress(const uint8_t * src, size_t n, uint8_t * dst, size_t cap, uint32_t * table) {
+    const uint8_t * ip = src + 1;
+    const uint8_t * anchor = src;
+    const uint8_t * end = src + n;
+    uint8_t * op = dst;
+    uint8_t * oend = dst + cap;
+    size_t lit;
+
+    if (n > LZ_MFLIMIT) {
+        const uint8_t * mflimit = end - LZ_MFLIMIT;
+        const uint8_t * matchlimit = end - LZ_LASTLITERALS;
+
+        memset(table, 0, sizeof(uint32_t) << LZ_HASH_LOG);
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = lz_hash(seq);
+            const uint8_t * ref = src + table[h];
+
+            table[h] = (uint32_t) (ip - src);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+                // step faster through bytes that do not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t * mp = ip + LZ_MINMATCH;
+            const uint8_t * rp = ref + LZ_MINMATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            lit = ip - anchor;
+            size_t mlen = mp - ip - LZ_MINMATCH;
+            size_t offset = ip - ref;
+            if ((size_t) (oend - op) < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1)
+                return 0;
+
+            uint8_t * token = op++;
+            *token = (uint8_t) ((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15)
+                op = put_length(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = (uint8_t) offset;
+            *op++ = (uint8_t) (offset >> 8);
+            *token |= (uint8_t) (mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15)
+                op = put_length(op, mlen - 15);
+
+            ip = anchor = mp;
+            if (ip < mflimit)
+                table[lz_hash(read32(ip - 2))] = (uint32_t) (ip - 2 - src);
+        }
+    }
+
+    lit = end - anchor;
+    if ((size_t) (oend - op) < 1 + lit / 255 + 1 + lit)
+        return 0;
+    *op++ = (uint8_t) ((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15)
+        op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+// 0 if the block decompresses to exactly n bytes
+static int lz_decompress(const uint8_t * src, size_t src_len, uint8_t * dst, size_t n) {
+    const uint8_t * ip = src;
+    const uint8_t * iend = src + src_len;
+    uint8_t * op = dst;
+    uint8_t * oend = dst + n;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        size_t mlen = token & 0xf;
+
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;  // the last sequence has no match
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst))
+            return -1;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MINMATCH;
+        if (mlen > (size_t) (oend - op))
+            return -1;
+
+        // the match may overlap the bytes it produces, copy what exists so far, doubling
+        const uint8_t * ref = op - offset;
+        uint8_t * mend = op + mlen;
+        while (op < mend) {
+            size_t run = op - ref;
+            if (run > (size_t) (mend - op))
+                run = mend - op;
+            memcpy(op, ref, run);
+            op += run;
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+static void write_all(int fd, const void * data, size_t len) {
+    const uint8_t * p = (const uint8_t *) data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("archive write");
+            exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+archive_out_t* archive_out_open(int fd, uint32_t align) {
+    archive_out_t * out = (archive_out_t *) calloc(1, sizeof(archive_out_t));
+    archive_header_t header = { ARCHIVE_MAGIC, ARCHIVE_VERSION, align, ARCHIVE_CHUNK_MAX };
+
+    if (out == NULL) {
+        perror("archive_out_open");
+        exit(1);
+    }
+    out->fd = fd;
+    out->align = align;
+    out->raw = (uint8_t *) malloc(ARCHIVE_CHUNK_MAX);
+    out->comp = (uint8_t *) malloc(sizeof(archive_chunk_t) + ARCHIVE_CHUNK_MAX);
+    out->table = (uint32_t *) malloc(sizeof(uint32_t) << LZ_HASH_LOG);
+    if (out->raw == NULL || out->comp == NULL || out->table == NULL) {
+        perror("archive_out_open");
+        exit(1);
+    }
+    out->next_flags = ARCHIVE_CHUNK_SYNC;   // the capture starts at a frame or an A-sync
+    write_all(fd, &header, sizeof(header));
+    out->comp_bytes = sizeof(header);
+    return out;
+}
+
+// writes the first cut raw bytes as a chunk, sync_next becomes the flags of the next one
+static void emit_chunk(archive_out_t * out, size_t cut, uint32_t sync_next) {
+    archive_chunk_t * chunk = (archive_chunk_t *) out->comp;
+    uint8_t * payload = out->comp + sizeof(archive_chunk_t);
+    size_t n = lz_compress(out->raw, cut, payload, cut - 1, out->table);
+
+    chunk->flags = out->next_flags;
+    if (n == 0) {
+        memcpy(payload, out->raw, cut);
+        n = cut;
+        chunk->flags |= ARCHIVE_CHUNK_STORED;
+    }
+    chunk->raw_len = (uint32_t) cut;
+    chunk->comp_len = (uint32_t) n;
+    write_all(out->fd, out->comp, sizeof(archive_chunk_t) + n);
+
+    out->raw_bytes += cut;
+    out->comp_bytes += sizeof(archive_chunk_t) + n;
+    out->chunks++;
+    memmove(out->raw, out->raw + cut, out->fill - cut);
+    out->fill -= cut;
+    out->scanned = 0;
+    out->next_flags = sync_next;
+}
+
+// the length of the next chunk, 0 while more bytes are needed
+static size_t find_cut(archive_out_t * out, uint32_t * sync_next) {
+    size_t q;
+
+    if (out->align == ARCHIVE_ALIGN_FRAME) {
+        *sync_next = ARCHIVE_CHUNK_SYNC;
+        return out->fill >= ARCHIVE_CHUNK_SIZE ? ARCHIVE_CHUNK_SIZE : 0;
+    }
+
+    q = out->scanned > ARCHIVE_CHUNK_SIZE + ASYNC_ZEROS ? out->scanned : ARCHIVE_CHUNK_SIZE + ASYNC_ZEROS;
+    for (; q < out->fill; q++) {
+        if (out->raw[q] != 0x80)
+            continue;
+        size_t z = 1;
+        while (z <= ASYNC_ZEROS && out->raw[q - z] == 0)
+            z++;
+        if (z > ASYNC_ZEROS) {
+            *sync_next = ARCHIVE_CHUNK_SYNC;
+            return q - ASYNC_ZEROS;
+        }
+    }
+    out->scanned = q;
+    if (out->fill == ARCHIVE_CHUNK_MAX) {
+        *sync_next = 0;
+        return ARCHIVE_CHUNK_MAX;
+    }
+    return 0;
+}
+
+void archive_out_write(archive_out_t* out, const void* data, size_t len) {
+    const uint8_t * p = (const uint8_t *) data;
+
+    while (len > 0) {
+        size_t n = ARCHIVE_CHUNK_MAX - out->fill;
+        size_t cut;
+        uint32_t sync_next;
+
+        if (n > len)
+            n = len;
+        memcpy(out->raw + out->fill, p, n);
+        out->fill += n;
+        p += n;
+        len -= n;
+        while ((cut = find_cut(out, &sync_next)) != 0)
+            emit_chunk(out, cut, sync_next);
+    }
+}
+
+// writes what is buffered as a shorter chunk
+void archive_out_flush(archive_out_t* out) {
+    if (out->fill > 0)
+        emit_chunk(out, out->fill, 0);
+}
+
+// flushes, the caller closes the fd
+void archive_out_close(archive_out_t* out) {
+    archive_out_flush(out);
+    free(out->raw);
+    free(out->comp);
+    free(out->table);
+    free(out);
+}
+
+static int header_valid(const archive_header_t * h) {
+    if (h->version != ARCHIVE_VERSION) {
+        fprintf(stderr, "archive: version %u, this decoder reads version %u\n", h->version, ARCHIVE_VERSION);
+        return 0;
+    }
+    if (h->chunk_max == 0 || h->chunk_max > 64 * ARCHIVE_CHUNK_MAX) {
+        fprintf(stderr, "archive: chunk size %u out of range\n", h->chunk_max);
+        return 0;
+    }
+    return 1;
+}
+
+static int chunk_valid(const archive_chunk_t * c, uint32_t chunk_max, uint64_t index) {
+    if (c->raw_len == 0 || c->raw_len > chunk_max || c->comp_len == 0
+        || c->comp_len > c->raw_len
+        || ((c->flags & ARCHIVE_CHUNK_STORED) && c->comp_len != c->raw_len)) {
+        fprintf(stderr, "archive: corrupt chunk %lu\n", (unsigned long) index);
+        return 0;
+    }
+    return 1;
+}
+
+archive_in_t* archive_in_open(int fd) {
+    archive_in_t * in = (archive_in_t *) calloc(1, sizeof(archive_in_t));
+
+    if (in == NULL || (in->src = (uint8_t *) malloc(sizeof(archive_header_t))) == NULL) {
+        perror("archive_in_open");
+        exit(1);
+    }
+    in->fd = fd;
+    in->mode = ARCHIVE_IN_PROBE;
+    in->src_want = sizeof(archive_header_t);
+    return in;
+}
+
+// reads until src holds src_want bytes, returns 1 then or what read returned
+static ssize_t fill_src(archive_in_t * in) {
+    while (in->src_len < in->src_want) {
+        ssize_t got = read(in->fd, in->src + in->src_len, in->src_want - in->src_len);
+        if (got <= 0)
+            return got;
+        in->src_len += got;
+    }
+    return 1;
+}
+
+ssize_t archive_in_read(archive_in_t* in, void* buf, size_t len) {
+    if (len == 0)
+        return 0;
+
+    for (;;) {
+        if (in->raw_pos < in->raw_len) {
+            size_t n = in->raw_len - in->raw_pos;
+            if (n > len)
+                n = len;
+            memcpy(buf, in->raw + in->raw_pos, n);
+            in->raw_pos += n;
+            return n;
+        }
+
+        if (in->mode == ARCHIVE_IN_PLAIN)
+            return read(in->fd, buf, len);
+
+        ssize_t got = fill_src(in);
+
+        if (in->mode == ARCHIVE_IN_PROBE) {
+            uint32_t magic = ARCHIVE_MAGIC;
+            size_t cmp = in->src_len < 4 ? in->src_len : 4;
+
+            if (memcmp(in->src, &magic, cmp) != 0) {
+                // not an archive, the probed bytes come first
+                in->mode = ARCHIVE_IN_PLAIN;
+                in->raw = in->src;
+                in->raw_len = in->src_len;
+                in->raw_pos = 0;
+                in->src = NULL;
+                continue;
+            }
+            if (got <= 0)
+                return got;     // still a prefix of the header
+
+            archive_header_t header;
+            memcpy(&header, in->src, sizeof(header));
+            if (!header_valid(&header)) {
+                errno = EINVAL;
+                return -1;
+            }
+            in->mode = ARCHIVE_IN_ARCHIVE;
+            in->chunk_max = header.chunk_max;
+            free(in->src);
+            in->src = (uint8_t *) malloc(sizeof(archive_chunk_t) + in->chunk_max);
+            in->raw = (uint8_t *) malloc(in->chunk_max);
+            if (in->src == NULL || in->raw == NULL) {
+                perror("archive_in_read");
+                exit(1);
+            }
+            in->src_len = 0;
+            in->src_want = sizeof(archive_chunk_t);
+            continue;
+        }
+
+        if (got <= 0)
+            return got;
+        if (in->src_want == sizeof(archive_chunk_t)) {
+            memcpy(&in->chunk, in->src, sizeof(archive_chunk_t));
+            if (!chunk_valid(&in->chunk, in->chunk_max, in->chunks)) {
+                errno = EIO;
+                return -1;
+            }
+            in->src_want += in->chunk.comp_len;
+            continue;
+        }
+
+        const uint8_t * payload = in->src + sizeof(archive_chunk_t);
+        if (in->chunk.flags & ARCHIVE_CHUNK_STORED)
+            memcpy(in->raw, payload, in->chunk.raw_len);
+        else if (lz_decompress(payload, in->chunk.comp_len, in->raw, in->chunk.raw_len) < 0) {
+            fprintf(stderr, "archive: corrupt chunk %lu\n", (unsigned long) in->chunks);
+            errno = EIO;
+            return -1;
+        }
+        in->raw_len = in->chunk.raw_len;
+        in->raw_pos = 0;
+        in->src_len = 0;
+        in->src_want = sizeof(archive_chunk_t);
+        in->chunks++;
+    }
+}
+
+// the fd stays open
+void archive_in_close(archive_in_t* in) {
+    free(in->src);
+    free(in->raw);
+    free(in);
+}
+
+int archive_is(const uint8_t* data, size_t size) {
+    uint32_t magic;
+
+    if (size < sizeof(archive_header_t))
+        return 0;
+    memcpy(&magic, data, 4);
+    return magic == ARCHIVE_MAGIC;
+}
+
+/*
+ * Two passes, the sizes then the bytes. A chunk cut short at the end, as
+ * when the capture was interrupted, ends the archive with a warning.
+ */
+uint8_t* archive_unpack(const uint8_t* data, size_t size, size_t* raw_size) {
+    archive_header_t header;
+    archive_chunk_t chunk;
+    size_t pos, total = 0, end;
+    uint64_t index = 0;
+    uint8_t * raw;
+
+    memcpy(&header, data, sizeof(header));
+    if (!header_valid(&header))
+        return NULL;
+
+    for (pos = sizeof(header); pos + sizeof(chunk) <= size; index++) {
+        memcpy(&chunk, data + pos, sizeof(chunk));
+        if (!chunk_valid(&chunk, header.chunk_max, index))
+            return NULL;
+        if (chunk.comp_len > size - pos - sizeof(chunk))
+            break;
+        total += chunk.raw_len;
+        pos += sizeof(chunk) + chunk.comp_len;
+    }
+    end = pos;
+    if (end != size)
+        fprintf(stderr, "archive: %lu bytes of a truncated chunk ignored\n", (unsigned long) (size - end));
+
+    raw = (uint8_t *) malloc(total + 1);
+    if (raw == NULL) {
+        perror("archive_unpack");
+        exit(1);
+    }
+    total = 0;
+    index = 0;
+    for (pos = sizeof(header); pos < end; index++) {
+        memcpy(&chunk, data + pos, sizeof(chunk));
+        const uint8_t * payload = data + pos + sizeof(chunk);
+        if (chunk.flags & ARCHIVE_CHUNK_STORED)
+            memcpy(raw + total, payload, chunk.raw_len);
+        else if (lz_decompress(payload, chunk.comp_len, raw + total, chunk.raw_len) < 0) {
+            fprintf(stderr, "archive: corrupt chunk %lu\n", (unsigned long) index);
+            free(raw);
+            return NULL;
+        }
+        total += chunk.raw_len;
+        pos += sizeof(chunk) + chunk.comp_len;
+    }
+    *raw_size = total;
+    return raw;
+}
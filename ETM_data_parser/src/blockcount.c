@@ -0,0 +1,329 @@
+/*
+    Block counts: how often every basic block of the reconstructed code
+    (-x) ran and how often every edge between two blocks was taken.
+
+    The counters are a flat array indexed by the id the block cache gives a
+    block when it first decodes it, and a hash table of edges. Both grow
+    with the code the trace reaches, not with its length, so a trace of any
+    size fits in the same memory. An edge is only counted when the second
+    range is where the first one's branch goes: the fall through or target
+    of a direct branch, anything after an indirect one, and never across an
+    exception, a sync or an overflow.
+
+    <prefix>.dot names the blocks the way paper_imp/cfg does,
+    "BB <function> first - last type: branch", with the counts as labels.
+    <prefix>.bbc is a TMG container (cfg/tmg_format.py) of kind
+    BBC_TMG_KIND, little endian 32-bit words:
+
+        blocks edges
+        start_lo start_hi instructions count_lo count_hi    per block, by id
+        from to count_lo count_hi                            per edge
+
+    n_nodes of the header is the number of blocks.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "reconstruct.h"
+#include "subscriber.h"
+
+#define EDGE_TABLE_INITIAL 1024
+#define BLOCK_ARRAY_INITIAL 1024
+
+#define BBC_TMG_MAGIC 0x46474d54     // "TMGF"
+#define BBC_TMG_VERSION 1
+#define BBC_TMG_KIND 3
+
+typedef struct block_info {
+    uint64_t start;
+    uint64_t target;
+    uint64_t count;
+    uint32_t length;
+    uint8_t kind;
+    uint8_t known;          // a range of the whole block ran, not only one cut by an exception
+} block_info_t;
+
+typedef struct edge_entry {
+    uint32_t from;
+    uint32_t to;
+    uint64_t count;         // 0 for a free slot
+} edge_entry_t;
+
+static const char * bbc_prefix = NULL;
+static block_info_t * block_info = NULL;
+static uint32_t block_capacity = 0;
+static edge_entry_t * edges = NULL;
+static uint32_t edge_capacity = 0;     // power of two
+static uint32_t edge_count = 0;
+
+// the range before, while an edge from it can follow
+static uint32_t prev_block;
+static uint64_t prev_end;
+static uint8_t prev_taken;
+static uint8_t prev_valid = 0;
+
+static uint64_t ranges, dropped;
+
+static edge_entry_t * edge_slot(edge_entry_t* entries, uint32_t capacity, uint32_t from, uint32_t to) {
+    uint32_t slot = (from * 0x9E3779B1u ^ to) & (capacity - 1);
+
+    while (entries[slot].count && (entries[slot].from != from || entries[slot].to != to))
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static void grow_edges(void) {
+    edge_entry_t * old = edges;
+    uint32_t old_capacity = edge_capacity;
+    uint32_t i;
+
+    edge_capacity = old_capacity ? old_capacity * 2 : EDGE_TABLE_INITIAL;
+    edges = (edge_entry_t *) calloc(edge_capacity, sizeof(edge_entry_t));
+    if (edges == NULL) {
+        fprintf(stderr, "Cannot allocate the edge table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].count)
+            *edge_slot(edges, edge_capacity, old[i].from, old[i].to) = old[i];
+    }
+    free(old);
+}
+
+// the ids are dense, the array follows reconstruct_block_count()
+static void grow_blocks(uint32_t id) {
+    uint32_t old_capacity = block_capacity;
+
+    while (block_capacity <= id)
+        block_capacity = block_capacity ? block_capacity * 2 : BLOCK_ARRAY_INITIAL;
+    block_info = (block_info_t *) realloc(block_info, block_capacity * sizeof(block_info_t));
+    if (block_info == NULL) {
+        fprintf(stderr, "Cannot allocate the block counters\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(block_info + old_capacity, 0, (block_capacity - old_capacity) * sizeof(block_info_t));
+}
+
+// the range of a whole block fills in the rest, handlers must not call reconstruct_block()
+static void first_run(block_info_t* info, const exec_range_t* range) {
+    uint32_t length = (range->end - range->start) / 4;
+
+    info->start = range->start;
+    if (length > info->length)
+        info->length = length;
+    if (range->kind != BRANCH_NONE) {
+        info->target = range->target;
+        info->kind = range->kind;
+        info->known = 1;
+    }
+}
+
+static uint8_t follows(const block_info_t* prev, uint64_t start) {
+    switch (prev->kind) {
+    case BRANCH_CONDITIONAL:
+        return start == (prev_taken ? prev->target : prev_end);
+    case BRANCH_DIRECT:
+        return start == prev->target;
+    case BRANCH_INDIRECT:
+        return prev_taken;
+    default:
+        return 0;
+    }
+}
+
+static void blockcount_range(const exec_range_t* range) {
+    block_info_t * info;
+    edge_entry_t * edge;
+
+    ranges++;
+    if (range->block >= block_capacity)
+        grow_blocks(range->block);
+
+    info = &block_info[range->block];
+    if (!info->known)
+        first_run(info, range);
+    info->count++;
+
+    if (prev_valid) {
+        if (follows(&block_info[prev_block], range->start)) {
+            if (edge_count * 2 >= edge_capacity)
+                grow_edges();
+            edge = edge_slot(edges, edge_capacity, prev_block, range->block);
+            if (edge->count == 0) {
+                edge->from = prev_block;
+                edge->to = range->block;
+                edge_count++;
+            }
+            edge->count++;
+        } else {
+            dropped++;
+        }
+    }
+
+    // a range cut short by an exception ends nowhere known
+    prev_valid = range->kind != BRANCH_NONE;
+    prev_block = range->block;
+    prev_end = range->end;
+    prev_taken = range->taken;
+}
+
+static void blockcount_event(const trace_event_t* event) {
+    switch (event->type) {
+    case EV_EXCEPTION:
+    case EV_SYNC:
+    case EV_OVERFLOW:
+    case EV_TRACE_ON:
+    case EV_TRACE_START:
+        prev_valid = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+// mnemonic of the branch that ends a block, as objdump prints it
+static void branch_name(const block_info_t* info, char* name, size_t size) {
+    static const char * conds[16] = {"eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+                                     "hi", "ls", "ge", "lt", "gt", "le", "al", "nv"};
+    uint32_t insn;
+
+    if (!image_fetch(info->start + (uint64_t) (info->length - 1) * 4, &insn) || info->kind == BRANCH_NONE)
+        snprintf(name, size, "-");
+    else if ((insn & 0x7C000000) == 0x14000000)
+        snprintf(name, size, (insn >> 31) ? "bl" : "b");
+    else if ((insn & 0xFF000010) == 0x54000000)
+        snprintf(name, size, "b.%s", conds[insn & 0xF]);
+    else if ((insn & 0x7E000000) == 0x34000000)
+        snprintf(name, size, (insn & 0x01000000) ? "cbnz" : "cbz");
+    else if ((insn & 0x7E000000) == 0x36000000)
+        snprintf(name, size, (insn & 0x01000000) ? "tbnz" : "tbz");
+    else if ((insn & 0xFFFFFC1F) == 0xD61F0000)
+        snprintf(name, size, "br");
+    else if ((insn & 0xFFFFFC1F) == 0xD63F0000)
+        snprintf(name, size, "blr");
+    else if (insn == 0xD69F03E0)
+        snprintf(name, size, "eret");
+    else
+        snprintf(name, size, "ret");
+}
+
+static void block_node(const block_info_t* info, char* name, size_t size) {
+    const image_symbol_t * symbol = image_symbol(info->start);
+    char branch[16];
+
+    branch_name(info, branch, sizeof(branch));
+    snprintf(name, size, "BB <%s> 0x%lx - 0x%lx type: %s", symbol ? symbol->name : "-",
+             info->start, info->start + (uint64_t) (info->length - 1) * 4, branch);
+}
+
+static void write_dot(const char* path, uint32_t blocks) {
+    char from[256], to[256];
+    FILE * fdot = fopen(path, "w");
+    uint32_t i;
+
+    if (fdot == NULL) {
+        fprintf(stderr, "Error opening dot file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fdot, "digraph \"\" {\n\tnode [shape=record, style=filled];\n");
+    for (i = 0; i < blocks; ++i) {
+        if (block_info[i].count == 0)
+            continue;
+        block_node(&block_info[i], from, sizeof(from));
+        fprintf(fdot, "\t\"%s\"\t[label=\"%s\\lcount:%lu\\linstructions:%u\\l\"];\n",
+                from, from, block_info[i].count, block_info[i].length);
+    }
+    for (i = 0; i < edge_capacity; ++i) {
+        if (edges[i].count == 0)
+            continue;
+        block_node(&block_info[edges[i].from], from, sizeof(from));
+        block_node(&block_info[edges[i].to], to, sizeof(to));
+        fprintf(fdot, "\t\"%s\" -> \"%s\"\t[label=\"count:%lu\"];\n", from, to, edges[i].count);
+    }
+    fprintf(fdot, "}\n");
+    fclose(fdot);
+}
+
+static void put_word(FILE* f, uint32_t word, uint32_t* checksum) {
+    *checksum = ((*checksum << 1) | (*checksum >> 31)) ^ word;
+    fwrite(&word, sizeof(word), 1, f);
+}
+
+// payload first, the header with its checksum is written over the start when done
+static void write_bbc(const char* path, uint32_t blocks) {
+    uint32_t header[8] = {BBC_TMG_MAGIC, BBC_TMG_VERSION, BBC_TMG_KIND, blocks, 0, 0, 0, 0};
+    uint32_t checksum = 0, i;
+    FILE * fbbc = fopen(path, "wb");
+
+    if (fbbc == NULL) {
+        fprintf(stderr, "Error opening block count file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(header, sizeof(header), 1, fbbc);
+    put_word(fbbc, blocks, &checksum);
+    put_word(fbbc, edge_count, &checksum);
+    for (i = 0; i < blocks; ++i) {
+        put_word(fbbc, (uint32_t) block_info[i].start, &checksum);
+        put_word(fbbc, (uint32_t) (block_info[i].start >> 32), &checksum);
+        put_word(fbbc, block_info[i].length, &checksum);
+        put_word(fbbc, (uint32_t) block_info[i].count, &checksum);
+        put_word(fbbc, (uint32_t) (block_info[i].count >> 32), &checksum);
+    }
+    for (i = 0; i < edge_capacity; ++i) {
+        if (edges[i].count == 0)
+            continue;
+        put_word(fbbc, edges[i].from, &checksum);
+        put_word(fbbc, edges[i].to, &checksum);
+        put_word(fbbc, (uint32_t) edges[i].count, &checksum);
+        put_word(fbbc, (uint32_t) (edges[i].count >> 32), &checksum);
+    }
+
+    header[4] = 2 + blocks * 5 + edge_count * 4;
+    header[5] = checksum;
+    rewind(fbbc);
+    fwrite(header, sizeof(header), 1, fbbc);
+    fclose(fbbc);
+}
+
+static void blockcount_finish(void) {
+    uint32_t blocks = reconstruct_block_count();
+    char path[256];
+
+    if (blocks > block_capacity)
+        grow_blocks(blocks - 1);
+
+    snprintf(path, sizeof(path), "%s.dot", bbc_prefix);
+    write_dot(path, blocks);
+    snprintf(path, sizeof(path), "%s.bbc", bbc_prefix);
+    write_bbc(path, blocks);
+
+    fprintf(stderr, "Counted %lu ranges in %u blocks, %u edges, %lu transitions not followed\n",
+            ranges, blocks, edge_count, dropped);
+
+    free(block_info);
+    free(edges);
+    block_info = NULL;
+    edges = NULL;
+    block_capacity = edge_capacity = edge_count = 0;
+}
+
+const subscriber_t blockcount_subscriber = {
+    .name = "blockcount",
+    .on_event = blockcount_event,
+    .on_finish = blockcount_finish,
+};
+
+// writes <prefix>.dot and <prefix>.bbc at the end of the trace
+void blockcount_open(const char* prefix) {
+    bbc_prefix = prefix;
+    grow_blocks(0);
+    grow_edges();
+    reconstruct_add_handler(blockcount_range);
+    subscriber_add(&blockcount_subscriber);
+}
@@ -0,0 +1,382 @@
+/*
+    Calibration: the nominal_t and tail_t of a milestone graph measured on
+    recorded runs, written as a new .ttmsg (cfg/tprofile.py
+    binarize_relative_tail() layout in a TMG container), in one decode.
+
+    A run starts at the address packet of the entry milestone, the first
+    node of the graph, and follows the graph as the R5 tracer does: an
+    address packet within 4 bytes of a successor of the last milestone is
+    a hit. The time of a hit is the sum of the cycle counts before it when
+    the run has cycle count packets (start_etr_mp -k), else the last
+    timestamp (-t), in generator ticks. Every hit is a sample of the edge it
+    took and of the time since the start of the run at the node reached;
+    nominal_t of an edge and tail_t of a node are percentiles of their
+    samples over all runs. A run ends at a milestone without successors,
+    at the end of its trace file, or is dropped at an overflow.
+
+    Edges and nodes never reached keep 0, as in tprofile.py.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "subscriber.h"
+
+#define CAL_TMG_MAGIC 0x46474d54     // "TMGF", cfg/tmg_format.py
+#define CAL_TMG_VERSION 1
+#define CAL_TMG_KIND_MSG 0
+#define CAL_TMG_KIND_TTMSG 1
+#define CAL_TMG_HEADER_WORDS 8
+#define CAL_TMG_END 0xffffffff
+#define CAL_MATCH_BYTES 4
+
+typedef struct samples {
+    uint32_t * v;
+    uint32_t n;
+    uint32_t capacity;
+} samples_t;
+
+typedef struct cal_edge {
+    uint32_t to;            // node index
+    samples_t nominal;
+} cal_edge_t;
+
+typedef struct cal_node {
+    uint32_t address;
+    uint32_t first_edge;
+    uint32_t n_edges;
+    samples_t tail;
+} cal_node_t;
+
+// a hit of the current run, kept until the run shows which clock it has
+typedef struct cal_hit {
+    uint32_t edge;
+    uint64_t ticks;
+    uint64_t cycles;
+} cal_hit_t;
+
+static cal_node_t * nodes = NULL;
+static uint32_t node_count = 0;
+static cal_edge_t * edges = NULL;
+static uint32_t edge_count = 0;
+
+static const char * out_path = NULL;
+static uint32_t nominal_pct, tail_pct;
+
+static cal_hit_t * hits = NULL;
+static uint32_t hit_count = 0, hit_capacity = 0;
+static int64_t current = -1;            // node of the last hit, -1 while waiting for the entry
+static uint64_t start_ticks, start_cycles;
+static uint64_t ticks, cycles;
+static uint8_t run_has_cycles = 0;
+
+static uint64_t runs, dropped_runs, cycle_runs;
+
+static void add_sample(samples_t* s, uint64_t value) {
+    if (s->n == s->capacity) {
+        s->capacity = s->capacity ? s->capacity * 2 : 16;
+        s->v = (uint32_t *) realloc(s->v, s->capacity * sizeof(uint32_t));
+        if (s->v == NULL) {
+            fprintf(stderr, "Cannot allocate the calibration samples\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    s->v[s->n++] = value > 0xfffffffe ? 0xfffffffe : (uint32_t) value;
+}
+
+static int by_value(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// nearest rank, 0 without samples
+static uint32_t percentile(samples_t* s, uint32_t pct) {
+    uint32_t rank;
+
+    if (s->n == 0)
+        return 0;
+    qsort(s->v, s->n, sizeof(uint32_t), by_value);
+    rank = (uint32_t) (((uint64_t) s->n * pct + 99) / 100);
+    return s->v[rank ? rank - 1 : 0];
+}
+
+static uint32_t checksum(const uint32_t* words, uint32_t n) {
+    uint32_t c = 0, i;
+
+    for (i = 0; i < n; ++i)
+        c = ((c << 1) | (c >> 31)) ^ words[i];
+    return c;
+}
+
+/*
+    The node lists of msg_binarize.py binarize() (kind 0) and of
+    binarize_relative_tail() (kind 1), with or without the TMG header; a
+    raw file is taken as a .ttmsg, as tracee/src/tmg.c does.
+*/
+static void load_graph(const char* path) {
+    const uint32_t * w;
+    uint32_t * node_at;
+    uint32_t n, i, head_words, pair_words, kind = CAL_TMG_KIND_TTMSG;
+    struct stat graph_stat;
+    void * map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &graph_stat) < 0) {
+        fprintf(stderr, "Error opening graph file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (graph_stat.st_size < 8 || graph_stat.st_size % 4) {
+        fprintf(stderr, "%s is not a graph of words\n", path);
+        exit(EXIT_FAILURE);
+    }
+    map = mmap(0, graph_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error mmap of graph file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    w = (const uint32_t *) map;
+    n = graph_stat.st_size / 4;
+    if (n >= CAL_TMG_HEADER_WORDS && w[0] == CAL_TMG_MAGIC) {
+        kind = w[2];
+        if (w[1] != CAL_TMG_VERSION || w[4] != n - CAL_TMG_HEADER_WORDS
+                || checksum(w + CAL_TMG_HEADER_WORDS, w[4]) != w[5]) {
+            fprintf(stderr, "%s: corrupt TMG container\n", path);
+            exit(EXIT_FAILURE);
+        }
+        w += CAL_TMG_HEADER_WORDS;
+        n -= CAL_TMG_HEADER_WORDS;
+    }
+    if (kind != CAL_TMG_KIND_MSG && kind != CAL_TMG_KIND_TTMSG) {
+        fprintf(stderr, "%s: only .msg and .ttmsg graphs can be calibrated, not kind %u\n", path, kind);
+        exit(EXIT_FAILURE);
+    }
+    head_words = kind == CAL_TMG_KIND_TTMSG ? 2 : 1;
+    pair_words = kind == CAL_TMG_KIND_TTMSG ? 2 : 1;
+
+    // first pass: where the nodes start, and how many edges there are
+    node_at = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+    nodes = (cal_node_t *) calloc(n, sizeof(cal_node_t));
+    edges = (cal_edge_t *) calloc(n, sizeof(cal_edge_t));
+    if (node_at == NULL || nodes == NULL || edges == NULL) {
+        fprintf(stderr, "Cannot allocate the graph\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(node_at, 0xff, (n + 1) * sizeof(uint32_t));
+    for (i = 0; i < n; ) {
+        cal_node_t * node = &nodes[node_count];
+
+        node_at[i] = node_count++;
+        node->address = w[i];
+        node->first_edge = edge_count;
+        for (i += head_words; i < n && w[i] != CAL_TMG_END; i += pair_words) {
+            edges[edge_count++].to = w[i];      // byte offset, resolved below
+            node->n_edges++;
+        }
+        if (i >= n) {
+            fprintf(stderr, "%s: node without terminator\n", path);
+            exit(EXIT_FAILURE);
+        }
+        i++;
+    }
+    for (i = 0; i < edge_count; ++i) {
+        uint32_t word = edges[i].to / 4;
+        if (edges[i].to % 4 || word >= n || node_at[word] == 0xffffffff) {
+            fprintf(stderr, "%s: successor offset 0x%x not at a node\n", path, edges[i].to);
+            exit(EXIT_FAILURE);
+        }
+        edges[i].to = node_at[word];
+    }
+
+    free(node_at);
+    munmap(map, graph_stat.st_size);
+}
+
+static void end_run(uint8_t keep) {
+    uint32_t i;
+
+    if (current < 0)
+        return;
+
+    if (keep) {
+        // the samples of a run all come from one clock
+        for (i = 0; i < hit_count; ++i) {
+            const cal_hit_t * hit = &hits[i];
+            const cal_hit_t * prev = i ? &hits[i - 1] : NULL;
+            uint64_t since_prev = run_has_cycles ? hit->cycles - (prev ? prev->cycles : start_cycles)
+                                                 : hit->ticks - (prev ? prev->ticks : start_ticks);
+            uint64_t since_start = run_has_cycles ? hit->cycles - start_cycles : hit->ticks - start_ticks;
+
+            add_sample(&edges[hit->edge].nominal, since_prev);
+            add_sample(&nodes[edges[hit->edge].to].tail, since_start);
+        }
+        runs++;
+        cycle_runs += run_has_cycles;
+    } else {
+        dropped_runs++;
+    }
+
+    hit_count = 0;
+    current = -1;
+}
+
+// the next trace file is another run
+void calibrate_next_run(void) {
+    end_run(1);
+    ticks = cycles = 0;
+    run_has_cycles = 0;
+}
+
+static uint8_t matches(uint64_t address, uint32_t milestone) {
+    return address + CAL_MATCH_BYTES >= milestone && address <= (uint64_t) milestone + CAL_MATCH_BYTES;
+}
+
+static void hit(uint32_t edge) {
+    if (hit_count == hit_capacity) {
+        hit_capacity = hit_capacity ? hit_capacity * 2 : 1024;
+        hits = (cal_hit_t *) realloc(hits, hit_capacity * sizeof(cal_hit_t));
+        if (hits == NULL) {
+            fprintf(stderr, "Cannot allocate the milestone hits\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    hits[hit_count].edge = edge;
+    hits[hit_count].ticks = ticks;
+    hits[hit_count].cycles = cycles;
+    hit_count++;
+
+    current = edges[edge].to;
+    if (nodes[current].n_edges == 0)
+        end_run(1);
+}
+
+static void follow_address(uint64_t address) {
+    const cal_node_t * node;
+    uint32_t i;
+
+    if (current < 0) {
+        if (matches(address, nodes[0].address)) {
+            current = 0;
+            start_ticks = ticks;
+            start_cycles = cycles;
+        }
+        return;
+    }
+
+    node = &nodes[current];
+    for (i = 0; i < node->n_edges; ++i) {
+        if (matches(address, nodes[edges[node->first_edge + i].to].address)) {
+            hit(node->first_edge + i);
+            return;
+        }
+    }
+}
+
+static void calibrate_event(const trace_event_t* event) {
+    switch (event->type) {
+    case EV_ADDRESS:
+        follow_address(event->value);
+        break;
+    case EV_TIMESTAMP:
+        ticks = event->value;
+        if (event->flags) {
+            cycles += event->data;
+            run_has_cycles = 1;
+        }
+        break;
+    case EV_CYCLECOUNT:
+        cycles += event->data;
+        run_has_cycles = 1;
+        break;
+    case EV_OVERFLOW:
+        end_run(0);
+        break;
+    default:
+        break;
+    }
+}
+
+static void put_word(FILE* f, uint32_t word, uint32_t* sum) {
+    *sum = ((*sum << 1) | (*sum >> 31)) ^ word;
+    fwrite(&word, sizeof(word), 1, f);
+}
+
+static void calibrate_finish(void) {
+    uint32_t header[CAL_TMG_HEADER_WORDS] = {CAL_TMG_MAGIC, CAL_TMG_VERSION, CAL_TMG_KIND_TTMSG, node_count, 0, 0, 0, 0};
+    uint32_t * offset = (uint32_t *) malloc(node_count * sizeof(uint32_t));
+    uint32_t i, j, words = 0, sum = 0, unreached = 0;
+    FILE * fout;
+
+    end_run(1);
+
+    // a node is its address, tail_t, an (offset, nominal_t) pair per successor and the terminator
+    for (i = 0; i < node_count; ++i) {
+        offset[i] = words * 4;
+        words += 3 + 2 * nodes[i].n_edges;
+    }
+
+    fout = fopen(out_path, "wb");
+    if (fout == NULL) {
+        fprintf(stderr, "Error opening calibrated graph %s\n", out_path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(header, sizeof(header), 1, fout);
+    for (i = 0; i < node_count; ++i) {
+        put_word(fout, nodes[i].address, &sum);
+        put_word(fout, i ? percentile(&nodes[i].tail, tail_pct) : 0, &sum);
+        if (i && nodes[i].tail.n == 0)
+            unreached++;
+        for (j = 0; j < nodes[i].n_edges; ++j) {
+            cal_edge_t * edge = &edges[nodes[i].first_edge + j];
+            put_word(fout, offset[edge->to], &sum);
+            put_word(fout, percentile(&edge->nominal, nominal_pct), &sum);
+        }
+        put_word(fout, CAL_TMG_END, &sum);
+    }
+    header[4] = words;
+    header[5] = sum;
+    rewind(fout);
+    fwrite(header, sizeof(header), 1, fout);
+    fclose(fout);
+
+    fprintf(stderr, "Calibrated %u milestones on %lu runs (%lu timed by cycle counts, %lu dropped at an overflow), "
+            "p%u nominal_t, p%u tail_t, %u milestones never reached\n",
+            node_count, runs, cycle_runs, dropped_runs, nominal_pct, tail_pct, unreached);
+    if (cycle_runs && cycle_runs != runs)
+        fprintf(stderr, "  some runs are timed in cycles, the others in timestamp ticks: the values mix both\n");
+
+    free(offset);
+}
+
+const subscriber_t calibrate_subscriber = {
+    .name = "calibrate",
+    .on_event = calibrate_event,
+    .on_finish = calibrate_finish,
+};
+
+// percentiles 1 to 100 of the segment times (nominal_t) and of the times since the start (tail_t)
+void calibrate_open(const char* graph, const char* out, uint32_t nominal, uint32_t tail) {
+    if (nominal == 0 || nominal > 100 || tail == 0 || tail > 100) {
+        fprintf(stderr, "Calibration percentiles must be 1 to 100\n");
+        exit(EXIT_FAILURE);
+    }
+
+    load_graph(graph);
+    if (node_count == 0) {
+        fprintf(stderr, "%s has no milestones\n", graph);
+        exit(EXIT_FAILURE);
+    }
+    out_path = out;
+    nominal_pct = nominal;
+    tail_pct = tail;
+    subscriber_add(&calibrate_subscriber);
+}
@@ -0,0 +1,338 @@
+/*
+    CFI monitor: the state machine of handlers.c, compiled. Every block of
+    the table becomes a transition: the block after an N atom, the block
+    after an E atom (the same block for an indirect branch, which the next
+    address packet resolves) and whether the E atom calls or returns. For
+    each block and each pattern of four atoms, jump4 holds the block after
+    them when none of the four calls, returns or violates, so most atoms
+    cost a quarter of a table load; the rest go one at a time.
+
+    Block 0 is out of scope, as in handlers.c: atoms are not checked until
+    an address packet enters a block.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cfimon.h"
+#include "subscriber.h"
+
+#define CFI_N_BAD 0x1       // N atom without a conditional branch
+#define CFI_E_PUSH 0x2      // E atom of a call (l), pushes the next block
+#define CFI_E_RETURN 0x4    // E atom of a return (r)
+
+#define CFI_SLOW 0xffffffff // jump4: the four atoms need single steps
+
+typedef struct cfi_block {
+    uint32_t start;
+    uint32_t next_n;
+    uint32_t next_e;
+    uint8_t flags;
+} cfi_block_t;
+
+struct cfimon {
+    cfi_block_t * blocks;
+    uint32_t * jump4;       // [block * 16 + four atoms, atom 0 in bit 0]
+    uint32_t entries;
+    uint32_t scope_lo, scope_hi;
+    uint8_t sorted;
+
+    uint32_t current;
+    uint8_t state;          // CTL_STATE_*
+    uint32_t stack[ADDRESS_STACK_SIZE];
+    uint16_t stack_ptr;
+
+    cfimon_violation_cb on_violation;
+    void * ctx;
+    uint64_t atoms;
+    uint64_t violations;
+};
+
+const char * cfimon_kind_name(uint8_t kind) {
+    switch (kind) {
+    case CFIMON_NOT_CONDITIONAL:
+        return "N atom without a conditional branch";
+    case CFIMON_UNKNOWN_BLOCK:
+        return "no block at the address";
+    case CFIMON_RETURN_MISMATCH:
+        return "return address mismatch";
+    case CFIMON_STACK_OVERFLOW:
+        return "return address stack overflow";
+    default:
+        return "unknown";
+    }
+}
+
+static void leave_scope(cfimon_t* mon) {
+    mon->current = 0;
+    mon->stack_ptr = 0;
+    mon->state = CTL_STATE_INIT;
+}
+
+void cfimon_reset(cfimon_t* mon) {
+    leave_scope(mon);
+}
+
+static void violation(cfimon_t* mon, uint8_t kind, uint64_t address, uint32_t expected) {
+    cfimon_violation_t v;
+
+    v.kind = kind;
+    v.block = mon->current ? mon->blocks[mon->current].start : 0;
+    v.address = address;
+    v.expected = expected;
+    v.atoms = mon->atoms;
+    mon->violations++;
+    if (mon->on_violation)
+        mon->on_violation(mon->ctx, &v);
+    leave_scope(mon);
+}
+
+// as find_block() of handlers.c
+static uint32_t find_block(const cfimon_t* mon, uint32_t address) {
+    uint32_t low = 1, high = mon->entries - 1, mid, i;
+
+    if (!mon->sorted) {
+        for (i = 1; i < mon->entries - 1; ++i) {
+            if (address >= mon->blocks[i].start && address < mon->blocks[i + 1].start)
+                return i;
+        }
+        return 0;
+    }
+
+    if (address < mon->blocks[low].start)
+        return 0;
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (mon->blocks[mid].start <= address)
+            low = mid;
+        else
+            high = mid;
+    }
+    return address < mon->blocks[low + 1].start ? low : 0;
+}
+
+void cfimon_address(cfimon_t* mon, uint64_t address) {
+    uint32_t address32 = (uint32_t) address;
+    uint32_t popped;
+
+    if (address >> 32 || address32 < mon->scope_lo || address32 >= mon->scope_hi) {
+        if (mon->current)
+            leave_scope(mon);
+        return;
+    }
+
+    if (mon->state == CTL_STATE_POP_COMP) {
+        popped = mon->stack_ptr ? mon->stack[mon->stack_ptr--] : 0;
+        if (popped != address32) {
+            violation(mon, CFIMON_RETURN_MISMATCH, address, popped);
+            return;
+        }
+    }
+
+    mon->current = find_block(mon, address32);
+    if (mon->current == 0) {
+        violation(mon, CFIMON_UNKNOWN_BLOCK, address, 0);
+        return;
+    }
+    mon->state = mon->state == CTL_STATE_PUSH ? CTL_STATE_INSCOPE : CTL_STATE_INIT;
+}
+
+// one atom of check_atom() in handlers.c, 0 after a violation
+static int step(cfimon_t* mon, uint8_t atom) {
+    const cfi_block_t * block = &mon->blocks[mon->current];
+
+    if (!atom) {
+        if (block->flags & CFI_N_BAD) {
+            violation(mon, CFIMON_NOT_CONDITIONAL, 0, 0);
+            return 0;
+        }
+        mon->current = block->next_n;
+        return 1;
+    }
+
+    if (block->flags & CFI_E_RETURN) {
+        mon->state = (mon->state == CTL_STATE_INSCOPE || mon->state == CTL_STATE_PUSH) ? CTL_STATE_POP_COMP
+                                                                                       : CTL_STATE_INIT;
+        return 1;
+    }
+    if (block->flags & CFI_E_PUSH) {
+        mon->state = CTL_STATE_PUSH;
+        if (mon->stack_ptr == ADDRESS_STACK_SIZE - 1) {
+            violation(mon, CFIMON_STACK_OVERFLOW, 0, 0);
+            return 0;
+        }
+        mon->stack[++mon->stack_ptr] = mon->blocks[mon->current + 1].start;
+    }
+    mon->current = block->next_e;
+    return 1;
+}
+
+// atom i is E when bit i of mask is set, as EV_ATOM carries them
+void cfimon_atoms(cfimon_t* mon, uint64_t mask, uint16_t count) {
+    uint32_t next;
+    uint16_t i = 0;
+
+    while (i < count && mon->current) {
+        if (count - i >= 4) {
+            next = mon->jump4[mon->current * 16 + ((mask >> i) & 0xf)];
+            if (next != CFI_SLOW) {
+                mon->current = next;
+                mon->atoms += 4;
+                i += 4;
+                continue;
+            }
+        }
+        mon->atoms++;
+        if (!step(mon, (mask >> i) & 0x1))
+            return;
+        i++;
+    }
+}
+
+void cfimon_event(cfimon_t* mon, const trace_event_t* event) {
+    switch (event->type) {
+    case EV_ATOM:
+        cfimon_atoms(mon, event->value, event->count);
+        break;
+    case EV_ADDRESS:
+        cfimon_address(mon, event->value);
+        break;
+    case EV_OVERFLOW:
+    case EV_TRACE_START:
+        // the path in between is lost, the next address packet starts over
+        leave_scope(mon);
+        break;
+    default:
+        break;
+    }
+}
+
+// the block after four atoms from block b, CFI_SLOW unless every one is a plain transition
+static uint32_t compile_jump4(const cfimon_t* mon, uint32_t b, uint32_t atoms) {
+    uint32_t i;
+
+    for (i = 0; i < 4 && b; ++i) {
+        const cfi_block_t * block = &mon->blocks[b];
+        if ((atoms >> i) & 0x1) {
+            if (block->flags & (CFI_E_PUSH | CFI_E_RETURN))
+                return CFI_SLOW;
+            b = block->next_e;
+        } else {
+            if (block->flags & CFI_N_BAD)
+                return CFI_SLOW;
+            b = block->next_n;
+        }
+    }
+    return b;
+}
+
+/*
+    Compiles a table as handlers.c reads it: entry 0 and the last entry only
+    bound the scope, block i covers [start_addr(i), start_addr(i + 1)). NULL
+    for a table the monitor cannot follow.
+*/
+cfimon_t * cfimon_open(const basicblock_t* table, uint32_t entries, cfimon_violation_cb on_violation, void* ctx) {
+    cfimon_t * mon;
+    uint32_t i, p, target;
+
+    if (entries < 3) {
+        fprintf(stderr, "CFI monitor: a block table needs at least 3 entries\n");
+        return NULL;
+    }
+
+    mon = (cfimon_t *) calloc(1, sizeof(cfimon_t));
+    if (mon == NULL)
+        return NULL;
+    mon->blocks = (cfi_block_t *) calloc(entries, sizeof(cfi_block_t));
+    mon->jump4 = (uint32_t *) malloc((size_t) entries * 16 * sizeof(uint32_t));
+    if (mon->blocks == NULL || mon->jump4 == NULL) {
+        cfimon_close(mon);
+        return NULL;
+    }
+    mon->entries = entries;
+    mon->scope_lo = table[1].start_addr;
+    mon->scope_hi = table[entries - 1].start_addr;
+    mon->on_violation = on_violation;
+    mon->ctx = ctx;
+
+    mon->sorted = 1;
+    for (i = 0; i < entries; ++i) {
+        mon->blocks[i].start = table[i].start_addr;
+        if (i && table[i].start_addr < table[i - 1].start_addr)
+            mon->sorted = 0;
+    }
+    if (!mon->sorted)
+        fprintf(stderr, "CTL table is not sorted by start address, using linear block lookup\n");
+
+    // falling through the last block leaves the scope
+    for (i = 1; i < entries - 1; ++i) {
+        cfi_block_t * block = &mon->blocks[i];
+
+        block->next_n = i + 1 < entries - 1 ? i + 1 : 0;
+        if (!table[i].c)
+            block->flags |= CFI_N_BAD;
+        block->next_e = i;
+        if (table[i].r) {
+            block->flags |= CFI_E_RETURN;
+        } else {
+            if (table[i].l)
+                block->flags |= CFI_E_PUSH;
+            if (table[i].s) {
+                target = table[i].offset / 8 + 1;
+                if (target >= entries - 1) {
+                    fprintf(stderr, "CFI monitor: block %u branches to entry %u, past the table\n", i, target);
+                    cfimon_close(mon);
+                    return NULL;
+                }
+                block->next_e = target;
+            }
+        }
+    }
+
+    for (i = 0; i < entries; ++i) {
+        for (p = 0; p < 16; ++p)
+            mon->jump4[i * 16 + p] = i ? compile_jump4(mon, i, p) : 0;
+    }
+
+    leave_scope(mon);
+    return mon;
+}
+
+uint64_t cfimon_checked_atoms(const cfimon_t* mon) {
+    return mon->atoms;
+}
+
+uint64_t cfimon_violations(const cfimon_t* mon) {
+    return mon->violations;
+}
+
+void cfimon_close(cfimon_t* mon) {
+    if (mon == NULL)
+        return;
+    free(mon->blocks);
+    free(mon->jump4);
+    free(mon);
+}
+
+static cfimon_t * attached = NULL;
+
+static void monitor_event(const trace_event_t* event) {
+    cfimon_event(attached, event);
+}
+
+static void monitor_finish(void) {
+    fprintf(stderr, "CFI monitor: %lu atoms checked, %lu violations\n",
+            cfimon_checked_atoms(attached), cfimon_violations(attached));
+}
+
+const subscriber_t cfimon_subscriber = {
+    .name = "cfimon",
+    .on_event = monitor_event,
+    .on_finish = monitor_finish,
+};
+
+void cfimon_attach(cfimon_t* mon) {
+    attached = mon;
+    subscriber_add(&cfimon_subscriber);
+}
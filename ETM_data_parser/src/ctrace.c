@@ -4,77 +4,661 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include "trace.h"
+#include "input.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "frame.h"
+#include "subscriber.h"
+#include "image.h"
+#include "reconstruct.h"
+#include "archive.h"
+#include "merge.h"
+#include "cfimon.h"
 
-extern void trace_loop(void);
+static const uint8_t * trace_buffer;
+static size_t buffer_size;
+static uint8_t buffer_mapped = 0;
 
-static uint8_t * trace_buffer;
-static uint32_t buffer_size;
-static uint32_t buffer_pointer;
+static double elapsed_seconds(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
-uint32_t read_data(uint8_t* buffer, uint32_t bytes, uint8_t advance_pointer)  {
-    uint32_t read;
+/*
+ * Decode the whole buffer with the sink silenced, once per dispatch
+ * method, and print the packet rate of each to stderr.
+ */
+static void run_benchmark(unsigned int rounds) {
+    const char* names[] = {"table", "switch"};
+    struct timespec start, end;
+    uint32_t packets = 0;
+    unsigned int i;
+    uint8_t mode;
+    double secs;
 
-    for (read = 0; read < bytes && buffer_pointer + read < buffer_size; ++read) {
-        buffer[read] = trace_buffer[buffer_pointer + read];
-    }
+    uint8_t saved_mode = sink_get_mode();
+
+    sink_set_mode(SINK_NONE);
 
-    if (advance_pointer) {
-        buffer_pointer += read;
+    for (mode = TRACE_DISPATCH_TABLE; mode <= TRACE_DISPATCH_SWITCH; ++mode) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < rounds; ++i) {
+            input_seek(0);
+            packets = trace_loop_dispatch(mode);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        secs = elapsed_seconds(&start, &end);
+        fprintf(stderr, "%-6s: %u packets x %u rounds in %.3f s, %.0f packets/s, %.1f MB/s\n",
+                names[mode], packets, rounds, secs, (double) packets * rounds / secs,
+                (double) buffer_size * rounds / secs / (1024 * 1024));
     }
 
-    return read;
+    sink_set_mode(saved_mode);
 }
 
-uint32_t advance_pointer(uint32_t offset) {
-    buffer_pointer += offset;
-    if (buffer_pointer >= buffer_size)
-        buffer_pointer = buffer_size;   
-
-    return buffer_pointer;
+static int has_suffix(const char* name, const char* suffix) {
+    size_t name_len = strlen(name), suffix_len = strlen(suffix);
+    return name_len >= suffix_len && !strcmp(name + name_len - suffix_len, suffix);
 }
 
-uint8_t data_available() {
-    return buffer_pointer < buffer_size;
+/*
+ * Raw trace bytes as written by deformat (trc_N.dat) are decoded in place,
+ * the mapping is as large as the file and nothing is copied. Archives are
+ * the exception, they are unpacked into memory.
+ */
+static void load_binary(const char* path) {
+    struct stat trace_stat;
+    void * map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening input file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fstat(fd, &trace_stat) < 0) {
+        fprintf(stderr, "Error getting stats for input file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    buffer_size = trace_stat.st_size;
+    if (buffer_size == 0) {
+        trace_buffer = NULL;
+        close(fd);
+        return;
+    }
+
+    map = mmap(0, buffer_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error mmap of input file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    madvise(map, buffer_size, MADV_SEQUENTIAL);
+    close(fd);
+
+    trace_buffer = (const uint8_t *) map;
+    buffer_mapped = 1;
+    // a compressed archive is unpacked once, decoding then works on the plain bytes
+    if (archive_is(trace_buffer, buffer_size)) {
+        size_t raw_size;
+        uint8_t * raw = archive_unpack(trace_buffer, buffer_size, &raw_size);
+        if (raw == NULL) {
+            fprintf(stderr, "Error unpacking the archive %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        munmap(map, buffer_size);
+        trace_buffer = raw;
+        buffer_size = raw_size;
+        buffer_mapped = 0;
+    }
 }
 
-int main(int argc, char const *argv[]) {
-    int ctl_flow_fd;
-    struct stat ctl_flow_stat;
+// One 0x%08X word per line (trc_N.out), the buffer grows with the file
+static void load_text(const char* path) {
     FILE * trace_file;
-    char * line;
+    char * line = NULL;
     unsigned int line_hex;
-    void * ctl_ptr;
+    uint8_t * buffer;
+    size_t capacity = 64 * 1024, size = 0;
     size_t len = 0;
-    ssize_t read;
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: ./ctrace [trace_input_file]\n");
+    trace_file = fopen(path, "r");
+    if (trace_file == NULL) {
+        fprintf(stderr, "Error opening input file %s\n", path);
         exit(EXIT_FAILURE);
     }
 
-    trace_buffer = (uint8_t *) malloc(256 * 1024 * 1024); // 64 mb??
-    buffer_size = 0;
-
-    trace_file = fopen(argv[1], "r");
-    if (trace_file == NULL) {
-        fprintf(stderr, "Error opening input file %s\n", argv[1]);
+    buffer = (uint8_t *) malloc(capacity);
+    if (buffer == NULL) {
+        perror("malloc");
         exit(EXIT_FAILURE);
     }
 
-    while ((read = getline(&line, &len, trace_file)) != -1) {
+    while (getline(&line, &len, trace_file) != -1) {
+        if (size + 4 > capacity) {
+            capacity *= 2;
+            buffer = (uint8_t *) realloc(buffer, capacity);
+            if (buffer == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+
         sscanf(line, "%x", &line_hex);
-        trace_buffer[buffer_size++] = line_hex & 0xFF;
-        trace_buffer[buffer_size++] = (line_hex >> 8) & 0xFF;
-        trace_buffer[buffer_size++] = (line_hex >> 16) & 0xFF;
-        trace_buffer[buffer_size++] = (line_hex >> 24) & 0xFF;
+        buffer[size++] = line_hex & 0xFF;
+        buffer[size++] = (line_hex >> 8) & 0xFF;
+        buffer[size++] = (line_hex >> 16) & 0xFF;
+        buffer[size++] = (line_hex >> 24) & 0xFF;
     }
 
+    free(line);
     fclose(trace_file);
 
-    printf("Done reading file, read %d bytes (should be %d lines)\n", buffer_size, buffer_size / 4);
+    trace_buffer = buffer;
+    buffer_size = size;
+    buffer_mapped = 0;
+}
+
+static void release_input(void) {
+    if (trace_buffer == NULL)
+        return;
+    if (buffer_mapped)
+        munmap((void *) trace_buffer, buffer_size);
+    else
+        free((void *) trace_buffer);
+    trace_buffer = NULL;
+}
+
+// Basic block table (basicblock_t entries) for the control flow checker in handlers.c
+static void * map_ctl(const char* path, uint32_t* entries) {
+    struct stat ctl_flow_stat;
+    int ctl_flow_fd;
+    void * ctl_ptr;
+
+    ctl_flow_fd = open(path, O_RDONLY);
+    if (ctl_flow_fd < 0) {
+        fprintf(stderr, "Error binary ctl file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fstat(ctl_flow_fd, &ctl_flow_stat) < 0) {
+        fprintf(stderr, "Error getting stats for ctl file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    ctl_ptr = mmap(0, ctl_flow_stat.st_size, PROT_READ, MAP_PRIVATE, ctl_flow_fd, 0);
+    if (ctl_ptr == MAP_FAILED) {
+        fprintf(stderr, "Error mmap of ctl file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(ctl_flow_fd);
+
+    *entries = ctl_flow_stat.st_size / sizeof(basicblock_t);
+    return ctl_ptr;
+}
+
+static void load_ctl(const char* path) {
+    uint32_t entries;
+    void * ctl_ptr = map_ctl(path, &entries);
+
+    set_ctl_buff(ctl_ptr, entries);
+    subscriber_add(&ctl_subscriber);
+}
+
+static void print_violation(void* ctx, const cfimon_violation_t* v) {
+    (void) ctx;
+    fprintf(stderr, "CFI violation after %lu atoms: %s, block 0x%x", v->atoms, cfimon_kind_name(v->kind), v->block);
+    if (v->address)
+        fprintf(stderr, ", address 0x%lx", v->address);
+    if (v->kind == CFIMON_RETURN_MISMATCH)
+        fprintf(stderr, ", expected 0x%x", v->expected);
+    fprintf(stderr, "\n");
+}
+
+// the checks of -c without the log, violations go to stderr and the decode goes on
+static void load_monitor(const char* path) {
+    uint32_t entries;
+    void * ctl_ptr = map_ctl(path, &entries);
+    cfimon_t * mon = cfimon_open((const basicblock_t *) ctl_ptr, entries, print_violation, NULL);
+
+    if (mon == NULL)
+        exit(EXIT_FAILURE);
+    cfimon_attach(mon);
+}
+
+// "-" is stdin, "tcp:host:port" a TCP connection, anything else a file or FIFO
+static int open_stream(const char* name) {
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char * port;
+    int fd = -1;
+
+    if (!strcmp(name, "-"))
+        return STDIN_FILENO;
+
+    if (strncmp(name, "tcp:", 4)) {
+        fd = open(name, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error opening input file %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        return fd;
+    }
+
+    port = strrchr(name + 4, ':');
+    if (port == NULL || port - (name + 4) >= (long) sizeof(host)) {
+        fprintf(stderr, "Bad address %s, expected tcp:host:port\n", name);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(host, name + 4, port - (name + 4));
+    host[port - (name + 4)] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port + 1, &hints, &res)) {
+        fprintf(stderr, "Cannot resolve %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+static void stop_stream(int sig) {
+    (void) sig;
+    input_stop_stream();
+}
+
+// no SA_RESTART: a blocked read returns and the stream ends cleanly, flushing the output
+static void catch_stop_signals(void) {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_stream;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
 
+// Every file is one recorded run of the calibrated code, decoded from its start
+static void run_calibration(char * const paths[], int count, uint8_t binary_input, FILE* info) {
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        if (binary_input || has_suffix(paths[i], ".dat"))
+            load_binary(paths[i]);
+        else
+            load_text(paths[i]);
+
+        input_set_buffer(trace_buffer, buffer_size);
+        trace_loop();
+        calibrate_next_run();
+        release_input();
+    }
+    fprintf(info, "Done decoding %d runs\n", count);
+}
+
+// Decode a raw byte stream as it arrives, with constant memory
+static void run_stream(const char* name, uint8_t follow) {
+    int fd = open_stream(name);
+
+    catch_stop_signals();
+    input_set_stream(fd, INPUT_STREAM_SIZE, follow);
     trace_loop();
+    input_close_stream();
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+}
+
+// Deformat and decode a formatted stream, one decoder per trace ID
+static void run_formatted(const char* name, int ids, uint8_t mode, const char* output_path, FILE* info) {
+    int fd = open_stream(name);
+    uint64_t total;
+
+    catch_stop_signals();
+    total = pipeline_decode(fd, ids, mode, output_path);
+    fprintf(info, "Done deformatting %lu bytes of %d trace IDs\n", total, ids);
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+}
+
+static uint8_t parse_sink_mode(const char* name) {
+    if (!strcmp(name, "text"))
+        return SINK_TEXT;
+    if (!strcmp(name, "binary"))
+        return SINK_BINARY;
+    if (!strcmp(name, "none"))
+        return SINK_NONE;
+
+    fprintf(stderr, "Unknown output mode %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// file or file@load_base, the base of a position independent image
+static void load_image(char* name) {
+    char * at = strrchr(name, '@');
+    uint64_t base = 0;
+
+    if (at) {
+        *at = '\0';
+        base = strtoull(at + 1, NULL, 0);
+    }
+
+    image_load(name, base);
+}
+
+// for the text log, the decoder itself does not link image.c
+static const char* symbol_of(uint64_t address, uint64_t* offset) {
+    const image_symbol_t * symbol = image_symbol(address);
+
+    if (symbol == NULL)
+        return NULL;
+    *offset = address - symbol->start;
+    return symbol->name;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: ./ctrace [options] trace_input_file [ctl_binary|strip]\n");
+    fprintf(stderr, "       ./ctrace -M [-Z hz] [-m mode] [-o file] [-t] events_0.evt events_1.evt ...\n");
+    fprintf(stderr, "       ./ctrace -K graph -k out.ttmsg [-Q nominal,tail] [options] run_0.dat run_1.dat ...\n");
+    fprintf(stderr, "  -b rounds  benchmark table against switch dispatch, no decode output\n");
+    fprintf(stderr, "  -r         input is raw binary trace (default for *.dat files)\n");
+    fprintf(stderr, "  -s         stream raw binary input through a fixed buffer; file, FIFO, - for stdin or tcp:host:port\n");
+    fprintf(stderr, "  -f         follow a growing file, like -s but waits for more data at its end (stop with ^C)\n");
+    fprintf(stderr, "  -F ids     input is formatted (ETR/ETF memory) with trace IDs 1 to ids, each decoded by its own\n");
+    fprintf(stderr, "             thread; with several IDs -o is the prefix of <prefix>_<n>.txt|.evt (default trc)\n");
+    fprintf(stderr, "  -j threads decode segments between A-sync packets in parallel (not with -c, -V, -S, -t, -x, -L, -H or -D)\n");
+    fprintf(stderr, "  -m mode    text log (default), binary event records (see sink.h) or no output\n");
+    fprintf(stderr, "  -o file    write the output to file instead of stdout\n");
+    fprintf(stderr, "  -c file    check the control flow against a basic block table\n");
+    fprintf(stderr, "  -V file    monitor the control flow against a basic block table: compiled, no log,\n");
+    fprintf(stderr, "             violations to stderr without stopping, e.g. with -s at capture speed\n");
+    fprintf(stderr, "  -S file    write the strip file (see strip.c)\n");
+    fprintf(stderr, "  -t         print packet and event statistics to stderr\n");
+    fprintf(stderr, "  -x elf     reconstruct the executed code of elf[@load_base], may be repeated\n");
+    fprintf(stderr, "  -X file    write the executed instruction ranges of -x to file\n");
+    fprintf(stderr, "  -e         end the trace at an unknown A-sync or empty TraceInfo instead of pausing\n");
+    fprintf(stderr, "  -L file    write the cycles per branch to file (see latency.c), per branch address with -x\n");
+    fprintf(stderr, "  -Z hz      timestamp generator frequency (start_etr_mp prints it), timestamps in ns\n");
+    fprintf(stderr, "  -M         merge binary event files (-m binary) into one stream in timestamp order\n");
+    fprintf(stderr, "  -T cci     cycle count threshold of the session when the trace carries no TraceInfo with it\n");
+    fprintf(stderr, "  -H file    write the event packets per code region to file (see hotspot.c), per function with -x\n");
+    fprintf(stderr, "  -P file    write the executed instructions per function of -x to file (see profile.c)\n");
+    fprintf(stderr, "  -G prefix  write the run counts of the basic blocks and edges of -x to <prefix>.dot and .bbc\n");
+    fprintf(stderr, "  -D prefix  split the events by context ID (PID) into <prefix>_<pid>.evt, per process counts in <prefix>.txt\n");
+    fprintf(stderr, "  -R bytes   region size of -H and -P for code without a symbol, a power of two (default 64)\n");
+    fprintf(stderr, "  -W count   PMU events per event packet of -H, the ETM counter reload value (default 1)\n");
+    fprintf(stderr, "  -K graph   calibrate the .msg or .ttmsg graph on the runs, one trace file each (see calibrate.c)\n");
+    fprintf(stderr, "  -k file    write the calibrated .ttmsg of -K to file\n");
+    fprintf(stderr, "  -Q n,t     percentiles of the nominal_t and tail_t of -K (default 50,99)\n");
+    fprintf(stderr, "A second positional argument is either a ctl_binary (-c) or \"strip\" (-S ./strip.txt -e),\n");
+    fprintf(stderr, "as trc_parser_offline used to take it.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * const argv[]) {
+    unsigned int bench_rounds = 0;
+    uint8_t binary_input = 0;
+    uint8_t output_mode = SINK_TEXT;
+    const char * output_path = NULL;
+    const char * ctl_path = NULL;
+    const char * monitor_path = NULL;
+    const char * strip_path = NULL;
+    uint8_t stats = 0;
+    uint8_t images = 0;
+    const char * range_path = NULL;
+    const char * latency_path = NULL;
+    const char * hotspot_path = NULL;
+    const char * profile_path = NULL;
+    const char * blockcount_prefix = NULL;
+    const char * demux_prefix = NULL;
+    const char * graph_path = NULL;
+    const char * calibrated_path = NULL;
+    uint32_t nominal_pct = 50, tail_pct = 99;
+    uint32_t hotspot_region = 64, hotspot_period = 1;
+    unsigned int threads = 0;
+    uint8_t streaming = 0, follow = 0, merge = 0;
+    int formatted_ids = 0;
+    FILE * info;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:rsfF:j:m:o:c:V:S:tx:X:eL:T:H:P:G:D:R:W:Z:MK:k:Q:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bench_rounds = strtoul(optarg, NULL, 0);
+            if (bench_rounds == 0)
+                usage();
+            break;
+        case 'r':
+            binary_input = 1;
+            break;
+        case 's':
+            streaming = 1;
+            break;
+        case 'f':
+            streaming = 1;
+            follow = 1;
+            break;
+        case 'F':
+            formatted_ids = strtol(optarg, NULL, 0);
+            if (formatted_ids <= 0 || formatted_ids > FRAME_ID_MAX)
+                usage();
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 0);
+            if (threads == 0)
+                usage();
+            break;
+        case 'm':
+            output_mode = parse_sink_mode(optarg);
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'c':
+            ctl_path = optarg;
+            break;
+        case 'V':
+            monitor_path = optarg;
+            break;
+        case 'S':
+            strip_path = optarg;
+            break;
+        case 't':
+            stats = 1;
+            break;
+        case 'x':
+            load_image(optarg);
+            trace_set_symbolizer(symbol_of);
+            images = 1;
+            break;
+        case 'X':
+            range_path = optarg;
+            break;
+        case 'e':
+            trace_set_end_on_loss(1);
+            break;
+        case 'L':
+            latency_path = optarg;
+            break;
+        case 'Z':
+            trace_set_timestamp_freq(strtoul(optarg, NULL, 0));
+            break;
+        case 'M':
+            merge = 1;
+            break;
+        case 'T':
+            trace_set_cc_threshold(strtoul(optarg, NULL, 0));
+            break;
+        case 'H':
+            hotspot_path = optarg;
+            break;
+        case 'P':
+            profile_path = optarg;
+            break;
+        case 'G':
+            blockcount_prefix = optarg;
+            break;
+        case 'D':
+            demux_prefix = optarg;
+            break;
+        case 'R':
+            hotspot_region = strtoul(optarg, NULL, 0);
+            break;
+        case 'W':
+            hotspot_period = strtoul(optarg, NULL, 0);
+            break;
+        case 'K':
+            graph_path = optarg;
+            break;
+        case 'k':
+            calibrated_path = optarg;
+            break;
+        case 'Q':
+            if (sscanf(optarg, "%u,%u", &nominal_pct, &tail_pct) != 2)
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (optind >= argc)
+        usage();
+
+    // every positional argument is an event file, only the statistics follow the interleaved files
+    if (merge && (ctl_path || monitor_path || strip_path || images || latency_path || hotspot_path || demux_prefix || threads
+                  || bench_rounds || streaming || formatted_ids)) {
+        fprintf(stderr, "-M takes only -Z, -m, -o and -t\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // every positional argument is a run, decoded one after the other
+    if (graph_path && (!calibrated_path || merge || threads || bench_rounds || streaming || formatted_ids)) {
+        fprintf(stderr, "-K needs -k and cannot be combined with -M, -j, -b, -s, -f or -F\n");
+        exit(EXIT_FAILURE);
+    }
+    if (calibrated_path && !graph_path)
+        usage();
+
+    if (optind + 1 < argc && !merge && !graph_path) {
+        if (!strcmp(argv[optind + 1], "strip")) {
+            strip_path = "./strip.txt";
+            trace_set_end_on_loss(1);
+        } else {
+            ctl_path = argv[optind + 1];
+        }
+    }
+
+    // subscribers follow the trace from start to end, segments decoded in parallel cannot feed them
+    if (threads && (ctl_path || monitor_path || strip_path || stats || images || latency_path || hotspot_path
+                    || demux_prefix)) {
+        fprintf(stderr, "-j cannot be combined with -c, -V, -S, -t, -x, -L, -H or -D\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (streaming && (threads || bench_rounds)) {
+        fprintf(stderr, "-s and -f need neither -j nor -b\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (formatted_ids && (threads || bench_rounds || streaming)) {
+        fprintf(stderr, "-F cannot be combined with -j, -b, -s or -f\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the subscribers are not shared between decoder threads
+    if (formatted_ids > 1 && (ctl_path || monitor_path || strip_path || stats || images || latency_path
+                              || hotspot_path || demux_prefix)) {
+        fprintf(stderr, "-c, -V, -S, -t, -x, -L, -H and -D need -F 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // with several trace IDs every decoder opens its own output
+    if (formatted_ids <= 1)
+        sink_open(output_mode, output_path);
+    // status lines go along with the text log, but must not end up in a binary stream
+    info = (output_mode == SINK_TEXT && output_path == NULL && formatted_ids <= 1) ? stdout : stderr;
+
+    if (ctl_path)
+        load_ctl(ctl_path);
+    if (monitor_path)
+        load_monitor(monitor_path);
+    if (strip_path)
+        strip_open(strip_path);
+    if (stats)
+        subscriber_add(&stats_subscriber);
+    if (images)
+        reconstruct_open(range_path);
+    else if (range_path || profile_path || blockcount_prefix)
+        usage();
+    if (latency_path)
+        latency_open(latency_path);
+    if (hotspot_path)
+        hotspot_open(hotspot_path, hotspot_region, hotspot_period);
+    if (profile_path)
+        profile_open(profile_path, hotspot_region);
+    if (blockcount_prefix)
+        blockcount_open(blockcount_prefix);
+    if (demux_prefix)
+        demux_open(demux_prefix);
+    if (graph_path)
+        calibrate_open(graph_path, calibrated_path, nominal_pct, tail_pct);
+
+    if (merge) {
+        merge_event_files(&argv[optind], argc - optind);
+    } else if (graph_path) {
+        run_calibration(&argv[optind], argc - optind, binary_input, info);
+    } else if (formatted_ids) {
+        run_formatted(argv[optind], formatted_ids, output_mode, output_path, info);
+    } else if (streaming) {
+        run_stream(argv[optind], follow);
+    } else {
+        if (binary_input || has_suffix(argv[optind], ".dat")) {
+            load_binary(argv[optind]);
+            fprintf(info, "Done mapping file, %zu bytes\n", buffer_size);
+        } else {
+            load_text(argv[optind]);
+            fprintf(info, "Done reading file, read %zu bytes (should be %zu lines)\n", buffer_size, buffer_size / 4);
+        }
+
+        input_set_buffer(trace_buffer, buffer_size);
+
+        if (bench_rounds)
+            run_benchmark(bench_rounds);
+        else if (threads)
+            parallel_decode(trace_buffer, buffer_size, threads);
+        else
+            trace_loop();
+    }
+
+    subscribers_finish();
+    sink_close();
 
     return 0;
 }
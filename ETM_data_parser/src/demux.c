@@ -0,0 +1,231 @@
+/*
+    Demux: one trace of many processes split by context ID in the same
+    pass that decodes it. With CONFIG_PID_IN_CONTEXTIDR the context ID is
+    the PID, so a trace without a context ID filter
+    (etm_set_contextid_cmp()) can be analysed process by process.
+
+    Every event goes to the process of the last Context packet with a
+    context ID: <prefix>_<pid>.evt, an event file as -m binary writes it,
+    starting with that EV_CONTEXT. Events before the first context ID and
+    after an overflow, until the next one, go to pid 0, as do those of
+    context ID 0 itself. <prefix>.txt gets a line per process
+
+        pid events switches atoms e_atoms addresses exceptions timestamps overflows first_ts last_ts
+
+    sorted by events, a switch being a change of context ID to it.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+#include "subscriber.h"
+
+#define DEMUX_TABLE_INITIAL 64
+#define DEMUX_BUFFER_SIZE (64 * 1024)
+
+typedef struct demux_entry {
+    uint32_t pid;
+    uint8_t used;
+    FILE * out;
+    uint64_t events;
+    uint64_t switches;
+    uint64_t atoms;
+    uint64_t e_atoms;
+    uint64_t addresses;
+    uint64_t exceptions;
+    uint64_t timestamps;
+    uint64_t overflows;
+    uint64_t first_ts;
+    uint64_t last_ts;
+} demux_entry_t;
+
+static const char * demux_prefix = NULL;
+static demux_entry_t * table = NULL;
+static uint32_t table_capacity = 0;     // power of two
+static uint32_t table_count = 0;
+static demux_entry_t * current = NULL;  // set again by switch_to() whenever the table may have grown
+static uint32_t current_pid = 0;
+
+static demux_entry_t * table_slot(demux_entry_t* entries, uint32_t capacity, uint32_t pid) {
+    uint32_t slot = (pid * 0x9E3779B1u) & (capacity - 1);
+
+    while (entries[slot].used && entries[slot].pid != pid)
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static void grow_table(void) {
+    demux_entry_t * old = table;
+    uint32_t old_capacity = table_capacity;
+    uint32_t i;
+
+    table_capacity = old_capacity ? old_capacity * 2 : DEMUX_TABLE_INITIAL;
+    table = (demux_entry_t *) calloc(table_capacity, sizeof(demux_entry_t));
+    if (table == NULL) {
+        fprintf(stderr, "Cannot allocate the demux table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].used)
+            *table_slot(table, table_capacity, old[i].pid) = old[i];
+    }
+    free(old);
+}
+
+static void write_event(FILE* out, const trace_event_t* event) {
+    if (fwrite(event, sizeof(*event), 1, out) != 1) {
+        fprintf(stderr, "Error writing the events of a process\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// the file is opened with the first event of the process
+static demux_entry_t * find_process(uint32_t pid, const trace_event_t* context) {
+    event_file_header_t header;
+    demux_entry_t * entry;
+    char path[256];
+
+    if (table_count * 2 >= table_capacity)
+        grow_table();
+
+    entry = table_slot(table, table_capacity, pid);
+    if (entry->used)
+        return entry;
+
+    entry->used = 1;
+    entry->pid = pid;
+    table_count++;
+
+    snprintf(path, sizeof(path), "%s_%u.evt", demux_prefix, pid);
+    entry->out = fopen(path, "wb");
+    if (entry->out == NULL) {
+        fprintf(stderr, "Error opening demux file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(entry->out, NULL, _IOFBF, DEMUX_BUFFER_SIZE);
+
+    memcpy(header.magic, EVENT_FILE_MAGIC, sizeof(header.magic));
+    header.version = EVENT_FILE_VERSION;
+    header.record_size = sizeof(trace_event_t);
+    fwrite(&header, sizeof(header), 1, entry->out);
+    if (context)
+        write_event(entry->out, context);
+    return entry;
+}
+
+static void switch_to(uint32_t pid, const trace_event_t* context) {
+    if (current != NULL && pid == current_pid)
+        return;
+
+    current = find_process(pid, context);
+    current_pid = pid;
+    current->switches++;
+}
+
+static void demux_event(const trace_event_t* event) {
+    switch (event->type) {
+    case EV_CONTEXT:
+        if (event->flags & EVENT_CONTEXT_CID) {
+            switch_to(event->data, event);
+            // the context is the first event of a new file, written there already
+            if (current->events++ == 0)
+                return;
+            write_event(current->out, event);
+            return;
+        }
+        break;
+    case EV_OVERFLOW:
+        // the context may have changed in what was lost
+        switch_to(0, NULL);
+        current->overflows++;
+        break;
+    case EV_TRACE_START:
+        switch_to(0, NULL);
+        break;
+    default:
+        if (current == NULL)
+            switch_to(0, NULL);
+        break;
+    }
+
+    current->events++;
+    switch (event->type) {
+    case EV_ATOM:
+        current->atoms += event->count;
+        current->e_atoms += __builtin_popcountll(event->value & ((1ull << event->count) - 1));
+        break;
+    case EV_ADDRESS:
+        current->addresses++;
+        break;
+    case EV_EXCEPTION:
+        current->exceptions++;
+        break;
+    case EV_TIMESTAMP:
+        if (current->timestamps++ == 0)
+            current->first_ts = event->value;
+        current->last_ts = event->value;
+        break;
+    default:
+        break;
+    }
+    write_event(current->out, event);
+}
+
+static int by_events(const void* a, const void* b) {
+    const demux_entry_t * x = (const demux_entry_t *) a;
+    const demux_entry_t * y = (const demux_entry_t *) b;
+
+    if (x->events != y->events)
+        return x->events < y->events ? 1 : -1;
+    return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+static void demux_finish(void) {
+    uint32_t i, n = 0;
+    char path[256];
+    FILE * fsummary;
+
+    for (i = 0; i < table_capacity; ++i) {
+        if (!table[i].used)
+            continue;
+        fclose(table[i].out);
+        table[n++] = table[i];
+    }
+    qsort(table, n, sizeof(demux_entry_t), by_events);
+
+    snprintf(path, sizeof(path), "%s.txt", demux_prefix);
+    fsummary = fopen(path, "w");
+    if (fsummary == NULL) {
+        fprintf(stderr, "Error opening demux summary %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(fsummary, "# %u processes, pid 0 is before a context ID or after an overflow\n", n);
+    fprintf(fsummary, "# pid events switches atoms e_atoms addresses exceptions timestamps overflows first_ts last_ts\n");
+    for (i = 0; i < n; ++i) {
+        fprintf(fsummary, "%u %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu\n", table[i].pid, table[i].events,
+                table[i].switches, table[i].atoms, table[i].e_atoms, table[i].addresses, table[i].exceptions,
+                table[i].timestamps, table[i].overflows, table[i].first_ts, table[i].last_ts);
+    }
+    fclose(fsummary);
+    fprintf(stderr, "Split the trace into %u processes, see %s\n", n, path);
+
+    free(table);
+    table = NULL;
+    current = NULL;
+    table_capacity = table_count = 0;
+}
+
+const subscriber_t demux_subscriber = {
+    .name = "demux",
+    .on_event = demux_event,
+    .on_finish = demux_finish,
+};
+
+void demux_open(const char* prefix) {
+    demux_prefix = prefix;
+    grow_table();
+    subscriber_add(&demux_subscriber);
+}
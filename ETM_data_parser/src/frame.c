@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "frame.h"
+
+// room past buf_size for the 16 byte stores of the fast path
+#define FRAME_OUT_SLACK FRAME_SIZE
+
+static frame_out_t* new_out(size_t buf_size) {
+    frame_out_t * out = (frame_out_t *) malloc(sizeof(frame_out_t));
+
+    if (out)
+        out->buf = (uint8_t *) malloc(buf_size + FRAME_OUT_SLACK);
+    if (out == NULL || out->buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    out->len = 0;
+    return out;
+}
+
+void deformat_init(deformatter_t* d, size_t buf_size, frame_flush_t flush, void* ctx) {
+    memset(d, 0, sizeof(*d));
+    d->cur_id = FRAME_ID_UNKNOWN;
+    d->buf_size = buf_size;
+    d->flush = flush;
+    d->ctx = ctx;
+}
+
+void deformat_keep_id(deformatter_t* d, int id) {
+    if (id < 1 || id > FRAME_ID_MAX) {
+        fprintf(stderr, "Trace ID %d cannot be kept, valid IDs are 1 to %d\n", id, FRAME_ID_MAX);
+        exit(EXIT_FAILURE);
+    }
+    if (d->outs[id] == NULL)
+        d->outs[id] = new_out(d->buf_size);
+}
+
+static void flush_out(deformatter_t* d, frame_out_t* out, int id) {
+    if (out->len)
+        d->flush(d->ctx, id, out->buf, out->len);
+    out->len = 0;
+}
+
+void deformat_flush(deformatter_t* d) {
+    int id;
+
+    for (id = 0; id < FRAME_IDS; ++id) {
+        if (d->outs[id])
+            flush_out(d, d->outs[id], id);
+    }
+    if (d->unknown)
+        flush_out(d, d->unknown, FRAME_ID_UNKNOWN);
+}
+
+void deformat_free(deformatter_t* d) {
+    int id;
+
+    for (id = 0; id < FRAME_IDS; ++id) {
+        if (d->outs[id]) {
+            free(d->outs[id]->buf);
+            free(d->outs[id]);
+            d->outs[id] = NULL;
+        }
+    }
+    if (d->unknown) {
+        free(d->unknown->buf);
+        free(d->unknown);
+        d->unknown = NULL;
+    }
+}
+
+static inline int is_padding_id(int id) {
+    return id == FRAME_ID_NULL || id > FRAME_ID_MAX;
+}
+
+// where the bytes of id go, NULL when they are not kept
+static frame_out_t* out_of(deformatter_t* d, int id) {
+    if (id == FRAME_ID_UNKNOWN) {
+        if (d->keep_unknown && d->unknown == NULL)
+            d->unknown = new_out(d->buf_size);
+        return d->keep_unknown ? d->unknown : NULL;
+    }
+
+    if (d->outs[id] == NULL && d->keep_all && !is_padding_id(id))
+        d->outs[id] = new_out(d->buf_size);
+    return d->outs[id];
+}
+
+static inline void put_byte(deformatter_t* d, int id, uint8_t byte) {
+    frame_out_t * out = out_of(d, id);
+
+    if (out == NULL) {
+        if (id != FRAME_ID_UNKNOWN && is_padding_id(id))
+            d->padding++;
+        else
+            d->dropped++;
+        return;
+    }
+
+    out->buf[out->len++] = byte;
+    if (out->len >= d->buf_size)
+        flush_out(d, out, id);
+}
+
+// 0 for a frame without ID bytes, 1 when byte 0 is its only ID byte, 2 otherwise
+static inline int id_bytes(const uint8_t* frame_buf) {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t rest_one[16] = {0, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0};
+
+    if (vmaxvq_u8(vandq_u8(vld1q_u8(frame_buf), vld1q_u8(rest_one))))
+        return 2;
+    return frame_buf[0] & 0x1;
+#elif defined(__SSE2__)
+    int mask = _mm_movemask_epi8(_mm_slli_epi64(_mm_loadu_si128((const __m128i *) frame_buf), 7)) & 0x5555;
+
+    return mask > 1 ? 2 : mask;
+#else
+    int i;
+
+    for (i = 1; i < 8; ++i) {
+        if (frame_buf[i * 2] & 0x1)
+            return 2;
+    }
+    return frame_buf[0] & 0x1;
+#endif
+}
+
+/*
+ * The 15 data bytes of a frame without ID bytes are its first 15 bytes,
+ * with bit 0 of each even byte taken from the auxiliary byte. dst must
+ * have room for 16.
+ */
+static inline void store_data_frame(uint8_t* dst, const uint8_t* frame_buf) {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    static const uint8_t even_one[16] = {1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0};
+    static const uint8_t aux_bit[16] = {1, 0, 2, 0, 4, 0, 8, 0, 16, 0, 32, 0, 64, 0, 128, 0};
+    uint8x16_t aux = vtstq_u8(vdupq_n_u8(frame_buf[15]), vld1q_u8(aux_bit));
+
+    vst1q_u8(dst, vorrq_u8(vld1q_u8(frame_buf), vandq_u8(aux, vld1q_u8(even_one))));
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_setr_epi8(1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0);
+    const __m128i aux_bit = _mm_setr_epi8(1, 0, 2, 0, 4, 0, 8, 0, 16, 0, 32, 0, 64, 0, (char) 128, 0);
+    // bytes where aux_bit is 0 compare equal too, ones masks them out
+    __m128i aux = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(frame_buf[15]), aux_bit), aux_bit);
+
+    _mm_storeu_si128((__m128i *) dst, _mm_or_si128(_mm_loadu_si128((const __m128i *) frame_buf), _mm_and_si128(aux, ones)));
+#else
+    int i;
+
+    memcpy(dst, frame_buf, FRAME_SIZE);
+    for (i = 0; i < 8; ++i) {
+        dst[i * 2] |= (frame_buf[15] >> i) & 0x1;
+    }
+#endif
+}
+
+static void proc_frame(deformatter_t* d, const uint8_t* frame_buf) {
+    uint8_t aux = frame_buf[15];
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+        if ((frame_buf[i * 2] & 0x1) && (aux & (0x1 << i))) {
+            // new ID and the next byte corresponding to the old ID
+            if (i == 7) {
+                printf("auxiliary fault!\n");
+                exit(0);
+            }
+            put_byte(d, d->cur_id, frame_buf[i * 2 + 1]);
+            d->cur_id = (frame_buf[i * 2] & 0xfe) >> 1;
+        } else if (frame_buf[i * 2] & 0x1) {
+            // new ID and the next byte corresponding to the new ID
+            d->cur_id = (frame_buf[i * 2] & 0xfe) >> 1;
+            if (i != 7)
+                put_byte(d, d->cur_id, frame_buf[i * 2 + 1]);
+        } else {
+            // data byte
+            put_byte(d, d->cur_id, (frame_buf[i * 2] & 0xfe) | ((aux >> i) & 0x1));
+            if (i != 7)
+                put_byte(d, d->cur_id, frame_buf[i * 2 + 1]);
+        }
+    }
+}
+
+/*
+ * Frames without ID bytes, the common case, are copied out as a block, and
+ * frames that only switch to a padding ID are skipped as a whole; the rest
+ * goes through proc_frame().
+ */
+static inline void deformat_frame(deformatter_t* d, const uint8_t* frame_buf) {
+    frame_out_t * out;
+    int ids = id_bytes(frame_buf);
+
+    if (ids == 0 && d->cur_id != FRAME_ID_UNKNOWN && (out = d->outs[d->cur_id]) != NULL) {
+        store_data_frame(out->buf + out->len, frame_buf);
+        out->len += 15;
+        if (out->len >= d->buf_size)
+            flush_out(d, out, d->cur_id);
+    } else if (ids == 1 && !(frame_buf[15] & 0x1) && is_padding_id(frame_buf[0] >> 1)) {
+        // one ID byte for all 14 data bytes
+        d->cur_id = frame_buf[0] >> 1;
+        d->padding += 14;
+        d->padding_frames++;
+    } else {
+        proc_frame(d, frame_buf);
+    }
+}
+
+void deformat_frames(deformatter_t* d, const uint8_t* frames, size_t n_frames) {
+    size_t f;
+
+    for (f = 0; f < n_frames; ++f) {
+        deformat_frame(d, frames + f * FRAME_SIZE);
+    }
+}
+
+static inline uint32_t le32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*
+ * Frames with FSYNC packets in between, as the formatter writes in
+ * continuous mode. Returns the bytes used, what is left is part of a frame.
+ */
+size_t deformat_stream(deformatter_t* d, const uint8_t* buf, size_t size) {
+    size_t pos = 0;
+
+    while (size - pos >= FRAME_FSYNC_SIZE) {
+        if (le32(buf + pos) == FRAME_FSYNC) {
+            pos += FRAME_FSYNC_SIZE;
+            d->fsyncs++;
+            continue;
+        }
+        if (size - pos < FRAME_SIZE)
+            break;
+        deformat_frame(d, buf + pos);
+        pos += FRAME_SIZE;
+    }
+
+    return pos;
+}
+
+// Offset of the first FSYNC packet at a word boundary, size when there is none
+size_t frame_find_sync(const uint8_t* buf, size_t size) {
+    size_t pos;
+
+    for (pos = 0; pos + FRAME_FSYNC_SIZE <= size; pos += FRAME_FSYNC_SIZE) {
+        if (le32(buf + pos) == FRAME_FSYNC)
+            return pos;
+    }
+    return size;
+}
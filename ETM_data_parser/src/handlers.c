@@ -1,33 +1,25 @@
 #include "handlers.h"
+#include "subscriber.h"
 #include <stdlib.h> // only for exit(EXIT_FAILURE), should not be here
 
 static basicblock_t * ctl_ptr = 0;
-static uint16_t ctl_buff_size;
-static uint16_t curr_block_index;
+static uint32_t ctl_buff_size;
+static uint32_t curr_block_index;
+static uint8_t ctl_sorted;
 
 static uint8_t ctl_state = CTL_STATE_INIT;
 
 static uint32_t address_stack[ADDRESS_STACK_SIZE];
 static uint16_t address_stack_ptr;
 
-void report(const char* format, ... ) {
-	va_list args;
-	va_start(args, format);
-	vfprintf(stdout, format, args);
-	va_end(args);
-	fprintf(stdout, "\n");
-	fflush(stdout);
-}
-
 static void ctl_panic(void) {
-	printf("CTL PANIC, ABORTING\n");
+	report("CTL PANIC, ABORTING");
 	fprintf(stderr, "CTL PANIC\n");
 	exit(EXIT_FAILURE);
 }
 
-// TODO: Should be binary search
-static uint16_t find_block(uint32_t address) {
-	uint16_t i;
+static uint32_t find_block_linear(uint32_t address) {
+	uint32_t i;
 
 	for (i = 1; i < ctl_buff_size - 1; ++i) {
 		if ((address >= ctl_ptr[i].start_addr) && (address < ctl_ptr[i + 1].start_addr)) {
@@ -38,6 +30,43 @@ static uint16_t find_block(uint32_t address) {
 	return 0;
 }
 
+/*
+ * Block i covers [start_addr(i), start_addr(i + 1)), entry 0 and the last entry only
+ * bound the table. With sorted start addresses, the block is the last one starting
+ * at or below the address.
+ */
+static uint32_t find_block(uint32_t address) {
+	uint32_t low = 1, high = ctl_buff_size - 1, mid;
+
+	if (!ctl_sorted)
+		return find_block_linear(address);
+
+	if (ctl_buff_size < 3 || address < ctl_ptr[low].start_addr)
+		return 0;
+
+	// invariant: start_addr(low) <= address, and high is past the last candidate
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (ctl_ptr[mid].start_addr <= address)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return (address < ctl_ptr[low + 1].start_addr) ? low : 0;
+}
+
+static uint8_t ctl_is_sorted(void) {
+	uint32_t i;
+
+	for (i = 1; i < ctl_buff_size; ++i) {
+		if (ctl_ptr[i].start_addr < ctl_ptr[i - 1].start_addr)
+			return 0;
+	}
+
+	return 1;
+}
+
 static int address_stack_push(uint32_t address) {
 	if (address_stack_ptr == ADDRESS_STACK_SIZE - 1)
 		return -1;
@@ -57,11 +86,15 @@ static inline void address_stack_clear(void) {
 	address_stack_ptr = 0;
 }
 
-void set_ctl_buff(void* ptr, uint16_t size) {
+void set_ctl_buff(void* ptr, uint32_t size) {
 	ctl_ptr = (basicblock_t *) ptr;
 	ctl_buff_size = size;
 	curr_block_index = 0;
 	address_stack_ptr = 0;
+
+	ctl_sorted = ctl_is_sorted();
+	if (!ctl_sorted)
+		fprintf(stderr, "CTL table is not sorted by start address, using linear block lookup\n");
 }
 
 void report_addres(uint64_t address64, uint8_t is) {
@@ -73,7 +106,7 @@ void report_addres(uint64_t address64, uint8_t is) {
 	
 	if ((address64 != (address64 & 0xffffffff)) || !(address32 >= ctl_ptr[1].start_addr && address32 < ctl_ptr[ctl_buff_size - 1].start_addr)) {	
 		if (curr_block_index != 0) {
-			printf("Leaving scope to 0x%lx\n\n", address64);
+			report("Leaving scope to 0x%lx\n", address64);
 			curr_block_index = 0;
 			//ctl_state = (ctl_state == CTL_STATE_INIT) ? CTL_STATE_INIT : CTL_STATE_OUTSCOPE;
 
@@ -85,66 +118,92 @@ void report_addres(uint64_t address64, uint8_t is) {
 		return;
 	}
 
-	printf("Entering scope block at 0x%x\n", address32);
+	report("Entering scope block at 0x%x", address32);
 
 	if (ctl_state == CTL_STATE_POP_COMP) {  
 		popped_address = address_stack_pop();
 		if (popped_address != address32) {
-			printf("Return; Popped address (0x%x) and reported address (0x%x) do not match, halting\n", popped_address, address32);
+			report("Return; Popped address (0x%x) and reported address (0x%x) do not match, halting", popped_address, address32);
 			ctl_panic();
 		} else {
-			printf("Return; Pop and compare: ok\n");
+			report("Return; Pop and compare: ok");
 		}
 	}
 
 	curr_block_index = find_block(address32);
 
 	if (curr_block_index == 0) {
-		printf("Block not found, halting\n\n");
+		report("Block not found, halting\n");
 		ctl_panic();
 	}
 
 	ctl_state = (ctl_state == CTL_STATE_PUSH) ?  CTL_STATE_INSCOPE : CTL_STATE_INIT ;
 
-	printf("Block index: %d\n\n", curr_block_index);
+	report("Block index: %d\n", curr_block_index);
 }
 
-void report_atom(uint8_t atom) {
+static void check_atom(uint8_t atom) {
 	if (ctl_ptr == 0)
 		return;
 
 	if (curr_block_index == 0)
 		return;
 
-	printf("Atom: %c\n", atom ? 'E' : 'N');
-	printf("Current block %d (0x%x): r: %d, l: %d, s: %d, c: %d, offset: 0x%x\n", curr_block_index, ctl_ptr[curr_block_index].start_addr, ctl_ptr[curr_block_index].r, ctl_ptr[curr_block_index].l,
+	report("Atom: %c", atom ? 'E' : 'N');
+	report("Current block %d (0x%x): r: %d, l: %d, s: %d, c: %d, offset: 0x%x", curr_block_index, ctl_ptr[curr_block_index].start_addr, ctl_ptr[curr_block_index].r, ctl_ptr[curr_block_index].l,
 						ctl_ptr[curr_block_index].s, ctl_ptr[curr_block_index].c, ctl_ptr[curr_block_index].offset);
 	if (atom == 0) {
 		if (ctl_ptr[curr_block_index].c == 0) {
-			printf("C bit is 0, but Atom is N, halting\n");
+			report("C bit is 0, but Atom is N, halting");
 			ctl_panic();
 		}
 
 		curr_block_index = curr_block_index + 1;
-		printf("New block index: %d\n\n", curr_block_index);
+		report("New block index: %d\n", curr_block_index);
 	} else {
 		if (ctl_ptr[curr_block_index].r) {
 			//ctl_state = CTL_STATE_POP_COMP;
 			ctl_state = (ctl_state == CTL_STATE_INSCOPE  || ctl_state == CTL_STATE_PUSH) ? CTL_STATE_POP_COMP : CTL_STATE_INIT ;
 		} else {
 			if (ctl_ptr[curr_block_index].l) {
-				printf("Pushing 0x%x\n", ctl_ptr[curr_block_index + 1].start_addr);
+				report("Pushing 0x%x", ctl_ptr[curr_block_index + 1].start_addr);
 				ctl_state = CTL_STATE_PUSH;
 				if (address_stack_push(ctl_ptr[curr_block_index + 1].start_addr) < 0) {
-					printf("Address stack overflow, halting\n");
+					report("Address stack overflow, halting");
 					ctl_panic();
 				}
 			}
 
 			if (ctl_ptr[curr_block_index].s) {
 				curr_block_index = ctl_ptr[curr_block_index].offset / 8 + 1;
-				printf("Entering block at %d, address: 0x%x\n\n", curr_block_index, ctl_ptr[curr_block_index].start_addr);
+				report("Entering block at %d, address: 0x%x\n", curr_block_index, ctl_ptr[curr_block_index].start_addr);
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+// A batch of atoms as decoded from one packet, atom i is E when bit i of mask is set
+void report_atoms(uint32_t mask, uint8_t count) {
+	uint8_t i;
+
+	if (ctl_ptr == 0 || curr_block_index == 0)
+		return;
+
+	for (i = 0; i < count; ++i) {
+		check_atom((mask >> i) & 0x1);
+	}
+}
+
+static void ctl_event(const trace_event_t* event) {
+	if (event->type == EV_ADDRESS) {
+		report_addres(event->value, event->flags);
+	} else if (event->type == EV_ATOM) {
+		report_atoms(event->value, event->count);
+	}
+}
+
+const subscriber_t ctl_subscriber = {
+	.name = "ctl",
+	.on_event = ctl_event,
+	.on_finish = NULL,
+};
@@ -0,0 +1,217 @@
+/*
+    Hotspot file: where the Event packets of a trace happened, per code
+    region. With an ETM event on a PMU counter (csc
+    etm_example_large_counter_fire_event()) every packet stands for a fixed
+    number of PMU events, so this is a sampling profile of that PMU event,
+    without interrupts and at the resolution of the trace.
+
+    A packet is charged to the last instruction executed before it with the
+    code reconstructed (-x), else to the last address packet, the start of
+    the code running at the time. Regions are the functions of the symbol
+    tables of -x, or aligned blocks of region bytes for code outside any.
+    Each bit of the event field counts once in its column.
+
+        region symbol event0 event1 event2 event3 pmu_events share
+
+    sorted by pmu_events, the packets times the period.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "trace.h"
+#include "image.h"
+#include "reconstruct.h"
+#include "subscriber.h"
+
+#define HOTSPOT_TABLE_INITIAL 256
+#define HOTSPOT_EVENTS 4
+
+typedef struct hotspot_entry {
+    uint64_t region;
+    const char * symbol;
+    uint64_t packets;       // 0 for a free slot
+    uint64_t events[HOTSPOT_EVENTS];
+} hotspot_entry_t;
+
+static FILE * fhotspot = NULL;
+static hotspot_entry_t * table = NULL;
+static uint32_t table_capacity = 0;     // power of two
+static uint32_t table_count = 0;
+static uint64_t region_mask;
+static uint64_t period;
+
+static uint64_t last_address;
+static uint8_t address_known = 0;
+static uint8_t ranges_seen = 0;
+
+static uint64_t packets, unattributed;
+
+static hotspot_entry_t * table_slot(hotspot_entry_t* entries, uint32_t capacity, uint64_t region) {
+    uint32_t slot = (region >> 2) & (capacity - 1);
+
+    while (entries[slot].packets && entries[slot].region != region)
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static void grow_table(void) {
+    hotspot_entry_t * old = table;
+    uint32_t old_capacity = table_capacity;
+    uint32_t i;
+
+    table_capacity = old_capacity ? old_capacity * 2 : HOTSPOT_TABLE_INITIAL;
+    table = (hotspot_entry_t *) calloc(table_capacity, sizeof(hotspot_entry_t));
+    if (table == NULL) {
+        fprintf(stderr, "Cannot allocate the hotspot table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].packets)
+            *table_slot(table, table_capacity, old[i].region) = old[i];
+    }
+    free(old);
+}
+
+static void add_packet(uint32_t field) {
+    const image_symbol_t * symbol;
+    hotspot_entry_t * entry;
+    uint64_t region;
+    uint8_t i;
+
+    packets++;
+    if (!address_known) {
+        unattributed++;
+        return;
+    }
+
+    symbol = image_symbol(last_address);
+    region = symbol ? symbol->start : last_address & region_mask;
+
+    if (table_count * 2 >= table_capacity)
+        grow_table();
+
+    entry = table_slot(table, table_capacity, region);
+    if (entry->packets == 0) {
+        entry->region = region;
+        entry->symbol = symbol ? symbol->name : NULL;
+        table_count++;
+    }
+    entry->packets++;
+    for (i = 0; i < HOTSPOT_EVENTS; ++i) {
+        if ((field >> i) & 0x1)
+            entry->events[i]++;
+    }
+}
+
+// executed ranges of the reconstruct subscriber, which is added before this one
+static void hotspot_range(const exec_range_t* range) {
+    if (range->end <= range->start)
+        return;
+    last_address = range->end - 4;
+    address_known = 1;
+    ranges_seen = 1;
+}
+
+static void hotspot_event(const trace_event_t* event) {
+    switch (event->type)
+    {
+    case EV_SYNC:
+    case EV_OVERFLOW:
+    case EV_TRACE_START:
+        address_known = 0;
+        ranges_seen = 0;
+        break;
+    case EV_ADDRESS:
+        // the reconstructed ranges are finer, once they follow the trace
+        if (!ranges_seen) {
+            last_address = event->value;
+            address_known = 1;
+        }
+        break;
+    case EV_EVENT:
+        add_packet(event->data);
+        break;
+    default:
+        break;
+    }
+}
+
+static uint64_t entry_events(const hotspot_entry_t* entry) {
+    uint64_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < HOTSPOT_EVENTS; ++i)
+        sum += entry->events[i];
+    return sum;
+}
+
+static int by_events(const void* a, const void* b) {
+    const hotspot_entry_t * x = (const hotspot_entry_t *) a;
+    const hotspot_entry_t * y = (const hotspot_entry_t *) b;
+    uint64_t ex = entry_events(x), ey = entry_events(y);
+
+    if (ex != ey)
+        return ex < ey ? 1 : -1;
+    return x->region < y->region ? -1 : x->region > y->region;
+}
+
+static void hotspot_finish(void) {
+    uint64_t total = 0;
+    uint32_t i, n = 0;
+
+    for (i = 0; i < table_capacity; ++i) {
+        if (table[i].packets) {
+            table[n++] = table[i];
+            total += entry_events(&table[i]);
+        }
+    }
+    qsort(table, n, sizeof(hotspot_entry_t), by_events);
+
+    fprintf(fhotspot, "# %lu event packets in %u regions, %lu before a known address, %lu PMU events per event\n",
+            packets, n, unattributed, period);
+    fprintf(fhotspot, "# region symbol event0 event1 event2 event3 pmu_events share\n");
+    for (i = 0; i < n; ++i) {
+        fprintf(fhotspot, "0x%lx %s %lu %lu %lu %lu %lu %.2f%%\n", table[i].region,
+                table[i].symbol ? table[i].symbol : "-", table[i].events[0], table[i].events[1],
+                table[i].events[2], table[i].events[3], entry_events(&table[i]) * period,
+                total ? 100.0 * entry_events(&table[i]) / total : 0.0);
+    }
+
+    fclose(fhotspot);
+    fhotspot = NULL;
+    free(table);
+    table = NULL;
+    table_capacity = table_count = 0;
+}
+
+const subscriber_t hotspot_subscriber = {
+    .name = "hotspot",
+    .on_event = hotspot_event,
+    .on_finish = hotspot_finish,
+};
+
+/*
+    region_bytes, a power of two, groups the code without a symbol; one
+    Event packet counts as pmu_period PMU events, the reload value of the
+    ETM counter, 1 to count packets.
+*/
+void hotspot_open(const char* path, uint32_t region_bytes, uint32_t pmu_period) {
+    if (region_bytes == 0 || (region_bytes & (region_bytes - 1))) {
+        fprintf(stderr, "Hotspot region size %u is not a power of two\n", region_bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    fhotspot = fopen(path, "w");
+    if (fhotspot == NULL) {
+        fprintf(stderr, "Error opening hotspot file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    region_mask = ~((uint64_t) region_bytes - 1);
+    period = pmu_period ? pmu_period : 1;
+    grow_table();
+    reconstruct_add_handler(hotspot_range);
+    subscriber_add(&hotspot_subscriber);
+}
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+static image_section_t sections[MAX_IMAGE_SECTIONS];
+static uint32_t section_count = 0;
+// the section of the last lookup, code is fetched from the same section most of the time
+static const image_section_t * last_section = NULL;
+
+// functions of all loaded files, sorted by start
+static image_symbol_t * symbols = NULL;
+static uint32_t symbol_count = 0;
+static uint32_t symbol_capacity = 0;
+
+static int by_start(const void* a, const void* b) {
+    const image_symbol_t * x = (const image_symbol_t *) a;
+    const image_symbol_t * y = (const image_symbol_t *) b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// STT_FUNC entries of .symtab, or of .dynsym when there is no .symtab
+static void load_symbols(const uint8_t* map, size_t map_size, const Elf64_Shdr* shdr, uint16_t shnum, uint64_t load_base) {
+    const Elf64_Shdr * table = NULL;
+    const Elf64_Sym * syms;
+    const char * strtab;
+    uint64_t count, i;
+    uint16_t j;
+
+    for (j = 0; j < shnum; ++j) {
+        if (shdr[j].sh_type == SHT_SYMTAB || (shdr[j].sh_type == SHT_DYNSYM && table == NULL))
+            table = &shdr[j];
+    }
+    if (table == NULL || table->sh_link >= shnum || table->sh_offset + table->sh_size > map_size
+            || shdr[table->sh_link].sh_offset + shdr[table->sh_link].sh_size > map_size)
+        return;
+
+    syms = (const Elf64_Sym *) (map + table->sh_offset);
+    strtab = (const char *) (map + shdr[table->sh_link].sh_offset);
+    count = table->sh_size / sizeof(Elf64_Sym);
+
+    for (i = 0; i < count; ++i) {
+        if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_shndx == SHN_UNDEF
+                || syms[i].st_name >= shdr[table->sh_link].sh_size)
+            continue;
+
+        if (symbol_count == symbol_capacity) {
+            symbol_capacity = symbol_capacity ? symbol_capacity * 2 : 256;
+            symbols = (image_symbol_t *) realloc(symbols, symbol_capacity * sizeof(image_symbol_t));
+            if (symbols == NULL) {
+                fprintf(stderr, "Cannot allocate the symbol table\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        symbols[symbol_count].start = syms[i].st_value + load_base;
+        symbols[symbol_count].size = syms[i].st_size;
+        symbols[symbol_count].name = strtab + syms[i].st_name;
+        symbol_count++;
+    }
+
+    qsort(symbols, symbol_count, sizeof(image_symbol_t), by_start);
+}
+
+void image_load(const char* path, uint64_t load_base) {
+    const Elf64_Ehdr * ehdr;
+    const Elf64_Shdr * shdr;
+    struct stat elf_stat;
+    const uint8_t * map;
+    uint16_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening ELF file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fstat(fd, &elf_stat) < 0) {
+        fprintf(stderr, "Error getting stats for ELF file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    map = (const uint8_t *) mmap(0, elf_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error mmap of ELF file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    ehdr = (const Elf64_Ehdr *) map;
+    if ((size_t) elf_stat.st_size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG)
+            || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB) {
+        fprintf(stderr, "%s is not a little endian 64-bit ELF file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (ehdr->e_machine != EM_AARCH64)
+        fprintf(stderr, "Warning: %s is not an AArch64 binary\n", path);
+
+    if (ehdr->e_shoff + (uint64_t) ehdr->e_shnum * sizeof(Elf64_Shdr) > (uint64_t) elf_stat.st_size) {
+        fprintf(stderr, "Section headers of %s are out of the file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    shdr = (const Elf64_Shdr *) (map + ehdr->e_shoff);
+    for (i = 0; i < ehdr->e_shnum; ++i) {
+        if (shdr[i].sh_type != SHT_PROGBITS || !(shdr[i].sh_flags & SHF_EXECINSTR) || shdr[i].sh_size == 0)
+            continue;
+
+        if (shdr[i].sh_offset + shdr[i].sh_size > (uint64_t) elf_stat.st_size)
+            continue;
+
+        if (section_count == MAX_IMAGE_SECTIONS) {
+            fprintf(stderr, "Too many executable sections, ignoring the rest of %s\n", path);
+            break;
+        }
+
+        sections[section_count].start = shdr[i].sh_addr + load_base;
+        sections[section_count].end = shdr[i].sh_addr + load_base + shdr[i].sh_size;
+        sections[section_count].data = map + shdr[i].sh_offset;
+        section_count++;
+    }
+
+    load_symbols(map, elf_stat.st_size, shdr, ehdr->e_shnum, load_base);
+}
+
+const image_symbol_t* image_symbol(uint64_t address) {
+    uint32_t lo = 0, hi = symbol_count;
+    const image_symbol_t * symbol;
+
+    // the last symbol starting at or before address
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (symbols[mid].start <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    symbol = &symbols[lo - 1];
+    if (symbol->size)
+        return address < symbol->start + symbol->size ? symbol : NULL;
+    // nor past its section
+    return image_find(address) == image_find(symbol->start) ? symbol : NULL;
+}
+
+const image_section_t* image_find(uint64_t address) {
+    uint32_t i;
+
+    if (last_section && address >= last_section->start && address < last_section->end)
+        return last_section;
+
+    for (i = 0; i < section_count; ++i) {
+        if (address >= sections[i].start && address < sections[i].end) {
+            last_section = &sections[i];
+            return last_section;
+        }
+    }
+
+    return NULL;
+}
+
+uint8_t image_fetch(uint64_t address, uint32_t* instruction) {
+    const image_section_t * section = image_find(address);
+
+    if (section == NULL || address + 4 > section->end)
+        return 0;
+
+    memcpy(instruction, section->data + (address - section->start), sizeof(uint32_t));
+    return 1;
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "input.h"
+#include "archive.h"
+
+static __thread const uint8_t * trace_buffer;
+static __thread size_t buffer_size;
+static __thread size_t buffer_pointer;
+/*
+ * Decoding stops at the first packet starting at or past buffer_stop, but
+ * that packet may still read its payload up to buffer_size.
+ */
+static __thread size_t buffer_stop;
+
+/*
+ * Streaming input: the bytes pass through a fixed size ring. head and tail
+ * only ever grow, their difference is the number of unread bytes. A packet
+ * that wraps around the end of the ring is copied into staging so that
+ * peek_data can still hand out contiguous bytes.
+ */
+typedef struct input_stream {
+    int fd;
+    archive_in_t * archive;     // reads plain files and archives alike
+    uint8_t follow;
+    uint8_t eof;
+    uint8_t * ring;
+    size_t mask;
+    size_t head;
+    size_t tail;
+    uint64_t total;
+    uint8_t staging[INPUT_MAX_PEEK];
+} input_stream_t;
+
+static __thread input_stream_t * stream = NULL;
+static volatile sig_atomic_t stream_stop = 0;
+
+void input_set_buffer(const uint8_t* buffer, size_t size) {
+    stream = NULL;
+    trace_buffer = buffer;
+    buffer_size = size;
+    buffer_stop = size;
+    buffer_pointer = 0;
+}
+
+void input_seek(size_t position) {
+    buffer_pointer = (position < buffer_size) ? position : buffer_size;
+}
+
+size_t input_position(void) {
+    return stream ? stream->total : buffer_pointer;
+}
+
+void input_set_stop(size_t stop) {
+    buffer_stop = (stop < buffer_size) ? stop : buffer_size;
+}
+
+void input_set_stream(int fd, size_t capacity, uint8_t follow) {
+    size_t size = INPUT_MAX_PEEK;
+
+    // round up to a power of two, so that positions wrap with a mask
+    while (size < capacity)
+        size <<= 1;
+
+    stream = (input_stream_t *) calloc(1, sizeof(input_stream_t));
+    if (stream == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    stream->ring = (uint8_t *) malloc(size);
+    if (stream->ring == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    stream->fd = fd;
+    stream->archive = archive_in_open(fd);
+    stream->follow = follow;
+    stream->mask = size - 1;
+}
+
+void input_close_stream(void) {
+    if (stream == NULL)
+        return;
+
+    archive_in_close(stream->archive);
+    free(stream->ring);
+    free(stream);
+    stream = NULL;
+}
+
+// Makes the stream end at the next read that finds no data; safe in a signal handler
+void input_stop_stream(void) {
+    stream_stop = 1;
+}
+
+// Read whatever fits into the free part of the ring up to its end, blocking until there is some
+static void stream_fill(void) {
+    size_t free_space = (stream->mask + 1) - (stream->head - stream->tail);
+    size_t offset = stream->head & stream->mask;
+    size_t chunk = stream->mask + 1 - offset;
+    ssize_t got;
+
+    if (chunk > free_space)
+        chunk = free_space;
+
+    while (1) {
+        got = archive_in_read(stream->archive, stream->ring + offset, chunk);
+        if (got > 0) {
+            stream->head += got;
+            return;
+        }
+
+        if (got < 0 && errno == EINTR && !stream_stop)
+            continue;
+
+        if (got < 0 && errno != EINTR)
+            perror("read");
+
+        // end of a growing file: wait for the writer, unless asked to stop
+        if (got == 0 && stream->follow && !stream_stop) {
+            usleep(INPUT_FOLLOW_DELAY_US);
+            continue;
+        }
+
+        stream->eof = 1;
+        return;
+    }
+}
+
+static const uint8_t* stream_peek(uint32_t wanted, uint32_t* available) {
+    size_t offset, first;
+
+    if (wanted > INPUT_MAX_PEEK)
+        wanted = INPUT_MAX_PEEK;
+
+    while (stream->head - stream->tail < wanted && !stream->eof)
+        stream_fill();
+
+    *available = (stream->head - stream->tail < wanted) ? stream->head - stream->tail : wanted;
+
+    offset = stream->tail & stream->mask;
+    if (offset + *available <= stream->mask + 1)
+        return stream->ring + offset;
+
+    first = stream->mask + 1 - offset;
+    memcpy(stream->staging, stream->ring + offset, first);
+    memcpy(stream->staging + first, stream->ring, *available - first);
+    return stream->staging;
+}
+
+const uint8_t* peek_data(uint32_t wanted, uint32_t* available) {
+    size_t left;
+
+    if (stream)
+        return stream_peek(wanted, available);
+
+    left = buffer_size - buffer_pointer;
+    *available = (left < wanted) ? left : wanted;
+    return trace_buffer + buffer_pointer;
+}
+
+void consume_data(uint32_t bytes) {
+    if (stream) {
+        if (bytes > stream->head - stream->tail)
+            bytes = stream->head - stream->tail;
+        stream->tail += bytes;
+        stream->total += bytes;
+        return;
+    }
+
+    buffer_pointer += bytes;
+    if (buffer_pointer >= buffer_size)
+        buffer_pointer = buffer_size;
+}
+
+uint8_t data_available(void) {
+    if (stream) {
+        if (stream->head == stream->tail && !stream->eof)
+            stream_fill();
+        return stream->head != stream->tail;
+    }
+
+    return buffer_pointer < buffer_stop;
+}
@@ -0,0 +1,193 @@
+/*
+    Latency file: the cycles spent per branch, from the cycle count packets
+    of a trace with TRCCCCTLR set (csc start_etr_mp -k).
+
+    A cycle count packet gives the cycles since the previous one, for all the
+    code executed in between; the span is charged to the branch that ends it.
+    With the code reconstructed (-x) that is the address of the last branch
+    instruction, else the last address packet, the start of the code the
+    cycles went to. Spans shorter than the threshold are merged into the next
+    one by the trace unit, so the threshold is the resolution.
+
+        branch spans cycles mean min max branches/span
+
+    sorted by cycles. Timestamps, when traced, give the wall clock span of
+    the trace in the header.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "trace.h"
+#include "reconstruct.h"
+#include "subscriber.h"
+
+#define LATENCY_TABLE_INITIAL 1024
+
+typedef struct latency_entry {
+    uint64_t address;
+    uint64_t spans;         // 0 for a free slot
+    uint64_t cycles;
+    uint64_t branches;
+    uint32_t min;
+    uint32_t max;
+} latency_entry_t;
+
+static FILE * flatency = NULL;
+static latency_entry_t * table = NULL;
+static uint32_t table_capacity = 0;     // power of two
+static uint32_t table_count = 0;
+
+static uint64_t span_end;
+static uint8_t span_known = 0;
+static uint32_t span_branches = 0;
+
+static uint64_t first_timestamp, last_timestamp, timestamps, samples, unattributed;
+
+static latency_entry_t * table_slot(latency_entry_t* entries, uint32_t capacity, uint64_t address) {
+    uint32_t slot = (address >> 2) & (capacity - 1);
+
+    while (entries[slot].spans && entries[slot].address != address)
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static void grow_table(void) {
+    latency_entry_t * old = table;
+    uint32_t old_capacity = table_capacity;
+    uint32_t i;
+
+    table_capacity = old_capacity ? old_capacity * 2 : LATENCY_TABLE_INITIAL;
+    table = (latency_entry_t *) calloc(table_capacity, sizeof(latency_entry_t));
+    if (table == NULL) {
+        fprintf(stderr, "Cannot allocate the latency table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].spans)
+            *table_slot(table, table_capacity, old[i].address) = old[i];
+    }
+    free(old);
+}
+
+static void add_span(uint32_t cycles) {
+    latency_entry_t * entry;
+
+    if (!span_known) {
+        unattributed++;
+        return;
+    }
+
+    if (table_count * 2 >= table_capacity)
+        grow_table();
+
+    entry = table_slot(table, table_capacity, span_end);
+    if (entry->spans == 0) {
+        entry->address = span_end;
+        entry->min = cycles;
+        table_count++;
+    }
+    entry->spans++;
+    entry->cycles += cycles;
+    entry->branches += span_branches;
+    if (cycles < entry->min)
+        entry->min = cycles;
+    if (cycles > entry->max)
+        entry->max = cycles;
+
+    samples++;
+    span_branches = 0;
+}
+
+// executed ranges of the reconstruct subscriber, which is added before this one
+static void latency_range(const exec_range_t* range) {
+    if (range->kind == BRANCH_NONE)
+        return;
+    span_end = range->end - 4;
+    span_known = 1;
+    span_branches++;
+}
+
+static void latency_event(const trace_event_t* event) {
+    switch (event->type)
+    {
+    case EV_SYNC:
+    case EV_OVERFLOW:
+    case EV_TRACE_START:
+        // the count restarts, nothing before it belongs to the next span
+        span_known = 0;
+        span_branches = 0;
+        break;
+    case EV_ADDRESS:
+        if (span_branches == 0) {
+            span_end = event->value;
+            span_known = 1;
+        }
+        break;
+    case EV_CYCLECOUNT:
+        add_span(event->data);
+        break;
+    case EV_TIMESTAMP:
+        if (timestamps++ == 0)
+            first_timestamp = event->value;
+        last_timestamp = event->value;
+        break;
+    default:
+        break;
+    }
+}
+
+static int by_cycles(const void* a, const void* b) {
+    const latency_entry_t * x = (const latency_entry_t *) a;
+    const latency_entry_t * y = (const latency_entry_t *) b;
+
+    if (x->cycles != y->cycles)
+        return x->cycles < y->cycles ? 1 : -1;
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+static void latency_finish(void) {
+    uint32_t i, n = 0;
+
+    for (i = 0; i < table_capacity; ++i) {
+        if (table[i].spans)
+            table[n++] = table[i];
+    }
+    qsort(table, n, sizeof(latency_entry_t), by_cycles);
+
+    fprintf(flatency, "# %lu spans over %u branches, %lu before a known address\n", samples, n, unattributed);
+    if (timestamps)
+        fprintf(flatency, "# %lu timestamps, %lu ticks from the first to the last\n",
+                timestamps, last_timestamp - first_timestamp);
+    fprintf(flatency, "# branch spans cycles mean min max branches/span\n");
+    for (i = 0; i < n; ++i) {
+        fprintf(flatency, "0x%lx %lu %lu %.1f %u %u %.2f\n", table[i].address, table[i].spans, table[i].cycles,
+                (double) table[i].cycles / table[i].spans, table[i].min, table[i].max,
+                (double) table[i].branches / table[i].spans);
+    }
+
+    fclose(flatency);
+    flatency = NULL;
+    free(table);
+    table = NULL;
+    table_capacity = table_count = 0;
+}
+
+const subscriber_t latency_subscriber = {
+    .name = "latency",
+    .on_event = latency_event,
+    .on_finish = latency_finish,
+};
+
+void latency_open(const char* path) {
+    flatency = fopen(path, "w");
+    if (flatency == NULL) {
+        fprintf(stderr, "Error opening latency file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    grow_table();
+    reconstruct_add_handler(latency_range);
+    subscriber_add(&latency_subscriber);
+}
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "merge.h"
+#include "subscriber.h"
+
+#define MERGE_MAX_STREAMS 128
+
+/*
+ * A run is a timestamp and the events up to the next one, the unit of the
+ * merge: the heap is keyed by the time of the next run of every file, so
+ * it costs a heap update per timestamp, not per event. Events before the
+ * first timestamp of a file run at time 0.
+ */
+typedef struct stream {
+    const trace_event_t * events;
+    uint64_t count;
+    uint64_t next;          // index of the first event of the next run
+    uint64_t time;          // of the next run, in ns
+} stream_t;
+
+static stream_t streams[MERGE_MAX_STREAMS];
+static int heap[MERGE_MAX_STREAMS];
+static int heap_size = 0;
+
+static void map_events(const char* path, stream_t* stream) {
+    const event_file_header_t * header;
+    struct stat event_stat;
+    void * map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &event_stat) < 0) {
+        fprintf(stderr, "Error opening event file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t) event_stat.st_size < sizeof(event_file_header_t)) {
+        fprintf(stderr, "%s is not an event file\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    map = mmap(0, event_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error mmap of event file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    madvise(map, event_stat.st_size, MADV_SEQUENTIAL);
+    close(fd);
+
+    header = (const event_file_header_t *) map;
+    if (memcmp(header->magic, EVENT_FILE_MAGIC, sizeof(header->magic))
+            || header->record_size != sizeof(trace_event_t)) {
+        fprintf(stderr, "%s is not an event file of this version\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    stream->events = (const trace_event_t *) (header + 1);
+    stream->count = (event_stat.st_size - sizeof(*header)) / sizeof(trace_event_t);
+    stream->next = 0;
+    stream->time = 0;
+}
+
+static int earlier(int a, int b) {
+    if (streams[a].time != streams[b].time)
+        return streams[a].time < streams[b].time;
+    return a < b;
+}
+
+static void heap_down(int i) {
+    int child, top;
+
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= heap_size)
+            return;
+        if (child + 1 < heap_size && earlier(heap[child + 1], heap[child]))
+            child++;
+        if (!earlier(heap[child], heap[i]))
+            return;
+        top = heap[i];
+        heap[i] = heap[child];
+        heap[child] = top;
+        i = child;
+    }
+}
+
+static void print_event(int id, const trace_event_t* event) {
+    switch (event->type) {
+    case EV_SYNC:
+        report("[%d] sync", id);
+        break;
+    case EV_OVERFLOW:
+        report("[%d] overflow", id);
+        break;
+    case EV_ADDRESS:
+        report("[%d] address: 0x%lx, is: %d", id, event->value, event->flags);
+        break;
+    case EV_ATOM:
+        report("[%d] atoms: %u, 0x%lx", id, event->count, event->value);
+        break;
+    case EV_CONTEXT:
+        report("[%d] context: 0x%x", id, event->data);
+        break;
+    case EV_TIMESTAMP:
+        report("[%d] timestamp: %lu, %lu ns", id, event->value, trace_timestamp_ns(event->value));
+        break;
+    case EV_EVENT:
+        report("[%d] event: 0x%x", id, event->data);
+        break;
+    case EV_EXCEPTION:
+        report("[%d] exception: %s", id, exception_name(event->data));
+        break;
+    case EV_EXCEPTION_RETURN:
+        report("[%d] exception return", id);
+        break;
+    case EV_CYCLECOUNT:
+        report("[%d] cc: %u", id, event->data);
+        break;
+    case EV_TRACE_ON:
+        report("[%d] trace on", id);
+        break;
+    case EV_TRACE_START:
+        report("[%d] trace start", id);
+        break;
+    default:
+        break;
+    }
+}
+
+// the events of the next run of s, then the time of the one after it
+static void take_run(int s) {
+    stream_t * stream = &streams[s];
+    const trace_event_t * event;
+    uint8_t text = sink_get_mode() == SINK_TEXT;
+
+    emit_event(EV_STREAM, 0, 0, s, stream->time);
+    do {
+        event = &stream->events[stream->next++];
+        if (text)
+            print_event(s, event);
+        emit_event(event->type, event->flags, event->count, event->data, event->value);
+    } while (stream->next < stream->count && stream->events[stream->next].type != EV_TIMESTAMP);
+
+    if (stream->next < stream->count)
+        stream->time = trace_timestamp_ns(stream->events[stream->next].value);
+}
+
+void merge_event_files(char * const paths[], int count) {
+    uint64_t runs = 0, events = 0, late = 0, last = 0;
+    int i, s;
+
+    if (count > MERGE_MAX_STREAMS) {
+        fprintf(stderr, "Too many event files, at most %d\n", MERGE_MAX_STREAMS);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < count; ++i) {
+        map_events(paths[i], &streams[i]);
+        events += streams[i].count;
+        if (streams[i].count == 0)
+            continue;
+        if (streams[i].events[0].type == EV_TIMESTAMP)
+            streams[i].time = trace_timestamp_ns(streams[i].events[0].value);
+        heap[heap_size++] = i;
+    }
+    for (i = heap_size / 2 - 1; i >= 0; --i)
+        heap_down(i);
+
+    while (heap_size) {
+        s = heap[0];
+        // timestamps of one file going back, e.g. after an overflow, are taken as they come
+        if (streams[s].time < last)
+            late++;
+        else
+            last = streams[s].time;
+        take_run(s);
+        runs++;
+        if (streams[s].next == streams[s].count)
+            heap[0] = heap[--heap_size];
+        heap_down(0);
+    }
+
+    fprintf(stderr, "Merged %lu events of %d files in %lu runs", events, count, runs);
+    if (late)
+        fprintf(stderr, ", %lu runs behind the time before them", late);
+    fprintf(stderr, "\n");
+}
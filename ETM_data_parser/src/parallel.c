@@ -0,0 +1,290 @@
+/*
+    Parallel decoding of an in-memory trace.
+
+    The buffer is cut into segments that start at an A-sync packet. Workers
+    decode the segments on their own, assuming the trace is running and the
+    address registers are empty at the A-sync, into per-segment memory
+    streams. The calling thread then writes the segments out in order and
+    checks each assumption against the final state of the segment before:
+    if the previous segment did not end exactly at the A-sync, left the trace
+    paused, or the segment read an address register it had not written
+    itself, that segment is decoded again from the real state. The output is
+    therefore the same as that of a sequential decode.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "input.h"
+#include "parallel.h"
+
+#define ASYNC_LENGTH 12
+
+typedef struct segment {
+    size_t start;
+    size_t end;
+    char * output;
+    size_t output_size;
+    decoder_state_t state;      // decoder state after the segment
+    size_t stop;                // input position after the segment, >= end
+    uint32_t packets;
+    uint8_t done;
+} segment_t;
+
+static const uint8_t * par_buffer;
+static size_t par_size;
+static uint8_t par_mode;
+
+static segment_t * segments;
+static uint32_t segment_count;
+static uint32_t next_segment;
+static uint32_t written_segments;
+static uint32_t window;
+
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t segment_cond = PTHREAD_COND_INITIALIZER;
+
+// Offset of the first A-sync (11 x 0x00, 0x80) starting at or after from
+static size_t find_async(size_t from) {
+    const uint8_t * hit;
+    size_t pos = from + ASYNC_LENGTH - 1;
+    size_t i;
+
+    while (pos < par_size) {
+        hit = (const uint8_t *) memchr(par_buffer + pos, 0x80, par_size - pos);
+        if (hit == NULL)
+            return par_size;
+        pos = hit - par_buffer;
+
+        for (i = 1; i < ASYNC_LENGTH && par_buffer[pos - i] == 0x0; ++i);
+        if (i == ASYNC_LENGTH)
+            return pos - (ASYNC_LENGTH - 1);
+
+        pos++;
+    }
+
+    return par_size;
+}
+
+static void split_segments(void) {
+    size_t start = 0, next;
+    uint32_t capacity = par_size / PARALLEL_SEGMENT_SIZE + 1;
+
+    segments = (segment_t *) calloc(capacity, sizeof(segment_t));
+    if (segments == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    segment_count = 0;
+    while (start < par_size) {
+        next = find_async(start + PARALLEL_SEGMENT_SIZE);
+        if (next >= par_size || segment_count == capacity - 1)
+            next = par_size;
+
+        segments[segment_count].start = start;
+        segments[segment_count].end = next;
+        segment_count++;
+        start = next;
+    }
+}
+
+static void decode_into(segment_t* seg, size_t start, const decoder_state_t* initial) {
+    input_set_buffer(par_buffer, par_size);
+    input_set_stop(seg->end);
+    input_seek(start);
+
+    trace_set_state(initial);
+    seg->packets = trace_run(TRACE_DISPATCH_TABLE);
+    trace_get_state(&seg->state);
+    seg->stop = input_position();
+}
+
+static void decode_segment(segment_t* seg, uint8_t first) {
+    decoder_state_t initial;
+    FILE* out = NULL;
+
+    trace_reset();
+    trace_get_state(&initial);
+    if (!first)
+        initial.trace_state = 1;
+
+    if (par_mode != SINK_NONE) {
+        out = open_memstream(&seg->output, &seg->output_size);
+        if (out == NULL) {
+            perror("open_memstream");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sink_use_stream(par_mode, out);
+
+    decode_into(seg, seg->start, &initial);
+
+    if (out)
+        fclose(out);
+}
+
+static void* worker(void* arg) {
+    uint32_t index;
+    (void) arg;
+
+    while (1) {
+        pthread_mutex_lock(&segment_lock);
+        while (next_segment < segment_count && next_segment >= written_segments + window)
+            pthread_cond_wait(&segment_cond, &segment_lock);
+        if (next_segment >= segment_count) {
+            pthread_mutex_unlock(&segment_lock);
+            break;
+        }
+        index = next_segment++;
+        pthread_mutex_unlock(&segment_lock);
+
+        decode_segment(&segments[index], index == 0);
+
+        pthread_mutex_lock(&segment_lock);
+        segments[index].done = 1;
+        pthread_cond_broadcast(&segment_cond);
+        pthread_mutex_unlock(&segment_lock);
+    }
+
+    return NULL;
+}
+
+static uint8_t regs_empty(const decoder_state_t* state) {
+    uint8_t i;
+
+    for (i = 0; i < 3; ++i) {
+        if (state->address_regs[i].address != 0 || state->address_regs[i].is != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static uint8_t speculation_holds(const segment_t* seg, const decoder_state_t* prev, size_t prev_stop) {
+    if (prev_stop != seg->start || prev->trace_state != 1)
+        return 0;
+
+    return !seg->state.regs_inherited || regs_empty(prev);
+}
+
+// Address registers the segment did not write are still those of the previous segment
+static void chain_state(decoder_state_t* state, const segment_t* seg) {
+    decoder_state_t prev = *state;
+    uint8_t i, written = seg->state.regs_written;
+
+    *state = seg->state;
+    for (i = written; i < 3; ++i) {
+        state->address_regs[i] = prev.address_regs[i - written];
+    }
+    state->packet_counter = prev.packet_counter + seg->packets;
+}
+
+// Text output of a segment, with packet numbers moved up by the packets before it
+static void write_text(FILE* out, const char* text, size_t size, uint32_t base) {
+    const char * line = text, * end = text + size, * next;
+    unsigned long number;
+    char * rest;
+
+    if (base == 0) {
+        fwrite(text, 1, size, out);
+        return;
+    }
+
+    while (line < end) {
+        next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+
+        if (next - line > 5 && !strncmp(line, "Pkt: ", 5)) {
+            number = strtoul(line + 5, &rest, 10);
+            fprintf(out, "Pkt: %lu", number + base);
+            fwrite(rest, 1, next - rest, out);
+        } else {
+            fwrite(line, 1, next - line, out);
+        }
+
+        line = next;
+    }
+}
+
+uint32_t parallel_decode(const uint8_t* buffer, size_t size, unsigned int threads) {
+    pthread_t * workers;
+    decoder_state_t state;
+    segment_t * seg;
+    size_t stop = 0;
+    uint32_t redone = 0;
+    unsigned int i;
+    FILE * out;
+
+    par_buffer = buffer;
+    par_size = size;
+    par_mode = sink_get_mode();
+    out = sink_stream();
+
+    init_header_table();
+    split_segments();
+    next_segment = 0;
+    written_segments = 0;
+    window = 2 * threads;
+
+    workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    if (workers == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < threads; ++i) {
+        if (pthread_create(&workers[i], NULL, worker, NULL)) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < segment_count; ++i) {
+        seg = &segments[i];
+
+        pthread_mutex_lock(&segment_lock);
+        while (!seg->done)
+            pthread_cond_wait(&segment_cond, &segment_lock);
+        pthread_mutex_unlock(&segment_lock);
+
+        if (i == 0 || speculation_holds(seg, &state, stop)) {
+            if (par_mode == SINK_TEXT)
+                write_text(out, seg->output, seg->output_size, i ? state.packet_counter : 0);
+            else if (par_mode == SINK_BINARY)
+                fwrite(seg->output, 1, seg->output_size, out);
+
+            if (i == 0)
+                state = seg->state;
+            else
+                chain_state(&state, seg);
+        } else {
+            // decode again, straight into the real output, from where the last one stopped
+            redone++;
+            decode_into(seg, stop, &state);
+            state = seg->state;
+        }
+        stop = seg->stop;
+
+        free(seg->output);
+        seg->output = NULL;
+
+        pthread_mutex_lock(&segment_lock);
+        written_segments++;
+        pthread_cond_broadcast(&segment_cond);
+        pthread_mutex_unlock(&segment_lock);
+    }
+
+    for (i = 0; i < threads; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    fprintf(stderr, "Parallel decode: %u segments on %u threads, %u decoded again\n", segment_count, threads, redone);
+
+    free(workers);
+    free(segments);
+
+    return state.packet_counter;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "input.h"
+#include "frame.h"
+#include "pipeline.h"
+#include "archive.h"
+
+typedef struct id_decoder {
+    pthread_t thread;
+    int id;
+    int pipe_fds[2];
+    uint8_t mode;
+    FILE * shared;                  // sink of the calling thread, one ID only
+    char path[256];
+} id_decoder_t;
+
+// trace ID of the decoder thread, for subscribers shared by all of them
+static __thread int decoder_id = 0;
+
+int pipeline_id(void) {
+    return decoder_id;
+}
+
+static void* decode_id(void* arg) {
+    id_decoder_t * dec = (id_decoder_t *) arg;
+
+    decoder_id = dec->id;
+
+    if (dec->shared || dec->mode == SINK_NONE)
+        sink_use_stream(dec->mode, dec->shared);
+    else
+        sink_open(dec->mode, dec->path);
+
+    input_set_stream(dec->pipe_fds[0], INPUT_STREAM_SIZE, 0);
+    trace_loop();
+    input_close_stream();
+    close(dec->pipe_fds[0]);
+
+    if (!dec->shared)
+        sink_close();
+    return NULL;
+}
+
+// flush callback of the deformatter: hand the bytes of one ID to its decoder
+static void write_pipe(void* ctx, int id, const uint8_t* data, size_t len) {
+    id_decoder_t * dec = &((id_decoder_t *) ctx)[id - 1];
+    ssize_t written;
+
+    while (len) {
+        written = write(dec->pipe_fds[1], data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+uint64_t pipeline_decode(int fd, int n_ids, uint8_t mode, const char* prefix) {
+    id_decoder_t * decoders;
+    deformatter_t d;
+    archive_in_t * in;
+    uint8_t * buf;
+    size_t have = 0, used;
+    uint64_t total = 0;
+    ssize_t got;
+    int i;
+
+    decoders = (id_decoder_t *) calloc(n_ids, sizeof(id_decoder_t));
+    buf = (uint8_t *) malloc(PIPELINE_READ_SIZE);
+    if (decoders == NULL || buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // the table is shared by the decoders, fill it before they start
+    init_header_table();
+    for (i = 0; i < n_ids; ++i) {
+        if (pipe(decoders[i].pipe_fds) < 0) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+#ifdef F_SETPIPE_SZ
+        // a larger pipe means fewer switches between reader and decoders, not required
+        fcntl(decoders[i].pipe_fds[1], F_SETPIPE_SZ, PIPELINE_PIPE_SIZE);
+#endif
+        decoders[i].id = i + 1;
+        decoders[i].mode = mode;
+        if (n_ids == 1 && mode != SINK_NONE)
+            decoders[i].shared = sink_stream();
+        snprintf(decoders[i].path, sizeof(decoders[i].path), "%s_%d.%s",
+                 prefix ? prefix : "trc", i, mode == SINK_BINARY ? "evt" : "txt");
+
+        if (pthread_create(&decoders[i].thread, NULL, decode_id, &decoders[i])) {
+            fprintf(stderr, "Cannot start the decoder of trace ID %d\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    deformat_init(&d, PIPELINE_OUT_SIZE, write_pipe, decoders);
+    for (i = 1; i <= n_ids; ++i) {
+        deformat_keep_id(&d, i);
+    }
+
+    // read errors, including EINTR from ^C, end the input like its end would
+    in = archive_in_open(fd);
+    while ((got = archive_in_read(in, buf + have, PIPELINE_READ_SIZE - have)) > 0) {
+        total += got;
+        have += got;
+        used = deformat_stream(&d, buf, have);
+        // keep a partial frame for the next read
+        memmove(buf, buf + used, have - used);
+        have -= used;
+    }
+    deformat_flush(&d);
+    archive_in_close(in);
+
+    for (i = 0; i < n_ids; ++i) {
+        close(decoders[i].pipe_fds[1]);
+    }
+    for (i = 0; i < n_ids; ++i) {
+        pthread_join(decoders[i].thread, NULL);
+    }
+
+    if (d.dropped)
+        fprintf(stderr, "%zu bytes dropped, their trace ID is not decoded\n", d.dropped);
+
+    deformat_free(&d);
+    free(buf);
+    free(decoders);
+    return total;
+}
@@ -0,0 +1,191 @@
+/*
+    Profile file: the executed code of a trace per function, from the
+    ranges of the code reconstructed (-x).
+
+    Every executed range is charged to the function it starts in, looked up
+    in the symbol tables of -x, or to an aligned block of region bytes for
+    code outside any. A range starting at the first instruction of a
+    function counts as an entry.
+
+        region symbol instructions ranges taken entries share
+
+    sorted by instructions; share is of all instructions executed. Ranges
+    mostly stay in the function of the one before, that one is checked
+    first, so a full capture costs one compare per range and a hash lookup
+    per change of function.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "reconstruct.h"
+#include "subscriber.h"
+
+#define PROFILE_TABLE_INITIAL 256
+
+typedef struct profile_entry {
+    uint64_t region;
+    const char * symbol;
+    uint64_t instructions;
+    uint64_t ranges;        // 0 for a free slot
+    uint64_t taken;
+    uint64_t entries;
+} profile_entry_t;
+
+static FILE * fprofile = NULL;
+static profile_entry_t * table = NULL;
+static uint32_t table_capacity = 0;     // power of two
+static uint32_t table_count = 0;
+static uint64_t region_mask;
+
+// the entry of the last range and the addresses it covers, NULL after a grow
+static profile_entry_t * last_entry = NULL;
+static uint64_t last_lo, last_hi;
+
+static uint64_t instructions;
+
+static profile_entry_t * table_slot(profile_entry_t* entries, uint32_t capacity, uint64_t region) {
+    uint32_t slot = (region >> 2) & (capacity - 1);
+
+    while (entries[slot].ranges && entries[slot].region != region)
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static void grow_table(void) {
+    profile_entry_t * old = table;
+    uint32_t old_capacity = table_capacity;
+    uint32_t i;
+
+    table_capacity = old_capacity ? old_capacity * 2 : PROFILE_TABLE_INITIAL;
+    table = (profile_entry_t *) calloc(table_capacity, sizeof(profile_entry_t));
+    if (table == NULL) {
+        fprintf(stderr, "Cannot allocate the profile table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].ranges)
+            *table_slot(table, table_capacity, old[i].region) = old[i];
+    }
+    free(old);
+    last_entry = NULL;
+}
+
+static profile_entry_t * find_entry(uint64_t address) {
+    const image_symbol_t * symbol;
+    profile_entry_t * entry;
+    uint64_t region;
+
+    if (last_entry && address >= last_lo && address < last_hi)
+        return last_entry;
+
+    symbol = image_symbol(address);
+    if (symbol) {
+        region = symbol->start;
+        last_lo = symbol->start;
+        // without a size the symbol ends at the next one, not known here
+        last_hi = symbol->size ? symbol->start + symbol->size : symbol->start;
+    } else {
+        region = address & region_mask;
+        last_lo = region;
+        last_hi = region + ~region_mask + 1;
+    }
+
+    if (table_count * 2 >= table_capacity)
+        grow_table();
+
+    entry = table_slot(table, table_capacity, region);
+    if (entry->ranges == 0) {
+        entry->region = region;
+        entry->symbol = symbol ? symbol->name : NULL;
+        table_count++;
+    }
+    last_entry = entry;
+    return entry;
+}
+
+static void profile_range(const exec_range_t* range) {
+    profile_entry_t * entry;
+    uint64_t count;
+
+    if (range->end <= range->start)
+        return;
+
+    count = (range->end - range->start) / 4;
+    instructions += count;
+
+    entry = find_entry(range->start);
+    entry->instructions += count;
+    entry->ranges++;
+    if (range->taken)
+        entry->taken++;
+    if (entry->symbol && range->start == entry->region)
+        entry->entries++;
+}
+
+// ranges come through reconstruct_add_handler(), nothing to follow here
+static void profile_event(const trace_event_t* event) {
+    (void) event;
+}
+
+static int by_instructions(const void* a, const void* b) {
+    const profile_entry_t * x = (const profile_entry_t *) a;
+    const profile_entry_t * y = (const profile_entry_t *) b;
+
+    if (x->instructions != y->instructions)
+        return x->instructions < y->instructions ? 1 : -1;
+    return x->region < y->region ? -1 : x->region > y->region;
+}
+
+static void profile_finish(void) {
+    uint32_t i, n = 0;
+
+    for (i = 0; i < table_capacity; ++i) {
+        if (table[i].ranges)
+            table[n++] = table[i];
+    }
+    qsort(table, n, sizeof(profile_entry_t), by_instructions);
+
+    fprintf(fprofile, "# %lu instructions in %u regions\n", instructions, n);
+    fprintf(fprofile, "# region symbol instructions ranges taken entries share\n");
+    for (i = 0; i < n; ++i) {
+        fprintf(fprofile, "0x%lx %s %lu %lu %lu %lu %.2f%%\n", table[i].region,
+                table[i].symbol ? table[i].symbol : "-", table[i].instructions, table[i].ranges,
+                table[i].taken, table[i].entries,
+                instructions ? 100.0 * table[i].instructions / instructions : 0.0);
+    }
+
+    fclose(fprofile);
+    fprofile = NULL;
+    free(table);
+    table = NULL;
+    table_capacity = table_count = 0;
+    last_entry = NULL;
+}
+
+const subscriber_t profile_subscriber = {
+    .name = "profile",
+    .on_event = profile_event,
+    .on_finish = profile_finish,
+};
+
+// region_bytes, a power of two, groups the code without a symbol
+void profile_open(const char* path, uint32_t region_bytes) {
+    if (region_bytes == 0 || (region_bytes & (region_bytes - 1))) {
+        fprintf(stderr, "Profile region size %u is not a power of two\n", region_bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    fprofile = fopen(path, "w");
+    if (fprofile == NULL) {
+        fprintf(stderr, "Error opening profile file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    region_mask = ~((uint64_t) region_bytes - 1);
+    grow_table();
+    reconstruct_add_handler(profile_range);
+    subscriber_add(&profile_subscriber);
+}
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "image.h"
+#include "reconstruct.h"
+#include "subscriber.h"
+
+#define BLOCK_CACHE_INITIAL 4096
+
+static basic_block_t * blocks = NULL;
+static uint32_t block_capacity = 0;     // power of two
+static uint32_t block_count = 0;
+
+static FILE * range_file = NULL;
+static range_handler_t range_handlers[MAX_RANGE_HANDLERS];
+static uint8_t range_handler_count = 0;
+
+// address of the next instruction to execute, valid only while pc_known
+static uint64_t pc;
+static uint8_t pc_known = 0;
+static uint8_t exception_pending = 0;
+
+static uint64_t ranges, instructions, lookups, unknown_atoms, lost, mismatches;
+
+void reconstruct_open(const char* path) {
+    if (path) {
+        range_file = fopen(path, "w");
+        if (range_file == NULL) {
+            fprintf(stderr, "Error opening range file %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    subscriber_add(&reconstruct_subscriber);
+}
+
+void reconstruct_add_handler(range_handler_t handler) {
+    if (range_handler_count == MAX_RANGE_HANDLERS) {
+        fprintf(stderr, "Too many range handlers, at most %d\n", MAX_RANGE_HANDLERS);
+        exit(EXIT_FAILURE);
+    }
+    range_handlers[range_handler_count++] = handler;
+}
+
+static int64_t sign_extend(uint32_t value, uint8_t bits) {
+    return ((int64_t) ((uint64_t) value << (64 - bits))) >> (64 - bits);
+}
+
+// Returns 1 and fills kind, flags and target when insn is a branch
+static uint8_t decode_branch(uint64_t address, uint32_t insn, basic_block_t* block) {
+    block->flags = 0;
+
+    if ((insn & 0x7C000000) == 0x14000000) {
+        // B, BL: imm26
+        block->kind = BRANCH_DIRECT;
+        block->flags = (insn >> 31) ? BRANCH_LINK : 0;
+        block->target = address + sign_extend(insn & 0x3FFFFFF, 26) * 4;
+    } else if ((insn & 0xFF000010) == 0x54000000) {
+        // B.cond: imm19
+        block->kind = BRANCH_CONDITIONAL;
+        block->target = address + sign_extend((insn >> 5) & 0x7FFFF, 19) * 4;
+    } else if ((insn & 0x7E000000) == 0x34000000) {
+        // CBZ, CBNZ: imm19
+        block->kind = BRANCH_CONDITIONAL;
+        block->target = address + sign_extend((insn >> 5) & 0x7FFFF, 19) * 4;
+    } else if ((insn & 0x7E000000) == 0x36000000) {
+        // TBZ, TBNZ: imm14
+        block->kind = BRANCH_CONDITIONAL;
+        block->target = address + sign_extend((insn >> 5) & 0x3FFF, 14) * 4;
+    } else if ((insn & 0xFFFFFC1F) == 0xD61F0000) {
+        block->kind = BRANCH_INDIRECT;      // BR
+    } else if ((insn & 0xFFFFFC1F) == 0xD63F0000) {
+        block->kind = BRANCH_INDIRECT;      // BLR
+        block->flags = BRANCH_LINK;
+    } else if ((insn & 0xFFFFFC1F) == 0xD65F0000 || insn == 0xD69F03E0) {
+        block->kind = BRANCH_INDIRECT;      // RET, ERET
+        block->flags = BRANCH_RETURN;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+static void decode_block(uint64_t address, basic_block_t* block) {
+    uint64_t next = address;
+    uint32_t insn;
+
+    block->start = address;
+    block->kind = BRANCH_NONE;
+    block->length = 0;
+
+    while (image_fetch(next, &insn)) {
+        block->length++;
+        if (decode_branch(next, insn, block))
+            return;
+        next += 4;
+    }
+}
+
+static void grow_cache(void) {
+    basic_block_t * old = blocks;
+    uint32_t old_capacity = block_capacity;
+    uint32_t i, slot;
+
+    block_capacity = old_capacity ? old_capacity * 2 : BLOCK_CACHE_INITIAL;
+    blocks = (basic_block_t *) calloc(block_capacity, sizeof(basic_block_t));
+    if (blocks == NULL) {
+        fprintf(stderr, "Cannot allocate the block cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old[i].length == 0)
+            continue;
+        slot = (old[i].start >> 2) & (block_capacity - 1);
+        while (blocks[slot].length)
+            slot = (slot + 1) & (block_capacity - 1);
+        blocks[slot] = old[i];
+    }
+    free(old);
+}
+
+/*
+ * Open addressing on the instruction index. Returns NULL when there is no
+ * code at address; blocks found empty are not cached.
+ */
+const basic_block_t* reconstruct_block(uint64_t address) {
+    uint32_t slot;
+
+    lookups++;
+    if (block_count * 2 >= block_capacity)
+        grow_cache();
+
+    slot = (address >> 2) & (block_capacity - 1);
+    while (blocks[slot].length) {
+        if (blocks[slot].start == address)
+            return &blocks[slot];
+        slot = (slot + 1) & (block_capacity - 1);
+    }
+
+    decode_block(address, &blocks[slot]);
+    if (blocks[slot].length == 0)
+        return NULL;
+
+    blocks[slot].id = block_count++;
+    return &blocks[slot];
+}
+
+// the ids so far are 0 to this - 1
+uint32_t reconstruct_block_count(void) {
+    return block_count;
+}
+
+static void emit_range(uint64_t start, uint64_t end, const basic_block_t* block, uint8_t kind, uint8_t taken) {
+    exec_range_t range = {start, end, block->target, block->id, kind, taken};
+    uint8_t i;
+
+    ranges++;
+    instructions += (end - start) / 4;
+
+    if (range_file)
+        fprintf(range_file, "0x%lx 0x%lx %c\n", start, end, taken ? 'E' : 'N');
+    for (i = 0; i < range_handler_count; ++i)
+        range_handlers[i](&range);
+}
+
+static void follow_atom(uint8_t taken) {
+    const basic_block_t * block;
+    uint64_t end;
+
+    if (!pc_known) {
+        unknown_atoms++;
+        return;
+    }
+
+    block = reconstruct_block(pc);
+    if (block == NULL || block->kind == BRANCH_NONE) {
+        // no code there, or no branch before the end of it: wait for the next address
+        lost++;
+        pc_known = 0;
+        return;
+    }
+
+    end = block->start + (uint64_t) block->length * 4;
+    emit_range(block->start, end, block, block->kind, taken);
+
+    if (block->kind == BRANCH_CONDITIONAL) {
+        pc = taken ? block->target : end;
+    } else if (!taken) {
+        // N atom on an unconditional branch, the image does not match the trace
+        mismatches++;
+        pc_known = 0;
+    } else if (block->kind == BRANCH_DIRECT) {
+        pc = block->target;
+    } else {
+        pc_known = 0;
+    }
+}
+
+static void reconstruct_event(const trace_event_t* event) {
+    const basic_block_t * block;
+    uint16_t i;
+
+    switch (event->type) {
+    case EV_ATOM:
+        for (i = 0; i < event->count; ++i) {
+            follow_atom((event->value >> i) & 0x1);
+        }
+        break;
+    case EV_ADDRESS:
+        if (exception_pending) {
+            // preferred return address: what ran before the exception was taken
+            exception_pending = 0;
+            if (pc_known && event->value > pc) {
+                block = reconstruct_block(pc);
+                if (block && event->value <= block->start + (uint64_t) block->length * 4)
+                    emit_range(pc, event->value, block, BRANCH_NONE, 0);
+            }
+            pc_known = 0;
+        } else {
+            pc = event->value;
+            pc_known = 1;
+        }
+        break;
+    case EV_EXCEPTION:
+        exception_pending = 1;
+        break;
+    case EV_SYNC:
+    case EV_OVERFLOW:
+    case EV_TRACE_ON:
+    case EV_TRACE_START:
+        pc_known = 0;
+        exception_pending = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static void reconstruct_finish(void) {
+    if (range_file)
+        fclose(range_file);
+
+    fprintf(stderr, "Reconstructed %lu ranges, %lu instructions, %u blocks decoded for %lu lookups\n",
+            ranges, instructions, block_count, lookups);
+    if (unknown_atoms || lost || mismatches)
+        fprintf(stderr, "  %lu atoms without a known address, %lu times off the image, %lu N atoms on unconditional branches\n",
+                unknown_atoms, lost, mismatches);
+}
+
+const subscriber_t reconstruct_subscriber = {
+    .name = "reconstruct",
+    .on_event = reconstruct_event,
+    .on_finish = reconstruct_finish,
+};
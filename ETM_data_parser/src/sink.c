@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "sink.h"
+#include "subscriber.h"
+
+// Mode and stream are per thread, parallel decoders write to their own streams
+static __thread uint8_t sink_mode = SINK_TEXT;
+static __thread FILE * sink_out = NULL;
+
+static void write_event_header(void) {
+    event_file_header_t header;
+
+    memcpy(header.magic, EVENT_FILE_MAGIC, sizeof(header.magic));
+    header.version = EVENT_FILE_VERSION;
+    header.record_size = sizeof(trace_event_t);
+
+    fwrite(&header, sizeof(header), 1, sink_out);
+}
+
+/*
+ * Output is fully buffered, it is flushed when the buffer fills up and
+ * on sink_close() or exit(), not after every line.
+ */
+void sink_open(uint8_t mode, const char* path) {
+    char * sink_buffer;
+
+    sink_mode = mode;
+
+    if (mode == SINK_NONE)
+        return;
+
+    if (path == NULL) {
+        sink_out = stdout;
+    } else {
+        sink_out = fopen(path, mode == SINK_BINARY ? "wb" : "w");
+        if (sink_out == NULL) {
+            fprintf(stderr, "Error opening output file %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sink_buffer = (char *) malloc(SINK_BUFFER_SIZE);
+    if (sink_buffer == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(sink_out, sink_buffer, _IOFBF, SINK_BUFFER_SIZE);
+
+    if (mode == SINK_BINARY)
+        write_event_header();
+}
+
+void sink_close(void) {
+    if (sink_out == NULL)
+        return;
+
+    fflush(sink_out);
+    if (sink_out != stdout)
+        fclose(sink_out);
+    sink_out = NULL;
+}
+
+// Switch the mode of an open sink, e.g. silence it for a benchmark
+void sink_set_mode(uint8_t mode) {
+    if (sink_out == NULL && mode != SINK_NONE)
+        sink_out = stdout;
+    sink_mode = mode;
+}
+
+uint8_t sink_get_mode(void) {
+    return sink_mode;
+}
+
+// Direct this thread's output to an already open stream, no header is written
+void sink_use_stream(uint8_t mode, FILE* out) {
+    sink_mode = mode;
+    sink_out = out;
+}
+
+FILE* sink_stream(void) {
+    return sink_out ? sink_out : stdout;
+}
+
+void report(const char* format, ... ) {
+    va_list args;
+    FILE * out;
+
+    if (sink_mode != SINK_TEXT)
+        return;
+
+    out = sink_out ? sink_out : stdout;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+    fputc('\n', out);
+}
+
+void emit_event(uint8_t type, uint8_t flags, uint16_t count, uint32_t data, uint64_t value) {
+    trace_event_t event;
+
+    if (sink_mode != SINK_BINARY && !subscribers_active())
+        return;
+
+    event.type = type;
+    event.flags = flags;
+    event.count = count;
+    event.data = data;
+    event.value = value;
+
+    if (sink_mode == SINK_BINARY)
+        fwrite(&event, sizeof(event), 1, sink_out);
+
+    subscribers_notify(&event);
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+
+#include "trace.h"
+#include "subscriber.h"
+
+static const char * class_names[PKT_CLASS_COUNT] = {
+    "undefined", "sync", "trace info", "address", "context", "timestamp",
+    "atom", "event", "exception", "cycle count", "other",
+};
+
+static uint64_t event_counts[EV_TRACE_START + 1];
+static uint64_t e_atoms, n_atoms;
+
+static void stats_event(const trace_event_t* event) {
+    uint8_t e;
+
+    if (event->type <= EV_TRACE_START)
+        event_counts[event->type]++;
+
+    if (event->type == EV_ATOM) {
+        e = __builtin_popcountll(event->value & ((1ull << event->count) - 1));
+        e_atoms += e;
+        n_atoms += event->count - e;
+    }
+}
+
+// Summary on stderr, so it never mixes with a text or binary decode on stdout
+static void stats_finish(void) {
+    const uint64_t * classes = trace_class_counts();
+    uint64_t packets = 0;
+    uint8_t i;
+
+    for (i = 0; i < PKT_CLASS_COUNT; ++i) {
+        packets += classes[i];
+    }
+
+    fprintf(stderr, "Packets: %lu\n", packets);
+    for (i = 0; i < PKT_CLASS_COUNT; ++i) {
+        if (classes[i])
+            fprintf(stderr, "  %-12s %10lu  %5.1f%%\n", class_names[i], classes[i], 100.0 * classes[i] / packets);
+    }
+
+    fprintf(stderr, "Atoms: %lu E, %lu N\n", e_atoms, n_atoms);
+    fprintf(stderr, "Addresses: %lu, context: %lu, timestamps: %lu, exceptions: %lu, overflows: %lu, syncs: %lu\n",
+            event_counts[EV_ADDRESS], event_counts[EV_CONTEXT], event_counts[EV_TIMESTAMP],
+            event_counts[EV_EXCEPTION], event_counts[EV_OVERFLOW], event_counts[EV_SYNC]);
+}
+
+const subscriber_t stats_subscriber = {
+    .name = "stats",
+    .on_event = stats_event,
+    .on_finish = stats_finish,
+};
@@ -0,0 +1,242 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "stm.h"
+
+enum { STM_OPCODE, STM_PAYLOAD, STM_TIMESTAMP, STM_IN_ASYNC };
+enum { K_NULL, K_MASTER, K_CHANNEL, K_DATA, K_MARKED, K_FLAG, K_TRIG, K_VERSION, K_FREQ, K_ERROR };
+
+typedef struct stm_op {
+    const char* name;       // NULL for the reserved opcodes
+    uint8_t nibbles;        // of the payload
+    uint8_t ts;             // followed by a timestamp
+    uint8_t kind;
+} stm_op_t;
+
+/*
+ * STPv2 opcodes: 0x0 to 0xe, 0xf1 to 0xfe at 0x10 + the second nibble and
+ * 0xf00 to 0xf0f at 0x20 + the third. 0xff starts an ASYNC.
+ */
+static const stm_op_t stm_ops[0x30] = {
+    [0x00] = {"NULL", 0, 0, K_NULL},
+    [0x01] = {"M8", 2, 0, K_MASTER},
+    [0x02] = {"MERR", 2, 0, K_ERROR},
+    [0x03] = {"C8", 2, 0, K_CHANNEL},
+    [0x04] = {"D8", 2, 0, K_DATA},
+    [0x05] = {"D16", 4, 0, K_DATA},
+    [0x06] = {"D32", 8, 0, K_DATA},
+    [0x07] = {"D64", 16, 0, K_DATA},
+    [0x08] = {"D8MTS", 2, 1, K_MARKED},
+    [0x09] = {"D16MTS", 4, 1, K_MARKED},
+    [0x0a] = {"D32MTS", 8, 1, K_MARKED},
+    [0x0b] = {"D64MTS", 16, 1, K_MARKED},
+    [0x0c] = {"D4", 1, 0, K_DATA},
+    [0x0d] = {"D4MTS", 1, 1, K_MARKED},
+    [0x0e] = {"FLAG_TS", 0, 1, K_FLAG},
+    [0x11] = {"M16", 4, 0, K_MASTER},
+    [0x12] = {"GERR", 2, 0, K_ERROR},
+    [0x13] = {"C16", 4, 0, K_CHANNEL},
+    [0x14] = {"D8TS", 2, 1, K_DATA},
+    [0x15] = {"D16TS", 4, 1, K_DATA},
+    [0x16] = {"D32TS", 8, 1, K_DATA},
+    [0x17] = {"D64TS", 16, 1, K_DATA},
+    [0x18] = {"D8M", 2, 0, K_MARKED},
+    [0x19] = {"D16M", 4, 0, K_MARKED},
+    [0x1a] = {"D32M", 8, 0, K_MARKED},
+    [0x1b] = {"D64M", 16, 0, K_MARKED},
+    [0x1c] = {"D4TS", 1, 1, K_DATA},
+    [0x1d] = {"D4M", 1, 0, K_MARKED},
+    [0x1e] = {"FLAG", 0, 0, K_FLAG},
+    [0x20] = {"VERSION", 1, 0, K_VERSION},
+    [0x21] = {"NULL_TS", 0, 1, K_NULL},
+    [0x26] = {"TRIG", 2, 0, K_TRIG},
+    [0x27] = {"TRIG_TS", 2, 1, K_TRIG},
+    [0x28] = {"FREQ", 8, 0, K_FREQ},
+    [0x29] = {"FREQ_TS", 8, 1, K_FREQ},
+};
+
+void stm_init(stm_decoder_t* s, FILE* out) {
+    memset(s, 0, sizeof(*s));
+    s->out = out;
+}
+
+static void start_opcode(stm_decoder_t* s) {
+    s->state = STM_OPCODE;
+    s->op = 0;
+    s->op_nibbles = 0;
+}
+
+// a packet that does not decode, nothing is trusted up to the next ASYNC
+static void lose_sync(stm_decoder_t* s, const char* why) {
+    s->errors++;
+    s->synced = 0;
+    if (s->out)
+        fprintf(s->out, "# %s, waiting for ASYNC\n", why);
+}
+
+static void print_packet(stm_decoder_t* s, const stm_op_t* o) {
+    if (s->out == NULL)
+        return;
+    if (o->ts)
+        fprintf(s->out, "%016" PRIx64, s->timestamp);
+    else
+        fprintf(s->out, "%16s", "-");
+    fprintf(s->out, " %5u %5u %-7s", s->master, s->channel, o->name);
+    if (o->nibbles)
+        fprintf(s->out, " 0x%0*" PRIx64, o->nibbles, s->payload);
+    fputc('\n', s->out);
+}
+
+static void end_packet(stm_decoder_t* s) {
+    const stm_op_t* o = &stm_ops[s->code];
+
+    s->packets++;
+    switch (o->kind) {
+        case K_MASTER:
+            s->master = (uint16_t) s->payload;
+            s->channel = 0;
+            break;
+        case K_CHANNEL:
+            // C8 only sends the low byte
+            s->channel = o->nibbles == 2 ? (s->channel & 0xff00) | (uint16_t) s->payload : (uint16_t) s->payload;
+            break;
+        case K_MARKED:
+            s->markers++;
+            // fall through
+        case K_DATA:
+            s->data++;
+            print_packet(s, o);
+            break;
+        case K_FLAG:
+            s->flags++;
+            print_packet(s, o);
+            break;
+        case K_TRIG:
+            s->triggers++;
+            print_packet(s, o);
+            break;
+        case K_VERSION:
+            s->version = (uint8_t) s->payload;
+            s->master = 0;
+            s->channel = 0;
+            break;
+        case K_FREQ:
+            s->freq = (uint32_t) s->payload;
+            print_packet(s, o);
+            break;
+        case K_ERROR:
+            s->errors++;
+            print_packet(s, o);
+            break;
+    }
+    start_opcode(s);
+}
+
+static void end_payload(stm_decoder_t* s) {
+    if (stm_ops[s->code].ts) {
+        s->state = STM_TIMESTAMP;
+        s->ts_need = -1;
+    } else {
+        end_packet(s);
+    }
+}
+
+static void stm_nibble(stm_decoder_t* s, uint8_t n) {
+    const stm_op_t* o;
+
+    if (n == 0xf) {
+        s->f_run++;
+    } else {
+        if (n == 0 && s->f_run >= STM_ASYNC_NIBBLES) {
+            s->asyncs++;
+            s->synced = 1;
+            s->f_run = 0;
+            s->master = 0;
+            s->channel = 0;
+            start_opcode(s);
+            return;
+        }
+        s->f_run = 0;
+    }
+    if (!s->synced)
+        return;
+
+    switch (s->state) {
+        case STM_OPCODE:
+            s->op = (s->op << 4) | n;
+            s->op_nibbles++;
+            if (s->op_nibbles == 1 && n != 0xf)
+                s->code = n;
+            else if (s->op_nibbles == 2 && n == 0xf) {
+                s->state = STM_IN_ASYNC;
+                return;
+            } else if (s->op_nibbles == 2 && n != 0)
+                s->code = 0x10 + n;
+            else if (s->op_nibbles == 3)
+                s->code = 0x20 + n;
+            else
+                return;
+            o = &stm_ops[s->code];
+            if (o->name == NULL) {
+                lose_sync(s, "reserved opcode");
+                return;
+            }
+            s->payload = 0;
+            s->need = o->nibbles;
+            if (s->need)
+                s->state = STM_PAYLOAD;
+            else
+                end_payload(s);
+            break;
+        case STM_PAYLOAD:
+            // most significant nibble first
+            s->payload = (s->payload << 4) | n;
+            if (--s->need == 0)
+                end_payload(s);
+            break;
+        case STM_TIMESTAMP:
+            if (s->ts_need < 0) {
+                if (n == 0xf) {
+                    lose_sync(s, "reserved timestamp length");
+                    return;
+                }
+                s->ts_need = n <= 12 ? n : (n == 13 ? 14 : 16);
+                s->ts_nibbles = s->ts_need;
+                s->ts_payload = 0;
+                if (s->ts_need == 0)
+                    end_packet(s);
+                return;
+            }
+            s->ts_payload = (s->ts_payload << 4) | n;
+            if (--s->ts_need == 0) {
+                // the nibbles sent replace the low ones of the last timestamp
+                uint64_t mask = s->ts_nibbles == 16 ? ~0ull : (1ull << (4 * s->ts_nibbles)) - 1;
+                s->timestamp = (s->timestamp & ~mask) | s->ts_payload;
+                end_packet(s);
+            }
+            break;
+        case STM_IN_ASYNC:
+            // an ASYNC ending in 0 has been taken above
+            lose_sync(s, "short ASYNC");
+            break;
+    }
+}
+
+void stm_decode(stm_decoder_t* s, const uint8_t* data, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        stm_nibble(s, data[i] & 0xf);
+        stm_nibble(s, data[i] >> 4);
+    }
+}
+
+void stm_report(const stm_decoder_t* s, FILE* fp) {
+    fprintf(fp, "%lu packets, %lu data (%lu marked), %lu flags, %lu triggers, %lu errors, %lu ASYNC",
+            (unsigned long) s->packets, (unsigned long) s->data, (unsigned long) s->markers,
+            (unsigned long) s->flags, (unsigned long) s->triggers, (unsigned long) s->errors,
+            (unsigned long) s->asyncs);
+    if (s->freq)
+        fprintf(fp, ", timestamps at %u Hz", s->freq);
+    fputc('\n', fp);
+}
@@ -0,0 +1,83 @@
+/*
+    Strip file: the control flow relevant events, one per line, as read by
+    paper_imp/cfg/tracer.py.
+
+        >       trace started
+        S       A-sync
+        X       overflow
+        A0x..   address
+        BE/BN   E or N atom
+        E<n>    event field
+        I:<..>  exception and its type
+        IR      exception return
+        O       trace on
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "trace.h"
+#include "subscriber.h"
+
+static FILE * fstrip = NULL;
+
+static void strip_event(const trace_event_t* event) {
+    uint16_t i;
+
+    switch (event->type)
+    {
+    case EV_TRACE_START:
+        fprintf(fstrip, ">\n");
+        break;
+    case EV_SYNC:
+        fprintf(fstrip, "S\n");
+        break;
+    case EV_OVERFLOW:
+        fprintf(fstrip, "X\n");
+        break;
+    case EV_ADDRESS:
+        fprintf(fstrip, "A0x%lx\n", event->value);
+        break;
+    case EV_ATOM:
+        for (i = 0; i < event->count; ++i) {
+            fputs(((event->value >> i) & 0x1) ? "BE\n" : "BN\n", fstrip);
+        }
+        break;
+    case EV_EVENT:
+        fprintf(fstrip, "E%d\n", event->data);
+        break;
+    case EV_EXCEPTION:
+        fprintf(fstrip, "I:%s\n", exception_name(event->data));
+        break;
+    case EV_EXCEPTION_RETURN:
+        fprintf(fstrip, "IR\n");
+        break;
+    case EV_TRACE_ON:
+        fprintf(fstrip, "O\n");
+        break;
+    default:
+        break;
+    }
+}
+
+static void strip_finish(void) {
+    fclose(fstrip);
+    fstrip = NULL;
+}
+
+const subscriber_t strip_subscriber = {
+    .name = "strip",
+    .on_event = strip_event,
+    .on_finish = strip_finish,
+};
+
+void strip_open(const char* path) {
+    fstrip = fopen(path, "w");
+    if (fstrip == NULL) {
+        fprintf(stderr, "Error opening strip file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(fstrip, NULL, _IOFBF, SINK_BUFFER_SIZE);
+
+    subscriber_add(&strip_subscriber);
+}
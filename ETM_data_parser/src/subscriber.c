@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "subscriber.h"
+
+static const subscriber_t * subscribers[MAX_SUBSCRIBERS];
+static uint8_t subscriber_count = 0;
+
+void subscriber_add(const subscriber_t* subscriber) {
+    if (subscriber_count == MAX_SUBSCRIBERS) {
+        fprintf(stderr, "Too many subscribers, cannot add %s\n", subscriber->name);
+        exit(EXIT_FAILURE);
+    }
+
+    subscribers[subscriber_count++] = subscriber;
+}
+
+uint8_t subscribers_active(void) {
+    return subscriber_count != 0;
+}
+
+void subscribers_notify(const trace_event_t* event) {
+    uint8_t i;
+
+    for (i = 0; i < subscriber_count; ++i) {
+        subscribers[i]->on_event(event);
+    }
+}
+
+void subscribers_finish(void) {
+    uint8_t i;
+
+    for (i = 0; i < subscriber_count; ++i) {
+        if (subscribers[i]->on_finish)
+            subscribers[i]->on_finish();
+    }
+}
@@ -1,206 +1,553 @@
+#include <string.h>
+
 #include "trace.h"
+#include "subscriber.h"
+
+// Per thread, so that segments of one trace can be decoded in parallel
+static __thread decoder_state_t decoder;
+static __thread uint64_t class_counts[PKT_CLASS_COUNT];
+
+// End the trace for good on an unrecognised A-sync or an empty TraceInfo, instead of pausing until the next A-sync
+static uint8_t end_on_loss = 0;
+
+// TRCCCCTLR of the session, the cycle count packets carry the count above it
+static uint32_t cc_threshold = CC_THRESHOLD;
+
+// Tsgen frequency in Hz (csc cs_enable_tsgen()), 0 while unknown: timestamps stay in ticks
+static uint32_t timestamp_freq = 0;
+
+// Names the function of an address in the text log, NULL while the program has no symbols
+static trace_symbolizer_t symbolizer = NULL;
 
-extern uint32_t read_data(uint8_t*, uint32_t, uint8_t);
-extern uint32_t advance_pointer(uint32_t);
-extern uint8_t data_available();
+static const uint8_t async_pattern[10] = {0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x80};
 
-static address_reg_t address_regs[3];
+static inline uint32_t le32(const uint8_t* bytes) {
+    return ((uint32_t) bytes[0]) | ((uint32_t) bytes[1] << 8)
+            | ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+// The buffer ends inside a packet: report it and drop the remaining bytes
+static void truncated_packet(uint32_t available, uint32_t wanted) {
+    report("Truncated packet, %u of %u payload bytes available", available, wanted);
+    consume_data(available);
+}
 
-static uint8_t trace_state = 0;
+// Payload of a fixed size, the bytes are consumed and can be decoded in place
+static const uint8_t* take_payload(uint32_t bytes) {
+    uint32_t available;
+    const uint8_t* payload = peek_data(bytes, &available);
+
+    if (available < bytes) {
+        truncated_packet(available, bytes);
+        return NULL;
+    }
+
+    consume_data(bytes);
+    return payload;
+}
+
+/*
+ * Payload made of up to max bytes, where bit 7 of each byte tells that another one
+ * follows. Everything up to and including the last byte is consumed.
+ */
+static const uint8_t* take_continued(uint32_t max) {
+    uint32_t available, length = 0;
+    const uint8_t* payload = peek_data(max, &available);
+
+    while (length < available && length < max && (payload[length] >> 7) == 1) {
+        ++length;
+    }
+
+    if (length == available && length < max) {
+        truncated_packet(available, length + 1);
+        return NULL;
+    }
+
+    length = (length == max) ? max : length + 1;
+    consume_data(length);
+    return payload;
+}
 
 static void init_address_regs(void) {
     uint8_t i;
     for (i = 0; i < 3; ++i) {
-        address_regs[i].address = 0x0;
-        address_regs[i].is = 0x0;
+        decoder.address_regs[i].address = 0x0;
+        decoder.address_regs[i].is = 0x0;
     }
 }
 
 static void update_address_regs(uint64_t address, uint8_t is) {
-    address_regs[2] = address_regs[1];
-    address_regs[1] = address_regs[0];
-    address_regs[0].address = address;
-    address_regs[0].is = is;
+    decoder.address_regs[2] = decoder.address_regs[1];
+    decoder.address_regs[1] = decoder.address_regs[0];
+    decoder.address_regs[0].address = address;
+    decoder.address_regs[0].is = is;
+    if (decoder.regs_written < 3)
+        decoder.regs_written++;
 }
 
-static void handle_atom(uint8_t status) {
-    if (status) {
-        report("E atom");
-    } else {
-        report("N atom");
+// Notes when a packet relies on an address from before the current decoder state was set
+static const address_reg_t* read_address_reg(uint8_t index) {
+    if (index >= decoder.regs_written)
+        decoder.regs_inherited = 1;
+    return &decoder.address_regs[index];
+}
+
+/*
+ * Atoms of every atom header, bit i of mask is 1 when atom i is E. The
+ * headers carry all atoms themselves (formats 5 and 6 have no payload),
+ * so one lookup gives the whole batch. count is 0 for the reserved
+ * format 5 patterns.
+ */
+typedef struct atom_entry {
+    uint32_t mask;
+    uint8_t count;
+    uint8_t format;
+} atom_entry_t;
+
+static atom_entry_t atom_table[256];
+
+static void set_atoms(uint8_t header, uint8_t format, uint8_t count, uint32_t mask) {
+    atom_table[header].format = format;
+    atom_table[header].count = count;
+    atom_table[header].mask = mask;
+}
+
+static void init_atom_table(void) {
+    static const uint32_t format4[4] = {0b1110, 0b0000, 0b1010, 0b0101};
+    uint16_t header;
+    uint8_t count;
+
+    for (header = 0b11111000; header <= 0b11111111; ++header) {
+        set_atoms(header, 3, 3, header & 0b111);
+    }
+
+    for (header = 0b11000000; header <= 0b11110100; ++header) {
+        if (header > 0b11010100 && header < 0b11100000)
+            continue;
+        // (header & 0x1f) + 3 E atoms, then an E or N atom
+        count = (header & 0b11111) + 4;
+        set_atoms(header, 6, count, ((1u << (count - 1)) - 1) | ((uint32_t) !((header >> 5) & 0x1) << (count - 1)));
+    }
+
+    set_atoms(Atom10, 1, 1, Atom10 & 0x1);
+    set_atoms(Atom11, 1, 1, Atom11 & 0x1);
+
+    for (header = Atom20; header <= Atom23; ++header) {
+        set_atoms(header, 2, 2, header & 0b11);
+    }
+
+    for (header = Atom40; header <= Atom43; ++header) {
+        set_atoms(header, 4, 4, format4[header & 0b11]);
     }
-    report_atom(status);
 
+    set_atoms(Atom50, 5, 5, 0b10101);   // E N E N E
+    set_atoms(Atom51, 5, 5, 0b01010);   // N E N E N
+    set_atoms(Atom52, 5, 5, 0b00000);   // N N N N N
+    set_atoms(Atom53, 5, 5, 0b11110);   // N E E E E
+}
+
+static void handle_atoms(uint8_t header) {
+    const atom_entry_t* atoms = &atom_table[header];
+    uint8_t i;
+
+    report("Atom %d packet", atoms->format);
+
+    if (atoms->count == 0) {
+        report("UNDEFINED handle_atom%d case: 0x%x", atoms->format, header);
+        return;
+    }
+
+    // the text log keeps what subscribers print (CTL) next to the atom it belongs to
+    if (sink_get_mode() == SINK_TEXT) {
+        for (i = 0; i < atoms->count; ++i) {
+            report(((atoms->mask >> i) & 0x1) ? "E atom" : "N atom");
+            if (subscribers_active())
+                emit_event(EV_ATOM, 0, 1, 0, (atoms->mask >> i) & 0x1);
+        }
+        if (subscribers_active())
+            return;
+    }
+
+    emit_event(EV_ATOM, 0, atoms->count, 0, atoms->mask);
 }
 
 static void handle_address(uint64_t address, uint8_t is) {
-    report("address: 0x%lx, is: %d", address, is);
-    report_addres(address, is);
+    const char * name;
+    uint64_t offset;
+
+    if (symbolizer && sink_get_mode() == SINK_TEXT && (name = symbolizer(address, &offset)) != NULL)
+        report("address: 0x%lx, is: %d <%s+0x%lx>", address, is, name, offset);
+    else
+        report("address: 0x%lx, is: %d", address, is);
+    emit_event(EV_ADDRESS, is, 0, 0, address);
     update_address_regs(address, is);
 }
 
 static void start_trace(void) {
-    if (trace_state == 0 || trace_state == 3) {
-        trace_state = 1;
+    if (decoder.trace_state == 0 || decoder.trace_state == 3) {
+        decoder.trace_state = 1;
         report("Starting/Resuming trace");
+        emit_event(EV_TRACE_START, 0, 0, 0, 0);
     }
 }
 
 static void end_trace(void) {
-    if (trace_state == 1) {
-        trace_state = 2;
+    if (decoder.trace_state == 1) {
+        decoder.trace_state = 2;
         report("Trace ended");
     }
 }
 
 static void pause_trace(void) {
-    if (trace_state == 1) {
-        trace_state = 3;
+    if (decoder.trace_state == 1) {
+        decoder.trace_state = 3;
         report("Trace paused until SYNC");
     }
 }
 
-void trace_loop(void) {
-    uint8_t header;
-    uint32_t packet_counter = 0;
+static void lose_trace(void) {
+    if (end_on_loss)
+        end_trace();
+    else
+        pause_trace();
+}
+
+void trace_set_end_on_loss(uint8_t enable) {
+    end_on_loss = enable;
+}
+
+void trace_set_cc_threshold(uint32_t threshold) {
+    cc_threshold = threshold;
+}
+
+void trace_set_timestamp_freq(uint32_t freq) {
+    timestamp_freq = freq;
+}
+
+void trace_set_symbolizer(trace_symbolizer_t lookup) {
+    symbolizer = lookup;
+}
+
+// ticks of the timestamp generator in ns, unchanged without a frequency
+uint64_t trace_timestamp_ns(uint64_t ticks) {
+    if (timestamp_freq == 0)
+        return ticks;
+    return ticks / timestamp_freq * 1000000000ull + ticks % timestamp_freq * 1000000000ull / timestamp_freq;
+}
+
+const uint64_t* trace_class_counts(void) {
+    return class_counts;
+}
+
+static void handle_undefined(uint8_t header) {
+    report("Undefined header 0x%x", header);
+}
+
+static void dispatch_async(uint8_t header) {
+    (void) header;
+    handle_async();
+}
+
+static void dispatch_resync(uint8_t header) {
+    (void) header;
+    handle_resync();
+}
+
+static void dispatch_traceinfo(uint8_t header) {
+    (void) header;
+    handle_traceinfo();
+}
 
+static void dispatch_exception(uint8_t header) {
+    (void) header;
+    handle_exception();
+}
+
+static void dispatch_exceptionreturn(uint8_t header) {
+    (void) header;
+    handle_exceptionreturn();
+}
+
+static void dispatch_functionreturn(uint8_t header) {
+    (void) header;
+    handle_functionreturn();
+}
+
+static void dispatch_traceon(uint8_t header) {
+    (void) header;
+    handle_traceon();
+}
+
+static header_entry_t header_table[256];
+static uint8_t header_table_ready = 0;
+
+static void set_header(uint8_t header, packet_handler_t handler, uint8_t packet_class) {
+    header_table[header].handler = handler;
+    header_table[header].packet_class = packet_class;
+}
+
+static void set_header_range(uint8_t first, uint8_t last, packet_handler_t handler, uint8_t packet_class) {
+    uint16_t header;
+    for (header = first; header <= last; ++header) {
+        set_header(header, handler, packet_class);
+    }
+}
+
+/*
+ * Every header byte is classified once, in the same order of precedence
+ * as the old switch: ranges first, then the single headers on top of them.
+ */
+void init_header_table(void) {
+    if (header_table_ready)
+        return;
+
+    init_atom_table();
+
+    set_header_range(0x00, 0xff, handle_undefined, PKT_UNDEFINED);
+
+    set_header_range(0b11111000, 0b11111111, handle_atoms, PKT_ATOM);
+    set_header_range(0b11000000, 0b11010100, handle_atoms, PKT_ATOM);
+    set_header_range(0b11100000, 0b11110100, handle_atoms, PKT_ATOM);
+    set_header_range(0b01110001, 0b01111111, handle_event, PKT_EVENT);
+    set_header_range(0b00010000, 0b00011111, handle_ccf3, PKT_CYCLECOUNT);
+
+    set_header(Async, dispatch_async, PKT_SYNC);
+    set_header(Resync, dispatch_resync, PKT_SYNC);
+    set_header(TraceInfo, dispatch_traceinfo, PKT_TRACEINFO);
+    set_header(Context0, handle_context, PKT_CONTEXT);
+    set_header(Context1, handle_context, PKT_CONTEXT);
+    set_header(LongAddress0, handle_longaddress, PKT_ADDRESS);
+    set_header(LongAddress1, handle_longaddress, PKT_ADDRESS);
+    set_header(LongAddress2, handle_longaddress, PKT_ADDRESS);
+    set_header(LongAddress3, handle_longaddress, PKT_ADDRESS);
+    set_header(ShortAddr0, handle_shortaddress, PKT_ADDRESS);
+    set_header(ShortAddr1, handle_shortaddress, PKT_ADDRESS);
+    set_header(ExactMatch0, handle_exactmatch, PKT_ADDRESS);
+    set_header(ExactMatch1, handle_exactmatch, PKT_ADDRESS);
+    set_header(ExactMatch2, handle_exactmatch, PKT_ADDRESS);
+    set_header(AddrWithContext0, handle_addrwithcontext, PKT_ADDRESS);
+    set_header(AddrWithContext1, handle_addrwithcontext, PKT_ADDRESS);
+    set_header(AddrWithContext2, handle_addrwithcontext, PKT_ADDRESS);
+    set_header(AddrWithContext3, handle_addrwithcontext, PKT_ADDRESS);
+    set_header(TimeStamp0, handle_timestamp, PKT_TIMESTAMP);
+    set_header(TimeStamp1, handle_timestamp, PKT_TIMESTAMP);
+    set_header(Atom10, handle_atoms, PKT_ATOM);
+    set_header(Atom11, handle_atoms, PKT_ATOM);
+    set_header(Atom20, handle_atoms, PKT_ATOM);
+    set_header(Atom21, handle_atoms, PKT_ATOM);
+    set_header(Atom22, handle_atoms, PKT_ATOM);
+    set_header(Atom23, handle_atoms, PKT_ATOM);
+    set_header(Atom40, handle_atoms, PKT_ATOM);
+    set_header(Atom41, handle_atoms, PKT_ATOM);
+    set_header(Atom42, handle_atoms, PKT_ATOM);
+    set_header(Atom43, handle_atoms, PKT_ATOM);
+    set_header(Atom50, handle_atoms, PKT_ATOM);
+    set_header(Atom51, handle_atoms, PKT_ATOM);
+    set_header(Atom52, handle_atoms, PKT_ATOM);
+    set_header(Atom53, handle_atoms, PKT_ATOM);
+    set_header(Exce, dispatch_exception, PKT_EXCEPTION);
+    set_header(ExceReturn, dispatch_exceptionreturn, PKT_EXCEPTION);
+    set_header(FunctionReturn, dispatch_functionreturn, PKT_OTHER);
+    set_header(TraceOn, dispatch_traceon, PKT_OTHER);
+    set_header(CCF10, handle_ccf1, PKT_CYCLECOUNT);
+    set_header(CCF11, handle_ccf1, PKT_CYCLECOUNT);
+    set_header(CCF20, handle_ccf2, PKT_CYCLECOUNT);
+    set_header(CCF21, handle_ccf2, PKT_CYCLECOUNT);
+
+    header_table_ready = 1;
+}
+
+const header_entry_t* get_header_entry(uint8_t header) {
+    init_header_table();
+    return &header_table[header];
+}
+
+// The original dispatch, still selectable with TRACE_DISPATCH_SWITCH for benchmarking
+static void dispatch_switch(uint8_t header) {
+    switch (header)
+    {
+    case Async:
+        handle_async();
+        break;
+    case Resync:
+        handle_resync();
+        break;
+    case TraceInfo:
+        handle_traceinfo();
+        break;
+    case Context0:
+    case Context1:
+        handle_context(header);
+        break;
+    case LongAddress0:
+    case LongAddress1:
+    case LongAddress2:
+    case LongAddress3:
+        handle_longaddress(header);
+        break;
+    case ShortAddr0:
+    case ShortAddr1:
+        handle_shortaddress(header);
+        break;
+    case ExactMatch0:
+    case ExactMatch1:
+    case ExactMatch2:
+        handle_exactmatch(header);
+        break;
+    case AddrWithContext0:
+    case AddrWithContext1:
+    case AddrWithContext2:
+    case AddrWithContext3:
+        handle_addrwithcontext(header);
+        break;
+    case TimeStamp0:
+    case TimeStamp1:
+        handle_timestamp(header);
+        break;
+    case Atom10:
+    case Atom11:
+        handle_atom1(header);
+        break;
+    case Atom20:
+    case Atom21:
+    case Atom22:
+    case Atom23:
+        handle_atom2(header);
+        break;
+    case Atom40:
+    case Atom41:
+    case Atom42:
+    case Atom43:
+        handle_atom4(header);
+        break;
+    case Atom50:
+    case Atom51:
+    case Atom52:
+    case Atom53:
+        handle_atom5(header);
+        break;
+    case Exce:
+        handle_exception();
+        break;
+    case ExceReturn:
+        handle_exceptionreturn();
+        break;
+    case FunctionReturn:
+        handle_functionreturn();
+        break;
+    case TraceOn:
+        handle_traceon();
+        break;
+    case CCF10:
+    case CCF11:
+        handle_ccf1(header);
+        break;
+    case CCF20:
+    case CCF21:
+        handle_ccf2(header);
+        break;
+    default:
+        if (header >= 0b11111000) {
+            handle_atom3(header);
+        } else if ((header >= 0b11000000 && header <= 0b11010100) 
+                    || (header >= 0b11100000 && header <= 0b11110100)) {
+            handle_atom6(header);
+        } else if (header >= 0b01110001 && header <= 0b01111111) {
+            handle_event(header);
+        } else if (header >= 0b00010000 && header <= 0b00011111) {
+            handle_ccf3(header);
+        } else {
+            report("Undefined header 0x%x", header);
+        }
+        break;
+    }
+}
+
+void trace_reset(void) {
     init_address_regs();
+    decoder.trace_state = 0;
+    decoder.regs_written = 0;
+    decoder.regs_inherited = 0;
+    decoder.packet_counter = 0;
+    decoder.timestamp = 0;
+}
+
+void trace_get_state(decoder_state_t* state) {
+    *state = decoder;
+}
+
+void trace_set_state(const decoder_state_t* state) {
+    decoder = *state;
+    decoder.regs_written = 0;
+    decoder.regs_inherited = 0;
+}
+
+// Decode from the current input position and decoder state, returns the number of packets
+uint32_t trace_run(uint8_t mode) {
+    uint8_t header;
+    uint32_t first_packet = decoder.packet_counter;
+    uint32_t available;
+
+    init_header_table();
 
     while(data_available()) {
-        read_data(&header, 1, 1);
+        header = *peek_data(1, &available);
+        consume_data(1);
 
-        if (trace_state == 2 || ((trace_state == 0 || trace_state == 3) && header != 0x0)) {
+        if (decoder.trace_state == 2 || ((decoder.trace_state == 0 || decoder.trace_state == 3) && header != 0x0)) {
             report("byte 0x%x outside of trace scope", header);
             continue;
         }
 
-        report("Pkt: %d Header: %#04x", packet_counter, header);
-        packet_counter++;
-
-        switch (header)
-        {
-        case Async:
-            handle_async();
-            break;
-        case Resync:
-            handle_resync();
-            break;
-        case TraceInfo:
-            handle_traceinfo();
-            break;
-        case Context0:
-        case Context1:
-            handle_context(header);
-            break;
-        case LongAddress0:
-        case LongAddress1:
-        case LongAddress2:
-        case LongAddress3:
-            handle_longaddress(header);
-            break;
-        case ShortAddr0:
-        case ShortAddr1:
-            handle_shortaddress(header);
-            break;
-        case ExactMatch0:
-        case ExactMatch1:
-        case ExactMatch2:
-            handle_exactmatch(header);
-            break;
-        case AddrWithContext0:
-        case AddrWithContext1:
-        case AddrWithContext2:
-        case AddrWithContext3:
-            handle_addrwithcontext(header);
-            break;
-        case TimeStamp0:
-        case TimeStamp1:
-            handle_timestamp(header);
-            break;
-        case Atom10:
-        case Atom11:
-            handle_atom1(header);
-            break;
-        case Atom20:
-        case Atom21:
-        case Atom22:
-        case Atom23:
-            handle_atom2(header);
-            break;
-        case Atom40:
-        case Atom41:
-        case Atom42:
-        case Atom43:
-            handle_atom4(header);
-            break;
-        case Atom50:
-        case Atom51:
-        case Atom52:
-        case Atom53:
-            handle_atom5(header);
-            break;
-        case Exce:
-            handle_exception();
-            break;
-        case ExceReturn:
-            handle_exceptionreturn();
-            break;
-        case FunctionReturn:
-            handle_functionreturn();
-            break;
-        case TraceOn:
-            handle_traceon();
-            break;
-        case CCF10:
-        case CCF11:
-            handle_ccf1(header);
-            break;
-        case CCF20:
-        case CCF21:
-            handle_ccf2(header);
-            break;
-        default:
-            if (header >= 0b11111000) {
-                handle_atom3(header);
-            } else if ((header >= 0b11000000 && header <= 0b11010100) 
-                        || (header >= 0b11100000 && header <= 0b11110100)) {
-                handle_atom6(header);
-            } else if (header >= 0b01110001 && header <= 0b01111111) {
-                handle_event(header);
-            } else if (header >= 0b00010000 && header <= 0b00011111) {
-                handle_ccf3(header);
-            } else {
-                report("Undefined header 0x%x", header);
-            }
-            break;
+        report("Pkt: %d Header: %#04x", decoder.packet_counter, header);
+        decoder.packet_counter++;
+
+        if (mode == TRACE_DISPATCH_TABLE) {
+            class_counts[header_table[header].packet_class]++;
+            header_table[header].handler(header);
+        } else {
+            dispatch_switch(header);
         }
 
         report("");
     }
+
+    return decoder.packet_counter - first_packet;
+}
+
+uint32_t trace_loop_dispatch(uint8_t mode) {
+    trace_reset();
+    return trace_run(mode);
+}
+
+void trace_loop(void) {
+    trace_loop_dispatch(TRACE_DISPATCH_TABLE);
 }
 
 void handle_async(void) {
-    uint8_t payload[10]; 
-    read_data(payload, 1, 1);
+    const uint8_t* payload;
+
+    if ((payload = take_payload(1)) == NULL)
+        return;
 
     if (payload[0] == 0x5){ 
         report("Async, OVERFLOW detected");
+        emit_event(EV_OVERFLOW, 0, 0, 0, 0);
 	}
     else if (payload[0] == 0x3) {
         report ("Async, Disarcrd.");
     } else if (payload[0] == 0x7) {
         report ("Async, Branch Future Flush.");
     } else if (payload[0] == 0) {
-        read_data(payload, 10, 1);
-        if (payload[0] == 0x0 && payload[1] == 0x0 && payload[2] == 0x0 && payload[3] == 0x0
-                && payload[4] == 0x0 && payload[5] == 0x0 && payload[6] == 0x0 && payload[7] == 0x0
-                && payload[8] == 0x0 && payload[9] == 0x80) {
+        if ((payload = take_payload(sizeof(async_pattern))) == NULL)
+            return;
+        if (!memcmp(payload, async_pattern, sizeof(async_pattern))) {
             start_trace();
             report("Async, OK");
+            emit_event(EV_SYNC, 0, 0, 0, 0);
         } else {
             report("Async, other. Ending trace.");
-            //end_trace();
-            pause_trace();
+            lose_trace();
         }
     }
 }
@@ -210,14 +557,18 @@ void handle_resync(void) {
 }
 
 void handle_traceinfo(void) {
+    const uint8_t* payload;
     uint8_t header;
-    uint8_t payload[2];
-    read_data(&header, 1, 1);
+
+    if ((payload = take_payload(1)) == NULL)
+        return;
+    header = payload[0];
 
     switch (header)
     {
     case 0b00000001:
-        read_data(payload, 1, 1);
+        if ((payload = take_payload(1)) == NULL)
+            return;
         if (payload[0] == 0b00000000) { // TODO: figure this out
             report("INFO session: nothing is enabled. No continue byte.");
         } else {
@@ -225,14 +576,17 @@ void handle_traceinfo(void) {
         }
         break;
     case 0b00001001:
-        read_data(payload, 2, 1);
+        if ((payload = take_payload(2)) == NULL)
+            return;
+        // the CYCT section is the threshold of the session, not a count
         report("Cycle Count enable");
-        report("CC: %d", payload[1]);
+        report("CC threshold: %d", payload[1]);
+        if (!(payload[1] & 0x80))
+            cc_threshold = payload[1];
         break;
     case 0b00000000:
         report("The trace might have ended!");
-        //end_trace();
-        pause_trace();
+        lose_trace();
         break;
     default:
         report("UNFINISHED handle_traceinfo header");
@@ -241,38 +595,59 @@ void handle_traceinfo(void) {
 }
 
 void handle_context(uint8_t header) {
-    uint8_t context_info, vmid; // On our system (Cortex-A53), vmid is only one byte
-    uint32_t contextid;
+    uint8_t context_info, vmid = 0; // On our system (Cortex-A53), vmid is only one byte
+    uint32_t contextid = 0, available, length;
+    uint8_t flags = 0;
+    const uint8_t* payload;
 
     if ((header & 0x1) == 0) {
         report("Context packet, no payload");
     } else {
         report("Context packet with payload");
-        read_data(&context_info, 1, 1);
+
+        // control byte, then one byte of vmid and four bytes of context ID if present
+        payload = peek_data(6, &available);
+        if (available < 1) {
+            truncated_packet(available, 1);
+            return;
+        }
+        context_info = payload[0];
+        length = 1 + ((context_info >> 6) & 1) + ((context_info >> 7) ? 4 : 0);
+        if (available < length) {
+            truncated_packet(available, length);
+            return;
+        }
+        consume_data(length);
+        payload++;
+
         report("payload ctl: 0x%x", context_info);
         if (((context_info >> 6) & 1) == 1) {
-            read_data(&vmid, 1, 1);
+            vmid = *payload++;
             report("vmid: %d", vmid);
+            flags |= EVENT_CONTEXT_VMID;
         }
         if ((context_info >> 7) == 1) {
-            read_data((uint8_t*) &contextid, 4, 1);
+            contextid = le32(payload);
             report("contextid: %d", contextid);
+            flags |= EVENT_CONTEXT_CID;
         }
+        emit_event(EV_CONTEXT, flags, 0, contextid, vmid);
     }
 }
 
 void handle_longaddress(uint8_t header) {
-    uint8_t payload[8];
+    const uint8_t* payload;
     uint8_t is;
-    uint64_t address = address_regs[0].address;
+    uint64_t address = decoder.address_regs[0].address;
 
     switch (header)
     {
     case 0b10011010:
         report("Long Address 32 IS0 packet");
-        read_data(payload, 4, 1);
+        if ((payload = take_payload(4)) == NULL)
+            return;
         is = 0;
-        address = address & ~((uint64_t) 0xffffffff);
+        address = read_address_reg(0)->address & ~((uint64_t) 0xffffffff);
         address = address | (((uint64_t) payload[0] & 0x7f) << 2)
                         | (((uint64_t) payload[1] & 0x7f) << 9)
                         | (((uint64_t) payload[2]) << 16)
@@ -280,9 +655,10 @@ void handle_longaddress(uint8_t header) {
         break;
     case 0b10011011:
         report("Long Address 32 IS1 packet");
-        read_data(payload, 4, 1);
+        if ((payload = take_payload(4)) == NULL)
+            return;
         is = 1;
-        address = address & ~((uint64_t) 0xffffffff);
+        address = read_address_reg(0)->address & ~((uint64_t) 0xffffffff);
         address = address | (((uint64_t) payload[0] & 0x7f) << 1)
                         | (((uint64_t) payload[1]) << 8)
                         | (((uint64_t) payload[2]) << 16)
@@ -290,7 +666,8 @@ void handle_longaddress(uint8_t header) {
         break;
     case 0b10011101:
         report("Long Address 64 IS0 packet");
-        read_data(payload, 8, 1);
+        if ((payload = take_payload(8)) == NULL)
+            return;
         is = 0;
         address = 0;
         address = address | (((uint64_t) payload[0] & 0x7f) << 2)
@@ -304,7 +681,8 @@ void handle_longaddress(uint8_t header) {
         break;
     case 0b10011110:
         report("Long Address 64 IS1 packet");
-        read_data(payload, 8, 1);
+        if ((payload = take_payload(8)) == NULL)
+            return;
         is = 1;
         address = 0;
         address = address | (((uint64_t) payload[0] & 0x7f) << 1)
@@ -325,34 +703,33 @@ void handle_longaddress(uint8_t header) {
 }
 
 void handle_shortaddress(uint8_t header) {
-    uint8_t payload;
+    const uint8_t* payload;
     uint8_t is;
-    uint64_t address = address_regs[0].address;
+    uint64_t address = read_address_reg(0)->address;
+
+    if ((payload = take_continued(2)) == NULL)
+        return;
 
     switch (header)
     {
     case 0b10010101:
         report("Short Address IS0 packet");
-        read_data(&payload, 1, 1);
         is = 0;
         address = address & ~((uint64_t) 0x1ff);
-        address = address | (((uint64_t) payload & 0x7f) << 2);
-        if ((payload >> 7) == 1) {
-            read_data(&payload, 1, 1);
+        address = address | (((uint64_t) payload[0] & 0x7f) << 2);
+        if ((payload[0] >> 7) == 1) {
             address = address & ~0x1fe00;
-            address = address | (((uint64_t) payload) << 9);
+            address = address | (((uint64_t) payload[1]) << 9);
         }
         break;
     case 0b10010110:
         report("Short Address IS1 packet");
-        read_data(&payload, 1, 1);
         is = 1;
         address = address & ~((uint64_t) 0xff);
-        address = address | (((uint64_t) payload & 0x7f) << 1);
-        if ((payload >> 7) == 1) {
-            read_data(&payload, 1, 1);
+        address = address | (((uint64_t) payload[0] & 0x7f) << 1);
+        if ((payload[0] >> 7) == 1) {
             address = address & ~0xff00;
-            address = address | (((uint64_t) payload) << 8);
+            address = address | (((uint64_t) payload[1]) << 8);
         }
         break;
     default:
@@ -365,8 +742,9 @@ void handle_shortaddress(uint8_t header) {
 
 void handle_exactmatch(uint8_t header) {
     uint8_t index = header & 0b11;
+    const address_reg_t* reg = read_address_reg(index);
     report("Exact Match Address(%d)", index);
-    handle_address(address_regs[index].address, address_regs[index].is);
+    handle_address(reg->address, reg->is);
 }
 
 void handle_addrwithcontext(uint8_t header) {
@@ -397,210 +775,147 @@ void handle_addrwithcontext(uint8_t header) {
 }
 
 void handle_timestamp(uint8_t header) {
-    uint8_t i = 0, payload;
-    uint64_t timestamp = 0;
+    uint8_t i = 0;
+    const uint8_t* payload;
+    uint64_t timestamp = 0, mask;
     uint32_t count = 0;
 
     report("Timestamp packet");
 
+    if ((payload = take_continued(9)) == NULL)
+        return;
+
     do {
-        read_data(&payload, 1, 1);
         if (i != 8) {
-            timestamp = timestamp | (((uint64_t) payload & 0x7f) << (7 * i));
+            timestamp = timestamp | (((uint64_t) payload[i] & 0x7f) << (7 * i));
         } else {
-            timestamp = timestamp | (((uint64_t) payload) << (7 * i));
+            timestamp = timestamp | (((uint64_t) payload[i]) << (7 * i));
         }
-    } while(((payload >> 7) == 1) && (++i < 9));
+    } while(((payload[i] >> 7) == 1) && (++i < 9));
+
+    // the bytes sent replace the low bits of the last timestamp
+    mask = i >= 8 ? ~0ull : (1ull << (7 * (i + 1))) - 1;
+    decoder.timestamp = (decoder.timestamp & ~mask) | timestamp;
+    timestamp = decoder.timestamp;
 
-    report("timestamp: %d", timestamp);
+    if (timestamp_freq)
+        report("timestamp: %lu, %lu ns", timestamp, trace_timestamp_ns(timestamp));
+    else
+        report("timestamp: %lu", timestamp);
 
     if ((header & 0x1) == 1) {
         i = 0;
 
+        if ((payload = take_continued(3)) == NULL)
+            return;
+
         do {
-            read_data(&payload, 1, 1);
             if (i != 2) {
-                count = count | (((uint64_t) payload & 0x7f) << (7 * i));
+                count = count | (((uint64_t) payload[i] & 0x7f) << (7 * i));
             } else {
-                count = count | (((uint64_t) payload & 0x3f) << (7 * i));
+                count = count | (((uint64_t) payload[i] & 0x3f) << (7 * i));
             }
-        } while (((payload >> 7) == 1) && (++i < 3));
+        } while (((payload[i] >> 7) == 1) && (++i < 3));
 
         report("count: %d", count);
     } else {
         report("no count info");
     }
+
+    emit_event(EV_TIMESTAMP, header & 0x1, 0, count, timestamp);
 }
 
+// Entry points of the switch dispatch, the header table goes to handle_atoms directly
 void handle_atom1(uint8_t header) {
-    report("Atom 1 packet");
-    handle_atom(header & 0x1);
+    handle_atoms(header);
 }
 
 void handle_atom2(uint8_t header) {
-    report("Atom 2 packet");
-    handle_atom(header & 0x1);
-    handle_atom((header >> 1) & 0x1);
+    handle_atoms(header);
 }
 
 void handle_atom3(uint8_t header) {
-    report("Atom 3 packet");
-    handle_atom(header & 0x1);
-    handle_atom((header >> 1) & 0x1);
-    handle_atom((header >> 2) & 0x1);
+    handle_atoms(header);
 }
 
 void handle_atom4(uint8_t header) {
-    report("Atom 4 packet");
-    switch (header & 0b11)
-    {
-    case 0b00:
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(1);
-        handle_atom(1);
-        break;
-    case 0b01:
-        handle_atom(0);
-        handle_atom(0);
-        handle_atom(0);
-        handle_atom(0);
-        break;
-    case 0b10:
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(0);
-        handle_atom(1);
-        break;
-    case 0b11:
-        handle_atom(1);
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(0);
-        break;
-    }
+    handle_atoms(header);
 }
 
 void handle_atom5(uint8_t header) {
-    report("Atom 5 packet");
-    switch (((header >> 3) & 0b100) | (header & 0b11))
-    {
-    case 0b101:
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(1);
-        handle_atom(1);
-        handle_atom(1);
-        break;
-    case 0b001:
-        handle_atom(0);
-        handle_atom(0);
-        handle_atom(0);
-        handle_atom(0);
-        handle_atom(0);
-        break;
-    case 0b010:
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(0);
-        break;
-    case 0b011:
-        handle_atom(1);
-        handle_atom(0);
-        handle_atom(1);
-        handle_atom(0);
-        handle_atom(1);
-        break;
-    default:
-        report("UNDEFINED handle_atom5 case: 0x%x", header);
-        break;
-    }
+    handle_atoms(header);
 }
 
 void handle_atom6(uint8_t header) {
-    uint8_t i;
-    report("Atom 6 packet");
-
-    for (i = 0; i <= ((header & 0b11111) + 2); ++i) {
-        handle_atom(1);
-    }
-
-    handle_atom(!((header >> 5) & 0x1));
+    handle_atoms(header);
 }
 
 void handle_event(uint8_t header) {
     uint8_t field = header & 0xf;
     report("Events: %d%d%d%d", (field >> 3) & 0x1, (field >> 2) & 0x1, (field >> 1) & 0x1, field & 0x1);
+    emit_event(EV_EVENT, 0, 0, field, 0);
 }
 
-void handle_exception(void) {
-    uint8_t payload, efield, pfield;
-    uint16_t type;
-
-    report("Exception packet");
-    read_data(&payload, 1, 1);
-
-    efield = (((payload >> 5) & 0b10) | (payload & 0b1)) & 0b11;
-    type = (payload >> 1) & 0b11111;
-
-    if ((payload >> 7) == 1) {
-        read_data(&payload, 1, 1);
-        type = type | (((uint16_t) payload & 0b11111) << 5);
-        pfield = (payload >> 5) & 0x1;
-
-        report(pfield ? "serious fault pending" : "no serious fault pending");
-    }
-
-    report("type: 0x%x, e: %d", type, efield);
-
+const char* exception_name(uint16_t type) {
     switch (type)
     {
     case 0b00000:
-        report("PE reset");
-        break;
+        return "PE reset";
     case 0b00001:
-        report("Debug halt");
-        break;
+        return "Debug halt";
     case 0b00010:
-        report("Call");
-        break;
+        return "Call";
     case 0b00011:
-        report("Trap");
-        break;
+        return "Trap";
     case 0b00100:
-        report("System error");
-        break;
+        return "System error";
     case 0b00110:
-        report("Inst debug");
-        break;
+        return "Inst debug";
     case 0b00111:
-        report("Data debug");
-        break;
+        return "Data debug";
     case 0b01010:
-        report("Alignment");
-        break;
+        return "Alignment";
     case 0b01011:
-        report("Inst fault");
-        break;
+        return "Inst fault";
     case 0b01100:
-        report("Data fault");
-        break;
+        return "Data fault";
     case 0b01110:
-        report("IRQ");
-        break;
+        return "IRQ";
     case 0b01111:
-        report("FIQ");
-        break;
+        return "FIQ";
     default:
-        report("reserved type");
-        break;
+        return "reserved type";
+    }
+}
+
+void handle_exception(void) {
+    uint8_t efield, pfield;
+    const uint8_t* payload;
+    uint16_t type;
+
+    report("Exception packet");
+    if ((payload = take_continued(2)) == NULL)
+        return;
+
+    efield = (((payload[0] >> 5) & 0b10) | (payload[0] & 0b1)) & 0b11;
+    type = (payload[0] >> 1) & 0b11111;
+
+    if ((payload[0] >> 7) == 1) {
+        type = type | (((uint16_t) payload[1] & 0b11111) << 5);
+        pfield = (payload[1] >> 5) & 0x1;
+
+        report(pfield ? "serious fault pending" : "no serious fault pending");
     }
+
+    report("type: 0x%x, e: %d", type, efield);
+    emit_event(EV_EXCEPTION, efield, 0, type, 0);
+
+    report("%s", exception_name(type));
 }
 
 void handle_exceptionreturn(void) {
     report("Exception return packet");
+    emit_event(EV_EXCEPTION_RETURN, 0, 0, 0, 0);
 }
 
 void handle_functionreturn(void) {
@@ -609,26 +924,30 @@ void handle_functionreturn(void) {
 
 void handle_traceon(void) {
     report("Trace on packet");
+    emit_event(EV_TRACE_ON, 0, 0, 0, 0);
 }
 
 void handle_ccf1(uint8_t header) {
-    uint8_t payload, i = 0;
+    const uint8_t* payload;
+    uint8_t i = 0;
     uint32_t count = 0;
 
     report("CCF1 packet");
 
     if ((header & 0x1) == 0) {
-        do {
-            read_data(&payload, 1, 1);
+        if ((payload = take_continued(3)) == NULL)
+            return;
 
+        do {
             if (i != 2) {
-                count = count | (((uint32_t) payload & 0x7f) << (7 * i));
+                count = count | (((uint32_t) payload[i] & 0x7f) << (7 * i));
             } else {
-                count = count | (((uint32_t) payload & 0x3f) << (7 * i));
+                count = count | (((uint32_t) payload[i] & 0x3f) << (7 * i));
             }
-        } while (((payload >> 7) == 1) && (++i < 3));
+        } while (((payload[i] >> 7) == 1) && (++i < 3));
 
-        report("cc: %d", count + CC_THRESHOLD);
+        report("cc: %d", count + cc_threshold);
+        emit_event(EV_CYCLECOUNT, 0, 0, count + cc_threshold, 0);
     } else {
         report("CC unknown skip");
     }
@@ -636,13 +955,16 @@ void handle_ccf1(uint8_t header) {
 
 void handle_ccf2(uint8_t header) {
     (void) header; // should be used, this is not complete functionality of ccf2
-    uint8_t payload;
+    const uint8_t* payload;
     report("CCF2 packet");
-    read_data(&payload, 1, 1);
-    report("cc: %d", (payload & 0b1111) + CC_THRESHOLD);
+    if ((payload = take_payload(1)) == NULL)
+        return;
+    report("cc: %d", (payload[0] & 0b1111) + cc_threshold);
+    emit_event(EV_CYCLECOUNT, 0, 0, (payload[0] & 0b1111) + cc_threshold, 0);
 }
 
 void handle_ccf3(uint8_t header) {
     report("CCF3 packet");
-    report("cc: %d", (header & 0b11) + CC_THRESHOLD);
+    report("cc: %d", (header & 0b11) + cc_threshold);
+    emit_event(EV_CYCLECOUNT, 0, 0, (header & 0b11) + cc_threshold, 0);
 }
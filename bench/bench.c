@@ -6,7 +6,7 @@
  * Benchmark memory performance
  *
  * Compile:
- *   $ gcc -O2 -DNDEBUG -W -Wall -Wextra -Werror bench.c -o bench
+ *   $ gcc -O2 -DNDEBUG -W -Wall -Wextra -Werror -pthread bench.c -o bench
  *
  * Run (as root)
  *   $ ./bench <read|write|modify> [-s <size-in-MiB>] [-c <cpu>] [-p <prio>]
@@ -37,6 +37,7 @@
 #include <asm/unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 
 
 /* program name */
@@ -71,6 +72,9 @@ static char *map_addr_end;
 static size_t map_size;
 /* ==0: small pages, 1: huge pages */
 static int map_huge = 0;
+/* buffer of the calling thread for the copy tests, see copy_dst() */
+static __thread char *copy_addr;
+static __thread size_t copy_half;
 
 /* global options */
 static int option_perf = 0;
@@ -81,8 +85,31 @@ static int option_num_loops = 0;
 /* print delay milliseconds, default 1s */
 static int option_print_delay_ms = 1000;
 static int option_all = 0;
+static int option_latency = 0;
+/* ==0: mean bandwidth only, >0: linear tests also time every n cachelines */
+static unsigned int option_hist = 0;
 static FILE *csv_file = NULL;
 static int option_csv_no_header = 0;
+/* ==0: unthrottled, 1: budget of the TPAw0v R5 tracer, 2: fixed duty */
+static int option_regulated = 0;
+static unsigned int option_duty = 0;
+static unsigned int option_period_us = 1000;
+
+/* corunner budget of the TPAw0v R5 tracer in OCM, see paper_imp/tracer/src/session.h:
+ * the session block at 0xfffe3000, its budget line at +0x60 is duty, period_us, updates
+ */
+#define BUDGET_PAGE 0xfffe3000ul
+#define BUDGET_OFFSET 0x60
+#define BUDGET_FULL 256
+/* bytes accessed between two checks of the budget */
+#define BUDGET_CHUNK (16 * 1024)
+
+static volatile unsigned int *budget;
+
+/* co-runner threads, one per CPU, ==0: run in the main thread */
+#define MAX_THREADS 64
+static int option_threads = 0;
+static int thread_cpus[MAX_THREADS];
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -343,21 +370,29 @@ static inline void memory_barrier(void)
 #endif
 }
 
-static inline void flush_cacheline_all(void)
+static inline void flush_cacheline_range(char *ptr, const char *end)
 {
-	char *ptr = map_addr;
-	const char *end = map_addr_end;
-
 	for (; ptr < end; ptr += CACHELINE_SIZE) {
 		flush_cacheline(ptr);
 	}
 	memory_barrier();
 }
 
+static inline void flush_cacheline_all(void)
+{
+	flush_cacheline_range(map_addr, map_addr_end);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 /* generate a set of non-inlined benchmark loops */
 #define BENCH_CACHELINE(name)	\
+	static void name ## _range(char *ptr, char *end)	\
+	{	\
+		for (; ptr < end; ptr += CACHELINE_SIZE) {	\
+			name(ptr);	\
+		}	\
+	}	\
 	static void name ## _linear(void)	\
 	{	\
 		char *ptr = map_addr;	\
@@ -377,7 +412,8 @@ static inline void flush_cacheline_all(void)
 
 #define BENCH_NAMES(name)	\
 	.bench_linear = name ## _linear,	\
-	.bench_step = name ## _step
+	.bench_step = name ## _step,	\
+	.bench_range = name ## _range
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -415,6 +451,22 @@ BENCH_CACHELINE(ldnp_cacheline)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#if defined __aarch64__
+
+/* load a complete cache line using a NEON LD1 of four registers */
+static inline void ld1_cacheline(void *addr)
+{
+	__asm__ volatile (
+		"ld1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%0]\n"
+		: : "r"(addr) : "v0", "v1", "v2", "v3", "memory");
+}
+
+BENCH_CACHELINE(ld1_cacheline)
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
 /* write to a complete cache line using stores */
 static inline void write_cacheline(void *addr)
 {
@@ -476,6 +528,22 @@ BENCH_CACHELINE(stnp_cacheline)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#if defined __aarch64__
+
+/* write to a complete cache line using a NEON ST1 of four registers */
+static inline void st1_cacheline(void *addr)
+{
+	__asm__ volatile (
+		"st1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%0]\n"
+		: : "r"(addr) : "memory");
+}
+
+BENCH_CACHELINE(st1_cacheline)
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
 /* modify a single word in a cache line, effectively a read-modify-write */
 static inline void modify_cacheline(void *addr)
 {
@@ -529,6 +597,47 @@ BENCH_CACHELINE(stnp_modify_cacheline)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*
+ * The copy tests read a cache line and write it to the line half a buffer
+ * away, so a pass reads and writes every line once in two separate streams.
+ */
+static inline void *copy_dst(void *addr)
+{
+	char *p = addr;
+
+	if (p < copy_addr + copy_half) {
+		return p + copy_half;
+	}
+	return p - copy_half;
+}
+
+/* copy a complete cache line using loads and stores */
+static inline void copy_cacheline(void *addr)
+{
+	memcpy(copy_dst(addr), addr, CACHELINE_SIZE);
+	/* the compiler barrier keeps the copy */
+	__asm__ volatile ("" : : : "memory");
+}
+
+BENCH_CACHELINE(copy_cacheline)
+
+#if defined __aarch64__
+
+/* copy a complete cache line using NEON LD1 and ST1 of four registers */
+static inline void ld1st1_cacheline(void *addr)
+{
+	__asm__ volatile (
+		"ld1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%0]\n"
+		"st1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%1]\n"
+		: : "r"(addr), "r"(copy_dst(addr)) : "v0", "v1", "v2", "v3", "memory");
+}
+
+BENCH_CACHELINE(ld1st1_cacheline)
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
 #if defined __aarch64__ || defined __x86_64__
 
 /* prefetch a full cacheline to L1 for reading */
@@ -689,21 +798,28 @@ static struct test {
 	const char *name;
 	void (*bench_linear)(void);
 	void (*bench_step)(size_t);
+	void (*bench_range)(char *, char *);
 	const char *desc;
 } tests[] = {
 	{	.name = "read", BENCH_NAMES(read_cacheline), .desc = "read cacheline",	},
 #if defined __aarch64__
 	{	.name = "read_ldnp", BENCH_NAMES(ldnp_cacheline), .desc = "read cacheline using LDNP (Arm)",	},
+	{	.name = "read_ld1", BENCH_NAMES(ld1_cacheline), .desc = "read cacheline using NEON LD1 (Arm)",	},
 #endif
 	{	.name = "write", BENCH_NAMES(write_cacheline), .desc = "write full cacheline",	},
 #if defined __aarch64__
 	{	.name = "write_dczva", BENCH_NAMES(dczva_cacheline), .desc = "write full cacheline using DC ZVA (Arm)",	},
 	{	.name = "write_stnp", BENCH_NAMES(stnp_cacheline), .desc = "write full cacheline using STNP (Arm)",	},
+	{	.name = "write_st1", BENCH_NAMES(st1_cacheline), .desc = "write full cacheline using NEON ST1 (Arm)",	},
 #endif
 	{	.name = "modify", BENCH_NAMES(modify_cacheline), .desc = "modify cacheline",	},
 #if defined __aarch64__
 	{	.name = "modify_prefetch", BENCH_NAMES(prefetch_modify_cacheline), .desc = "modify cacheline with prefetching (Arm)",	},
 	{	.name = "modify_stnp", BENCH_NAMES(stnp_modify_cacheline), .desc = "modify cacheline using STNP (Arm)",	},
+#endif
+	{	.name = "copy", BENCH_NAMES(copy_cacheline), .desc = "copy cacheline to the other buffer half",	},
+#if defined __aarch64__
+	{	.name = "copy_ld1", BENCH_NAMES(ld1st1_cacheline), .desc = "copy cacheline using NEON LD1/ST1 (Arm)",	},
 #endif
 #if defined __aarch64__ || defined __x86_64__
 	{	.name = "prefetch_l1", BENCH_NAMES(prefetch_l1_cacheline), .desc = "prefetch cacheline to L1 for reading",	},
@@ -729,7 +845,100 @@ static struct test {
 	{	.name = NULL, .desc = NULL,	},
 };
 
-static void bench_linear(const char *name, void (*bench)(void))
+/*
+ * Log-linear histogram of the sample times of --hist in ns: values below
+ * HIST_SUB exactly, above in HIST_SUB buckets per power of two, so a
+ * bucket is at most 1/HIST_SUB wide relative to its value.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+static struct hist {
+	unsigned long long count[HIST_BUCKETS];
+	unsigned long long n;
+	unsigned long long min;
+	unsigned long long max;
+} hist;
+
+static inline unsigned int hist_bucket(unsigned long long val)
+{
+	unsigned int e;
+
+	if (val < HIST_SUB) {
+		return val;
+	}
+	e = 63 - __builtin_clzll(val);
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB + ((val >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* smallest value of a bucket */
+static inline unsigned long long hist_lower(unsigned int bucket)
+{
+	if (bucket < HIST_SUB) {
+		return bucket;
+	}
+	return (unsigned long long)(HIST_SUB + bucket % HIST_SUB) << (bucket / HIST_SUB - 1);
+}
+
+static void hist_reset(void)
+{
+	memset(&hist, 0, sizeof(hist));
+	hist.min = -1ull;
+}
+
+static inline void hist_add(unsigned long long val)
+{
+	hist.count[hist_bucket(val)]++;
+	hist.n++;
+	if (val < hist.min) {
+		hist.min = val;
+	}
+	if (val > hist.max) {
+		hist.max = val;
+	}
+}
+
+/* the largest value of the bucket holding quantile q, at most the maximum */
+static unsigned long long hist_quantile(double q)
+{
+	unsigned long long target = q * hist.n + 0.5;
+	unsigned long long upper;
+	unsigned long long sum = 0;
+	unsigned int b;
+
+	if (target == 0) {
+		target = 1;
+	}
+	for (b = 0; b < HIST_BUCKETS - 1; b++) {
+		sum += hist.count[b];
+		if (sum >= target) {
+			break;
+		}
+	}
+	upper = hist_lower(b + 1) - 1;
+	return upper < hist.max ? upper : hist.max;
+}
+
+/* one pass over the mapping, a sample per option_hist cachelines */
+static void bench_chunks(void (*bench)(char *, char *))
+{
+	size_t chunk = (size_t)option_hist * CACHELINE_SIZE;
+	struct timespec ts_prev, ts_now;
+	char *ptr = map_addr;
+	char *end;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_prev);
+	for (; ptr < map_addr_end; ptr = end) {
+		end = ptr + chunk < map_addr_end ? ptr + chunk : map_addr_end;
+		bench(ptr, end);
+		clock_gettime(CLOCK_MONOTONIC, &ts_now);
+		hist_add(timespec_ns(&ts_now) - timespec_ns(&ts_prev));
+		ts_prev = ts_now;
+	}
+}
+
+static void bench_linear(const char *name, void (*bench)(void), void (*bench_range)(char *, char *))
 {
 	struct timespec ts_now, ts_start, ts_end, ts_tmp;
 	unsigned long long bytes_accessed;
@@ -754,9 +963,14 @@ static void bench_linear(const char *name, void (*bench)(void))
 	loops = 0;
 
 	perf_read(perf_prev_values); //
+	hist_reset();
 
 	while (1) {
-		bench();
+		if (option_hist != 0) {
+			bench_chunks(bench_range);
+		} else {
+			bench();
+		}
 		runs++;
 
 		clock_gettime(CLOCK_MONOTONIC, &ts_now);
@@ -787,12 +1001,32 @@ static void bench_linear(const char *name, void (*bench)(void))
 #endif
 			}
 #endif
+			if (option_hist != 0) {
+				printf(", %u lines: min %llu, p50 %llu, p99 %llu, max %llu ns", option_hist,
+				       hist.min, hist_quantile(0.5), hist_quantile(0.99), hist.max);
+			}
 			printf("\n");
 
 			if (csv_file != NULL) {
-				fprintf(csv_file, "%s;%d;%llu;%llu;%llu\n",
+				fprintf(csv_file, "%s;%d;%llu;%llu;%llu",
 				        name, CACHELINE_SIZE, delta_t_ns,
 				        bytes_accessed, sum * CACHELINE_SIZE);
+				if (option_hist != 0) {
+					/* the raw counters, then the non-empty buckets as <lower ns>:<count> */
+					fprintf(csv_file, ";%llu;%llu;%llu;%llu;%llu",
+					        hist.n, hist.min, hist_quantile(0.5), hist_quantile(0.99), hist.max);
+					for (int i = 0; i < NUM_PERF; i++) {
+						fprintf(csv_file, ";%llu", perf_delta_values[i]);
+					}
+					char delim = ';';
+					for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+						if (hist.count[b] != 0) {
+							fprintf(csv_file, "%c%llu:%llu", delim, hist_lower(b), hist.count[b]);
+							delim = ' ';
+						}
+					}
+				}
+				fprintf(csv_file, "\n");
 				fflush(csv_file);
 			}
 
@@ -807,6 +1041,7 @@ static void bench_linear(const char *name, void (*bench)(void))
 			runs = 0;
 
 			perf_read(perf_prev_values);
+			hist_reset();
 		}
 	}
 }
@@ -988,160 +1223,1098 @@ static void bench_auto(const char *name, void (*bench)(size_t))
 	printf("slowest step size: %zu\n", min_step);
 }
 
-/* map memory, preferrably using huge TLBs  */
-static void *map(size_t size)
-{
+/*
+ * Physical worst-case search of --phys: the frame number of every page of
+ * the buffer comes from /proc/self/pagemap (root only). Alternating reads
+ * of two uncached lines are slow when both are in the same DRAM bank, but
+ * in different rows. Flipping single physical address bits and pairs of
+ * them tells row, column and bank bits apart, then the test runs over one
+ * line of every row of the bank of the first line of the buffer.
+ */
+#define PHYS_MIN_BIT 6
+#define PHYS_MAX_BIT 47
+/* rounds of alternating reads per timing, and timings per pair (minimum) */
+#define PHYS_ROUNDS 1000
+#define PHYS_REPEAT 5
+
+/* physical page of a virtual one, phys_sorted is sorted by frame number */
+static struct phys_page {
+	unsigned long long pfn;
 	char *addr;
-	int flags;
-	int flags_huge;
+} *phys_sorted;
+static unsigned long long *phys_pfns;
+static size_t phys_num_pages;
+static size_t phys_page_size;
 
-	flags = MAP_PRIVATE | MAP_ANONYMOUS;
-	flags_huge = MAP_HUGETLB | MAP_HUGE_2MB;
-	if (option_huge) {
-		flags |= flags_huge;
-		map_huge = 1;
-	}
+/* lines of the worst-case set */
+static char **phys_set;
+static size_t phys_set_lines;
 
-again:
-	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
-	if (addr == MAP_FAILED) {
-		/* if huge TLBs fail, try again with normal pages */
-		if ((flags & MAP_HUGETLB) != 0) {
-			if (errno == ENOMEM) {
-				printf("# mapping memory as huge TLBs failed, this impacts results due to TLB misses\n"
-					   "# increase number of huge TLBs: $ sudo sysctl -w vm.nr_hugepages=%zu\n",
-					   (size + 0x200000 - 1) / 0x200000);
-			}
-			flags &= ~flags_huge;
-			map_huge = 0;
-			goto again;
-		}
+static int phys_page_cmp(const void *a, const void *b)
+{
+	const struct phys_page *pa = a;
+	const struct phys_page *pb = b;
 
-		perror("mmap");
+	return (pa->pfn > pb->pfn) - (pa->pfn < pb->pfn);
+}
+
+static void phys_map(void)
+{
+	unsigned long long entry;
+	ssize_t r;
+	int fd;
+
+	phys_page_size = sysconf(_SC_PAGESIZE);
+	phys_num_pages = map_size / phys_page_size;
+	phys_pfns = malloc(phys_num_pages * sizeof(phys_pfns[0]));
+	phys_sorted = malloc(phys_num_pages * sizeof(phys_sorted[0]));
+	if (phys_pfns == NULL || phys_sorted == NULL) {
+		perror("malloc");
 		exit(EXIT_FAILURE);
 	}
 
-	return addr;
+	fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		perror("open /proc/self/pagemap");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < phys_num_pages; i++) {
+		char *addr = &map_addr[i * phys_page_size];
+
+		r = pread(fd, &entry, sizeof(entry), (unsigned long)addr / phys_page_size * sizeof(entry));
+		if (r != sizeof(entry)) {
+			perror("read /proc/self/pagemap");
+			exit(EXIT_FAILURE);
+		}
+		/* bit 63: present, bits 0..54: frame number, reads as 0 without root */
+		phys_pfns[i] = entry & ((1ull << 55) - 1);
+		if ((entry & (1ull << 63)) == 0 || phys_pfns[i] == 0) {
+			fprintf(stderr, "error: no physical addresses in /proc/self/pagemap, rerun as root user\n");
+			exit(EXIT_FAILURE);
+		}
+		phys_sorted[i].pfn = phys_pfns[i];
+		phys_sorted[i].addr = addr;
+	}
+	close(fd);
+
+	qsort(phys_sorted, phys_num_pages, sizeof(phys_sorted[0]), phys_page_cmp);
 }
 
-static void version(FILE *f)
+static inline unsigned long long phys_of(const char *addr)
 {
-	fprintf(f, PROGNAME " build " BUILDID
-#ifndef NDEBUG
-	        " DEBUG"
-#endif
-	        "\n");
+	size_t offset = addr - map_addr;
+
+	return phys_pfns[offset / phys_page_size] * phys_page_size + offset % phys_page_size;
 }
 
-static void usage(FILE *f)
+/* virtual address of a physical one in the buffer, or NULL */
+static char *phys_find(unsigned long long pa)
 {
-	struct test *t;
+	unsigned long long pfn = pa / phys_page_size;
+	size_t lo = 0;
+	size_t hi = phys_num_pages;
 
-	version(f);
-	fprintf(f, "usage: " PROGNAME " [<options>] <test>\n\n"
-	        "Platform memory benchmarks.\n\n"
-	        "Options:\n"
-	        "  -s|--size <size>  memory size in MiB (default %d MiB)\n"
-	        "  -c|--cpu <cpu>    run on given CPU ID (default any)\n"
-	        "  -p|--prio <prio>  run at given priority (default current)\n"
-	        "  -l|--loops <num>  stop after given number of loops (default run infinitely)\n"
-	        "  -d|--delay <ms>   print bandwidth after given ms (default %d ms)\n"
-	        "  --huge            enable huge pages\n"
-	        "  --perf            enable perf tracing\n"
-	        "  --step <bytes>    access memory with given step in bytes\n"
-	        "  --auto            auto-detect worst-case memory access\n"
-	        "  --all             run all tests (don't specify a test, -l 1 set implicitly)\n"
-	        "  --csv <file>      export data as CSV to file\n"
-	        "  --csv-no-header   do not print a header in the CSV file\n"
-	        "  --version         print version info\n"
-	        "  --help            show usage\n"
-	        "Tests:\n",
-	        DEFAULT_MB, option_print_delay_ms);
-	for (t = tests; t->name != NULL; t++) {
-		fprintf(f, "  %-18s%s\n", t->name, t->desc != NULL ? t->desc : "");
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (phys_sorted[mid].pfn < pfn) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == phys_num_pages || phys_sorted[lo].pfn != pfn) {
+		return NULL;
 	}
+	return phys_sorted[lo].addr + pa % phys_page_size;
 }
 
-int main(int argc, char *argv[])
+/* time of PHYS_ROUNDS alternating uncached reads of two lines in ns */
+static unsigned long long phys_time(char *a, char *b)
 {
-	struct test *t = tests;
-	const char *mode_str = NULL;
-	const char *size_str = NULL;
-	const char *cpu_str = NULL;
-	const char *prio_str = NULL;
-	const char *step_str = NULL;
-	const char *loop_str = NULL;
-	const char *delay_str = NULL;
-	const char *csv_file_str = NULL;
-	unsigned int step_size = CACHELINE_SIZE;
-	unsigned int mb = DEFAULT_MB;
-	int arg;
-
-	for (arg = 1; arg < argc; arg++) {
-		if (argv[arg][0] != '-') {
-			if (mode_str != NULL) {
-				usage(stderr);
-				return EXIT_FAILURE;
-			}
-			mode_str = argv[arg];
-			continue;
+	struct timespec ts_start, ts_end, ts_tmp;
+	unsigned long long t, min = -1ull;
+
+	for (int r = 0; r < PHYS_REPEAT; r++) {
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		for (int i = 0; i < PHYS_ROUNDS; i++) {
+			read_cacheline(a);
+			read_cacheline(b);
+			flush_cacheline(a);
+			flush_cacheline(b);
+			memory_barrier();
 		}
-
-		if (!strcmp(argv[arg], "--version")) {
-			version(stdout);
-			return EXIT_SUCCESS;
-		} else if (!strcmp(argv[arg], "--help")) {
-			usage(stdout);
-			return EXIT_SUCCESS;
-		} else if (!strcmp(argv[arg], "--size") || !strcmp(argv[arg], "-s")) {
-			arg++;
-			size_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--cpu") || !strcmp(argv[arg], "-c")) {
-			arg++;
-			cpu_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--prio") || !strcmp(argv[arg], "-p")) {
-			arg++;
-			prio_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--perf")) {
-			option_perf = 1;
-		} else if (!strcmp(argv[arg], "--huge")) {
-			option_huge = 1;
-		} else if (!strcmp(argv[arg], "--step")) {
-			option_step = 1;
-			arg++;
-			step_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--loops") || !strcmp(argv[arg], "-l")) {
-			arg++;
-			loop_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--delay") || !strcmp(argv[arg], "-d")) {
-			arg++;
-			delay_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--auto")) {
-			option_step = 2;
-		} else if (!strcmp(argv[arg], "--all")) {
-			option_all = 1;
-			/* changes the number of loops to 1 by default */
-			option_num_loops = 1;
-		} else if (!strcmp(argv[arg], "--csv")) {
-			arg++;
-			csv_file_str = argv[arg];
-		} else if (!strcmp(argv[arg], "--csv-no-header")) {
-			option_csv_no_header = 1;
-		} else {
-			fprintf(stderr, "unknown option '%s'\n", argv[arg]);
-			usage(stderr);
-			return EXIT_FAILURE;
+		clock_gettime(CLOCK_MONOTONIC, &ts_end);
+		t = timespec_ns(timespec_sub(&ts_end, &ts_start, &ts_tmp));
+		if (t < min) {
+			min = t;
 		}
 	}
 
-	if ((arg != argc) || ((option_all == 0) && (mode_str == NULL))
-	                  || ((option_all != 0) && (mode_str != NULL))) {
-		usage(stderr);
-		return EXIT_FAILURE;
+	return min;
+}
+
+/* time of a pair of lines whose physical addresses differ in mask, 0 if none */
+static unsigned long long phys_flip(unsigned long long mask)
+{
+	for (size_t i = 0; i < phys_num_pages; i++) {
+		char *a = &map_addr[i * phys_page_size];
+		char *b = phys_find(phys_of(a) ^ mask);
+
+		if (b != NULL) {
+			return phys_time(a, b);
+		}
 	}
 
+	return 0;
+}
+
+static void phys_print_bits(const char *what, unsigned long long mask)
+{
+	printf("%s:", what);
+	for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+		if ((mask & (1ull << bit)) != 0) {
+			printf(" %d", bit);
+		}
+	}
+	printf("\n");
+}
+
+/*
+ * Flipping a bit alone is slow for row bits that are in no bank function.
+ * Together with such a row bit, flipping a column bit is slow (same bank,
+ * other row) and flipping a bank bit is fast. Two bank bits flipped
+ * together are slow if they are in the same XOR function, one a row bit.
+ */
+static void phys_setup(void)
+{
+	unsigned long long t_bit[PHYS_MAX_BIT + 1] = { 0 };
+	unsigned long long t_min = -1ull, t_max = 0, thr;
+	unsigned long long tested = 0, row = 0, column = 0, bank = 0;
+	/* XOR functions, group[bit] is the mask of the function of bit */
+	unsigned long long group[PHYS_MAX_BIT + 1] = { 0 };
+	unsigned long long keep, xors, pa, base;
+	int row_bit = -1;
+
+	phys_map();
+	flush_cacheline_all();
+
+	for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+		t_bit[bit] = phys_flip(1ull << bit);
+		if (t_bit[bit] == 0) {
+			continue;
+		}
+		tested |= 1ull << bit;
+		if (t_bit[bit] < t_min) {
+			t_min = t_bit[bit];
+		}
+		if (t_bit[bit] > t_max) {
+			t_max = t_bit[bit];
+		}
+	}
+	/* row misses should take at least 10% longer than the rest */
+	if (tested == 0 || t_max * 10 < t_min * 11) {
+		fprintf(stderr, "error: no row conflicts found, try a larger size or --huge\n");
+		exit(EXIT_FAILURE);
+	}
+	thr = (t_min + t_max) / 2;
+
+	for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+		if (t_bit[bit] > thr) {
+			row |= 1ull << bit;
+			if (row_bit < 0) {
+				row_bit = bit;
+			}
+		}
+	}
+	for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+		unsigned long long m = 1ull << bit;
+		unsigned long long t;
+
+		if ((tested & m) == 0 || (row & m) != 0) {
+			continue;
+		}
+		t = phys_flip(m | (1ull << row_bit));
+		if (t == 0) {
+			tested &= ~m;
+		} else if (t > thr) {
+			column |= m;
+		} else {
+			bank |= m;
+		}
+	}
+	for (int b1 = PHYS_MIN_BIT; b1 <= PHYS_MAX_BIT; b1++) {
+		if ((bank & (1ull << b1)) == 0) {
+			continue;
+		}
+		for (int b2 = b1 + 1; b2 <= PHYS_MAX_BIT; b2++) {
+			if ((bank & (1ull << b2)) == 0) {
+				continue;
+			}
+			if (phys_flip((1ull << b1) | (1ull << b2)) > thr) {
+				unsigned long long m = group[b1] | group[b2] | (1ull << b1) | (1ull << b2);
+
+				for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+					if ((m & (1ull << bit)) != 0) {
+						group[bit] = m;
+					}
+				}
+			}
+		}
+	}
+
+	printf("# alternating reads: %.1f ns fastest, %.1f ns slowest\n",
+	       (double)t_min / PHYS_ROUNDS, (double)t_max / PHYS_ROUNDS);
+	phys_print_bits("# row bits", row);
+	phys_print_bits("# column bits", column);
+	phys_print_bits("# bank bits", bank);
+	xors = 0;
+	for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+		if (group[bit] != 0 && (xors & group[bit]) == 0) {
+			phys_print_bits("# bank xor", group[bit]);
+			xors |= group[bit];
+		}
+	}
+
+	/*
+	 * Lines of the set differ from the first line only in row bits and in
+	 * an even number of bits of each XOR function: same bank, other rows.
+	 * All other bits, including untested ones, must match.
+	 */
+	keep = ~(row | xors);
+	base = phys_of(map_addr);
+	phys_set = malloc(map_size / CACHELINE_SIZE * sizeof(phys_set[0]));
+	if (phys_set == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	phys_set_lines = 0;
+	for (char *ptr = map_addr; ptr < map_addr_end; ptr += CACHELINE_SIZE) {
+		int same_bank = 1;
+
+		pa = phys_of(ptr) ^ base;
+		if ((pa & keep) != 0) {
+			continue;
+		}
+		for (int bit = PHYS_MIN_BIT; bit <= PHYS_MAX_BIT; bit++) {
+			if (group[bit] != 0 && (__builtin_popcountll(pa & group[bit]) & 1) != 0) {
+				same_bank = 0;
+				break;
+			}
+		}
+		if (same_bank) {
+			phys_set[phys_set_lines++] = ptr;
+		}
+	}
+	printf("# worst-case set: %zu lines in one bank\n", phys_set_lines);
+	if (phys_set_lines < 2) {
+		fprintf(stderr, "error: too few lines in the bank, try a larger size\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void bench_phys(const char *name, void (*bench)(char *, char *))
+{
+	struct timespec ts_now, ts_start, ts_end, ts_tmp;
+	unsigned long long bytes_accessed;
+	unsigned long long delta_t_ns;
+	unsigned long long sum = 0;
+	unsigned long long runs;
+	int loops;
+	double bw;
+
+	printf("worst-case %s bandwidth over %zu lines of one bank in %zu MiB block", name,
+	       phys_set_lines, map_size / 1024 / 1024);
+	if (map_huge != 0) {
+		printf(" (huge TLB)");
+	}
+	printf("\n");
+
+	flush_cacheline_all();
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	ts_end = ts_start;
+	timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+	runs = 0;
+	loops = 0;
+
+	perf_read(perf_prev_values);
+
+	while (1) {
+		/* the set may fit into the caches, flushing keeps every access in DRAM */
+		for (size_t i = 0; i < phys_set_lines; i++) {
+			bench(phys_set[i], phys_set[i] + CACHELINE_SIZE);
+			flush_cacheline(phys_set[i]);
+		}
+		runs++;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts_now);
+		if (!timespec_is_le(&ts_now, &ts_end)) {
+			perf_read(perf_curr_values);
+			perf_delta(perf_curr_values, perf_prev_values, perf_delta_values);
+
+			bytes_accessed = runs * phys_set_lines * CACHELINE_SIZE;
+			delta_t_ns = timespec_ns(timespec_sub(&ts_now, &ts_start, &ts_tmp));
+			bw = 1000.0 * bytes_accessed / delta_t_ns;
+
+			printf("%.1f MiB/s, %.1f MB/s", to_mib(bw), bw);
+#if NUM_PERF > 0
+			if (perf_ok) {
+#if NUM_PERF == 1
+				printf(", perf: %.1f MB/s", 1000.0 * perf_delta_values[0] * CACHELINE_SIZE / delta_t_ns);
+#else
+				char delim = ' ';
+				sum = 0;
+
+				printf(", perf:");
+				for (unsigned int i = 0; i < NUM_PERF; i++) {
+					printf("%c%.1f", delim, 1000.0 * perf_delta_values[i] * CACHELINE_SIZE / delta_t_ns);
+					sum += perf_delta_values[i];
+					delim = '+';
+				}
+				printf("=%.1f MB/s", 1000.0 * sum * CACHELINE_SIZE / delta_t_ns);
+#endif
+			}
+#endif
+			printf("\n");
+
+			if (csv_file != NULL) {
+				/* step 0: the lines of the bank set, no fixed step */
+				fprintf(csv_file, "%s;%d;%llu;%llu;%llu\n",
+				        name, 0, delta_t_ns,
+				        bytes_accessed, sum * CACHELINE_SIZE);
+				fflush(csv_file);
+			}
+
+			loops++;
+			if (loops == option_num_loops) {
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &ts_start);
+			ts_end = ts_start;
+			timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+			runs = 0;
+
+			perf_read(perf_prev_values);
+		}
+	}
+}
+
+/* smallest working set of the latency test, and loads between two clock reads */
+#define CHASE_MIN_SIZE 4096
+#define CHASE_BATCH 65536
+
+/* xorshift64, with a fixed seed the chains are the same on every run */
+static inline unsigned long long chase_rand(unsigned long long *state)
+{
+	unsigned long long x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+/*
+ * Link the cachelines of the first size bytes of the mapping into one
+ * cycle in random order, so that every load depends on the one before and
+ * the prefetchers cannot guess the next line. Returns the first line.
+ */
+static void *chase_build(size_t size)
+{
+	unsigned long long state = 0x2545f4914f6cdd1dull;
+	size_t lines = size / CACHELINE_SIZE;
+	unsigned int *order;
+	unsigned int tmp;
+	size_t i, j;
+
+	order = malloc(lines * sizeof(*order));
+	if (order == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < lines; i++) {
+		order[i] = i;
+	}
+	for (i = lines - 1; i > 0; i--) {
+		j = chase_rand(&state) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < lines; i++) {
+		*(char **)&map_addr[(size_t)order[i] * CACHELINE_SIZE] =
+			&map_addr[(size_t)order[(i + 1) % lines] * CACHELINE_SIZE];
+	}
+	i = order[0];
+	free(order);
+
+	return &map_addr[i * CACHELINE_SIZE];
+}
+
+/* n dependent loads along the chain, n a multiple of 8 */
+static __attribute__((noinline)) void *chase(void *p, unsigned long n)
+{
+	void **q = p;
+
+	for (; n > 0; n -= 8) {
+		q = *q;
+		q = *q;
+		q = *q;
+		q = *q;
+		q = *q;
+		q = *q;
+		q = *q;
+		q = *q;
+	}
+
+	return q;
+}
+
+/*
+ * Load-to-use latency for growing working sets, from CHASE_MIN_SIZE up to
+ * the mapping in steps of 2^n and 1.5 * 2^n: a random chain through the
+ * working set is walked for the print delay. Without huge pages the larger
+ * sets also miss in the TLB.
+ */
+static void bench_latency(void)
+{
+	struct timespec ts_now, ts_start, ts_end, ts_tmp;
+	unsigned long long delta_t_ns;
+	unsigned long long loads;
+	size_t size;
+	int loops;
+	void *p;
+
+	printf("pointer chasing latency over up to %zu MiB block", map_size / 1024 / 1024);
+	if (map_huge != 0) {
+		printf(" (huge TLB)");
+	}
+	printf("\n");
+
+	loops = 0;
+	while (1) {
+		for (size = CHASE_MIN_SIZE; size <= map_size; ) {
+			p = chase_build(size);
+			/* warm up caches and TLBs with the whole chain */
+			p = chase(p, (size / CACHELINE_SIZE + 7) & ~7ul);
+
+			clock_gettime(CLOCK_MONOTONIC, &ts_start);
+			ts_end = ts_start;
+			timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+			loads = 0;
+			do {
+				p = chase(p, CHASE_BATCH);
+				loads += CHASE_BATCH;
+				clock_gettime(CLOCK_MONOTONIC, &ts_now);
+			} while (timespec_is_le(&ts_now, &ts_end));
+			/* consume p */
+			__asm__ volatile ("" : : "r"(p) : "memory");
+
+			delta_t_ns = timespec_ns(timespec_sub(&ts_now, &ts_start, &ts_tmp));
+			printf("%8zu KiB: %.2f ns per load\n", size / 1024, (double)delta_t_ns / loads);
+
+			if (csv_file != NULL) {
+				fprintf(csv_file, "latency;%zu;%llu;%llu;%llu\n",
+				        size, delta_t_ns, loads * CACHELINE_SIZE, 0ull);
+				fflush(csv_file);
+			}
+
+			/* 4, 6, 8, 12, 16 ... KiB */
+			if ((size & (size - 1)) == 0) {
+				size += size / 2;
+			} else {
+				size = size / 3 * 4;
+			}
+		}
+
+		loops++;
+		if (loops == option_num_loops) {
+			break;
+		}
+	}
+}
+
+/* map the budget line the tracer writes, uncached */
+static void budget_map(void)
+{
+	char *page;
+	int fd;
+
+	fd = open("/dev/mem", O_RDONLY | O_SYNC);
+	if (fd == -1) {
+		perror("open /dev/mem");
+		exit(EXIT_FAILURE);
+	}
+	page = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, BUDGET_PAGE);
+	if (page == MAP_FAILED) {
+		perror("mmap budget");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	budget = (volatile unsigned int *)(page + BUDGET_OFFSET);
+}
+
+/* duty of BUDGET_FULL and period of the current budget */
+static inline void budget_get(unsigned int *duty, unsigned int *period_us)
+{
+	if (option_regulated == 2) {
+		*duty = option_duty;
+		*period_us = option_period_us;
+		return;
+	}
+	*duty = budget[0];
+	*period_us = budget[1];
+	if (*duty > BUDGET_FULL) {
+		*duty = BUDGET_FULL;
+	}
+	if (*period_us == 0) {
+		*period_us = option_period_us;
+	}
+}
+
+/*
+ * A corunner keeping to a budget: in every period, it accesses memory in
+ * BUDGET_CHUNK steps for duty / BUDGET_FULL of the period, then sleeps
+ * until the next one. A period missed entirely is not made up for.
+ */
+static void bench_regulated(const char *name, void (*bench)(char *, char *))
+{
+	struct timespec ts_now, ts_start, ts_end, ts_period, ts_run, ts_tmp;
+	unsigned long long bytes_accessed;
+	unsigned long long delta_t_ns;
+	unsigned long long duty_sum;
+	unsigned long long periods;
+	unsigned int duty, period_us;
+	char *ptr = map_addr;
+	int loops;
+	double bw;
+
+	printf("regulated %s bandwidth over %zu MiB block, %s budget", name, map_size / 1024 / 1024,
+	       option_regulated == 2 ? "fixed" : "tracer");
+	if (map_huge != 0) {
+		printf(" (huge TLB)");
+	}
+	printf("\n");
+
+	flush_cacheline_all();
+
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
+	ts_end = ts_start;
+	timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+	ts_period = ts_start;
+	bytes_accessed = 0;
+	duty_sum = 0;
+	periods = 0;
+	loops = 0;
+
+	while (1) {
+		budget_get(&duty, &period_us);
+		duty_sum += duty;
+		periods++;
+
+		ts_run = ts_period;
+		timespec_inc_by(&ts_run, period_us * 1000ull * duty / BUDGET_FULL);
+		while (duty > 0) {
+			bench(ptr, ptr + BUDGET_CHUNK);
+			bytes_accessed += BUDGET_CHUNK;
+			ptr += BUDGET_CHUNK;
+			if (ptr >= map_addr_end) {
+				ptr = map_addr;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &ts_now);
+			if (!timespec_is_le(&ts_now, &ts_run)) {
+				break;
+			}
+		}
+
+		timespec_inc_by(&ts_period, period_us * 1000ull);
+		if (duty < BUDGET_FULL) {
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_period, NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts_now);
+		if (!timespec_is_le(&ts_now, &ts_period)) {
+			ts_period = ts_now;
+		}
+
+		if (!timespec_is_le(&ts_now, &ts_end)) {
+			delta_t_ns = timespec_ns(timespec_sub(&ts_now, &ts_start, &ts_tmp));
+			bw = 1000.0 * bytes_accessed / delta_t_ns;
+
+			printf("%.1f MiB/s, %.1f MB/s, duty %.1f%%\n", to_mib(bw), bw,
+			       100.0 * duty_sum / periods / BUDGET_FULL);
+
+			if (csv_file != NULL) {
+				fprintf(csv_file, "%s;%d;%llu;%llu;%llu\n",
+				        name, CACHELINE_SIZE, delta_t_ns,
+				        bytes_accessed, 0ull);
+				fflush(csv_file);
+			}
+
+			loops++;
+			if (loops == option_num_loops) {
+				break;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &ts_start);
+			ts_end = ts_start;
+			timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+			bytes_accessed = 0;
+			duty_sum = 0;
+			periods = 0;
+		}
+	}
+}
+
+/* map memory, preferrably using huge TLBs  */
+static void *map(size_t size)
+{
+	char *addr;
+	int flags;
+	int flags_huge;
+
+	flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	flags_huge = MAP_HUGETLB | MAP_HUGE_2MB;
+	if (option_huge) {
+		flags |= flags_huge;
+		map_huge = 1;
+	}
+
+again:
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (addr == MAP_FAILED) {
+		/* if huge TLBs fail, try again with normal pages */
+		if ((flags & MAP_HUGETLB) != 0) {
+			if (errno == ENOMEM) {
+				printf("# mapping memory as huge TLBs failed, this impacts results due to TLB misses\n"
+					   "# increase number of huge TLBs: $ sudo sysctl -w vm.nr_hugepages=%zu\n",
+					   (size + 0x200000 - 1) / 0x200000);
+			}
+			flags &= ~flags_huge;
+			map_huge = 0;
+			goto again;
+		}
+
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	return addr;
+}
+
+/* per-CPU state of a co-runner thread */
+static struct worker {
+	pthread_t thread;
+	int cpu;
+	char *addr;
+	char *addr_end;
+	void (*bench)(char *, char *);
+	/* updated by the thread, read by the main thread at each print */
+	unsigned long long bytes;
+	unsigned long long duty_sum;
+	unsigned long long periods;
+	/* values at the previous print */
+	unsigned long long prev_bytes;
+	unsigned long long prev_duty_sum;
+	unsigned long long prev_periods;
+} workers[MAX_THREADS];
+
+static pthread_barrier_t workers_barrier;
+/* common start time, also the first budget period of every thread */
+static struct timespec workers_start;
+static volatile int workers_stop;
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct timespec ts_now, ts_period, ts_run;
+	unsigned int duty, period_us;
+	cpu_set_t cpuset;
+	char *ptr;
+	int err;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(w->cpu, &cpuset);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (err != 0) {
+		fprintf(stderr, "error: cannot run on CPU %d: %s\n", w->cpu, strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	/* every thread maps and prefaults its own buffer from its CPU */
+	w->addr = map(map_size);
+	w->addr_end = &w->addr[map_size];
+	memset(w->addr, 0x5a, map_size);
+	flush_cacheline_range(w->addr, w->addr_end);
+	copy_addr = w->addr;
+	copy_half = map_size / 2;
+
+	/* once when all buffers are ready, once more when the start time is set */
+	pthread_barrier_wait(&workers_barrier);
+	pthread_barrier_wait(&workers_barrier);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &workers_start, NULL);
+
+	ptr = w->addr;
+	ts_period = workers_start;
+	while (!workers_stop) {
+		if (option_regulated == 0) {
+			duty = BUDGET_FULL;
+			period_us = 0;
+		} else {
+			budget_get(&duty, &period_us);
+			__atomic_store_n(&w->duty_sum, w->duty_sum + duty, __ATOMIC_RELAXED);
+			__atomic_store_n(&w->periods, w->periods + 1, __ATOMIC_RELAXED);
+		}
+
+		/* periods start at workers_start on every CPU, so they stay aligned */
+		ts_run = ts_period;
+		timespec_inc_by(&ts_run, period_us * 1000ull * duty / BUDGET_FULL);
+		while (duty > 0 && !workers_stop) {
+			w->bench(ptr, ptr + BUDGET_CHUNK);
+			__atomic_store_n(&w->bytes, w->bytes + BUDGET_CHUNK, __ATOMIC_RELAXED);
+			ptr += BUDGET_CHUNK;
+			if (ptr >= w->addr_end) {
+				ptr = w->addr;
+			}
+			if (option_regulated == 0) {
+				continue;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &ts_now);
+			if (!timespec_is_le(&ts_now, &ts_run)) {
+				break;
+			}
+		}
+
+		timespec_inc_by(&ts_period, period_us * 1000ull);
+		if (duty < BUDGET_FULL) {
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_period, NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts_now);
+		if (!timespec_is_le(&ts_now, &ts_period)) {
+			ts_period = ts_now;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * A linear or regulated test on every CPU of thread_cpus at once: the
+ * threads prefault their buffers, then start together at workers_start.
+ * The main thread only sleeps and, at each print interval, reports the
+ * bandwidth of every CPU and their sum.
+ */
+static void bench_threads(const char *name, void (*bench)(char *, char *))
+{
+	struct timespec ts_now, ts_start, ts_end, ts_tmp;
+	unsigned long long delta_bytes, total_bytes;
+	unsigned long long duty_sum, periods;
+	unsigned long long delta_t_ns;
+	unsigned long long val;
+	struct worker *w;
+	int loops;
+	double bw;
+	int err;
+	int i;
+
+	printf("%s %s bandwidth over %zu MiB block per CPU on CPUs", option_regulated != 0 ? "regulated" : "linear",
+	       name, map_size / 1024 / 1024);
+	for (i = 0; i < option_threads; i++) {
+		printf(" %d", thread_cpus[i]);
+	}
+	if (option_huge != 0) {
+		printf(" (huge TLB)");
+	}
+	printf("\n");
+
+	memset(workers, 0, sizeof(workers));
+	workers_stop = 0;
+	pthread_barrier_init(&workers_barrier, NULL, option_threads + 1);
+	for (i = 0; i < option_threads; i++) {
+		w = &workers[i];
+		w->cpu = thread_cpus[i];
+		w->bench = bench;
+		err = pthread_create(&w->thread, NULL, worker_main, w);
+		if (err != 0) {
+			errno = err;
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&workers_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &workers_start);
+	timespec_inc_by(&workers_start, 1000000ull);
+	pthread_barrier_wait(&workers_barrier);
+
+	ts_start = workers_start;
+	ts_end = ts_start;
+	timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+	loops = 0;
+
+	while (1) {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_end, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &ts_now);
+		delta_t_ns = timespec_ns(timespec_sub(&ts_now, &ts_start, &ts_tmp));
+
+		total_bytes = 0;
+		duty_sum = 0;
+		periods = 0;
+		for (i = 0; i < option_threads; i++) {
+			w = &workers[i];
+			val = __atomic_load_n(&w->bytes, __ATOMIC_RELAXED);
+			delta_bytes = val - w->prev_bytes;
+			w->prev_bytes = val;
+			total_bytes += delta_bytes;
+			val = __atomic_load_n(&w->duty_sum, __ATOMIC_RELAXED);
+			duty_sum += val - w->prev_duty_sum;
+			w->prev_duty_sum = val;
+			val = __atomic_load_n(&w->periods, __ATOMIC_RELAXED);
+			periods += val - w->prev_periods;
+			w->prev_periods = val;
+
+			bw = 1000.0 * delta_bytes / delta_t_ns;
+			printf("CPU %d: %.1f MB/s, ", w->cpu, bw);
+
+			if (csv_file != NULL) {
+				fprintf(csv_file, "%s@%d;%d;%llu;%llu;%llu\n",
+				        name, w->cpu, CACHELINE_SIZE, delta_t_ns,
+				        delta_bytes, 0ull);
+			}
+		}
+
+		bw = 1000.0 * total_bytes / delta_t_ns;
+		printf("total: %.1f MiB/s, %.1f MB/s", to_mib(bw), bw);
+		if (periods > 0) {
+			printf(", duty %.1f%%", 100.0 * duty_sum / periods / BUDGET_FULL);
+		}
+		printf("\n");
+
+		if (csv_file != NULL) {
+			fprintf(csv_file, "%s;%d;%llu;%llu;%llu\n",
+			        name, CACHELINE_SIZE, delta_t_ns,
+			        total_bytes, 0ull);
+			fflush(csv_file);
+		}
+
+		loops++;
+		if (loops == option_num_loops) {
+			break;
+		}
+
+		ts_start = ts_now;
+		ts_end = ts_start;
+		timespec_inc_by(&ts_end, option_print_delay_ms * 1000000ull);
+	}
+
+	workers_stop = 1;
+	for (i = 0; i < option_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		munmap(workers[i].addr, map_size);
+	}
+	pthread_barrier_destroy(&workers_barrier);
+}
+
+/* "0,2-3" into thread_cpus, returns the number of CPUs */
+static int parse_cpus(const char *str)
+{
+	const char *p = str;
+	char *end;
+	long first, last;
+	int n = 0;
+
+	while (*p != '\0') {
+		first = strtol(p, &end, 0);
+		last = first;
+		if (end != p && *end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 0);
+		}
+		if (end == p || first < 0 || last < first || last >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+			fprintf(stderr, "error: invalid CPU list '%s'\n", str);
+			exit(EXIT_FAILURE);
+		}
+		for (; first <= last; first++) {
+			if (n == MAX_THREADS) {
+				fprintf(stderr, "error: more than %d CPUs\n", MAX_THREADS);
+				exit(EXIT_FAILURE);
+			}
+			thread_cpus[n++] = first;
+		}
+		p = (*end == ',') ? end + 1 : end;
+	}
+
+	return n;
+}
+
+static void version(FILE *f)
+{
+	fprintf(f, PROGNAME " build " BUILDID
+#ifndef NDEBUG
+	        " DEBUG"
+#endif
+	        "\n");
+}
+
+static void usage(FILE *f)
+{
+	struct test *t;
+
+	version(f);
+	fprintf(f, "usage: " PROGNAME " [<options>] <test>\n\n"
+	        "Platform memory benchmarks.\n\n"
+	        "Options:\n"
+	        "  -s|--size <size>  memory size in MiB (default %d MiB)\n"
+	        "  -c|--cpu <cpu>    run on given CPU ID (default any)\n"
+	        "  -p|--prio <prio>  run at given priority (default current)\n"
+	        "  -l|--loops <num>  stop after given number of loops (default run infinitely)\n"
+	        "  -d|--delay <ms>   print bandwidth after given ms (default %d ms)\n"
+	        "  --huge            enable huge pages\n"
+	        "  --perf            enable perf tracing\n"
+	        "  --step <bytes>    access memory with given step in bytes\n"
+	        "  --auto            auto-detect worst-case memory access\n"
+	        "  --phys            worst-case access from physical DRAM bank bits (root)\n"
+	        "  --all             run all tests (don't specify a test, -l 1 set implicitly)\n"
+	        "  --hist <lines>    time linear tests every n cachelines, percentiles and histogram\n"
+	        "  --latency         pointer chasing latency per working set (no test, -l 1 implicitly)\n"
+	        "  --csv <file>      export data as CSV to file\n"
+	        "  --csv-no-header   do not print a header in the CSV file\n"
+	        "  --regulated       keep to the corunner budget of the TPAw0v R5 tracer\n"
+	        "  --duty <n>        keep to a fixed budget of n/%d of every period\n"
+	        "  --period <us>     budget period without one from the tracer (default %u us)\n"
+	        "  --threads <n>     run the test on CPUs 0 to n-1 at once, a buffer each\n"
+	        "  --cpus <list>     run the test on the CPUs of list at once, e.g. 0,2-3\n"
+	        "  --version         print version info\n"
+	        "  --help            show usage\n"
+	        "Tests:\n",
+	        DEFAULT_MB, option_print_delay_ms, BUDGET_FULL, option_period_us);
+	for (t = tests; t->name != NULL; t++) {
+		fprintf(f, "  %-18s%s\n", t->name, t->desc != NULL ? t->desc : "");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct test *t = tests;
+	const char *mode_str = NULL;
+	const char *size_str = NULL;
+	const char *cpu_str = NULL;
+	const char *prio_str = NULL;
+	const char *step_str = NULL;
+	const char *loop_str = NULL;
+	const char *delay_str = NULL;
+	const char *csv_file_str = NULL;
+	const char *duty_str = NULL;
+	const char *period_str = NULL;
+	const char *threads_str = NULL;
+	const char *cpus_str = NULL;
+	const char *hist_str = NULL;
+	unsigned int step_size = CACHELINE_SIZE;
+	unsigned int mb = DEFAULT_MB;
+	int arg;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (argv[arg][0] != '-') {
+			if (mode_str != NULL) {
+				usage(stderr);
+				return EXIT_FAILURE;
+			}
+			mode_str = argv[arg];
+			continue;
+		}
+
+		if (!strcmp(argv[arg], "--version")) {
+			version(stdout);
+			return EXIT_SUCCESS;
+		} else if (!strcmp(argv[arg], "--help")) {
+			usage(stdout);
+			return EXIT_SUCCESS;
+		} else if (!strcmp(argv[arg], "--size") || !strcmp(argv[arg], "-s")) {
+			arg++;
+			size_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--cpu") || !strcmp(argv[arg], "-c")) {
+			arg++;
+			cpu_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--prio") || !strcmp(argv[arg], "-p")) {
+			arg++;
+			prio_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--perf")) {
+			option_perf = 1;
+		} else if (!strcmp(argv[arg], "--huge")) {
+			option_huge = 1;
+		} else if (!strcmp(argv[arg], "--step")) {
+			option_step = 1;
+			arg++;
+			step_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--loops") || !strcmp(argv[arg], "-l")) {
+			arg++;
+			loop_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--delay") || !strcmp(argv[arg], "-d")) {
+			arg++;
+			delay_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--auto")) {
+			option_step = 2;
+		} else if (!strcmp(argv[arg], "--phys")) {
+			option_step = 3;
+		} else if (!strcmp(argv[arg], "--all")) {
+			option_all = 1;
+			/* changes the number of loops to 1 by default */
+			option_num_loops = 1;
+		} else if (!strcmp(argv[arg], "--hist")) {
+			arg++;
+			hist_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--latency")) {
+			option_latency = 1;
+			option_num_loops = 1;
+		} else if (!strcmp(argv[arg], "--csv")) {
+			arg++;
+			csv_file_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--csv-no-header")) {
+			option_csv_no_header = 1;
+		} else if (!strcmp(argv[arg], "--regulated")) {
+			option_regulated = 1;
+		} else if (!strcmp(argv[arg], "--duty")) {
+			option_regulated = 2;
+			arg++;
+			duty_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--period")) {
+			arg++;
+			period_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--threads")) {
+			arg++;
+			threads_str = argv[arg];
+		} else if (!strcmp(argv[arg], "--cpus")) {
+			arg++;
+			cpus_str = argv[arg];
+		} else {
+			fprintf(stderr, "unknown option '%s'\n", argv[arg]);
+			usage(stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((arg != argc) || ((option_all == 0) && (option_latency == 0) && (mode_str == NULL))
+	                  || ((option_all != 0 || option_latency != 0) && (mode_str != NULL))) {
+		usage(stderr);
+		return EXIT_FAILURE;
+	}
+	if (option_latency != 0 && (option_all != 0 || option_step != 0 || option_regulated != 0 ||
+	                            threads_str != NULL || cpus_str != NULL)) {
+		fprintf(stderr, "error: --latency runs on its own\n");
+		exit(EXIT_FAILURE);
+	}
+#if defined __riscv
+	if (option_step == 3) {
+		/* the timing needs flush_cacheline() */
+		fprintf(stderr, "error: --phys is not supported on RISC-V\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
 	/* check mode */
-	if (option_all == 0) {
+	if (option_all == 0 && option_latency == 0) {
 		for (t = tests; t->name != NULL; t++) {
 			if (strcmp(mode_str, t->name) == 0) {
 				break;
@@ -1224,11 +2397,79 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* check budget */
+	if (duty_str != NULL) {
+		option_duty = atoi(duty_str);
+		if (option_duty > BUDGET_FULL) {
+			fprintf(stderr, "error: invalid duty, must be <=%d\n", BUDGET_FULL);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (period_str != NULL) {
+		option_period_us = atoi(period_str);
+		if (option_period_us == 0) {
+			fprintf(stderr, "error: invalid period\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (option_regulated != 0 && option_step != 0) {
+		fprintf(stderr, "error: a budget applies to linear tests only\n");
+		exit(EXIT_FAILURE);
+	}
+	if (option_regulated == 1) {
+		budget_map();
+	}
+
+	/* check co-runner threads */
+	if (threads_str != NULL && cpus_str != NULL) {
+		fprintf(stderr, "error: --threads and --cpus are exclusive\n");
+		exit(EXIT_FAILURE);
+	}
+	if (threads_str != NULL) {
+		option_threads = atoi(threads_str);
+		if (option_threads <= 0 || option_threads > MAX_THREADS) {
+			fprintf(stderr, "error: invalid number of threads, must be 1 to %d\n", MAX_THREADS);
+			exit(EXIT_FAILURE);
+		}
+		for (int i = 0; i < option_threads; i++) {
+			thread_cpus[i] = i;
+		}
+	}
+	if (cpus_str != NULL) {
+		option_threads = parse_cpus(cpus_str);
+	}
+	if (option_threads != 0 && option_step != 0) {
+		fprintf(stderr, "error: threads run linear and regulated tests only\n");
+		exit(EXIT_FAILURE);
+	}
+	if (option_threads != 0 && option_perf) {
+		/* the counters of perf_open() follow the main thread only */
+		printf("# perf tracing is not supported with threads, disabled\n");
+		option_perf = 0;
+	}
+
+	/* check sampling */
+	if (hist_str != NULL) {
+		option_hist = atoi(hist_str);
+		if (option_hist == 0 || (size_t)option_hist * CACHELINE_SIZE > mb * 1024ull * 1024) {
+			fprintf(stderr, "error: invalid number of cachelines per sample\n");
+			exit(EXIT_FAILURE);
+		}
+		if (option_step != 0 || option_regulated != 0 || option_threads != 0 || option_latency != 0) {
+			fprintf(stderr, "error: --hist applies to linear tests only\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	map_size = mb * 1024 * 1024;
-	map_addr = map(map_size);
-	map_addr_end = &map_addr[map_size];
-	/* prefault memory */
-	memset(map_addr, 0x5a, map_size);
+	if (option_threads == 0) {
+		map_addr = map(map_size);
+		map_addr_end = &map_addr[map_size];
+		/* prefault memory */
+		memset(map_addr, 0x5a, map_size);
+		copy_addr = map_addr;
+		copy_half = map_size / 2;
+	}
 
 	if (option_perf) {
 		perf_open();
@@ -1242,19 +2483,47 @@ int main(int argc, char *argv[])
 			exit(EXIT_FAILURE);
 		}
 		if (!option_csv_no_header) {
-			fprintf(csv_file, "#test;step;time_nanoseconds;bytes_accessed;bytes_perf\n");
+			fprintf(csv_file, "#test;step;time_nanoseconds;bytes_accessed;bytes_perf");
+			if (option_hist != 0) {
+				fprintf(csv_file, ";samples;min_ns;p50_ns;p99_ns;max_ns");
+				for (int i = 0; i < NUM_PERF; i++) {
+					fprintf(csv_file, ";perf_0x%llx", perf_config[i]);
+				}
+				fprintf(csv_file, ";histogram");
+			}
+			fprintf(csv_file, "\n");
 			fflush(csv_file);
 		}
 	}
 
-	if (option_step == 0) {
+	if (option_latency != 0) {
+		bench_latency();
+	} else if (option_threads != 0) {
+		if (option_all != 0) {
+			for (t = tests; t->name != NULL; t++) {
+				bench_threads(t->name, t->bench_range);
+			}
+		} else {
+			assert(t->name != NULL);
+			bench_threads(t->name, t->bench_range);
+		}
+	} else if (option_regulated != 0) {
+		if (option_all != 0) {
+			for (t = tests; t->name != NULL; t++) {
+				bench_regulated(t->name, t->bench_range);
+			}
+		} else {
+			assert(t->name != NULL);
+			bench_regulated(t->name, t->bench_range);
+		}
+	} else if (option_step == 0) {
 		if (option_all != 0) {
 			for (t = tests; t->name != NULL; t++) {
-				bench_linear(t->name, t->bench_linear);
+				bench_linear(t->name, t->bench_linear, t->bench_range);
 			}
 		} else {
 			assert(t->name != NULL);
-			bench_linear(t->name, t->bench_linear);
+			bench_linear(t->name, t->bench_linear, t->bench_range);
 		}
 	} else if (option_step == 1) {
 		if (option_all != 0) {
@@ -1274,6 +2543,16 @@ int main(int argc, char *argv[])
 			assert(t->name != NULL);
 			bench_auto(t->name, t->bench_step);
 		}
+	} else if (option_step == 3) {
+		phys_setup();
+		if (option_all != 0) {
+			for (t = tests; t->name != NULL; t++) {
+				bench_phys(t->name, t->bench_range);
+			}
+		} else {
+			assert(t->name != NULL);
+			bench_phys(t->name, t->bench_range);
+		}
 	}
 
 	if (csv_file != NULL) {
@@ -114,6 +114,14 @@ static inline void arm_perf_int_ack(unsigned int mask)
 	__asm__ volatile ("msr PMOVSCLR_EL0, %0" : : "r"(mask) : "memory");
 }
 
+/** Get USEREN (User Enable) Register, readable from EL0 */
+static inline unsigned int arm_perf_get_useren(void)
+{
+	unsigned int val;
+	__asm__ volatile ("mrs %0, PMUSERENR_EL0" : "=r"(val));
+	return val;
+}
+
 /** Set USEREN (User Enable) Register */
 static inline void arm_perf_set_useren(unsigned int val)
 {
@@ -136,6 +144,14 @@ static inline void arm_perf_int_mask(unsigned int mask)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/** Performance Monitors Cycle Count Register */
+static inline unsigned long arm_perf_cycles(void)
+{
+	unsigned long val;
+	__asm__ volatile ("mrs %0, PMCCNTR_EL0" : "=r"(val));
+	return val;
+}
+
 /** Performance Monitors Event Count Register 0 */
 static inline unsigned int arm_perf_counter0(void)
 {
@@ -220,6 +236,36 @@ static inline void arm_perf_type5(unsigned int val)
 	__asm__ volatile ("msr PMEVTYPER5_EL0, %0" : : "r"(val) : "memory");
 }
 
+/** Event counter n of the Cortex-A53 (0..5) or the cycle counter (31), 0 otherwise */
+static inline int arm_perf_read_counter(unsigned int n, unsigned long long *val)
+{
+	switch (n) {
+	case 0: *val = arm_perf_counter0(); break;
+	case 1: *val = arm_perf_counter1(); break;
+	case 2: *val = arm_perf_counter2(); break;
+	case 3: *val = arm_perf_counter3(); break;
+	case 4: *val = arm_perf_counter4(); break;
+	case 5: *val = arm_perf_counter5(); break;
+	case 31: *val = arm_perf_cycles(); break;
+	default: return 0;
+	}
+	return 1;
+}
+
+/** Set the event type of counter n (0..5) */
+static inline void arm_perf_set_type(unsigned int n, unsigned int val)
+{
+	switch (n) {
+	case 0: arm_perf_type0(val); break;
+	case 1: arm_perf_type1(val); break;
+	case 2: arm_perf_type2(val); break;
+	case 3: arm_perf_type3(val); break;
+	case 4: arm_perf_type4(val); break;
+	case 5: arm_perf_type5(val); break;
+	default: break;
+	}
+}
+
 #endif
 
 #endif
@@ -3,9 +3,47 @@
 
 #include <stdint.h>
 
+// ETR scatter-gather table: 32-bit entries, bits [31:4] the page address [39:12]
+#define SG_PAGE_SIZE 4096
+#define SG_PAGE_ENTRIES (SG_PAGE_SIZE / 4)
+#define SG_ET_LAST 0x1
+#define SG_ET_NORMAL 0x2
+#define SG_ET_LINK 0x3
+#define SG_ENTRY(addr, type) ((uint32_t) ((((addr) >> 12) << 4) | (type)))
+
+typedef struct etr_sg_buf {
+    uint32_t size;          // bytes, whole pages
+    uint32_t n_pages;
+    uint32_t n_tables;
+    uint8_t *data;          // the data pages, contiguous in this process only
+    uint32_t *tables;
+    uint64_t *page_phys;    // physical address of each data page
+    uint64_t table_phys;    // the first table page, programmed as the buffer address
+} etr_sg_buf_t;
+
+// a physically contiguous ETR buffer allocated at run time, see etr_buffer_alloc()
+typedef struct etr_buf {
+    uint64_t phys;          // the address the ETR writes to
+    uint32_t size;
+    int memfd;              // the huge page, -1 for CMA through /dev/cs_mem
+    uint8_t *data;          // the huge page in this process
+} etr_buf_t;
+
+// set by -z: trace.dat is written as a compressed archive, see archive.h
+extern int trace_compress;
+
 uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size);
+int buf_sync_for_cpu(uint64_t addr, uint32_t size);
+void buf_sync_for_device(uint64_t addr, uint32_t size);
 void clear_buffer(uint64_t buf_addr, uint32_t buf_size);
-void dump_buffer(uint64_t buf_addr, uint32_t buf_size);
+void dump_text(const char *dat_name, const char *out_name);
+void dump_buffer(uint64_t buf_addr, uint32_t buf_size, int text);
+void dump_buffer_ring(uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full);
+etr_sg_buf_t *sg_buffer_alloc(uint32_t buf_size);
+void sg_buffer_free(etr_sg_buf_t *sg);
+void dump_sg_buffer_ring(etr_sg_buf_t *sg, uint64_t rwp, int full);
+etr_buf_t *etr_buffer_alloc(uint32_t buf_size);
+void etr_buffer_free(etr_buf_t *buf);
 
 
 #endif
\ No newline at end of file
@@ -13,6 +13,25 @@
 #define CHECK(x,y) (((x) & (1 << (y))) ? 1 : 0)
 #define CLEAR(x,y) ((x) &= ~(1 << (y)))
 
+// default poller ring, 64 MB
+#define POLLER_RING_WORDS (16 * 1024 * 1024)
+
+enum poll_mode {
+    POLL_SPIN,      // one RRD read per iteration, no flush
+    POLL_ADAPTIVE,  // bursts while data flows, back off and flush when idle
+};
+
+// set before spawn_child(poller)
+typedef struct poller_config {
+    uint32_t ring_words;  // rounded up to a power of two, at most 4 GB
+    uint8_t writer_core;  // core the thread draining the ring to trace.dat runs on
+    enum poll_mode mode;
+    uint32_t burst;           // RRD reads between checks of the session state
+    uint32_t flush_us;        // latency bound: flush TMC1 this long after the last word
+    uint32_t backoff_max_us;  // longest wait between reads while idle
+} poller_config_t;
+extern poller_config_t poller_cfg;
+
 int write_mem(unsigned long physical_address, uint32_t data);
 void pin_to_core(uint8_t id);
 void linux_disable_cpuidle(void);
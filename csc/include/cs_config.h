@@ -1,8 +1,26 @@
 #ifndef CS_CONFIG_H
 #define CS_CONFIG_H
 
+// the ETMs take IDs 1 to 4, deformat -s 0x10 splits the STM stream out
+#define STM_TRACE_ID 0x10
+// bytes of STM trace between ASYNC packets, a multiple of 8 below 4096
+#define STM_SYNC_BYTES 0x800
+
 void cs_config_tmc1_softfifo();
 void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size);
+void cs_register_etms(uint8_t core_mask);
+void cs_stop_etr(uint64_t *rwp, int *full);
+void cs_rearm_etr(uint64_t buf_addr);
+void cs_dump_etr(uint64_t buf_addr, uint32_t buf_size);
+int cs_report_tmcs(int level);
+uint32_t cs_enable_tsgen(void);
+void cs_config_stm(uint8_t trace_id);
+void cs_disable_stm(void);
+void cs_config_trigger(uint8_t core_mask, int trigout, uint32_t after_bytes);
+int cs_etr_triggered(void);
+struct etr_sg_buf;
+void cs_config_etr_sg(struct etr_sg_buf *sg);
+void cs_dump_etr_sg(struct etr_sg_buf *sg);
 void cs_config_SRAM();
 void config_etm_n(ETM_interface* etm_n, int stall, int id);
 void config_etm_addr_event_test(ETM_interface*, uint64_t, uint64_t, uint64_t, uint64_t);
@@ -212,17 +212,20 @@ uint8_t etm_is_idle(ETM_interface *p_etm);
 void etm_info(ETM_interface *);
 void etm_set_cci(ETM_interface* , int);
 void etm_set_sync(ETM_interface*, int);
+void etm_set_timestamp(ETM_interface*, uint16_t period);
 void etm_implementation_info(ETM_interface*);
 void etm_unlock(ETM_interface*);
 void etm_reset(ETM_interface *);
 void etm_set_stall(ETM_interface*, int);
 void etm_set_branch_broadcast(ETM_interface*, int, uint8_t);
 void etm_set_contextid_cmp(ETM_interface*, uint64_t);
+void etm_clear_filters(ETM_interface*);
 void etm_set_ext_input(ETM_interface*, int, int);
 void etm_set_event_trc(ETM_interface*, int mask, int atb);
 void etm_always_fire_event_post(ETM_interface* etm, int pos);
 void etm_register_pmu_event(ETM_interface *, int event_bus);
 void etm_register_range(ETM_interface*, uint64_t start_addr, uint64_t end_addr, int cmp_contextid);
+void etm_register_exclude_range(ETM_interface*, uint64_t start_addr, uint64_t end_addr, int cmp_contextid);
 void etm_register_single_addr_match_event(ETM_interface *, uint64_t);
 void etm_register_start_stop_addr(ETM_interface *etm, uint64_t start_addr, uint64_t end_addr);
 void etm_example_single_counter(ETM_interface* etm, int event_bus, uint16_t counter_val);
@@ -0,0 +1,44 @@
+#ifndef CS_MEM_H
+#define CS_MEM_H
+
+/*
+    Interface of support/cs_mem.c, shared by the module and csc. The
+    mmap offset of /dev/cs_mem is the physical address, as with /dev/mem,
+    but only the CoreSight window (uncached), the trace buffer and a
+    CS_MEM_ALLOC buffer (both cacheable) can be mapped. The CPU does not
+    see what the ETR wrote to a buffer before CS_MEM_SYNC_FOR_CPU, nor the
+    ETR what the CPU wrote before CS_MEM_SYNC_FOR_DEVICE.
+*/
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define CS_MEM_DEVICE "/dev/cs_mem"
+
+struct cs_mem_info {
+    __u64 cs_base;
+    __u64 cs_size;
+    __u64 buf_base;
+    __u64 buf_size;
+};
+
+// a range of the trace buffer, by physical address
+struct cs_mem_sync {
+    __u64 addr;
+    __u64 size;
+};
+
+// size in, the bus address of the ETR buffer out; one per open file, freed when it is closed
+struct cs_mem_alloc {
+    __u64 size;
+    __u64 addr;
+};
+
+#define CS_MEM_IOC_MAGIC 'C'
+#define CS_MEM_INFO _IOR(CS_MEM_IOC_MAGIC, 0, struct cs_mem_info)
+#define CS_MEM_SYNC_FOR_CPU _IOW(CS_MEM_IOC_MAGIC, 1, struct cs_mem_sync)
+#define CS_MEM_SYNC_FOR_DEVICE _IOW(CS_MEM_IOC_MAGIC, 2, struct cs_mem_sync)
+#define CS_MEM_ALLOC _IOWR(CS_MEM_IOC_MAGIC, 3, struct cs_mem_alloc)
+#define CS_MEM_FREE _IO(CS_MEM_IOC_MAGIC, 4)
+
+#endif
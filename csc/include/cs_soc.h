@@ -335,6 +335,51 @@ typedef struct __attribute__((__packed__)) tmc_interface {
     uint32_t comp_id_3;
 } TMC_interface ;
 
+// control frame of the system timestamp generator, the time base of ETM timestamps
+typedef struct __attribute__((__packed__)) tsgen_interface {
+    uint32_t cnt_ctrl ;         // CNTCR, bit 0 enables the counter
+    uint32_t cnt_status ;
+    uint32_t cnt_val_low ;
+    uint32_t cnt_val_high ;
+    PAD(0x10, 0x20);
+    uint32_t cnt_freq ;         // CNTFID0
+} TSGEN_interface ;
+
+// STM-500 programming registers, the stimulus ports are at STM_PORTS
+typedef struct __attribute__((__packed__)) stm_interface {
+    PAD(0x0, 0xe00);
+    uint32_t sp_enable ;            // STMSPER, a bit per port of each group of 32
+    PAD(0xe04, 0xe20);
+    uint32_t sp_trigger_enable ;    // STMSPTER
+    PAD(0xe24, 0xe60);
+    uint32_t sp_select ;            // STMSPSCR, 0: STMSPER applies to every group
+    uint32_t sp_master_select ;     // STMSPMSCR
+    uint32_t sp_override ;
+    uint32_t sp_master_override ;
+    uint32_t sp_trigger_ctrl ;
+    PAD(0xe74, 0xe80);
+    uint32_t trace_ctrl ;           // STMTCSR
+    uint32_t ts_stimulus ;
+    PAD(0xe88, 0xe8c);
+    uint32_t ts_freq ;              // STMTSFREQR, sent in a FREQ packet
+    uint32_t sync_ctrl ;            // STMSYNCR, bytes between ASYNC packets in bits 11:3
+    uint32_t aux_ctrl ;
+    PAD(0xe98, 0xea0);
+    uint32_t feature_1 ;
+    uint32_t feature_2 ;
+    uint32_t feature_3 ;
+    PAD(0xeac, 0xfb0);
+    uint32_t lock_access ;
+    uint32_t lock_status ;
+} STM_interface ;
+
+// STMTCSR
+#define STM_TCSR_EN         (1 << 0)
+#define STM_TCSR_TSEN       (1 << 1)
+#define STM_TCSR_SYNCEN     (1 << 2)
+#define STM_TCSR_TRACEID(id)    (((id) & 0x7f) << 16)
+#define STM_TCSR_BUSY       (1 << 23)
+
 static inline void funnel_unlock(Funnel_interface *funnel)
 {
     funnel->lock_access = 0xc5acce55;
@@ -355,6 +400,11 @@ static inline void tpiu_unlock(TPIU_interface *tpiu)
     tpiu->lock_access = 0xc5acce55;
 }
 
+static inline void stm_unlock(STM_interface *stm)
+{
+    stm->lock_access = 0xc5acce55;
+}
+
 static inline void tmc_enable(TMC_interface *tmc)
 {
     tmc->ctrl = 0x1;
@@ -376,6 +426,35 @@ static inline void tmc_man_flush(TMC_interface *tmc)
     tmc->formatter_flush_ctrl |= 0x1 << 6;
 }
 
+static inline uint64_t tmc_get_write_pt(TMC_interface *tmc)
+{
+    return ((uint64_t) tmc->ram_write_pt_high << 32) | tmc->ram_write_pt;
+}
+
+// STS.Full, in Circular mode: the write pointer wrapped, the oldest data is at RWP
+static inline int tmc_full(TMC_interface *tmc)
+{
+    return CHECK(tmc->status, 0);
+}
+
+// STS.Triggered, a trigger event was seen
+static inline int tmc_triggered(TMC_interface *tmc)
+{
+    return CHECK(tmc->status, 1);
+}
+
+// the 64-bit Tsgen count, the high word read again in case the low one wrapped
+static inline uint64_t tsgen_count(TSGEN_interface *tsgen)
+{
+    uint32_t hi, lo;
+
+    do {
+        hi = tsgen->cnt_val_high;
+        lo = tsgen->cnt_val_low;
+    } while (hi != tsgen->cnt_val_high);
+    return ((uint64_t) hi << 32) | lo;
+}
+
 static inline void cti_unlock(CTI_interface *cti)
 {
     cti->lock_access = 0xc5acce55;
@@ -401,6 +480,7 @@ void tmc_set_mode(TMC_interface *, enum tmc_mode);
 void tmc_set_size(TMC_interface *, uint32_t);
 void tmc_set_data_buf(TMC_interface *, uint64_t);
 void tmc_set_axi(TMC_interface *, int);
+void tmc_set_scatter_gather(TMC_interface *, int);
 void tmc_set_read_pt(TMC_interface *, uint64_t);
 void tmc_set_write_pt(TMC_interface *, uint64_t);
 void funnel_config_port(Funnel_interface *funnel, uint8_t mask, int hold_time);
@@ -0,0 +1,36 @@
+#ifndef DRAIN_H
+#define DRAIN_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "archive.h"
+
+/*
+    Live drain of a cs_config_etr_mp() buffer: a thread follows the TMC3
+    write pointer during the session and appends what the ETR wrote to a
+    file or pipe, in trace order, so the session may write more than the
+    buffer holds.
+*/
+typedef struct etr_drain {
+    uint64_t buf_addr;
+    uint32_t buf_size;
+    int fd;
+    archive_out_t *archive;     // with trace_compress
+    uint8_t core;
+    uint32_t poll_us;       // sleep when the write pointer did not move
+    volatile int stop;
+    pthread_t thread;
+
+    // statistics
+    uint64_t bytes;
+    uint64_t polls;
+    uint64_t behind;        // polls that found more than 3/4 of the buffer unread
+    uint64_t overwrites;    // copies the ETR wrote over before they were done
+    uint32_t peak_lag;
+} etr_drain_t;
+
+void etr_drain_start(etr_drain_t *drain, uint64_t buf_addr, uint32_t buf_size, const char *out, uint8_t core);
+void etr_drain_start_fd(etr_drain_t *drain, uint64_t buf_addr, uint32_t buf_size, int fd, uint8_t core);
+void etr_drain_stop(etr_drain_t *drain);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+#include "cs_pmu.h"
+#include "pmu_counter.h"
+
+/*
+    One interface over the three ways to the A53 PMU:
+
+    PMU_PERF    perf_event_open(), with perf_read_fast() from userspace when
+                the kernel allows it, else a read() per sample; multiplexes
+                more events than counters and counts the forked children
+    PMU_SYSREG  PMEVCNTR<n>_EL0 from EL0, needs PMUSERENR.EN, e.g. from
+                support/enable_arm_pmu.c; the calling thread is pinned to core
+    PMU_MMIO    the memory mapped PMU of the core through /dev/mem, works
+                from any core
+
+    The register backends program counters 0..n-1 behind perf's back, do
+    not use them together with perf counting on the same core.
+*/
+enum pmu_backend {
+    PMU_PERF,
+    PMU_SYSREG,
+    PMU_MMIO,
+    PMU_BACKENDS,
+};
+
+// event counters of the Cortex-A53, the limit of the register backends
+#define PMU_HW_COUNTERS 6
+#define PMU_MAX_EVENTS 32
+
+typedef struct pmu {
+    enum pmu_backend backend;
+    int event_num;
+    PmuEvent events[PMU_MAX_EVENTS];
+    uint8_t core;
+    int fast;                   // PMU_PERF: read from userspace
+    int perf_fds[PMU_MAX_EVENTS];
+    PMU_interface *regs;        // PMU_MMIO
+    double read_ns;             // per pmu_read(), from pmu_measure()
+} pmu_t;
+
+int pmu_event_lookup(const char *name);
+const char *pmu_event_name(int number);
+const char *pmu_backend_name(enum pmu_backend backend);
+int pmu_open(pmu_t *pmu, enum pmu_backend backend, const int *events, int event_num, uint8_t core);
+int pmu_read(pmu_t *pmu, uint64_t *values);
+void pmu_close(pmu_t *pmu);
+double pmu_measure(pmu_t *pmu, int reads);
+int pmu_open_cheapest(pmu_t *pmu, const int *events, int event_num, uint8_t core);
+
+#endif
@@ -15,6 +15,9 @@
 
 #define MAX_EVENT_NAME 50
 
+// events per perf group: the Cortex-A53 has 6 event counters
+#define PERF_GROUP_SIZE 6
+
 typedef struct {
     char name[MAX_EVENT_NAME];
     int number;
@@ -24,7 +27,12 @@ extern int perf_ok;
 
 int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags);
 int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds);
+int perf_open_user(int event_num, PmuEvent *pmu_events, int *perf_fds);
 int perf_read(unsigned long long *values, int event_num, int *perf_fds);
+int perf_read_scaled(unsigned long long *values, double *running, int event_num, int *perf_fds);
+int perf_mmap(int event_num, int *perf_fds);
+int perf_read_fast(unsigned long long *values, int event_num, int *perf_fds);
+void perf_close(int event_num, int *perf_fds);
 unsigned long long *perf_delta(const unsigned long long *curr_values, const unsigned long long *prev_values, unsigned long long *delta_values, int event_num);
 
 #endif /* PMU_COUNTER_H */
\ No newline at end of file
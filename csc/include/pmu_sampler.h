@@ -0,0 +1,48 @@
+#ifndef PMU_SAMPLER_H
+#define PMU_SAMPLER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pmu_counter.h"
+
+/*
+    Interval sampling of perf_open() counters: a thread reads all groups
+    every period_us and appends one record to a binary timeline, stamped
+    with the Tsgen count, the time base of the ETM timestamps.
+
+    File: a pmu_timeline_header_t, event_num uint32_t event numbers, then
+    records of a uint64_t Tsgen count and event_num uint64_t scaled counts,
+    cumulative since perf_open(), all little endian.
+*/
+#define PMU_TIMELINE_MAGIC 0x53554d50    // "PMUS"
+#define PMU_TIMELINE_VERSION 1
+
+typedef struct __attribute__((__packed__)) pmu_timeline_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t event_num;
+    uint32_t period_us;
+    uint32_t tsgen_freq;    // Hz, of the record timestamps
+    uint32_t reserved;
+} pmu_timeline_header_t;
+
+typedef struct pmu_sampler {
+    int event_num;
+    int *perf_fds;
+    FILE *out;
+    uint8_t core;
+    uint32_t period_us;
+    volatile int stop;
+    pthread_t thread;
+
+    // statistics
+    uint64_t samples;
+    uint64_t late;          // periods that read after the next one was due
+} pmu_sampler_t;
+
+void pmu_sampler_start(pmu_sampler_t *sampler, int event_num, PmuEvent *pmu_events, int *perf_fds,
+                       uint32_t period_us, const char *out, uint8_t core);
+void pmu_sampler_stop(pmu_sampler_t *sampler);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include "frame.h"
+#include "sink.h"
+
+/*
+    A trace session in one process: the ETR path of cs_config_etr_mp(), an
+    ETM with a context ID and address range filter per selected core, the
+    targets run on those cores, and the trace drained, deformatted and
+    decoded while they run. The formatted bytes go through pipes, nothing
+    is written to disk unless raw_path or decode_prefix ask for it.
+
+    on_event is called from the decoder thread of each trace ID (core + 1)
+    with the events of that ID in trace order; the threads of different IDs
+    call it concurrently. Fill in a session_init() session, then
+    session_run(); one session runs at a time.
+*/
+typedef void (*session_event_cb)(void *ctx, int id, const trace_event_t *event);
+
+typedef struct session {
+    // path and filters
+    uint64_t buf_addr;
+    uint32_t buf_size;
+    uint8_t core_mask;
+    uint64_t range_lo[4];
+    uint64_t range_hi[4];
+    int stall;              // ETM stall level 0..15
+    int sync;               // 0 or 8..20, an A-sync every 2^sync bytes
+    int cc_threshold;       // 0: no cycle counts
+    int ts_period;          // -1: no timestamps
+    uint8_t drain_core;
+
+    // results
+    session_event_cb on_event;
+    void *ctx;
+    const char *raw_path;       // the formatted trace as drained, e.g. trace.dat
+    const char *decode_prefix;  // <prefix>_<core>.txt or .evt per trace ID
+    uint8_t decode_mode;        // SINK_TEXT or SINK_BINARY for decode_prefix
+
+    // filled in by session_run()
+    double secs;
+    uint64_t bytes;             // formatted bytes drained
+    uint64_t events[FRAME_IDS];
+    uint64_t overflows[FRAME_IDS];
+    uint64_t overwrites;        // drain copies the ETR lapped, their trace is lost
+} session_t;
+
+void session_init(session_t *s);
+void session_set_filter(session_t *s, int core, uint64_t lo, uint64_t hi);
+int session_run(session_t *s, char **target);
+void session_print(const session_t *s);
+
+#endif
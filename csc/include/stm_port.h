@@ -0,0 +1,86 @@
+#ifndef STM_PORT_H
+#define STM_PORT_H
+
+#include <stdint.h>
+#include "zcu_cs.h"
+
+/*
+    Markers from applications through the STM stimulus ports, after
+    cs_config_stm(). A marker is one store into a mapped port: the offset
+    picks the packet, the size of the store its data size, and the STM adds
+    master, channel (the port) and a timestamp of the same generator as the
+    ETM timestamps. Guaranteed stores stall when the STM FIFO is full,
+    invariant timing ones are dropped instead and leave the cost of the
+    store constant.
+
+        stm_ports_t ports;
+        stm_open(&ports, 0, 16);
+        volatile uint8_t *port = stm_port(&ports, 3);
+        stm_mark(port, value);
+*/
+
+// offsets in a port
+#define STM_G_DMTS      0x00    // guaranteed data, marked and timestamped
+#define STM_G_DM        0x08
+#define STM_G_DTS       0x10
+#define STM_G_D         0x18
+#define STM_G_FLAGTS    0x60
+#define STM_G_FLAG      0x68
+#define STM_G_TRIGTS    0x70
+#define STM_G_TRIG      0x78
+#define STM_I_DMTS      0x80    // invariant timing
+#define STM_I_DM        0x88
+#define STM_I_DTS       0x90
+#define STM_I_D         0x98
+#define STM_I_FLAGTS    0xe0
+#define STM_I_FLAG      0xe8
+#define STM_I_TRIGTS    0xf0
+#define STM_I_TRIG      0xf8
+
+typedef struct stm_ports {
+    volatile uint8_t *base;     // of port first
+    void *map;
+    size_t map_size;
+    uint32_t first;
+    uint32_t n;
+} stm_ports_t;
+
+void stm_open(stm_ports_t *ports, uint32_t first, uint32_t n);
+void stm_close(stm_ports_t *ports);
+
+static inline volatile uint8_t *stm_port(stm_ports_t *ports, uint32_t port)
+{
+    return ports->base + (uintptr_t) (port - ports->first) * STM_PORT_SIZE;
+}
+
+// a D32MTS packet, a marker timestamped where it was written
+static inline void stm_mark(volatile uint8_t *port, uint32_t value)
+{
+    *(volatile uint32_t *) (port + STM_G_DMTS) = value;
+}
+
+// the same, dropped rather than stalling when the STM is busy
+static inline void stm_mark_nowait(volatile uint8_t *port, uint32_t value)
+{
+    *(volatile uint32_t *) (port + STM_I_DMTS) = value;
+}
+
+// a D64TS packet, for pointers and counters
+static inline void stm_data64(volatile uint8_t *port, uint64_t value)
+{
+    *(volatile uint64_t *) (port + STM_G_DTS) = value;
+}
+
+// a D32 packet without timestamp, the cheapest to trace
+static inline void stm_data32(volatile uint8_t *port, uint32_t value)
+{
+    *(volatile uint32_t *) (port + STM_G_D) = value;
+}
+
+// a FLAG_TS packet, the value is not traced
+static inline void stm_flag(volatile uint8_t *port)
+{
+    *(volatile uint32_t *) (port + STM_G_FLAGTS) = 0;
+}
+
+#endif
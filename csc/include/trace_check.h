@@ -0,0 +1,28 @@
+#ifndef TRACE_CHECK_H
+#define TRACE_CHECK_H
+
+#include <stdint.h>
+#include "frame.h"
+
+/*
+    What one ETR session recorded, per trace ID. The streams are decoded
+    in memory, so overflows are counted from the packets and not from the
+    text decode. A sync period is the trace between two A-syncs, one with an
+    overflow lost some of its trace.
+*/
+typedef struct trace_check {
+    uint64_t bytes[FRAME_IDS];
+    uint64_t overflows[FRAME_IDS];
+    uint64_t syncs[FRAME_IDS];
+    uint64_t padding;
+    uint64_t fsyncs;
+    int wrapped;            // the ETR wrapped, the oldest trace is gone
+} trace_check_t;
+
+void trace_check_ring(trace_check_t *check, const uint8_t *data, uint32_t size, uint32_t rwp, int full);
+void trace_check_etr(trace_check_t *check, uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full);
+uint64_t trace_check_overflows(const trace_check_t *check);
+void trace_check_print(const trace_check_t *check, double secs);
+void report_trace_ids(const char *dat_name, const char *ring_name, double secs);
+
+#endif
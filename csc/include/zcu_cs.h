@@ -21,6 +21,11 @@
 #define STM 0x1C0000
 #define FTM 0x1D0000
 
+// STM extended stimulus ports, not behind CS_BASE: 65536 ports of 256 bytes
+#define STM_PORTS 0xF8000000
+#define STM_PORT_SIZE 0x100
+#define STM_N_PORTS 0x10000
+
 #define R5_ROM 0x3E0000
 #define R5_0_DEBUG 0x3F0000
 #define R5_1_DEBUG 0x3F2000
@@ -99,6 +104,16 @@ enum component {
     A53_3_etm,
     };
 
+// CS_BASE up to the end of the A53 debug blocks, mapped once by cs_session_open()
+#define CS_WINDOW_SIZE 0x800000
+
+int cs_mem_fd(int sync);
+int cs_mem_driver_fd(uint64_t addr, uint64_t size);
+uint64_t cs_mem_driver_alloc(uint64_t size);
+void cs_mem_driver_free(void);
+void cs_session_open(void);
+void cs_session_close(void);
 void* cs_register(enum component);
+void cs_unregister(void *ptr, size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+/*
+    Brief: Compares the PMU backends of pmu.h on this board.
+
+    Every backend that opens here is measured over -n reads and counts the
+    events around a short loop as a sanity check. The last line names the
+    cheapest one, which a caller gets with pmu_open_cheapest().
+
+    ./pmu_backends [-c core] [-n reads] [event_name]...
+
+    Default: core 0, 10000 reads, L2D_CACHE_REFILL and BR_MIS_PRED. The
+    memory mapped PMU needs root, the system registers PMUSERENR.EN.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "pmu_event.h"
+#include "pmu.h"
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c core] [-n reads] [event_name]...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// some loads and branches for the counters to see
+static volatile uint64_t sink;
+static void workload(void)
+{
+    static uint64_t data[64 * 1024];
+
+    for (unsigned int i = 0; i < sizeof(data) / sizeof(data[0]); i += 8) {
+        if (data[i] & 1)
+            sink++;
+        sink += data[(i * 2654435761u) % (sizeof(data) / sizeof(data[0]))];
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int events[PMU_MAX_EVENTS] = {L2D_CACHE_REFILL, BR_MIS_PRED};
+    int event_num = 2;
+    unsigned int core = 0;
+    int reads = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        if (opt == 'c') {
+            core = strtoul(optarg, NULL, 0);
+            if (core > 3)
+                usage(argv[0]);
+        } else if (opt == 'n') {
+            reads = atoi(optarg);
+            if (reads < 1)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        event_num = 0;
+        for (int i = optind; i < argc; i++) {
+            if (event_num == PMU_MAX_EVENTS)
+                usage(argv[0]);
+            events[event_num] = pmu_event_lookup(argv[i]);
+            if (events[event_num] < 0) {
+                fprintf(stderr, "Unknown event %s, see pmu_event.h\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            event_num++;
+        }
+    }
+
+    // Disabling all cpuidle. Access the PMU of an idled core will cause a hang.
+    linux_disable_cpuidle();
+    pin_to_core(core);
+
+    for (int b = 0; b < PMU_BACKENDS; b++) {
+        uint64_t before[PMU_MAX_EVENTS], after[PMU_MAX_EVENTS];
+        pmu_t pmu;
+
+        if ((b == PMU_MMIO && access("/dev/mem", R_OK | W_OK) != 0)
+                || pmu_open(&pmu, b, events, event_num, core) != 0) {
+            printf("%-6s not available\n", pmu_backend_name(b));
+            continue;
+        }
+        pmu_measure(&pmu, reads);
+        pmu_read(&pmu, before);
+        workload();
+        pmu_read(&pmu, after);
+
+        printf("%-6s %8.1f ns per read%s\n", pmu_backend_name(b), pmu.read_ns,
+               b == PMU_PERF ? (pmu.fast ? ", from userspace" : ", read()") : "");
+        for (int i = 0; i < event_num; i++)
+            printf("       %s: %lu\n", pmu.events[i].name, (uint64_t) (uint32_t) (after[i] - before[i]));
+        pmu_close(&pmu);
+    }
+
+    pmu_t pmu;
+    int best = pmu_open_cheapest(&pmu, events, event_num, core);
+    if (best < 0) {
+        printf("No PMU backend available\n");
+        return 1;
+    }
+    printf("Cheapest: %s, %.1f ns per read\n", pmu_backend_name(best), pmu.read_ns);
+    pmu_close(&pmu);
+    return 0;
+}
@@ -24,18 +24,67 @@
 #include "cs_etm.h"
 #include "cs_config.h"
 #include "buffer.h"
+#include "zcu_cs.h"
 #include "pmu_counter.h"
+#include "pmu_sampler.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // init parser
 #define MAX_EVENTS 100
+#define MAX_RANGES 4
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} AddrRange;
+
 typedef struct {
     PmuEvent pmu_events[MAX_EVENTS];
     int pmu_events_count;
     char function_name[100];
     int etm_coefficient;
+    // [Filter], the comparators of one ETM: 4 pairs, a start/stop point takes a pair too
+    AddrRange include[MAX_RANGES];
+    int include_count;
+    AddrRange exclude[MAX_RANGES];
+    int exclude_count;
+    AddrRange start_stop[MAX_RANGES];
+    int start_stop_count;
+    int context_id;
+    int branch_broadcast;       // mask of include ranges, -1 when off
+    int branch_broadcast_invert;
+    int counter_event_bus;      // -1 when off
+    uint32_t counter_event_count;
+    // [Sampling], 0 reads the counters only before and after the run
+    uint32_t sample_period_us;
+    char sample_file[100];
 } configuration;
 
+// "start:end" per line of value, as the pmu_events list
+static void parse_ranges(const char* value, AddrRange* ranges, int* count, const char* name) {
+    char* line = strdup(value);
+    char* token = strtok(line, "\n");
+    while (token != NULL) {
+        while (*token == ' ' || *token == '\t' || *token == ';') token++;
+
+        if (*token != '\0') {
+            unsigned long start, end;
+            if (sscanf(token, "%li:%li", &start, &end) != 2 || start >= end) {
+                fprintf(stderr, "Error: bad %s range '%s'\n", name, token);
+                exit(1);
+            }
+            if (*count == MAX_RANGES) {
+                fprintf(stderr, "Error: more than %d %s ranges\n", MAX_RANGES, name);
+                exit(1);
+            }
+            ranges[*count].start = start;
+            ranges[*count].end = end;
+            (*count)++;
+        }
+        token = strtok(NULL, "\n");
+    }
+    free(line);
+}
+
 static int handler(void* user, const char* section, const char* name, const char* value) {
     configuration* pconfig = (configuration*)user;
 
@@ -71,10 +120,54 @@ static int handler(void* user, const char* section, const char* name, const char
         pconfig->function_name[sizeof(pconfig->function_name) - 1] = '\0';
     } else if (MATCH("Variables", "etm_coefficient")) {
         pconfig->etm_coefficient = atoi(value);
+    } else if (MATCH("Filter", "include")) {
+        parse_ranges(value, pconfig->include, &pconfig->include_count, "include");
+    } else if (MATCH("Filter", "exclude")) {
+        parse_ranges(value, pconfig->exclude, &pconfig->exclude_count, "exclude");
+    } else if (MATCH("Filter", "start_stop")) {
+        parse_ranges(value, pconfig->start_stop, &pconfig->start_stop_count, "start_stop");
+    } else if (MATCH("Filter", "context_id")) {
+        pconfig->context_id = atoi(value);
+    } else if (MATCH("Filter", "branch_broadcast")) {
+        pconfig->branch_broadcast = strtol(value, NULL, 0);
+    } else if (MATCH("Filter", "branch_broadcast_invert")) {
+        pconfig->branch_broadcast_invert = atoi(value);
+    } else if (MATCH("Filter", "counter_event")) {
+        // event bus:count, the event bus numbers are the ones of pmu_events
+        if (sscanf(value, "%d:%u", &pconfig->counter_event_bus, &pconfig->counter_event_count) != 2) {
+            fprintf(stderr, "Error: bad counter_event '%s'\n", value);
+            exit(1);
+        }
+    } else if (MATCH("Sampling", "period_us")) {
+        pconfig->sample_period_us = strtoul(value, NULL, 0);
+    } else if (MATCH("Sampling", "file")) {
+        strncpy(pconfig->sample_file, value, sizeof(pconfig->sample_file) - 1);
+        pconfig->sample_file[sizeof(pconfig->sample_file) - 1] = '\0';
     }
     return 1;
 }
 
+/*
+    Programs the [Filter] section on an ETM, after etm_set_contextid_cmp().
+    Include ranges take the comparator pairs first, so bit i of the branch
+    broadcast mask is the i-th include range. The pid filter applies to
+    all comparators unless context_id = 0.
+*/
+static void apply_filters(ETM_interface* etm, const configuration* config) {
+    int i;
+
+    for (i = 0; i < config->include_count; i++)
+        etm_register_range(etm, config->include[i].start, config->include[i].end, config->context_id);
+    for (i = 0; i < config->exclude_count; i++)
+        etm_register_exclude_range(etm, config->exclude[i].start, config->exclude[i].end, config->context_id);
+    for (i = 0; i < config->start_stop_count; i++)
+        etm_register_start_stop_addr(etm, config->start_stop[i].start, config->start_stop[i].end);
+    if (config->branch_broadcast >= 0)
+        etm_set_branch_broadcast(etm, config->branch_broadcast_invert, config->branch_broadcast);
+    if (config->counter_event_bus >= 0)
+        etm_example_large_counter_fire_event(etm, config->counter_event_bus, config->counter_event_count);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // function pointer array for configuration functions
 struct {
@@ -108,6 +201,10 @@ extern ETM_interface *etms[4];
 
 int main(int argc, char* argv[]) {
     configuration config = {0}; // Initialize all fields to 0/NULL
+    config.context_id = 1;
+    config.branch_broadcast = -1;
+    config.counter_event_bus = -1;
+    strcpy(config.sample_file, "pmu_timeline.bin");
 
     if (ini_parse("profiling_config.ini", handler, &config) < 0) {
         printf("Can't load 'profiling_config.ini'\n");
@@ -121,6 +218,19 @@ int main(int argc, char* argv[]) {
     printf("Function name: %s\n", config.function_name);
     printf("ETM Coefficient: %d\n", config.etm_coefficient);
 
+    // without a [Filter] range, the text of ./hello_ETM
+    if (config.include_count == 0 && config.exclude_count == 0 && config.start_stop_count == 0) {
+        config.include[0].start = 0x400000;
+        config.include[0].end = 0x500000;
+        config.include_count = 1;
+    }
+    for (int i = 0; i < config.include_count; i++)
+        printf("Include range: 0x%lx - 0x%lx\n", config.include[i].start, config.include[i].end);
+    for (int i = 0; i < config.exclude_count; i++)
+        printf("Exclude range: 0x%lx - 0x%lx\n", config.exclude[i].start, config.exclude[i].end);
+    for (int i = 0; i < config.start_stop_count; i++)
+        printf("Start/stop: 0x%lx / 0x%lx\n", config.start_stop[i].start, config.start_stop[i].end);
+
     ////////////////////////////////////////////////////////////////////////////////
     // Create shared memory
     unsigned long long *shared_perf_values = mmap(NULL, config.pmu_events_count * sizeof(unsigned long long),
@@ -182,14 +292,21 @@ int main(int argc, char* argv[]) {
     ////////////////////////////////////////////////////////////////////////////////
 
 
-    // clear the buffer
-    clear_buffer(buf_addr, buf_size);
+    // clear the buffer, unless the ETR write pointer bounds the valid data
+    if (strcmp(config.function_name, "cs_config_etr_mp"))
+        clear_buffer(buf_addr, buf_size);
 
     // initialize ETM
     config_etm_n(etms[0], 0, 1);
 
     // config_pmu_enable_export();
 
+    // the timeline of the counters during the run, on this core
+    pmu_sampler_t sampler;
+    if (config.sample_period_us)
+        pmu_sampler_start(&sampler, config.pmu_events_count, config.pmu_events, perf_fds,
+                          config.sample_period_us, config.sample_file, 3);
+
     // fork a child to execute the target application
     for (int i = 0; i < 1; i++)
     {
@@ -200,11 +317,9 @@ int main(int argc, char* argv[]) {
             uint64_t child_pid = (uint64_t) getpid();
 
             // further configure ETM. So that it will only trace the process with pid == child_pid/target_pid
-            // with the program counter in the range of 0x400000 to 0x500000
+            // with the program counter in the [Filter] ranges
             etm_set_contextid_cmp(etms[0], child_pid);
-            etm_register_range(etms[0], 0x400000, 0x500000, 1);
-
-            // etm_example_large_counter_fire_event(etms[0], L2D_CACHE_REFILL_T, 10000);
+            apply_filters(etms[0], &config);
 
             perf_read(shared_perf_values, config.pmu_events_count, perf_fds);
             for (int i = 0; i < config.pmu_events_count; i++) {
@@ -232,13 +347,18 @@ int main(int argc, char* argv[]) {
 
     // Disable ETM, our trace session is done
     etm_disable(etms[0]);
+    if (config.sample_period_us)
+        pmu_sampler_stop(&sampler);
 
-    perf_read(perf_curr_values, config.pmu_events_count, perf_fds);
+    // more events than counters are multiplexed, the values are scaled
+    double perf_running[config.pmu_events_count];
+    perf_read_scaled(perf_curr_values, perf_running, config.pmu_events_count, perf_fds);
     for (int i = 0; i < config.pmu_events_count; i++) {
         printf("For event: %s, the start perf value in parent process is %llu\n", config.pmu_events[i].name, shared_perf_values[i]);
     }
     for (int i = 0; i < config.pmu_events_count; i++) {
-        printf("For event: %s, the curr perf value is %llu\n", config.pmu_events[i].name, perf_curr_values[i]);
+        printf("For event: %s, the curr perf value is %llu (counted %.0f%% of the time)\n",
+               config.pmu_events[i].name, perf_curr_values[i], 100 * perf_running[i]);
     }
 
     perf_delta(perf_curr_values, shared_perf_values, perf_delta_values, config.pmu_events_count);
@@ -246,9 +366,13 @@ int main(int argc, char* argv[]) {
         printf("For event: %s, the delta value is %llu\n", config.pmu_events[i].name, perf_delta_values[i]);
     }
 
-    munmap(etms[0], sizeof(ETM_interface));
+    cs_unregister(etms[0], sizeof(ETM_interface));
 
-    dump_buffer(buf_addr, buf_size);
+    // the ETR write pointer marks the end of its data, else the 0xffffffff fill does
+    if (!strcmp(config.function_name, "cs_config_etr_mp"))
+        cs_dump_etr(buf_addr, buf_size);
+    else
+        dump_buffer(buf_addr, buf_size, 1);
 
     // Clean up shared memory
     if (munmap(shared_perf_values, NUM_PERF * sizeof(unsigned long long)) == -1) {
@@ -0,0 +1,257 @@
+/*
+    Brief: Traces many target runs with one CoreSight configuration.
+
+    The ETR path, the ETM and cpuidle are set up once. Every run then only
+    gets its own context ID and address range filter and the ETR pointers go
+    back to the start of the buffer, so a sweep of thousands of runs does not
+    pay the setup for each. Run n leaves <prefix>n.dat and <prefix>n.ring,
+    the input of deformat -r, and one result line:
+
+        run <n> status <exit status> secs <wall time> bytes <trace bytes> overflows <count>
+
+    ./start_batch [-c core] [-r lo:hi] [-o prefix] [-f command_file | -l socket]
+
+    Every line of the command file, or of a connection to the unix socket,
+    is one run: "[lo:hi] target [args]", the range overriding -r. Results go
+    to stdout, or back to the client; the line "quit" stops the daemon.
+    Default: core 0, range 0x400000:0x500000, commands on stdin.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "common.h"
+#include "pmu_event.h"
+#include "cs_etm.h"
+#include "cs_config.h"
+#include "buffer.h"
+#include "trace_check.h"
+#include "zcu_cs.h"
+
+#define BATCH_MAX_ARGS 64
+#define BATCH_LINE_SIZE 4096
+
+extern ETM_interface *etms[4];
+
+static uint64_t buf_addr = 0x00FFFC0000;  //OCM
+static uint32_t buf_size = 1024 * 256;
+static unsigned int core = 0;
+static uint64_t range_lo = 0x400000, range_hi = 0x500000;
+static const char *prefix = "run_";
+static unsigned long n_runs;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c core] [-r lo:hi] [-o prefix] [-b KB] [-z] [-f command_file | -l socket]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+    Runs one command line and writes its result line to out.
+    Returns 0 on "quit".
+*/
+static int run_line(char *line, FILE *out)
+{
+    char *args[BATCH_MAX_ARGS];
+    char name[256];
+    uint64_t lo = range_lo, hi = range_hi, rwp;
+    struct timespec t_start, t_end;
+    trace_check_t check;
+    int n = 0, status = 0, full;
+    pid_t pid;
+    char *tok, *save;
+
+    for (tok = strtok_r(line, " \t\r\n", &save); tok != NULL && n < BATCH_MAX_ARGS - 1;
+         tok = strtok_r(NULL, " \t\r\n", &save))
+        args[n++] = tok;
+    args[n] = NULL;
+    if (n == 0)
+        return 1;
+    if (strcmp(args[0], "quit") == 0)
+        return 0;
+
+    if (strchr(args[0], ':') != NULL) {
+        long l, h;
+        if (sscanf(args[0], "%li:%li", &l, &h) != 2 || l >= h || n == 1) {
+            fprintf(out, "bad request: %s\n", args[0]);
+            fflush(out);
+            return 1;
+        }
+        lo = l;
+        hi = h;
+        memmove(args, args + 1, n * sizeof(char *));
+    }
+
+    cs_rearm_etr(buf_addr);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    pid = fork();
+    if (pid == 0) {
+        pin_to_core(core);
+
+        etm_set_contextid_cmp(etms[core], (uint64_t) getpid());
+        etm_register_range(etms[core], lo, hi, 1);
+        etm_enable(etms[core]);
+
+        execv(args[0], args);
+        perror("execv failed. Target application failed to start.");
+        exit(1);
+    } else if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    etm_disable(etms[core]);
+    etm_clear_filters(etms[core]);
+
+    cs_stop_etr(&rwp, &full);
+    dump_buffer_ring(buf_addr, buf_size, rwp, full);
+    trace_check_etr(&check, buf_addr, buf_size, rwp, full);
+
+    snprintf(name, sizeof(name), "%s%lu.dat", prefix, n_runs);
+    rename("trace.dat", name);
+    snprintf(name, sizeof(name), "%s%lu.ring", prefix, n_runs);
+    rename("trace.ring", name);
+
+    fprintf(out, "run %lu status %d secs %.6f bytes %lu overflows %lu\n", n_runs,
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+            (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9,
+            check.bytes[core + 1], check.overflows[core + 1]);
+    fflush(out);
+    n_runs++;
+    return 1;
+}
+
+// returns 0 when a line asked to quit
+static int run_stream(FILE *in, FILE *out)
+{
+    char line[BATCH_LINE_SIZE];
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (!run_line(line, out))
+            return 0;
+    }
+    return 1;
+}
+
+static void serve(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        perror(path);
+        exit(1);
+    }
+    printf("Waiting for requests on %s\n", path);
+
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            perror("accept");
+            continue;
+        }
+        FILE *in = fdopen(conn, "r");
+        FILE *out = fdopen(dup(conn), "w");
+        int more = run_stream(in, out);
+        fclose(in);
+        fclose(out);
+        if (!more)
+            break;
+    }
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Vanilla ZCU102 batch trace demo.\n");
+    printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
+
+    const char *list = NULL, *sock = NULL;
+    unsigned long buf_kb = 0;
+    etr_buf_t *rbuf = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:o:b:zf:l:")) != -1) {
+        if (opt == 'c') {
+            core = strtoul(optarg, NULL, 0);
+            if (core > 3)
+                usage(argv[0]);
+        } else if (opt == 'r') {
+            long lo, hi;
+            if (sscanf(optarg, "%li:%li", &lo, &hi) != 2 || lo >= hi)
+                usage(argv[0]);
+            range_lo = lo;
+            range_hi = hi;
+        } else if (opt == 'o') {
+            prefix = optarg;
+        } else if (opt == 'b') {
+            buf_kb = strtoul(optarg, NULL, 0);
+            if (buf_kb == 0)
+                usage(argv[0]);
+        } else if (opt == 'z') {
+            trace_compress = 1;
+        } else if (opt == 'f') {
+            list = optarg;
+        } else if (opt == 'l') {
+            sock = optarg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (list && sock)
+        usage(argv[0]);
+
+    // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
+    linux_disable_cpuidle();
+
+    // off the traced core
+    pin_to_core(core == 3 ? 2 : 3);
+
+    // once for all runs, a run only rearms the ETR and sets its filters
+    if (buf_kb) {
+        rbuf = etr_buffer_alloc(buf_kb * 1024);
+        buf_addr = rbuf->phys;
+        buf_size = rbuf->size;
+    }
+    cs_config_etr_mp(buf_addr, buf_size);
+    cs_register_etms(1 << core);
+    config_etm_n(etms[core], 0, core + 1);
+
+    if (sock) {
+        serve(sock);
+    } else {
+        FILE *in = list ? fopen(list, "r") : stdin;
+        if (in == NULL) {
+            perror(list);
+            exit(1);
+        }
+        run_stream(in, stdout);
+    }
+
+    printf("%lu runs\n", n_runs);
+    cs_unregister(etms[core], sizeof(ETM_interface));
+    if (rbuf) {
+        // stopped after every run, but armed by cs_config_etr_mp() when there was none
+        uint64_t rwp;
+        int full;
+        cs_stop_etr(&rwp, &full);
+        etr_buffer_free(rbuf);
+    }
+    return 0;
+}
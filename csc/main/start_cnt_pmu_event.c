@@ -46,8 +46,8 @@ int main(int argc, char *argv[])
     uint64_t buf_addr = 0x00FFFC0000;  //OCM
     uint32_t buf_size = 1024 * 256;
 
+    // not cleared, cs_dump_etr() takes the valid data from the ETR write pointer
     cs_config_etr_mp(buf_addr, buf_size);
-    clear_buffer(buf_addr, buf_size);
 
     // enable PMU architectural event export
     config_pmu_enable_export();
@@ -100,7 +100,7 @@ int main(int argc, char *argv[])
     // Disable ETM, our trace session is done. Poller will print trace data.
     etm_disable(etms[0]);
 
-    dump_buffer(buf_addr, buf_size);
+    cs_dump_etr(buf_addr, buf_size);
     return 0;
 }
 
@@ -21,6 +21,8 @@
 #include "cs_config.h"
 #include "buffer.h"
 #include "pmu_counter.h"
+#include "drain.h"
+#include "zcu_cs.h"
 
 extern ETM_interface *etms[4];
 
@@ -30,6 +32,39 @@ int main(int argc, char *argv[])
     printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
 
     pid_t target_pid;
+    etr_sg_buf_t *sg = NULL;
+    etr_drain_t drain;
+    const char *drain_out = NULL;
+    unsigned long sg_mb = 0;
+    unsigned long buf_kb = 0;
+    etr_buf_t *rbuf = NULL;
+    int with_stm = 0;
+    int opt;
+
+    // -g MB: a scatter-gather buffer of ordinary pages, -d file: drain the buffer there during the run,
+    // -z: trace.dat or the drain output is a compressed archive,
+    // -s: STM markers of the target (stm_port.h) in the same trace under STM_TRACE_ID,
+    // -b KB: a contiguous buffer of that size allocated for the run (CMA or a huge page) instead of the OCM
+    while ((opt = getopt(argc, argv, "g:d:zsb:")) != -1) {
+        if (opt == 'g')
+            sg_mb = strtoul(optarg, NULL, 0);
+        else if (opt == 'b')
+            buf_kb = strtoul(optarg, NULL, 0);
+        else if (opt == 'd')
+            drain_out = optarg;
+        else if (opt == 'z')
+            trace_compress = 1;
+        else if (opt == 's')
+            with_stm = 1;
+        else {
+            fprintf(stderr, "Usage: %s [-g MB | -b KB] [-d file|-] [-z] [-s]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (sg_mb && (drain_out || buf_kb)) {
+        fprintf(stderr, "-d and -b are for the flat buffer only, not with -g\n");
+        exit(EXIT_FAILURE);
+    }
 
     // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
     linux_disable_cpuidle();
@@ -44,10 +79,24 @@ int main(int argc, char *argv[])
     uint64_t buf_addr = 0x00FFFC0000;  //OCM
     uint32_t buf_size = 1024 * 256;
 
-    cs_config_etr_mp(buf_addr, buf_size);
+    if (buf_kb) {
+        rbuf = etr_buffer_alloc(buf_kb * 1024);
+        buf_addr = rbuf->phys;
+        buf_size = rbuf->size;
+    }
+    if (sg_mb) {
+        sg = sg_buffer_alloc(sg_mb * 1024 * 1024);
+        cs_config_etr_sg(sg);
+    } else {
+        cs_config_etr_mp(buf_addr, buf_size);
+    }
+    if (with_stm)
+        cs_config_stm(STM_TRACE_ID);
+    // core 2 is spare: the target runs on 0 and this process on 3
+    if (drain_out)
+        etr_drain_start(&drain, buf_addr, buf_size, drain_out, 2);
 
-    // clear the buffer
-    clear_buffer(buf_addr, buf_size);
+    // no need to clear the buffer, cs_dump_etr() takes the valid data from the ETR write pointer
 
     // initialize ETM
     config_etm_n(etms[0], 0, 1);
@@ -87,10 +136,21 @@ int main(int argc, char *argv[])
 
     // Disable ETM, our trace session is done
     etm_disable(etms[0]);
-
-    munmap(etms[0], sizeof(ETM_interface));
-
-    dump_buffer(buf_addr, buf_size);
+    if (with_stm)
+        cs_disable_stm();
+
+    cs_unregister(etms[0], sizeof(ETM_interface));
+
+    if (drain_out) {
+        etr_drain_stop(&drain);
+    } else if (sg) {
+        cs_dump_etr_sg(sg);
+        sg_buffer_free(sg);
+    } else {
+        cs_dump_etr(buf_addr, buf_size);
+    }
+    if (rbuf)
+        etr_buffer_free(rbuf);
 
     return 0;
 }
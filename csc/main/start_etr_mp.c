@@ -0,0 +1,293 @@
+/*
+    Brief: Traces one target application per selected A53 core through the ETR.
+
+    Each core has its own ETM, trace ID core + 1, context ID filter on the pid
+    of the target it runs and address range filter. After the run the buffer
+    is deformatted and decoded in memory to report the trace bytes, the
+    bandwidth and the overflows of each trace ID, which is what sizes the ETR
+    for parallel workloads, together with the TMC status.
+
+    ./start_etr_mp [-c core_mask] [-r core:lo:hi]... [-s stall] [-p sync] [-k cci] [-t period]
+                   [-C runs] [-v] [target [args]]
+
+    -s is the ETM stall level 0..15 and -p the TRCSYNCPR sync period, 0 or
+    8..20 for one A-sync every 2^p bytes. -C calibrates instead: it runs the
+    target untraced and then with every stall level and sync period of the
+    grid below, each runs times, and picks the fastest setting that had no
+    overflow and did not fill an ETF.
+
+    -k turns on cycle counting with the threshold cci, -t on timestamps
+    from the Tsgen counter, one every period cycles or with 0 only at syncs.
+    ctrace -T cci -L file turns both into per-branch latencies.
+
+    Default: cores 0x1, range 0x400000:0x500000, target ./hello_ETM.
+    Core 3 is kept for this process unless it is selected as well.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "pmu_event.h"
+#include "cs_etm.h"
+#include "cs_config.h"
+#include "buffer.h"
+#include "trace_check.h"
+#include "zcu_cs.h"
+
+extern ETM_interface *etms[4];
+
+typedef struct core_filter {
+    uint64_t lo;
+    uint64_t hi;
+} core_filter_t;
+
+static const int stall_levels[] = {0, 1, 2, 4, 8, 15};
+static const int sync_periods[] = {0, 8, 12, 16, 20};
+
+static uint64_t buf_addr = 0x00FFFC0000;  //OCM
+static uint32_t buf_size = 1024 * 256;
+static int cc_threshold = 0;    // 0: no cycle counts
+static int ts_period = -1;      // -1: no timestamps
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c core_mask] [-r core:lo:hi]... [-s stall] [-p sync] [-k cci] [-t period]\n"
+                    "       [-C runs] [-b KB] [-v] [-z] [target [args]]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/*
+    One session: the targets run on their cores, traced with the given stall
+    level and sync period unless traced is 0. Returns the wall time in s, the
+    ETR is stopped and holds the trace.
+*/
+static double run_session(uint8_t core_mask, core_filter_t *filters, char **target,
+                          int traced, int stall, int sync)
+{
+    pid_t target_pids[4];
+    struct timespec t_start, t_end;
+    int i;
+
+    cs_config_etr_mp(buf_addr, buf_size);
+    cs_register_etms(core_mask);
+    // not cleared, the ETR write pointer bounds the data
+    cs_report_tmcs(0);
+
+    for (i = 0; i < 4; i++) {
+        if (core_mask & (1 << i)) {
+            config_etm_n(etms[i], stall, i + 1);
+            etm_set_sync(etms[i], sync);
+            if (cc_threshold)
+                etm_set_cci(etms[i], cc_threshold);
+            if (ts_period >= 0)
+                etm_set_timestamp(etms[i], ts_period);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (i = 0; i < 4; i++)
+    {
+        if (!(core_mask & (1 << i)))
+            continue;
+        target_pids[i] = fork();
+        if (target_pids[i] == 0)
+        {
+            pin_to_core(i);
+
+            // only this process, in its own range, on the ETM of its core
+            if (traced) {
+                etm_set_contextid_cmp(etms[i], (uint64_t) getpid());
+                etm_register_range(etms[i], filters[i].lo, filters[i].hi, 1);
+                etm_enable(etms[i]);
+            }
+
+            execv(target[0], target);
+            perror("execv failed. Target application failed to start.");
+            exit(1);
+        }
+        else if (target_pids[i] < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (core_mask & (1 << i)) {
+            int status;
+            waitpid(target_pids[i], &status, 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    for (i = 0; i < 4; i++) {
+        if (core_mask & (1 << i)) {
+            etm_disable(etms[i]);
+            cs_unregister(etms[i], sizeof(ETM_interface));
+        }
+    }
+
+    return (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+}
+
+// best of runs sessions, with its trace checked
+static double best_session(uint8_t core_mask, core_filter_t *filters, char **target,
+                           int runs, int traced, int stall, int sync, uint64_t *overflows, int *held)
+{
+    double best = 0;
+    uint64_t rwp;
+    int full;
+
+    *overflows = 0;
+    *held = 0;
+    for (int r = 0; r < runs; r++) {
+        double secs = run_session(core_mask, filters, target, traced, stall, sync);
+        trace_check_t check;
+
+        cs_stop_etr(&rwp, &full);
+        *held |= cs_report_tmcs(0);
+        if (traced) {
+            trace_check_etr(&check, buf_addr, buf_size, rwp, full);
+            *overflows += trace_check_overflows(&check);
+        }
+        if (r == 0 || secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+/*
+    Stall costs the target cycles and a short sync period costs trace
+    bandwidth, the fastest grid point without overflow is the cheapest one
+    that keeps all the trace.
+*/
+static void calibrate(uint8_t core_mask, core_filter_t *filters, char **target, int runs)
+{
+    uint64_t overflows;
+    int held, best_stall = -1, best_sync = -1;
+    double base, best = 0;
+
+    base = best_session(core_mask, filters, target, runs, 0, 0, 0, &overflows, &held);
+    printf("untraced: %.6f s\n", base);
+
+    for (unsigned int i = 0; i < sizeof(stall_levels) / sizeof(stall_levels[0]); i++) {
+        for (unsigned int j = 0; j < sizeof(sync_periods) / sizeof(sync_periods[0]); j++) {
+            double secs = best_session(core_mask, filters, target, runs, 1,
+                                       stall_levels[i], sync_periods[j], &overflows, &held);
+
+            printf("stall %2d sync %2d: %.6f s, %+.1f%%, %lu overflows%s\n",
+                   stall_levels[i], sync_periods[j], secs, base > 0 ? 100.0 * (secs - base) / base : 0.0,
+                   overflows, held ? ", ETF full" : "");
+            if (overflows == 0 && !held && (best_stall < 0 || secs < best)) {
+                best = secs;
+                best_stall = stall_levels[i];
+                best_sync = sync_periods[j];
+            }
+        }
+    }
+
+    if (best_stall < 0)
+        printf("No setting traced without overflow, narrow the ranges or trace fewer cores\n");
+    else
+        printf("Best: -s %d -p %d, %.6f s, %+.1f%% over untraced\n",
+               best_stall, best_sync, best, base > 0 ? 100.0 * (best - base) / base : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Vanilla ZCU102 multi-core trace demo.\n");
+    printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
+
+    core_filter_t filters[4];
+    uint8_t core_mask = 0x1;
+    char *default_target[] = {"./hello_ETM", NULL};
+    char **target = default_target;
+    int stall = 0, sync = 0, calib_runs = 0, verbose = 0;
+    etr_buf_t *rbuf = NULL;
+    unsigned int core;
+    int opt, i;
+
+    for (i = 0; i < 4; i++) {
+        filters[i].lo = 0x400000;
+        filters[i].hi = 0x500000;
+    }
+    while ((opt = getopt(argc, argv, "+c:r:s:p:k:t:C:b:vz")) != -1) {
+        if (opt == 'c') {
+            core_mask = strtoul(optarg, NULL, 0) & 0xf;
+        } else if (opt == 'r') {
+            long lo, hi;
+            if (sscanf(optarg, "%u:%li:%li", &core, &lo, &hi) != 3 || core > 3 || lo >= hi)
+                usage(argv[0]);
+            filters[core].lo = lo;
+            filters[core].hi = hi;
+        } else if (opt == 's') {
+            stall = atoi(optarg);
+            if (stall < 0 || stall > 15)
+                usage(argv[0]);
+        } else if (opt == 'p') {
+            sync = atoi(optarg);
+            if (sync != 0 && (sync < 8 || sync > 20))
+                usage(argv[0]);
+        } else if (opt == 'k') {
+            cc_threshold = atoi(optarg);
+            if (cc_threshold < 1 || cc_threshold > 4096)
+                usage(argv[0]);
+        } else if (opt == 't') {
+            ts_period = atoi(optarg);
+            if (ts_period < 0 || ts_period > 0xffff)
+                usage(argv[0]);
+        } else if (opt == 'C') {
+            calib_runs = atoi(optarg);
+            if (calib_runs < 1)
+                usage(argv[0]);
+        } else if (opt == 'b') {
+            // a buffer sized to the workload, allocated for this run, instead of the OCM
+            unsigned long kb = strtoul(optarg, NULL, 0);
+            if (kb == 0 || rbuf)
+                usage(argv[0]);
+            rbuf = etr_buffer_alloc(kb * 1024);
+            buf_addr = rbuf->phys;
+            buf_size = rbuf->size;
+        } else if (opt == 'v') {
+            verbose = 1;
+        } else if (opt == 'z') {
+            trace_compress = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (core_mask == 0)
+        usage(argv[0]);
+    if (optind < argc)
+        target = &argv[optind];
+
+    // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
+    linux_disable_cpuidle();
+
+    // off the traced cores if one is left
+    pin_to_core(core_mask == 0xf ? 3 : 31 - __builtin_clz(~core_mask & 0xf));
+
+    if (ts_period >= 0)
+        printf("Timestamps at %u Hz\n", cs_enable_tsgen());
+    for (i = 0; i < 4; i++) {
+        if (core_mask & (1 << i))
+            printf("core %d: trace ID %d, range 0x%lx - 0x%lx\n", i, i + 1, filters[i].lo, filters[i].hi);
+    }
+
+    if (calib_runs) {
+        calibrate(core_mask, filters, target, calib_runs);
+    } else {
+        double secs = run_session(core_mask, filters, target, 1, stall, sync);
+
+        cs_report_tmcs(verbose ? 2 : 1);
+        cs_dump_etr(buf_addr, buf_size);
+        report_trace_ids("trace.dat", "trace.ring", secs);
+    }
+    if (rbuf)
+        etr_buffer_free(rbuf);
+
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "pmu_event.h"
 #include "cs_etm.h"
 #include "cs_config.h"
+#include "buffer.h"
 
 extern ETM_interface *etms[4];
 
@@ -27,6 +28,16 @@ int main(int argc, char *argv[])
 
     pid_t target_pid;
 
+    // optional: size of the poller ring in MB, then a flush latency bound in us, then 1 to compress trace.dat
+    if (argc > 1)
+        poller_cfg.ring_words = strtoul(argv[1], NULL, 0) * (1024 * 1024 / sizeof(uint32_t));
+    if (argc > 2) {
+        poller_cfg.mode = POLL_ADAPTIVE;
+        poller_cfg.flush_us = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3)
+        trace_compress = atoi(argv[3]);
+
     // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
     linux_disable_cpuidle();
     
@@ -0,0 +1,127 @@
+/*
+    Brief: Traces a target through the session library (session.h): the
+    ETR is drained, deformatted and decoded in this process while the target
+    runs, and the events come back through a callback. Files are written
+    only on request.
+
+    ./start_session [-c core_mask] [-r core:lo:hi]... [-s stall] [-p sync] [-o trace.dat]
+                    [-D prefix] [-e] [target [args]]
+
+    -o keeps the formatted trace as drained, -D writes the decode of trace
+    ID i + 1 to <prefix>_<i>.txt, or .evt with -e. Without either, only the
+    counts below are printed: the atoms, branches taken and addresses of
+    every trace ID, counted by the callback as they are decoded.
+
+    Default: cores 0x1, range 0x400000:0x500000, target ./hello_ETM.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "buffer.h"
+#include "session.h"
+
+typedef struct counts {
+    uint64_t atoms[FRAME_IDS];
+    uint64_t taken[FRAME_IDS];
+    uint64_t addresses[FRAME_IDS];
+} counts_t;
+
+// each ID has its own decoder thread and its own counters
+static void count_event(void *ctx, int id, const trace_event_t *event)
+{
+    counts_t *c = (counts_t *) ctx;
+
+    if (event->type == EV_ATOM) {
+        c->atoms[id] += event->count;
+        c->taken[id] += __builtin_popcountll(event->value);
+    } else if (event->type == EV_ADDRESS) {
+        c->addresses[id]++;
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c core_mask] [-r core:lo:hi]... [-s stall] [-p sync] [-o trace.dat]\n"
+                    "       [-D prefix] [-e] [-b KB] [target [args]]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Vanilla ZCU102 in-process trace session.\n");
+    printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
+
+    char *default_target[] = {"./hello_ETM", NULL};
+    char **target = default_target;
+    static counts_t counts;
+    session_t s;
+    etr_buf_t *rbuf = NULL;
+    unsigned long buf_kb = 0;
+    unsigned int core;
+    int opt, failed;
+
+    session_init(&s);
+    s.on_event = count_event;
+    s.ctx = &counts;
+    while ((opt = getopt(argc, argv, "+c:r:s:p:o:D:eb:")) != -1) {
+        if (opt == 'c') {
+            s.core_mask = strtoul(optarg, NULL, 0) & 0xf;
+        } else if (opt == 'r') {
+            long lo, hi;
+            if (sscanf(optarg, "%u:%li:%li", &core, &lo, &hi) != 3 || core > 3 || lo >= hi)
+                usage(argv[0]);
+            session_set_filter(&s, core, lo, hi);
+        } else if (opt == 's') {
+            s.stall = atoi(optarg);
+            if (s.stall < 0 || s.stall > 15)
+                usage(argv[0]);
+        } else if (opt == 'p') {
+            s.sync = atoi(optarg);
+            if (s.sync != 0 && (s.sync < 8 || s.sync > 20))
+                usage(argv[0]);
+        } else if (opt == 'o') {
+            s.raw_path = optarg;
+        } else if (opt == 'D') {
+            s.decode_prefix = optarg;
+        } else if (opt == 'e') {
+            s.decode_mode = SINK_BINARY;
+        } else if (opt == 'b') {
+            buf_kb = strtoul(optarg, NULL, 0);
+            if (buf_kb == 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (s.core_mask == 0)
+        usage(argv[0]);
+    if (optind < argc)
+        target = &argv[optind];
+
+    // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
+    linux_disable_cpuidle();
+
+    // the drain runs on core 2, this process stays off the traced cores if one is left
+    pin_to_core(s.core_mask == 0xf ? 3 : 31 - __builtin_clz(~s.core_mask & 0xf));
+
+    // a buffer for this session instead of the OCM, a larger one lets the drain fall further behind
+    if (buf_kb) {
+        rbuf = etr_buffer_alloc(buf_kb * 1024);
+        s.buf_addr = rbuf->phys;
+        s.buf_size = rbuf->size;
+    }
+    failed = session_run(&s, target);
+    if (rbuf)
+        etr_buffer_free(rbuf);
+
+    session_print(&s);
+    for (int id = 1; id <= 4; id++) {
+        if (counts.atoms[id] == 0 && counts.addresses[id] == 0)
+            continue;
+        printf("  ID %d: %lu atoms, %lu taken, %lu addresses\n",
+               id, counts.atoms[id], counts.taken[id], counts.addresses[id]);
+    }
+    return failed;
+}
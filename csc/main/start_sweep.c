@@ -0,0 +1,465 @@
+/*
+    Brief: Sweeps the trace paths and ETM stall levels over one target on
+    core 0 and writes a capacity table: trace bytes/s, overflows, drain
+    latency and the slowdown over an untraced run for every path and stall
+    level.
+
+    ./start_sweep [-P paths] [-s stall,...] [-r lo:hi] [-R runs] [-b addr:size] [-o table.csv]
+                  [-A MBps:us] [target [args]]
+
+    Paths, by letter: f is TMC1 in Software FIFO mode read by the poller
+    (start_mp), s is TMC2 in Circular mode read back over APB (start_sram),
+    e is the ETR into buf_addr, drained to sweep.dat during the run
+    (start_etr -d). Each point is run runs times and the fastest run is
+    kept, with the trace it left (sweep.dat for s and e, trace.dat for f).
+    -o appends the rows to a CSV file, so runs of stress_ETM with different
+    -d/-i/-x add up to one table.
+
+    Latency is the longest a trace byte waited in the path before it left
+    for the file: the peak fill of TMC1 or peak lag of the drain at the
+    measured rate, plus the flush or poll interval. SRAM is only read
+    after the target exits, its latency is the run.
+
+    -A picks the path for a session instead: from the rows of the -o table
+    for this target line (swept first if there are none), the stall level
+    and path with the least slowdown that traced at least MBps MB/s with
+    at most us of latency and lost nothing, then traces one run through it.
+
+    Default: paths fse, stall 0,1,2,4,8,15, range 0x400000:0x500000, 1 run,
+    the 256 KB of OCM at 0xFFFC0000, target ./stress_ETM.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "cs_etm.h"
+#include "cs_soc.h"
+#include "cs_config.h"
+#include "buffer.h"
+#include "drain.h"
+#include "trace_check.h"
+#include "zcu_cs.h"
+
+extern ETM_interface *etms[4];
+extern TMC_interface *tmc1;
+extern TMC_interface *tmc2;
+
+#define MAX_STALLS 16
+#define SWEEP_DAT "sweep.dat"
+
+enum path { PATH_FIFO, PATH_SRAM, PATH_ETR, NUM_PATHS };
+static const char path_letters[NUM_PATHS] = {'f', 's', 'e'};
+static const char *path_names[NUM_PATHS] = {"softfifo", "sram", "etr"};
+
+static uint64_t buf_addr = 0x00FFFC0000;  //OCM
+static uint32_t buf_size = 1024 * 256;
+static uint64_t range_lo = 0x400000;
+static uint64_t range_hi = 0x500000;
+
+// one traced run: its time, its trace and what the path lost on the way
+typedef struct point {
+    double secs;
+    trace_check_t check;
+    int held;           // an ETF filled up
+    uint64_t lost;      // ETR copies overwritten before the drain took them
+    double latency_us;
+} point_t;
+
+// a row of the table, as -A reads it back
+typedef struct choice {
+    enum path path;
+    int stall;
+    double slowdown;
+    double bytes_per_s;
+    double latency_us;
+} choice_t;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-P paths] [-s stall,...] [-r lo:hi] [-R runs] [-b addr:size] [-o table.csv]\n"
+                    "       [-A MBps:us] [target [args]]\n"
+                    "       paths: f softfifo, s sram, e etr, default fse\n"
+                    "       -A: the path with the least slowdown at MBps and us of latency, needs -o\n", name);
+    exit(EXIT_FAILURE);
+}
+
+// the whole file to memory, for trace_check_ring()
+static uint8_t *read_file(const char *name, uint32_t *size)
+{
+    FILE *fp = fopen(name, "rb");
+    uint8_t *data;
+    long len;
+
+    if (fp == NULL) {
+        perror(name);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    data = (uint8_t *) malloc(len + 1);
+    if (data == NULL || fread(data, 1, len, fp) != (size_t) len) {
+        fprintf(stderr, "%s can't be read\n", name);
+        exit(1);
+    }
+    fclose(fp);
+    *size = (uint32_t) len;
+    return data;
+}
+
+/*
+    Stops TMC2 and reads its RAM over RRD, oldest word first: all of it
+    when it wrapped, else up to the write pointer. Returns the bytes.
+*/
+static uint32_t read_sram(uint8_t **data, int *full)
+{
+    uint32_t words = tmc2->ram_size, n = 0;
+    uint32_t *buf = (uint32_t *) malloc(words * sizeof(uint32_t));
+
+    tmc_disable(tmc2);
+    *full = tmc_full(tmc2);
+    while (n < words && (*full || tmc2->ram_read_pt != tmc2->ram_write_pt)) {
+        uint32_t word = tmc2->ram_read_data;
+        if (word == 0xffffffff && !*full)
+            break;
+        buf[n++] = word;
+    }
+    *data = (uint8_t *) buf;
+    return n * sizeof(uint32_t);
+}
+
+static void write_file(const char *name, const uint8_t *data, uint32_t size)
+{
+    FILE *fp = fopen(name, "wb");
+
+    if (fp == NULL || fwrite(data, 1, size, fp) != size) {
+        perror(name);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+// the target on core 0, traced through path unless traced is 0; returns the wall time in s
+static double run_once(enum path path, char **target, int traced, int stall, point_t *pt)
+{
+    struct timespec t_start, t_end;
+    pid_t target_pid, poller_pid = 0;
+    etr_drain_t drain;
+    uint8_t *data = NULL;
+    uint32_t size = 0;
+    uint32_t fill = 0;
+    int status, full = 0;
+
+    if (path == PATH_FIFO) {
+        cs_config_tmc1_softfifo();
+    } else if (path == PATH_SRAM) {
+        cs_config_SRAM();
+    } else {
+        cs_config_etr_mp(buf_addr, buf_size);
+        if (traced)
+            etr_drain_start(&drain, buf_addr, buf_size, SWEEP_DAT, 2);
+    }
+    cs_report_tmcs(0);
+    config_etm_n(etms[0], stall, 1);
+
+    // the poller waits for the ETM on core 1, its writer thread is on core 2
+    if (traced && path == PATH_FIFO) {
+        poller_pid = fork();
+        if (poller_pid == 0) {
+            poller();
+            exit(0);
+        } else if (poller_pid < 0) {
+            perror("fork");
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    target_pid = fork();
+    if (target_pid == 0) {
+        pin_to_core(0);
+        if (traced) {
+            etm_set_contextid_cmp(etms[0], (uint64_t) getpid());
+            etm_register_range(etms[0], range_lo, range_hi, 1);
+            etm_enable(etms[0]);
+        }
+        execv(target[0], target);
+        perror("execv failed. Target application failed to start.");
+        exit(1);
+    } else if (target_pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    waitpid(target_pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    etm_disable(etms[0]);
+
+    // latched since cs_report_tmcs() above, read before it resets it again
+    if (path == PATH_FIFO)
+        fill = tmc1->latched_buf_fill_level * sizeof(uint32_t);
+
+    pt->secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    pt->held = cs_report_tmcs(0);
+    pt->lost = 0;
+    pt->latency_us = 0;
+    memset(&pt->check, 0, sizeof(pt->check));
+
+    if (traced) {
+        if (path == PATH_FIFO) {
+            waitpid(poller_pid, &status, 0);
+            data = read_file("trace.dat", &size);
+        } else if (path == PATH_SRAM) {
+            size = read_sram(&data, &full);
+            write_file(SWEEP_DAT, data, size);
+        } else {
+            etr_drain_stop(&drain);
+            pt->lost = drain.overwrites;
+            fill = drain.peak_lag;
+            data = read_file(SWEEP_DAT, &size);
+        }
+        trace_check_ring(&pt->check, data, size, size, 0);
+        pt->check.wrapped = full;
+        free(data);
+
+        if (path == PATH_SRAM)
+            pt->latency_us = pt->secs * 1e6;
+        else if (size > 0 && pt->secs > 0)
+            pt->latency_us = fill / (size / pt->secs) * 1e6;
+        if (path == PATH_FIFO && poller_cfg.mode == POLL_ADAPTIVE)
+            pt->latency_us += poller_cfg.flush_us;
+        else if (path == PATH_ETR)
+            pt->latency_us += drain.poll_us;
+    } else if (path == PATH_ETR) {
+        uint64_t rwp;
+        cs_stop_etr(&rwp, &full);
+    }
+
+    // the FIFO and SRAM configurations register all four ETMs
+    for (int i = 0; i < (path == PATH_ETR ? 1 : 4); i++)
+        cs_unregister(etms[i], sizeof(ETM_interface));
+    if (path == PATH_FIFO)
+        cs_unregister(tmc1, sizeof(TMC_interface));
+    else if (path == PATH_SRAM)
+        cs_unregister(tmc2, sizeof(TMC_interface));
+    return pt->secs;
+}
+
+// the fastest of runs
+static void run_point(enum path path, char **target, int runs, int traced, int stall, point_t *best)
+{
+    point_t pt;
+
+    for (int r = 0; r < runs; r++) {
+        run_once(path, target, traced, stall, &pt);
+        if (r == 0 || pt.secs < best->secs)
+            *best = pt;
+    }
+}
+
+static uint64_t sum_ids(const uint64_t *v)
+{
+    uint64_t n = 0;
+
+    for (int id = 0; id < FRAME_IDS; id++)
+        n += v[id];
+    return n;
+}
+
+/*
+    The cheapest row of the table for cmdline: least slowdown at rate
+    bytes/s or more and latency us or less, no overflow, nothing lost.
+    Rows of other paths than paths and rows without latency (tables of an
+    older start_sweep) do not count. Returns the rows of cmdline, 0 when
+    the target was never swept.
+*/
+static int select_path(const char *csv_name, const char *cmdline, const char *paths,
+                       double rate, double latency, choice_t *best, int *found)
+{
+    FILE *fp = fopen(csv_name, "r");
+    char line[512], name[16];
+    size_t len = strlen(cmdline);
+    int rows = 0;
+
+    *found = 0;
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        choice_t c;
+        uint64_t bytes, overflows, syncs, lost;
+        int held, p;
+        double secs;
+
+        if (strncmp(line, cmdline, len) != 0 || line[len] != ';')
+            continue;
+        if (sscanf(line + len + 1, "%15[^;];%d;%lf;%lf;%lu;%lf;%lu;%lu;%d;%lu;%lf",
+                   name, &c.stall, &secs, &c.slowdown, &bytes, &c.bytes_per_s,
+                   &overflows, &syncs, &held, &lost, &c.latency_us) != 11)
+            continue;
+        for (p = 0; p < NUM_PATHS && strcmp(name, path_names[p]) != 0; p++);
+        if (p == NUM_PATHS || strchr(paths, path_letters[p]) == NULL)
+            continue;
+        c.path = (enum path) p;
+        rows++;
+        if (c.bytes_per_s < rate || c.latency_us > latency || overflows || held || lost)
+            continue;
+        if (!*found || c.slowdown < best->slowdown)
+            *best = c;
+        *found = 1;
+    }
+    fclose(fp);
+    return rows;
+}
+
+// the untraced run, then every path at every stall level; rows to csv unless NULL
+static void sweep(char **target, const char *cmdline, const char *paths, const int *stalls, int n_stalls,
+                  int runs, FILE *csv)
+{
+    point_t base, pt;
+
+    run_point(PATH_ETR, target, runs, 0, 0, &base);
+    printf("\n%s untraced: %.6f s\n\n", cmdline, base.secs);
+    printf("%-9s %5s %10s %9s %12s %10s %10s %9s %6s\n",
+           "path", "stall", "secs", "slowdown", "bytes", "MB/s", "latency", "overflow", "lost");
+
+    for (int p = 0; p < NUM_PATHS; p++) {
+        if (strchr(paths, path_letters[p]) == NULL)
+            continue;
+        for (int s = 0; s < n_stalls; s++) {
+            uint64_t bytes, overflows, syncs;
+            double slowdown;
+
+            run_point((enum path) p, target, runs, 1, stalls[s], &pt);
+            bytes = sum_ids(pt.check.bytes);
+            overflows = sum_ids(pt.check.overflows);
+            syncs = sum_ids(pt.check.syncs);
+            slowdown = base.secs > 0 ? 100.0 * (pt.secs - base.secs) / base.secs : 0.0;
+
+            printf("%-9s %5d %10.6f %+8.1f%% %12lu %10.3f %8.0fus %9lu %6lu%s%s\n",
+                   path_names[p], stalls[s], pt.secs, slowdown, bytes,
+                   pt.secs > 0 ? bytes / pt.secs / 1e6 : 0.0, pt.latency_us, overflows, pt.lost,
+                   pt.held ? " ETF full" : "", pt.check.wrapped ? " wrapped" : "");
+            if (csv != NULL) {
+                fprintf(csv, "%s;%s;%d;%.6f;%.1f;%lu;%.0f;%lu;%lu;%d;%lu;%.0f\n",
+                        cmdline, path_names[p], stalls[s], pt.secs, slowdown, bytes,
+                        pt.secs > 0 ? bytes / pt.secs : 0.0, overflows, syncs, pt.held,
+                        pt.lost + (uint64_t) pt.check.wrapped, pt.latency_us);
+                fflush(csv);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Vanilla ZCU102 trace path sweep.\n");
+    printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
+
+    char *default_target[] = {"./stress_ETM", NULL};
+    char **target = default_target;
+    const char *paths = "fse";
+    const char *csv_name = NULL;
+    int stalls[MAX_STALLS] = {0, 1, 2, 4, 8, 15};
+    int n_stalls = 6, runs = 1;
+    char cmdline[256] = "";
+    FILE *csv = NULL;
+    double want_rate = 0, want_latency = 0;
+    int choose = 0, found = 0;
+    choice_t choice;
+    point_t pt;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "+P:s:r:R:b:o:A:")) != -1) {
+        if (opt == 'P') {
+            paths = optarg;
+            if (strspn(paths, "fse") != strlen(paths) || *paths == '\0')
+                usage(argv[0]);
+        } else if (opt == 's') {
+            char *p = optarg;
+            n_stalls = 0;
+            while (*p != '\0' && n_stalls < MAX_STALLS) {
+                stalls[n_stalls] = strtol(p, &p, 0);
+                if (stalls[n_stalls] < 0 || stalls[n_stalls] > 15 || (*p != ',' && *p != '\0'))
+                    usage(argv[0]);
+                n_stalls++;
+                if (*p == ',')
+                    p++;
+            }
+            if (n_stalls == 0)
+                usage(argv[0]);
+        } else if (opt == 'r') {
+            if (sscanf(optarg, "%li:%li", &range_lo, &range_hi) != 2 || range_lo >= range_hi)
+                usage(argv[0]);
+        } else if (opt == 'R') {
+            runs = atoi(optarg);
+            if (runs < 1)
+                usage(argv[0]);
+        } else if (opt == 'b') {
+            if (sscanf(optarg, "%li:%i", &buf_addr, &buf_size) != 2 || buf_size == 0)
+                usage(argv[0]);
+        } else if (opt == 'o') {
+            csv_name = optarg;
+        } else if (opt == 'A') {
+            if (sscanf(optarg, "%lf:%lf", &want_rate, &want_latency) != 2 || want_rate < 0 || want_latency <= 0)
+                usage(argv[0]);
+            want_rate *= 1e6;
+            choose = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (choose && csv_name == NULL)
+        usage(argv[0]);
+    if (optind < argc)
+        target = &argv[optind];
+    for (char **arg = target; *arg != NULL; arg++) {
+        size_t len = strlen(cmdline);
+        snprintf(cmdline + len, sizeof(cmdline) - len, "%s%s", len ? " " : "", *arg);
+    }
+
+    if (csv_name != NULL) {
+        csv = fopen(csv_name, "a");
+        if (csv == NULL) {
+            perror(csv_name);
+            exit(1);
+        }
+        if (ftell(csv) == 0)
+            fprintf(csv, "#target;path;stall;secs;slowdown_pct;bytes;bytes_per_s;overflows;syncs;etf_full;lost;latency_us\n");
+    }
+
+    // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
+    linux_disable_cpuidle();
+
+    // core 0 runs the target, 1 the poller, 2 the writer or the drain
+    pin_to_core(3);
+
+    if (choose) {
+        if (select_path(csv_name, cmdline, paths, want_rate, want_latency, &choice, &found) == 0)
+            sweep(target, cmdline, paths, stalls, n_stalls, runs, csv);
+    } else {
+        sweep(target, cmdline, paths, stalls, n_stalls, runs, csv);
+    }
+    if (csv != NULL)
+        fclose(csv);
+    if (!choose)
+        return 0;
+
+    if (!found && select_path(csv_name, cmdline, paths, want_rate, want_latency, &choice, &found) == 0) {
+        fprintf(stderr, "%s has no rows for %s\n", csv_name, cmdline);
+        return 1;
+    }
+    if (!found) {
+        fprintf(stderr, "No path of %s traces %s at %.3f MB/s within %.0f us without loss\n",
+                csv_name, cmdline, want_rate / 1e6, want_latency);
+        return 1;
+    }
+    printf("\nSelected %s at stall %d: %.3f MB/s, %.0f us, %+.1f%% in the table\n",
+           path_names[choice.path], choice.stall, choice.bytes_per_s / 1e6, choice.latency_us, choice.slowdown);
+    run_once(choice.path, target, 1, choice.stall, &pt);
+    printf("%s traced: %.6f s, %lu bytes, %.0f us, %lu overflows, trace in %s\n",
+           cmdline, pt.secs, sum_ids(pt.check.bytes), pt.latency_us, sum_ids(pt.check.overflows),
+           choice.path == PATH_FIFO ? "trace.dat" : SWEEP_DAT);
+    return 0;
+}
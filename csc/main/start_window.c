@@ -0,0 +1,139 @@
+/*
+    Brief: Records only a window of trace around an event of interest.
+
+    An ETM event, an address hit (-e) or a PMU event count reaching a
+    threshold (-P), asserts an ETM external output. Through the CTIs it
+    triggers the ETR, which captures -a KB more and then stops, so its
+    circular buffer holds the -b KB before the trigger and the -a KB after.
+    The event is also an Event packet in the trace, it marks the trigger.
+
+    ./start_window [-c core] [-r lo:hi] [-b KB] [-a KB] [-o trigout] [-z] (-e addr | -P bus:count) [target [args]]
+
+    Default: core 0, range 0x400000:0x500000, 192 KB before and 64 KB after,
+    CTI0 trigger output 0 (see cs_config_trigger()), target ./hello_ETM.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "pmu_event.h"
+#include "cs_etm.h"
+#include "cs_config.h"
+#include "buffer.h"
+#include "zcu_cs.h"
+
+extern ETM_interface *etms[4];
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c core] [-r lo:hi] [-b KB] [-a KB] [-o trigout] [-z] (-e addr | -P bus:count) [target [args]]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Vanilla ZCU102 windowed trace demo.\n");
+    printf("Build: on %s at %s\n\n", __DATE__, __TIME__);
+
+    char *default_target[] = {"./hello_ETM", NULL};
+    char **target = default_target;
+    unsigned int core = 0, before_kb = 192, after_kb = 64;
+    uint64_t lo = 0x400000, hi = 0x500000, hit_addr = 0;
+    int trigout = 0, pmu_bus = -1;
+    uint32_t pmu_count = 0;
+    pid_t target_pid;
+    int opt, status;
+
+    while ((opt = getopt(argc, argv, "+c:r:b:a:o:ze:P:")) != -1) {
+        if (opt == 'c') {
+            core = strtoul(optarg, NULL, 0);
+            if (core > 3)
+                usage(argv[0]);
+        } else if (opt == 'r') {
+            long l, h;
+            if (sscanf(optarg, "%li:%li", &l, &h) != 2 || l >= h)
+                usage(argv[0]);
+            lo = l;
+            hi = h;
+        } else if (opt == 'b') {
+            before_kb = strtoul(optarg, NULL, 0);
+        } else if (opt == 'a') {
+            after_kb = strtoul(optarg, NULL, 0);
+        } else if (opt == 'o') {
+            trigout = atoi(optarg);
+            if (trigout < 0 || trigout > 7)
+                usage(argv[0]);
+        } else if (opt == 'z') {
+            trace_compress = 1;
+        } else if (opt == 'e') {
+            hit_addr = strtoull(optarg, NULL, 0);
+        } else if (opt == 'P') {
+            if (sscanf(optarg, "%d:%u", &pmu_bus, &pmu_count) != 2 || pmu_bus < 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if ((hit_addr == 0) == (pmu_bus < 0))
+        usage(argv[0]);
+    if (optind < argc)
+        target = &argv[optind];
+
+    // the window is the whole ETR buffer, in the OCM
+    uint64_t buf_addr = 0x00FFFC0000;
+    uint32_t buf_size = (before_kb + after_kb) * 1024;
+    if (after_kb == 0 || buf_size > 1024 * 256) {
+        fprintf(stderr, "The window must fit the 256 KB of OCM with some trace after the trigger\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Disabling all cpuidle. Access the ETM of an idled core will cause a hang.
+    linux_disable_cpuidle();
+
+    // off the traced core
+    pin_to_core(core == 3 ? 2 : 3);
+
+    cs_config_etr_mp(buf_addr, buf_size);
+    cs_register_etms(1 << core);
+    cs_config_trigger(1 << core, trigout, after_kb * 1024);
+    config_etm_n(etms[core], 0, core + 1);
+    printf("Window: %u KB before and %u KB after the trigger\n", before_kb, after_kb);
+
+    target_pid = fork();
+    if (target_pid == 0)
+    {
+        pin_to_core(core);
+
+        etm_set_contextid_cmp(etms[core], (uint64_t) getpid());
+        etm_register_range(etms[core], lo, hi, 1);
+        // both fire the ETM external output 3, and an Event packet
+        if (hit_addr)
+            etm_register_single_addr_match_event(etms[core], hit_addr);
+        else
+            etm_example_large_counter_fire_event(etms[core], pmu_bus, pmu_count);
+        etm_enable(etms[core]);
+
+        execv(target[0], target);
+        perror("execv failed. Target application failed to start.");
+        exit(1);
+    }
+    else if (target_pid < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    waitpid(target_pid, &status, 0);
+    etm_disable(etms[core]);
+    cs_unregister(etms[core], sizeof(ETM_interface));
+
+    if (cs_etr_triggered())
+        printf("Triggered, the buffer holds the window around the first event\n");
+    else
+        printf("No trigger, the buffer holds the last %u KB of trace\n", before_kb + after_kb);
+    cs_dump_etr(buf_addr, buf_size);
+
+    return 0;
+}
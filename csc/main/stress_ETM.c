@@ -0,0 +1,147 @@
+/*
+    Brief: A trace target with a configurable branch mix, to find the branch
+    rate at which a trace path starts to overflow. hello_ETM hardly branches.
+
+    ./stress_ETM [-n blocks] [-d pad] [-i indirect] [-x yield]
+
+    A block is 16 conditional branches, each after pad NOPs (-d 0, 1, 3, 7,
+    15 or 31), taken or not by the bits of a xorshift value, so the atoms do
+    not repeat. -i adds that many indirect calls per block to one of four
+    leaves picked by the same value, each one an address packet. -x yields
+    the core every that many blocks to a partner process on the same core,
+    so the trace is switched off and on again with a context ID packet each
+    time. At the end it prints the branch rate it ran at.
+
+    Default: 1000000 blocks, no padding, no indirect calls, no yields.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define BLOCK_BRANCHES 16
+
+// 16 TBZ on bits 0..15, each to the next instruction after pad NOPs
+#define BRANCH_BLOCK(pad)                                   \
+static void block_##pad(uint64_t bits)                      \
+{                                                           \
+    __asm__ volatile(                                       \
+        ".irp bit, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15\n" \
+        ".rept " #pad "\n"                                  \
+        "nop\n"                                             \
+        ".endr\n"                                           \
+        "tbz %0, #\\bit, 1f\n"                              \
+        "1:\n"                                              \
+        ".endr\n"                                           \
+        : : "r" (bits) : "memory");                         \
+}
+
+BRANCH_BLOCK(0)
+BRANCH_BLOCK(1)
+BRANCH_BLOCK(3)
+BRANCH_BLOCK(7)
+BRANCH_BLOCK(15)
+BRANCH_BLOCK(31)
+
+static const struct {
+    int pad;
+    void (*run)(uint64_t);
+} blocks[] = {
+    {0, block_0}, {1, block_1}, {3, block_3}, {7, block_7}, {15, block_15}, {31, block_31},
+};
+
+static __attribute__((noinline)) uint64_t leaf_0(uint64_t x) { return x + 1; }
+static __attribute__((noinline)) uint64_t leaf_1(uint64_t x) { return x ^ 0x55; }
+static __attribute__((noinline)) uint64_t leaf_2(uint64_t x) { return x << 1; }
+static __attribute__((noinline)) uint64_t leaf_3(uint64_t x) { return x >> 1; }
+
+// volatile, so the calls stay indirect
+static uint64_t (*volatile leaves[4])(uint64_t) = {leaf_0, leaf_1, leaf_2, leaf_3};
+
+static inline uint64_t xorshift(uint64_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n blocks] [-d pad] [-i indirect] [-x yield]\n"
+                    "       pad: 0, 1, 3, 7, 15 or 31 NOPs between two branches\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n_blocks = 1000000, yield_every = 0, yields = 0;
+    unsigned int indirect = 0, b;
+    void (*run)(uint64_t) = NULL;
+    int pad = 0, opt;
+    uint64_t bits = 0x9e3779b97f4a7c15ull, sum = 0;
+    struct timespec t_start, t_end;
+    pid_t partner = 0;
+    double secs;
+
+    while ((opt = getopt(argc, argv, "n:d:i:x:")) != -1) {
+        if (opt == 'n')
+            n_blocks = strtoul(optarg, NULL, 0);
+        else if (opt == 'd')
+            pad = atoi(optarg);
+        else if (opt == 'i')
+            indirect = strtoul(optarg, NULL, 0);
+        else if (opt == 'x')
+            yield_every = strtoul(optarg, NULL, 0);
+        else
+            usage(argv[0]);
+    }
+    for (b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+        if (blocks[b].pad == pad)
+            run = blocks[b].run;
+    }
+    if (run == NULL || n_blocks == 0 || indirect > 32)
+        usage(argv[0]);
+
+    // the partner inherits the core, it is not traced: another pid
+    if (yield_every) {
+        partner = fork();
+        if (partner == 0) {
+            for (;;)
+                sched_yield();
+        } else if (partner < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (unsigned long n = 0; n < n_blocks; n++) {
+        bits = xorshift(bits);
+        run(bits);
+        for (unsigned int k = 0; k < indirect; k++)
+            sum += leaves[(bits >> (2 * k)) & 3](bits);
+        if (yield_every && (n + 1) % yield_every == 0) {
+            sched_yield();
+            yields++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    if (partner > 0) {
+        kill(partner, SIGKILL);
+        waitpid(partner, NULL, 0);
+    }
+
+    secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    printf("stress_ETM: %lu blocks, pad %d, %u indirect, %lu yields, %.6f s, %.2f M branches/s (%lx)\n",
+           n_blocks, pad, indirect, yields, secs,
+           secs > 0 ? n_blocks * (BLOCK_BRANCHES + indirect) / secs / 1e6 : 0.0, (unsigned long) sum);
+    return 0;
+}
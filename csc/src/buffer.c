@@ -1,25 +1,143 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <stdint.h>
+#include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include "buffer.h"
+#include "zcu_cs.h"
+#include "cs_mem.h"
+#include "archive.h"
 
-uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size)
+int trace_compress = 0;
+
+// the etr_buffer_alloc() buffer of the session, if any
+static etr_buf_t *runtime_buf = NULL;
+
+// physical address of a page mapped by this process, from /proc/self/pagemap
+static uint64_t virt_to_phys(void *addr)
 {
-    void* ptr = NULL;
-    int fd = open("/dev/mem", O_RDWR);
-    if (fd < 0) {
-        perror("Cannot open /dev/mem\n");
+    static int fd = -1;
+    uint64_t entry;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (fd < 0 && (fd = open("/proc/self/pagemap", O_RDONLY)) < 0) {
+        perror("/proc/self/pagemap");
         exit(1);
     }
-    ptr = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf_addr);
+    if (pread(fd, &entry, sizeof(entry), ((uintptr_t) addr / page) * sizeof(entry)) != sizeof(entry)) {
+        perror("pread pagemap");
+        exit(1);
+    }
+    // bit 63 present, bits 0-54 page frame number; the PFN reads as 0 without CAP_SYS_ADMIN
+    if (!(entry >> 63) || !(entry & ((1ull << 55) - 1))) {
+        fprintf(stderr, "no physical address for %p, run as root\n", addr);
+        exit(1);
+    }
+    return (entry & ((1ull << 55) - 1)) * page + ((uintptr_t) addr % page);
+}
+
+// clean and invalidate to the point of coherency, the ETR does not snoop the caches
+static void sync_for_device(void *addr, size_t size)
+{
+#if defined(__aarch64__)
+    for (uintptr_t p = (uintptr_t) addr & ~63ul; p < (uintptr_t) addr + size; p += 64)
+        __asm__ volatile("dc civac, %0" : : "r" (p) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    (void) addr;
+    (void) size;
+#endif
+}
+
+static int in_huge_page(uint64_t addr, uint32_t size)
+{
+    return runtime_buf && runtime_buf->memfd >= 0 && addr >= runtime_buf->phys
+        && addr + size <= runtime_buf->phys + runtime_buf->size;
+}
+
+/*
+    Cached through /dev/cs_mem when the module covers the buffer and for an
+    etr_buffer_alloc() buffer, see buf_sync_for_cpu(). A huge page is only
+    mapped whole.
+*/
+uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size)
+{
+    void* ptr = NULL;
+    int fd = cs_mem_driver_fd(buf_addr, buf_size);
+    if (in_huge_page(buf_addr, buf_size))
+        ptr = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, runtime_buf->memfd, buf_addr - runtime_buf->phys);
+    else
+        ptr = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd >= 0 ? fd : cs_mem_fd(0), buf_addr);
     if (ptr == MAP_FAILED)
 		fprintf(stderr,"mmap to buffer failed!\n");
-	close(fd);
     return (uint32_t *) ptr;
 }
 
+static int buf_sync(uint64_t addr, uint32_t size, unsigned long request)
+{
+    struct cs_mem_sync sync = { addr, size };
+    int fd = cs_mem_driver_fd(addr, size);
+
+    // our own mapping of the huge page, EL0 may clean and invalidate by VA
+    if (in_huge_page(addr, size)) {
+        sync_for_device(runtime_buf->data + (addr - runtime_buf->phys), size);
+        return 1;
+    }
+    if (fd < 0)
+        return 0;
+    if (ioctl(fd, request, &sync) < 0) {
+        perror("cs_mem sync");
+        exit(1);
+    }
+    return 1;
+}
+
+/*
+    Before the CPU reads what the ETR wrote to [addr, addr + size) of a
+    get_buf_ptr() mapping. 1 when the mapping is cached, else it is
+    /dev/mem and needs nothing.
+*/
+int buf_sync_for_cpu(uint64_t addr, uint32_t size)
+{
+    return buf_sync(addr, size, CS_MEM_SYNC_FOR_CPU);
+}
+
+// before the ETR writes where the CPU wrote
+void buf_sync_for_device(uint64_t addr, uint32_t size)
+{
+    buf_sync(addr, size, CS_MEM_SYNC_FOR_DEVICE);
+}
+
+/*
+    Fills the mapping with 64-byte runs of paired 64-bit stores, not one word
+    at a time. The mapping is device memory, so no memset: its DC ZVA faults.
+*/
+static void fill_buffer(uint32_t *ptr, uint32_t buf_size, uint32_t pattern)
+{
+    uint64_t value = ((uint64_t) pattern << 32) | pattern;
+    uint8_t *p = (uint8_t *) ptr;
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    for(; i + 64 <= buf_size; i += 64) {
+        __asm__ volatile("stp %1, %1, [%0]\n\t"
+                         "stp %1, %1, [%0, #16]\n\t"
+                         "stp %1, %1, [%0, #32]\n\t"
+                         "stp %1, %1, [%0, #48]"
+                         : : "r" (p + i), "r" (value) : "memory");
+    }
+#endif
+    for(; i + 8 <= buf_size; i += 8) {
+	    *(volatile uint64_t *) (p + i) = value;
+    }
+    for(; i + 4 <= buf_size; i += 4) {
+	    *(volatile uint32_t *) (p + i) = pattern;
+    }
+}
+
 /*
     When formatter is enabled. 0xffffffff is not possible. 
     Thus it can be used as a valid trace ending marker
@@ -28,36 +146,315 @@ void clear_buffer(uint64_t buf_addr, uint32_t buf_size)
 {
     printf("Populate Buffer with 0xffffffff\n");
     uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
-    volatile uint32_t *buf = ptr;
-    for(uint32_t i=0; i<buf_size/4; i++) {
-	    *buf++ = 0xffffffff;
-    }
+    fill_buffer(ptr, buf_size, 0xffffffff);
+    buf_sync_for_device(buf_addr, buf_size);
     munmap(ptr, buf_size);
 }
 
-void dump_buffer(uint64_t buf_addr, uint32_t buf_size)
+// words copied out of the mapping at a time
+#define DUMP_BLOCK_WORDS (16 * 1024)
+
+/*
+    Copies a block of the buffer to cached memory, one uncached read per
+    word unless the mapping is cached; the scans and writes then run on
+    the copy.
+*/
+static void copy_block(uint32_t *dst, volatile uint32_t *src, uint32_t words, int cached)
+{
+    if (cached) {
+        memcpy(dst, (const uint32_t *) src, words * sizeof(uint32_t));
+        return;
+    }
+    for(uint32_t i=0; i<words; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/*
+    Writes the hex text of a binary trace file, one word per line.
+*/
+void dump_text(const char *dat_name, const char *out_name)
+{
+    FILE *in = fopen(dat_name, "r");
+    FILE *out = fopen(out_name, "w");
+    uint32_t block[DUMP_BLOCK_WORDS];
+    size_t n;
+
+    if(in == NULL || out == NULL) {
+	    printf("file can't be opened\n");
+	    exit(1);
+    }
+    while ((n = fread(block, sizeof(uint32_t), DUMP_BLOCK_WORDS, in)) > 0) {
+        for(size_t i=0; i<n; i++) {
+            fprintf(out, "0x%08X\n", block[i]);
+        }
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static void print_ratio(const archive_out_t *archive)
 {
-    printf("Dumping trace to trace.{out.dat}\n");
+    printf("%lu bytes of trace compressed to %lu, %.1f:1\n", archive->raw_bytes, archive->comp_bytes,
+           archive->comp_bytes ? (double) archive->raw_bytes / archive->comp_bytes : 0.0);
+}
+
+/*
+    One pass over the buffer up to the 0xffffffff clear_buffer left, written
+    to trace.dat a block at a time. With text, trace.out is derived from it,
+    except from an archive.
+*/
+void dump_buffer(uint64_t buf_addr, uint32_t buf_size, int text)
+{
+    archive_out_t *archive = NULL;
+
+    text = text && !trace_compress;
+    printf("Dumping trace to trace.%s%s\n", text ? "{out.dat}" : "dat", trace_compress ? ", compressed" : "");
     uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
-    volatile uint32_t *buf = ptr;
-    FILE *fp2 = fopen("trace.out", "w");
+    int cached = buf_sync_for_cpu(buf_addr, buf_size);
     FILE *fp3 = fopen("trace.dat", "w");
-    if(fp2 == NULL || fp3 == NULL) {
+    if(fp3 == NULL) {
 	    printf("file can't be opened\n");
 	    exit(1);
     }
+    if (trace_compress)
+        archive = archive_out_open(fileno(fp3), ARCHIVE_ALIGN_FRAME);
 
-    buf = ptr;
-    for(uint32_t i=0; i<buf_size/4; i++) {
-        if ((uint32_t)*buf != 0xffffffff) {
-            fprintf(fp2, "0x%08X\n", *buf);
-            fwrite((void *)buf, sizeof(uint32_t), 1, fp3);
-	        buf++;
-        } else {
+    static uint32_t block[DUMP_BLOCK_WORDS];
+    uint32_t words = buf_size / 4;
+    for(uint32_t base=0; base<words; base+=DUMP_BLOCK_WORDS) {
+        uint32_t n = words - base < DUMP_BLOCK_WORDS ? words - base : DUMP_BLOCK_WORDS;
+        uint32_t i;
+        copy_block(block, ptr + base, n, cached);
+        for(i=0; i<n && block[i] != 0xffffffff; i++);
+        if (archive)
+            archive_out_write(archive, block, i * sizeof(uint32_t));
+        else
+            fwrite(block, sizeof(uint32_t), i, fp3);
+        if (i < n)
             break;
-        }
     }
-    fclose(fp2);
+    if (archive) {
+        archive_out_flush(archive);
+        print_ratio(archive);
+        archive_out_close(archive);
+    }
     fclose(fp3);
     munmap(ptr, buf_size);
+    if (text)
+        dump_text("trace.dat", "trace.out");
+}
+
+/*
+    Writes the used part of a ring to trace.dat in memory order and where
+    it starts to trace.ring, the input of deformat -r. The ring file gives
+    offsets of the plain bytes, also when trace.dat is an archive.
+*/
+static void write_ring(const void *data, uint32_t buf_size, uint32_t offset, int full)
+{
+    uint32_t used = full ? buf_size : offset;
+    FILE *fp = fopen("trace.dat", "w");
+    FILE *fp2 = fopen("trace.ring", "w");
+    if(fp == NULL || fp2 == NULL) {
+	    printf("file can't be opened\n");
+	    exit(1);
+    }
+
+    if (trace_compress) {
+        archive_out_t *archive = archive_out_open(fileno(fp), ARCHIVE_ALIGN_FRAME);
+        archive_out_write(archive, data, used);
+        archive_out_flush(archive);
+        print_ratio(archive);
+        archive_out_close(archive);
+    }
+    // one write of the mapping, no per-word loop
+    else if (fwrite(data, 1, used, fp) != used)
+        perror("fwrite");
+    fprintf(fp2, "size 0x%x\nrwp 0x%x\nfull %d\n", buf_size, offset, full);
+
+    fclose(fp);
+    fclose(fp2);
+}
+
+/*
+    For a buffer written by the ETR in Circular mode. Up to the write pointer
+    rwp, or the whole buffer once it wrapped (full), goes to trace.dat in
+    memory order. trace.ring records where the ring starts, so deformat -r
+    can read it from the oldest frame on; no end marker is needed.
+*/
+void dump_buffer_ring(uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full)
+{
+    uint32_t offset = (uint32_t) (rwp - buf_addr);
+
+    printf("Dumping %u bytes of trace to trace.dat, write pointer at 0x%x%s\n",
+           full ? buf_size : offset, offset, full ? ", wrapped" : "");
+    if (offset > buf_size) {
+        printf("write pointer 0x%lx is outside of the buffer\n", rwp);
+        exit(1);
+    }
+
+    uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
+    buf_sync_for_cpu(buf_addr, buf_size);
+    write_ring(ptr, buf_size, offset, full);
+    munmap(ptr, buf_size);
+}
+
+/*
+    Builds the ETR scatter-gather table over buf_size bytes of ordinary
+    pages, so a session needs no contiguous carve-out. Each 4 KB table page
+    holds 1024 entries: data pages, then a link to the next table page in
+    its last entry; the last data page is marked as such and the ETR wraps
+    back to the first in Circular mode. The pages are shared (no copy on
+    write after fork) and locked. Set vm.compact_unevictable_allowed to 0
+    as well, so that compaction cannot move them during a session.
+*/
+etr_sg_buf_t *sg_buffer_alloc(uint32_t buf_size)
+{
+    etr_sg_buf_t *sg = (etr_sg_buf_t *) calloc(1, sizeof(etr_sg_buf_t));
+    uint32_t i, t, e;
+
+    sg->n_pages = (buf_size + SG_PAGE_SIZE - 1) / SG_PAGE_SIZE;
+    sg->size = sg->n_pages * SG_PAGE_SIZE;
+    // a table page maps SG_PAGE_ENTRIES - 1 data pages and a link, the last one all it holds
+    sg->n_tables = sg->n_pages <= SG_PAGE_ENTRIES ? 1 :
+                   (sg->n_pages - 2) / (SG_PAGE_ENTRIES - 1) + 1;
+    sg->data = (uint8_t *) mmap(NULL, sg->size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS | MAP_LOCKED | MAP_POPULATE, -1, 0);
+    sg->tables = (uint32_t *) mmap(NULL, (size_t) sg->n_tables * SG_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS | MAP_LOCKED | MAP_POPULATE, -1, 0);
+    sg->page_phys = (uint64_t *) malloc(sizeof(uint64_t) * sg->n_pages);
+    if (sg->data == MAP_FAILED || sg->tables == MAP_FAILED || sg->page_phys == NULL) {
+        perror("sg_buffer_alloc");
+        exit(1);
+    }
+
+    for (i = 0; i < sg->n_pages; i++)
+        sg->page_phys[i] = virt_to_phys(sg->data + (size_t) i * SG_PAGE_SIZE);
+    sg->table_phys = virt_to_phys(sg->tables);
+
+    for (i = 0, t = 0; t < sg->n_tables; t++) {
+        uint32_t *table = sg->tables + (size_t) t * SG_PAGE_ENTRIES;
+        uint32_t data_entries = t == sg->n_tables - 1 ? SG_PAGE_ENTRIES : SG_PAGE_ENTRIES - 1;
+        for (e = 0; e < data_entries && i < sg->n_pages; e++, i++)
+            table[e] = SG_ENTRY(sg->page_phys[i], i == sg->n_pages - 1 ? SG_ET_LAST : SG_ET_NORMAL);
+        if (t < sg->n_tables - 1)
+            table[SG_PAGE_ENTRIES - 1] = SG_ENTRY(virt_to_phys(table + SG_PAGE_ENTRIES), SG_ET_LINK);
+    }
+    sync_for_device(sg->data, sg->size);
+    sync_for_device(sg->tables, (size_t) sg->n_tables * SG_PAGE_SIZE);
+
+    printf("Scatter-gather buffer: %u pages in %u table pages, table at 0x%lx\n",
+           sg->n_pages, sg->n_tables, sg->table_phys);
+    return sg;
+}
+
+void sg_buffer_free(etr_sg_buf_t *sg)
+{
+    munmap(sg->data, sg->size);
+    munmap(sg->tables, (size_t) sg->n_tables * SG_PAGE_SIZE);
+    free(sg->page_phys);
+    free(sg);
+}
+
+/*
+    dump_buffer_ring() for a scatter-gather buffer. In this mode the write
+    pointer is the physical address within a data page, turned back into
+    an offset of the buffer by a look up of its page.
+*/
+void dump_sg_buffer_ring(etr_sg_buf_t *sg, uint64_t rwp, int full)
+{
+    uint32_t i;
+
+    for (i = 0; i < sg->n_pages; i++) {
+        if (rwp >= sg->page_phys[i] && rwp < sg->page_phys[i] + SG_PAGE_SIZE)
+            break;
+    }
+    if (i == sg->n_pages) {
+        printf("write pointer 0x%lx is outside of the buffer\n", rwp);
+        exit(1);
+    }
+    uint32_t offset = i * SG_PAGE_SIZE + (uint32_t) (rwp - sg->page_phys[i]);
+
+    printf("Dumping %u bytes of trace to trace.dat, write pointer at 0x%x%s\n",
+           full ? sg->size : offset, offset, full ? ", wrapped" : "");
+    // drop any stale lines, the ETR wrote behind the caches
+    sync_for_device(sg->data, sg->size);
+    write_ring(sg->data, sg->size, offset, full);
+}
+
+// Hugepagesize of /proc/meminfo, 0 without huge pages
+static uint64_t huge_page_size(void)
+{
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    unsigned long kb = 0;
+
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+            break;
+    fclose(fp);
+    return (uint64_t) kb * 1024;
+}
+
+/*
+    A physically contiguous buffer of buf_size bytes for one session,
+    nothing reserved at boot: from CMA through /dev/cs_mem (support/cs_mem.c),
+    else one huge page, as large as buf_size may then be. phys goes to
+    cs_config_etr_mp() and the dump and drain functions like a fixed
+    address; get_buf_ptr() maps it cached and buf_sync_for_cpu() invalidates
+    it once the ETR stopped. One at a time.
+*/
+etr_buf_t *etr_buffer_alloc(uint32_t buf_size)
+{
+    etr_buf_t *buf = (etr_buf_t *) calloc(1, sizeof(etr_buf_t));
+    uint64_t huge;
+
+    buf->size = buf_size;
+    buf->memfd = -1;
+    buf->phys = cs_mem_driver_alloc(buf_size);
+    if (buf->phys) {
+        printf("ETR buffer: %u bytes of CMA at 0x%lx\n", buf_size, buf->phys);
+        runtime_buf = buf;
+        return buf;
+    }
+
+    huge = huge_page_size();
+    if (huge == 0 || buf_size > huge) {
+        fprintf(stderr, "no CMA through %s and %u bytes do not fit a huge page of %lu, "
+                "load support/cs_mem.ko or reserve larger huge pages\n", CS_MEM_DEVICE, buf_size, huge);
+        exit(1);
+    }
+    buf->memfd = memfd_create("etr_buf", MFD_HUGETLB);
+    if (buf->memfd < 0 || ftruncate(buf->memfd, huge) < 0) {
+        perror("huge page for the ETR buffer, see /proc/sys/vm/nr_hugepages");
+        exit(1);
+    }
+    buf->data = (uint8_t *) mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE,
+                                 buf->memfd, 0);
+    if (buf->data == MAP_FAILED) {
+        perror("mmap huge page");
+        exit(1);
+    }
+    buf->phys = virt_to_phys(buf->data);
+    // nothing of it in the caches when the ETR starts
+    sync_for_device(buf->data, huge);
+    printf("ETR buffer: %u bytes in a huge page of %lu at 0x%lx\n", buf_size, huge, buf->phys);
+    runtime_buf = buf;
+    return buf;
+}
+
+// after the ETR stopped
+void etr_buffer_free(etr_buf_t *buf)
+{
+    if (buf->memfd >= 0) {
+        munmap(buf->data, huge_page_size());
+        close(buf->memfd);
+    } else {
+        cs_mem_driver_free();
+    }
+    if (runtime_buf == buf)
+        runtime_buf = NULL;
+    free(buf);
 }
@@ -2,6 +2,9 @@
 #include "common.h"
 #include "cs_etm.h"
 #include "cs_soc.h"
+#include "zcu_cs.h"
+#include "buffer.h"
+#include "archive.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -12,6 +15,7 @@
 #include <errno.h>
 #include <sys/sysinfo.h>
 #include <time.h>
+#include <pthread.h>
 
 // spawn a child process for the input function
 void spawn_child(void (*func)())
@@ -31,81 +35,264 @@ void spawn_child(void (*func)())
 
 /*
     Poller waits until ETM is enabled.
-    Then it polls TMC1 (aka ETF1) to read trace data.
+    Then it polls TMC1 (aka ETF1) to read trace data into a ring buffer,
+    which a writer thread on another core drains to trace.dat meanwhile.
     When ETM is disabled again, poller prints the trace data.
 */
 extern ETM_interface *etms[4];
 extern TMC_interface *tmc1;
-void poller()
+
+poller_config_t poller_cfg = {
+    .ring_words = POLLER_RING_WORDS,
+    .writer_core = 2,
+    .mode = POLL_SPIN,
+    .burst = 256,
+    .flush_us = 1000,
+    .backoff_max_us = 50,
+};
+
+typedef struct poller_ring {
+    uint32_t *words;
+    uint32_t mask;
+    size_t map_size;
+    volatile uint64_t head;  // written by the poller only
+    volatile uint64_t tail;  // written by the writer only
+    volatile int done;
+    FILE *fp;
+    archive_out_t *archive;  // with trace_compress, written instead of fp
+    uint64_t dropped;
+    uint64_t peak;
+} poller_ring_t;
+
+typedef struct poller_stats {
+    uint64_t null_reads;
+    uint64_t flushes;
+} poller_stats_t;
+
+// hugepages first, so the poll loop does not take TLB misses on the ring
+static void ring_alloc(poller_ring_t *ring, uint32_t words)
 {
-    pin_to_core(1);
-    const uint32_t storage_size = 1024 * 32;
-    uint32_t soft_fifo_storage[storage_size];
-    uint32_t storage_ptr = 0;
-    uint32_t flush_ct = 0;
+    uint32_t n = 1024;
+    while (n < words && n < (1u << 30))
+        n <<= 1;
+    ring->mask = n - 1;
+    ring->map_size = (size_t) n * sizeof(uint32_t);
+    ring->words = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (ring->words == MAP_FAILED) {
+        printf("No hugepages for the %zu KB ring, using normal pages\n", ring->map_size >> 10);
+        ring->words = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+    if (ring->words == MAP_FAILED) {
+        perror("mmap ring");
+        exit(1);
+    }
+    ring->head = ring->tail = 0;
+    ring->done = 0;
+    ring->dropped = ring->peak = 0;
+}
 
-    while (etms[0]->prog_ctrl == 0);
-    while (etms[0]->prog_ctrl == 1 || !etm_is_idle(etms[0]) || !(tmc1->ram_write_pt == tmc1->ram_read_pt))
+// keep polling when the writer falls behind, the TMC must not back up
+static inline void ring_put(poller_ring_t *ring, uint32_t word)
+{
+    uint64_t fill = ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (fill > ring->mask) {
+        ring->dropped++;
+        return;
+    }
+    if (fill + 1 > ring->peak)
+        ring->peak = fill + 1;
+    ring->words[ring->head & ring->mask] = word;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static inline int session_active(void)
+{
+    return etms[0]->prog_ctrl == 1 || !etm_is_idle(etms[0]) || !(tmc1->ram_write_pt == tmc1->ram_read_pt);
+}
+
+// POLL_SPIN: one RRD read per iteration
+static void poll_spin(poller_ring_t *ring, poller_stats_t *stats)
+{
+    while (session_active())
     {
         // When ETF is in Software FIFO mode, poll RRD register return new data or 0xffffffff if no new data
         uint32_t tmp = tmc1->ram_read_data;
         if (tmp == 0xffffffff)
         {
             // If there is no new data to read, trigger a flush to force output buffered data. But it will trash the bus with formatter padding (i.e. bunch of zeros)
-            // tmc1->formatter_flush_ctrl = 0x43; 
-            flush_ct++;
-            if (flush_ct % 10 == 0)
+            // tmc1->formatter_flush_ctrl = 0x43; POLL_ADAPTIVE does so with a latency bound
+            stats->null_reads++;
+            if (stats->null_reads % 10 == 0)
             {
                 // etm_print_large_counter(etms[0], 0); // it's very hacky, but you can print cnt value at runtime
             }
         }
         else
         {
-            soft_fifo_storage[storage_ptr++] = tmp;
-            if (storage_ptr == storage_size)
-            {
-                while (etms[0]->prog_ctrl == 1);
-            }
+            ring_put(ring, tmp);
         }
     }
-    printf("Trace session ended. Poller print trace data:\n");
-
-    // open a new file name trace.out and write the trace data to it.
-    FILE *fp = fopen("trace.out", "w");
+}
 
-    // open a new file to save binary version
-    FILE *fp_bin = fopen("trace.dat", "wb");
+/*
+    POLL_ADAPTIVE: read RRD back to back while data flows, up to burst words
+    between checks of the session state. Once it runs dry, wait between
+    reads, doubling up to backoff_max_us, so idle time does not fill APB with
+    null reads. Words still held by the formatter are pushed out with a
+    manual flush flush_us after the last one, which bounds their latency and
+    only pads the stream once per quiet period: the words a flush brings out
+    do not call for another.
+*/
+static void poll_adaptive(poller_ring_t *ring, poller_stats_t *stats)
+{
+    uint64_t last_data = now_us(), backoff = 0;
+    int pending = 0, flushed = 0;
 
-    for (uint32_t i = 0; i < storage_ptr; i++)
+    while (session_active())
     {
-        fprintf(fp, "0x%08x\n", soft_fifo_storage[i]);
-        fwrite(&soft_fifo_storage[i], sizeof(uint32_t), 1, fp_bin);
+        uint32_t n = 0, tmp;
+        while (n < poller_cfg.burst && (tmp = tmc1->ram_read_data) != 0xffffffff)
+        {
+            ring_put(ring, tmp);
+            n++;
+        }
+        if (n == poller_cfg.burst)
+            continue;
+
+        uint64_t now = now_us();
+        stats->null_reads++;
+        if (n)
+        {
+            last_data = now;
+            pending = !flushed;
+            flushed = 0;
+            backoff = 0;
+            continue;
+        }
+        if (pending && now - last_data >= poller_cfg.flush_us && !(tmc1->formatter_flush_status & 0x1))
+        {
+            tmc_man_flush(tmc1);
+            stats->flushes++;
+            pending = 0;
+            flushed = 1;
+        }
+        // spin on the local clock, not on the bus
+        backoff = backoff ? backoff * 2 : 1;
+        if (backoff > poller_cfg.backoff_max_us)
+            backoff = poller_cfg.backoff_max_us;
+        while (now_us() - now < backoff);
     }
+}
 
-    printf("Trace snippet 0 - 30 (line) \n");
-    for (uint32_t i = 0; i < storage_ptr; i++)
-    {
-        printf("0x%08x\n", soft_fifo_storage[i]);
-        if(i == 30) break;
+// drain the ring to trace.dat, in the largest contiguous pieces available
+static void *ring_writer(void *arg)
+{
+    poller_ring_t *ring = (poller_ring_t *) arg;
+    pin_to_core(poller_cfg.writer_core);
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        if (head == tail) {
+            if (ring->done && head == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+                break;
+            usleep(100);
+            continue;
+        }
+        uint32_t start = tail & ring->mask;
+        uint64_t n = head - tail;
+        if (n > (uint64_t) ring->mask + 1 - start)
+            n = ring->mask + 1 - start;
+        if (ring->archive)
+            archive_out_write(ring->archive, &ring->words[start], n * sizeof(uint32_t));
+        else if (fwrite(&ring->words[start], sizeof(uint32_t), n, ring->fp) != n)
+            perror("fwrite trace.dat");
+        __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
     }
+    return NULL;
+}
 
-    fclose(fp);
-    fclose(fp_bin);
+void poller()
+{
+    pin_to_core(1);
+    poller_ring_t ring;
+    pthread_t writer;
+    poller_stats_t stats = {0};
+    uint64_t t_start, t_end;
+
+    ring_alloc(&ring, poller_cfg.ring_words);
+    ring.fp = fopen("trace.dat", "wb");
+    if (ring.fp == NULL) {
+        perror("trace.dat");
+        exit(1);
+    }
+    ring.archive = trace_compress ? archive_out_open(fileno(ring.fp), ARCHIVE_ALIGN_FRAME) : NULL;
+    if (pthread_create(&writer, NULL, ring_writer, &ring) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+
+    while (etms[0]->prog_ctrl == 0);
+    t_start = now_us();
+    if (poller_cfg.mode == POLL_ADAPTIVE)
+        poll_adaptive(&ring, &stats);
+    else
+        poll_spin(&ring, &stats);
+    t_end = now_us();
+    ring.done = 1;
+    pthread_join(writer, NULL);
+    int compressed = ring.archive != NULL;
+    if (compressed) {
+        archive_out_flush(ring.archive);
+        printf("Trace session ended, %lu bytes compressed to %lu\n", ring.archive->raw_bytes, ring.archive->comp_bytes);
+        archive_out_close(ring.archive);
+    }
+    fclose(ring.fp);
+    munmap(ring.words, ring.map_size);
+
+    // trace.out is derived from trace.dat, once the session is over; not from an archive
+    if (!compressed) {
+        printf("Trace session ended. Poller print trace data:\n");
+        FILE *fp_bin = fopen("trace.dat", "rb");
+        FILE *fp = fopen("trace.out", "w");
+        uint32_t word;
+        uint64_t i = 0;
+
+        printf("Trace snippet 0 - 30 (line) \n");
+        while (fread(&word, sizeof(uint32_t), 1, fp_bin) == 1)
+        {
+            fprintf(fp, "0x%08x\n", word);
+            if (i++ <= 30)
+                printf("0x%08x\n", word);
+        }
+
+        fclose(fp);
+        fclose(fp_bin);
+    }
 
     printf("\nmeta data\n");
-    printf("null read count: %d\n\n", flush_ct);
-    printf("total read count: %d\n", storage_ptr);
-    printf("Trace data is saved to trace.out/dat\n");
+    printf("null read count: %lu\n\n", stats.null_reads);
+    printf("total read count: %lu\n", ring.head + ring.dropped);
+    printf("dropped words: %lu, peak ring fill: %lu of %u words\n", ring.dropped, ring.peak, ring.mask + 1);
+    printf("flushes issued: %lu\n", stats.flushes);
+    if (t_end > t_start)
+        printf("%.0f words/s over %.3f s\n", (ring.head + ring.dropped) * 1e6 / (t_end - t_start),
+               (t_end - t_start) / 1e6);
+    printf("Trace data is saved to %s\n", compressed ? "trace.dat" : "trace.out/dat");
 }
 
 int write_mem(unsigned long physical_address, uint32_t data)
 {
-
-    int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (mem_fd == -1) {
-        perror("Failed to open /dev/mem");
-        return 1;
-    }
+    int mem_fd = cs_mem_fd(1);
 
     size_t pagesize = sysconf(_SC_PAGESIZE);
     unsigned long page_base = physical_address & ~(pagesize-1);
@@ -115,7 +302,6 @@ int write_mem(unsigned long physical_address, uint32_t data)
     char *mapped_base = (char* ) mmap(0, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, page_base);
     if (mapped_base == MAP_FAILED) {
         perror("Failed to map memory");
-        close(mem_fd);
         return 1;
     }
 
@@ -123,7 +309,6 @@ int write_mem(unsigned long physical_address, uint32_t data)
     uint32_t *mapped_ptr = (uint32_t *) (mapped_base + page_offset);
     *mapped_ptr = data;
 
-    close(mem_fd);
     munmap(mapped_base, pagesize);
 
     return 0;
@@ -289,13 +474,7 @@ uint32_t wrmem(char* bin_name, unsigned long addr) {
     fread(buffer, 1, file_size, file);
     fclose(file);
 
-    // Open the /dev/mem file
-    int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (mem_fd == -1) {
-        perror("Failed to open /dev/mem");
-        free(buffer);
-        return 1;
-    }
+    int mem_fd = cs_mem_fd(1);
 
     // Parse the target physical address
     unsigned long physical_address = addr;
@@ -309,7 +488,6 @@ uint32_t wrmem(char* bin_name, unsigned long addr) {
     char *mapped_base = (char* ) mmap(0, file_size + page_offset, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, page_base);
     if (mapped_base == MAP_FAILED) {
         perror("Failed to map memory");
-        close(mem_fd);
         free(buffer);
         return 1;
     }
@@ -324,7 +502,6 @@ uint32_t wrmem(char* bin_name, unsigned long addr) {
 
     // Clean up
     munmap(mapped_base, file_size + page_offset);
-    close(mem_fd);
     free(buffer);
 
     return first_milestone;
@@ -4,6 +4,8 @@
 #include "cs_pmu.h"
 #include "cs_soc.h"
 #include "zcu_cs.h"
+#include "buffer.h"
+#include "cs_config.h"
 
 ETM_interface *etms[4] = {NULL, NULL, NULL, NULL};
 Replicator_interface *replicator = NULL;
@@ -50,8 +52,8 @@ void cs_config_tmc1_softfifo() {
 	funnel_config_port(funnel1, 0xff, 0);
 	funnel_config_port(funnel2, 0xff, 0);
 
-	munmap(funnel1, sizeof(Funnel_interface));
-	munmap(funnel2, sizeof(Funnel_interface));
+	cs_unregister(funnel1, sizeof(Funnel_interface));
+	cs_unregister(funnel2, sizeof(Funnel_interface));
 
 	tmc_unlock(tmc1);
 	tmc_disable(tmc1);
@@ -105,19 +107,16 @@ void cs_config_SRAM() {
 	tmc_enable(tmc1);
 	tmc_enable(tmc2);
 
-	munmap(tmc1, sizeof(TMC_interface));
+	cs_unregister(tmc1, sizeof(TMC_interface));
 
 	return ;	
 }
 
 /*
-	The configuration uses TMC3 (ETR) in circular buffer mode to stream the trace data
-	to a user defined memory buffer.
+	TMC1 -> TMC2 -> TMC3 (ETR in Circular) to buf_addr. With sg, buf_addr is
+	the first page of a scatter-gather table instead of a flat buffer.
 */
-void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size) {
-	printf("Trace data path: TMC1(HardFIFO) -> TMC2(HardFIFO) -> TMC3(ETR in Circular) -> 0x%lx\n", buf_addr);
-	printf("ETR assumes the buffer size is %d bytes\n", buf_size);
-
+static void config_etr_path(uint64_t buf_addr, uint32_t buf_size, int sg) {
 	etms[0] = (ETM_interface *) cs_register(A53_0_etm);
 	// etms[1] = (ETM_interface *) cs_register(A53_1_etm);
 	// etms[2] = (ETM_interface *) cs_register(A53_2_etm);
@@ -133,14 +132,14 @@ void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size) {
 	// on ZCU102, TPIU is not powered by default. To power, connect jumper J88 on board 
 	replicator->lock_access = 0xc5acce55;
 	replicator->id_filter_atb_master_p_1 = 0xff;
-	munmap(replicator, sizeof(Replicator_interface));
+	cs_unregister(replicator, sizeof(Replicator_interface));
 
 	funnel_unlock(funnel1);
 	funnel_unlock(funnel2);
 	funnel_config_port(funnel1, 0xff, 0);
 	funnel_config_port(funnel2, 0xff, 0);
-	munmap(funnel1, sizeof(Funnel_interface));
-	munmap(funnel2, sizeof(Funnel_interface));
+	cs_unregister(funnel1, sizeof(Funnel_interface));
+	cs_unregister(funnel2, sizeof(Funnel_interface));
 
 	tmc_unlock(tmc1);
 	tmc_unlock(tmc2);
@@ -161,24 +160,249 @@ void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size) {
 	tmc3->formatter_flush_ctrl = 0x3; 
 
 	tmc_set_axi(tmc3, 0xf);
+	tmc_set_scatter_gather(tmc3, sg);
 
 	// ETR specific configuration
 	tmc_set_size(tmc3, buf_size); // this function would divide the buf_size by 4 to write to the register in unit of word
 	tmc_set_data_buf(tmc3, buf_addr);
-	tmc_set_read_pt(tmc3, buf_addr);
-	tmc_set_write_pt(tmc3, buf_addr);
+	// in scatter-gather mode the ETR starts at the first table entry by itself
+	if (!sg) {
+		tmc_set_read_pt(tmc3, buf_addr);
+		tmc_set_write_pt(tmc3, buf_addr);
+	}
 
 	tmc_enable(tmc1);
 	tmc_enable(tmc2);
 	tmc_enable(tmc3);
 
-	munmap(tmc1, sizeof(TMC_interface));
-	munmap(tmc2, sizeof(TMC_interface));
-	munmap(tmc3, sizeof(TMC_interface));
+	cs_unregister(tmc1, sizeof(TMC_interface));
+	cs_unregister(tmc2, sizeof(TMC_interface));
+	cs_unregister(tmc3, sizeof(TMC_interface));
 
 	return ;
 }
 
+/*
+	Registers the ETM of each A53 core set in core_mask, on top of the
+	etms[0] the ETR configurations register, for multi-core sessions.
+*/
+void cs_register_etms(uint8_t core_mask) {
+	static const enum component etm_comps[4] = {A53_0_etm, A53_1_etm, A53_2_etm, A53_3_etm};
+
+	for (int i = 0; i < 4; i++) {
+		if (core_mask & (1 << i))
+			etms[i] = (ETM_interface *) cs_register(etm_comps[i]);
+	}
+}
+
+/*
+	The configuration uses TMC3 (ETR) in circular buffer mode to stream the trace data
+	to a user defined memory buffer.
+*/
+void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size) {
+	printf("Trace data path: TMC1(HardFIFO) -> TMC2(HardFIFO) -> TMC3(ETR in Circular) -> 0x%lx\n", buf_addr);
+	printf("ETR assumes the buffer size is %d bytes\n", buf_size);
+	config_etr_path(buf_addr, buf_size, 0);
+}
+
+/*
+	As cs_config_etr_mp(), into the pages of a buffer from sg_buffer_alloc(),
+	which need not be physically contiguous.
+*/
+void cs_config_etr_sg(etr_sg_buf_t *sg) {
+	printf("Trace data path: TMC1(HardFIFO) -> TMC2(HardFIFO) -> TMC3(ETR in Circular, scatter-gather) -> table 0x%lx\n", sg->table_phys);
+	printf("ETR assumes the buffer size is %u bytes in %u pages\n", sg->size, sg->n_pages);
+	config_etr_path(sg->table_phys, sg->size, 1);
+}
+
+/*
+	Starts another cs_config_etr_mp() session after cs_stop_etr(): only the
+	ETR pointers go back to the start of the buffer, the rest of the path
+	stays as it is. Enabling the ETR clears Full.
+*/
+void cs_rearm_etr(uint64_t buf_addr) {
+	TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+
+	tmc_disable(etr);
+	tmc_set_read_pt(etr, buf_addr);
+	tmc_set_write_pt(etr, buf_addr);
+	tmc_enable(etr);
+	cs_unregister(etr, sizeof(TMC_interface));
+}
+
+// flush and stop the ETR, the write pointer and Full tell where the data is
+void cs_stop_etr(uint64_t *rwp, int *full) {
+	TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+
+	tmc_man_flush(etr);
+	while (etr->formatter_flush_status & 0x1);	// FlInProg
+	tmc_disable(etr);
+
+	*rwp = tmc_get_write_pt(etr);
+	*full = tmc_full(etr);
+	cs_unregister(etr, sizeof(TMC_interface));
+}
+
+/*
+	Ends a cs_config_etr_mp() session: flushes the formatter, stops TMC3 and
+	dumps the buffer as a ring from its write pointer and Full status.
+*/
+void cs_dump_etr(uint64_t buf_addr, uint32_t buf_size) {
+	uint64_t rwp;
+	int full;
+
+	cs_stop_etr(&rwp, &full);
+	dump_buffer_ring(buf_addr, buf_size, rwp, full);
+}
+
+// cs_dump_etr() for a cs_config_etr_sg() session
+void cs_dump_etr_sg(etr_sg_buf_t *sg) {
+	TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+
+	tmc_man_flush(etr);
+	while (etr->formatter_flush_status & 0x1);	// FlInProg
+	tmc_disable(etr);
+
+	dump_sg_buffer_ring(sg, tmc_get_write_pt(etr), tmc_full(etr));
+	cs_unregister(etr, sizeof(TMC_interface));
+}
+
+/*
+	Windowed capture on a cs_config_etr_mp() path. An ETM event on external
+	output 0..3 (event selector position) of a core in core_mask goes over
+	channel 3, as cti_setup() does it, to trigger output trigout of CTI0,
+	which is wired to the TRIGIN of the ETR. After the trigger the ETR
+	captures after_bytes more, flushes and stops, so its circular buffer
+	keeps buf_size - after_bytes of trace from before the trigger.
+	Before the ETMs are enabled.
+*/
+void cs_config_trigger(uint8_t core_mask, int trigout, uint32_t after_bytes) {
+	static const enum component cti_comps[4] = {A53_0_cti, A53_1_cti, A53_2_cti, A53_3_cti};
+	CTI_interface *cti;
+	TMC_interface *etr;
+
+	for (int i = 0; i < 4; i++) {
+		if (!(core_mask & (1 << i)))
+			continue;
+		cti = (CTI_interface *) cs_register(cti_comps[i]);
+		cti_config(cti, 0x8);
+		// trigin 4..7 are the ETM external outputs
+		for (int j = 0; j < 4; j++)
+			cti->trig_to_channel_en[4 + j] = 0b1000;
+		cs_unregister(cti, sizeof(CTI_interface));
+	}
+
+	cti = (CTI_interface *) cs_register(Cti0);
+	cti_config(cti, 0x8);
+	cti->channel_to_trig_en[trigout] = 0b1000;
+	cs_unregister(cti, sizeof(CTI_interface));
+
+	etr = (TMC_interface *) cs_register(Tmc3);
+	tmc_disable(etr);
+	etr->trig_counter = after_bytes / 4;
+	// EnFt, EnTI, FOnTrigEvt, TrigOnTrigIn, StopOnTrigEvt
+	etr->formatter_flush_ctrl = 0x3 | (0x1 << 5) | (0x1 << 8) | (0x1 << 13);
+	tmc_enable(etr);
+	cs_unregister(etr, sizeof(TMC_interface));
+}
+
+// after a cs_config_trigger() session: whether the trigger came
+int cs_etr_triggered(void) {
+	TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+	int triggered = tmc_triggered(etr);
+
+	cs_unregister(etr, sizeof(TMC_interface));
+	return triggered;
+}
+
+/*
+	Starts the system timestamp generator, the time base of ETM timestamps.
+	Returns its frequency in Hz as CNTFID0 tells, 0 when it is not set.
+*/
+uint32_t cs_enable_tsgen(void) {
+	TSGEN_interface *tsgen = (TSGEN_interface *) cs_register(Tsgen);
+	uint32_t freq;
+
+	tsgen->cnt_ctrl |= 0x1;
+	freq = tsgen->cnt_freq;
+	cs_unregister(tsgen, sizeof(TSGEN_interface));
+	return freq;
+}
+
+/*
+	Software instrumentation through the STM: every stimulus port enabled,
+	packets under trace_id with timestamps of the same generator as the
+	ETMs and an ASYNC every STM_SYNC_BYTES. The STM is a slave of the main
+	funnel, Funnel2, its port is opened with the others the path configs
+	leave open; call after one of them. Applications write to the ports
+	through stm_port.h.
+*/
+void cs_config_stm(uint8_t trace_id) {
+	STM_interface *stm = (STM_interface *) cs_register(Stm);
+	uint32_t freq = cs_enable_tsgen();
+
+	funnel2 = (Funnel_interface *) cs_register(Funnel2);
+	funnel_unlock(funnel2);
+	funnel2->ctrl |= 0xff;
+	cs_unregister(funnel2, sizeof(Funnel_interface));
+
+	stm_unlock(stm);
+	stm->trace_ctrl &= ~STM_TCSR_EN;
+	while (stm->trace_ctrl & STM_TCSR_BUSY);
+	stm->sp_select = 0;
+	stm->sp_master_select = 0;
+	stm->sp_enable = 0xffffffff;
+	stm->sp_trigger_enable = 0;
+	stm->sync_ctrl = STM_SYNC_BYTES;
+	stm->ts_freq = freq;
+	stm->trace_ctrl = STM_TCSR_TRACEID(trace_id) | STM_TCSR_SYNCEN | STM_TCSR_TSEN | STM_TCSR_EN;
+	printf("STM: trace ID 0x%x, stimulus ports at 0x%x\n", trace_id, STM_PORTS);
+	cs_unregister(stm, sizeof(STM_interface));
+}
+
+// before the ETR is stopped, so the last STM packets are in the buffer
+void cs_disable_stm(void) {
+	STM_interface *stm = (STM_interface *) cs_register(Stm);
+
+	stm->trace_ctrl &= ~STM_TCSR_EN;
+	while (stm->trace_ctrl & STM_TCSR_BUSY);
+	cs_unregister(stm, sizeof(STM_interface));
+}
+
+/*
+	Status of the ETR path after a session: STS of each TMC and the peak fill
+	level of ETF1 and ETF2 in words. An ETF that filled up held the ATB back,
+	that is when the ETMs overflow or stall. Reading LBUFLEVEL clears it, so
+	call once with level 0 before the session. Level 2 adds tmc_report().
+	Returns non zero when an ETF was full or the ETR hit a memory error.
+*/
+int cs_report_tmcs(int level) {
+	enum component comps[3] = {Tmc1, Tmc2, Tmc3};
+	int held = 0;
+
+	for (int i = 0; i < 3; i++) {
+		TMC_interface *tmc = (TMC_interface *) cs_register(comps[i]);
+		uint32_t sts = tmc->status;
+		uint32_t peak = tmc->latched_buf_fill_level;
+
+		if (i < 2 && peak >= tmc->ram_size)
+			held = 1;
+		if (i == 2 && (sts & 0x20))
+			held = 1;
+		if (level > 0) {
+			printf("TMC%d: STS 0x%x%s%s%s", i + 1, sts,
+			       (sts & 0x1) ? " Full" : "", (sts & 0x10) ? " Empty" : "", (sts & 0x20) ? " MemErr" : "");
+			if (i < 2)
+				printf(", peak fill %u of %u words", peak, tmc->ram_size);
+			printf("\n");
+		}
+		if (level > 1)
+			tmc_report(tmc, i + 1);
+		cs_unregister(tmc, sizeof(TMC_interface));
+	}
+	return held;
+}
+
 /*
 	This function assume the PMU is writtable in user space.
 	If something goes wrong,
@@ -200,7 +424,7 @@ void config_pmu_enable_export()
 		pmus[i]->lock_access = 0xc5acce55;
 		pmus[i]->ctrl = 0x11;
 
-		munmap(pmus[i], sizeof(PMU_interface));
+		cs_unregister(pmus[i], sizeof(PMU_interface));
 	}
 
 
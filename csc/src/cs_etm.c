@@ -190,6 +190,43 @@ void etm_reset(ETM_interface *etm)
         etm->counter_val[i] = 0;
     }
 
+    // every comparator, resource and selector is free again
+    int id = get_etm_index(etm);
+    if (id >= 0) {
+        avail_addr_cmp_high[id] = 7;
+        avail_addr_cmp_low[id] = 0;
+        avail_rs_high[id] = 15;
+        avail_rs_low[id] = 2;
+        avail_ext_sel_low[id] = 0;
+        avail_ext_sel_high[id] = 3;
+    }
+}
+
+/*
+    Undoes the filters of one run, the address and context ID comparators
+    and the ViewInst include/exclude and start/stop selections, and gives
+    the comparators back. The rest of the etm_reset() state is kept, so a
+    session can trace many targets with one configuration.
+    The ETM must be disabled.
+*/
+void etm_clear_filters(ETM_interface *etm)
+{
+    int id = get_etm_index(etm);
+    int i;
+
+    etm->vi_main_ctrl = 0x201;
+    etm->vi_ie_ctrl = 0;
+    etm->vi_ss_ctrl = 0;
+    for(i=0; i<16; i++) {
+        etm->addr_cmp_val[i] = 0;
+        etm->addr_cmp_access_type[i] = 0;
+    }
+    etm->contextid_cmp_val[0] = 0;
+
+    if (id >= 0) {
+        avail_addr_cmp_high[id] = 7;
+        avail_addr_cmp_low[id] = 0;
+    }
 }
 
 void etm_set_contextid_cmp(ETM_interface *etm, uint64_t cid)
@@ -284,6 +321,15 @@ void etm_register_range(ETM_interface *etm, uint64_t start_addr, uint64_t end_ad
     SET(etm->vi_ie_ctrl, addr_cmp_index_base / 2);
 }
 
+/* as etm_register_range(), but nothing in the range is traced */
+void etm_register_exclude_range(ETM_interface *etm, uint64_t start_addr, uint64_t end_addr, int cmp_contextid)
+{
+    int addr_cmp_index_base = _request_addr_cmp_pair(etm);
+    etm_set_addr_cmp(etm, addr_cmp_index_base, start_addr, cmp_contextid);
+    etm_set_addr_cmp(etm, addr_cmp_index_base + 1, end_addr, cmp_contextid);
+    SET(etm->vi_ie_ctrl, addr_cmp_index_base / 2 + 16);
+}
+
 void etm_register_start_stop_addr(ETM_interface *etm, uint64_t start_addr, uint64_t end_addr)
 {
     int cmp_0 = _request_addr_cmp(etm);
@@ -351,6 +397,28 @@ static void etm_set_event_sel(ETM_interface *etm, int sel_num, int rs_num, int p
     etm_set_event_sel_n(etm, true_num, pair, sel_num);
 }
 
+/*
+    Global timestamps, from the Tsgen counter (see cs_enable_tsgen()).
+    period 0: only at trace start and syncs. Else one every period cycles,
+    from counter 1 reloading itself on the always true resource, so it
+    can't be combined with the large counter examples.
+*/
+void etm_set_timestamp(ETM_interface *etm, uint16_t period)
+{
+    SET(etm->trace_config, 11);
+    if (period == 0) {
+        etm->global_ts_ctrl = 0;
+        return ;
+    }
+
+    int rs_num = _request_rs(etm);
+    etm->counter_ctrl[1] = 0x1 | (0x1 << 16);
+    etm->counter_val[1] = period;
+    etm->counter_reload_val[1] = period;
+    etm_set_rs(etm, rs_num, Counter_Seq, 1, -1, 0, 0);
+    etm->global_ts_ctrl = rs_num;
+}
+
 /*
     atb: whether enable atb trigger
 */
@@ -39,6 +39,15 @@ void tmc_set_axi(TMC_interface *tmc, int burst_len)
     tmc->axi_ctrl = 0b111111;
 }
 
+// AXICTL.ScatterGatherMode: DBA then holds the first page of the table, not the buffer
+void tmc_set_scatter_gather(TMC_interface *tmc, int enable)
+{
+    if (enable)
+        SET(tmc->axi_ctrl, 7);
+    else
+        CLEAR(tmc->axi_ctrl, 7);
+}
+
 void tmc_set_read_pt(TMC_interface *tmc, uint64_t addr)
 {
     tmc->ram_read_pt = (uint32_t) addr;
@@ -160,7 +169,7 @@ void tmc_report(TMC_interface* tmc, int tmc_index) {
     printf("ctrl %x\n", tmc->ctrl);
     // printf("ram_write_data %x\n", tmc->ram_write_data);
     // printf("mode %x\n", tmc->mode);
-    // printf("latched_buf_fill_level %x\n", tmc->latched_buf_fill_level);
+    printf("latched_buf_fill_level %x\n", tmc->latched_buf_fill_level);
     // printf("cur_buf_fill_level %x\n", tmc->cur_buf_fill_level);
     // printf("buf_level_water_mark %x\n", tmc->buf_level_water_mark);
     printf("ram_read_pt_high %x\n", tmc->ram_read_pt_high);
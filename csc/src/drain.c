@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "cs_soc.h"
+#include "zcu_cs.h"
+#include "buffer.h"
+#include "drain.h"
+
+// write all of data, a pipe may take it in pieces
+static void write_out(etr_drain_t *drain, const uint8_t *data, uint32_t size)
+{
+    if (drain->archive) {
+        archive_out_write(drain->archive, data, size);
+        return;
+    }
+    while (size > 0) {
+        ssize_t n = write(drain->fd, data, size);
+        if (n < 0) {
+            perror("drain write");
+            exit(1);
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+// bytes from offset to the write pointer, around the end of the ring
+static inline uint32_t ring_dist(uint32_t from, uint32_t to, uint32_t size)
+{
+    return to >= from ? to - from : size - from + to;
+}
+
+/*
+    The ETR runs in Circular mode and does not wait for a reader, so RRP is
+    not moved: the drain keeps its read offset itself. What lies between it
+    and RWP is appended on every poll. A copy the ETR lapped while it ran is
+    counted as an overwrite, its start was lost; more than one lap between
+    two polls cannot be seen in RWP at all, hence the behind count as the
+    early warning.
+*/
+static void *drain_loop(void *arg)
+{
+    etr_drain_t *drain = (etr_drain_t *) arg;
+    TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+    uint8_t *buf = (uint8_t *) get_buf_ptr(drain->buf_addr, drain->buf_size);
+    uint32_t size = drain->buf_size;
+    uint32_t offset = 0;
+    int last = 0;
+
+    pin_to_core(drain->core);
+    while (!last) {
+        // one more pass once the session stopped, for what the flush wrote
+        last = drain->stop;
+        uint32_t wp = (uint32_t) (tmc_get_write_pt(etr) - drain->buf_addr);
+        if (wp >= size) {
+            fprintf(stderr, "drain: write pointer 0x%lx is outside of the buffer\n", tmc_get_write_pt(etr));
+            exit(1);
+        }
+        drain->polls++;
+
+        uint32_t lag = ring_dist(offset, wp, size);
+        if (lag == 0) {
+            if (!last)
+                usleep(drain->poll_us);
+            continue;
+        }
+        if (lag > drain->peak_lag)
+            drain->peak_lag = lag;
+        if (lag > size / 4 * 3)
+            drain->behind++;
+
+        if (offset + lag <= size) {
+            buf_sync_for_cpu(drain->buf_addr + offset, lag);
+            write_out(drain, buf + offset, lag);
+        } else {
+            buf_sync_for_cpu(drain->buf_addr + offset, size - offset);
+            write_out(drain, buf + offset, size - offset);
+            buf_sync_for_cpu(drain->buf_addr, lag - (size - offset));
+            write_out(drain, buf, lag - (size - offset));
+        }
+        drain->bytes += lag;
+
+        uint32_t wp2 = (uint32_t) (tmc_get_write_pt(etr) - drain->buf_addr);
+        if (wp2 < size && lag + ring_dist(wp, wp2, size) > size)
+            drain->overwrites++;
+        offset = wp;
+    }
+
+    munmap(buf, drain->buf_size);
+    cs_unregister(etr, sizeof(TMC_interface));
+    return NULL;
+}
+
+/*
+    Starts draining buf_addr, as configured by cs_config_etr_mp(), into out
+    ("-" for stdout) on its own thread, pinned to core. With trace_compress
+    out is an archive, compressed on the drain thread.
+*/
+void etr_drain_start(etr_drain_t *drain, uint64_t buf_addr, uint32_t buf_size, const char *out, uint8_t core)
+{
+    int fd = strcmp(out, "-") ? open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+
+    if (fd < 0) {
+        perror(out);
+        exit(1);
+    }
+    etr_drain_start_fd(drain, buf_addr, buf_size, fd, core);
+    printf("Draining the ETR buffer to %s on core %u\n", out, core);
+}
+
+// etr_drain_start() into an open fd, e.g. a pipe, closed by etr_drain_stop()
+void etr_drain_start_fd(etr_drain_t *drain, uint64_t buf_addr, uint32_t buf_size, int fd, uint8_t core)
+{
+    memset(drain, 0, sizeof(*drain));
+    drain->buf_addr = buf_addr;
+    drain->buf_size = buf_size;
+    drain->core = core;
+    drain->poll_us = 100;
+    drain->fd = fd;
+    if (trace_compress)
+        drain->archive = archive_out_open(drain->fd, ARCHIVE_ALIGN_FRAME);
+    if (pthread_create(&drain->thread, NULL, drain_loop, drain) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+}
+
+// flushes and stops TMC3, lets the drain take the rest and reports
+void etr_drain_stop(etr_drain_t *drain)
+{
+    TMC_interface *etr = (TMC_interface *) cs_register(Tmc3);
+
+    tmc_man_flush(etr);
+    while (etr->formatter_flush_status & 0x1);	// FlInProg
+    tmc_disable(etr);
+    cs_unregister(etr, sizeof(TMC_interface));
+
+    drain->stop = 1;
+    pthread_join(drain->thread, NULL);
+    if (drain->archive) {
+        archive_out_flush(drain->archive);
+        fprintf(stderr, "drain: compressed to %lu bytes, %.1f:1\n", drain->archive->comp_bytes,
+                drain->archive->comp_bytes ? (double) drain->archive->raw_bytes / drain->archive->comp_bytes : 0.0);
+        archive_out_close(drain->archive);
+        drain->archive = NULL;
+    }
+    if (drain->fd != STDOUT_FILENO)
+        close(drain->fd);
+
+    fprintf(stderr, "drain: %lu bytes in %lu polls, peak lag %u of %u bytes\n",
+            drain->bytes, drain->polls, drain->peak_lag, drain->buf_size);
+    if (drain->behind || drain->overwrites)
+        fprintf(stderr, "drain: %lu polls more than 3/4 behind, %lu copies overwritten\n",
+                drain->behind, drain->overwrites);
+}
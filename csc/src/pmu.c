@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "zcu_cs.h"
+#include "pmu_event.h"
+#include "pmu.h"
+#if defined __aarch64__
+#include "arm_perf_v8.h"
+#endif
+
+#define PMU_EVENT(name) { #name, name }
+
+// the names of pmu_event.h, as in the pmu_events list of profiling_config.ini
+static const struct {
+    const char *name;
+    int number;
+} pmu_event_names[] = {
+    PMU_EVENT(L1I_CACHE_REFILL),
+    PMU_EVENT(L1I_TLB_REFILL),
+    PMU_EVENT(L1D_CACHE_REFILL),
+    PMU_EVENT(L1D_CACHE),
+    PMU_EVENT(INST_RETIRED),
+    PMU_EVENT(L1I_CACHE),
+    PMU_EVENT(L1D_CACHE_WB),
+    PMU_EVENT(L2D_CACHE),
+    PMU_EVENT(L2D_CACHE_REFILL),
+    PMU_EVENT(L2D_CACHE_WB),
+    PMU_EVENT(LD_RETIRED),
+    PMU_EVENT(ST_RETIRED),
+    PMU_EVENT(EXC_TAKEN),
+    PMU_EVENT(EXC_RETURN),
+    PMU_EVENT(CID_WRITE_RETIRED),
+    PMU_EVENT(PC_WRITE_RETIRED),
+    PMU_EVENT(BR_IMMED_RETIRED),
+    PMU_EVENT(UNALIGNED_LDST_RETIRED),
+    PMU_EVENT(BR_MIS_PRED),
+    PMU_EVENT(BR_PRED),
+    PMU_EVENT(MEM_ACCESS),
+    PMU_EVENT(L1I_CACHE_ERR),
+    PMU_EVENT(L1D_CACHE_ERR),
+    PMU_EVENT(TLB_MEM_ERR),
+    {NULL, 0},
+};
+
+static const char *backend_names[PMU_BACKENDS] = {"perf", "sysreg", "mmio"};
+
+static const enum component core_pmus[4] = {A53_0_pmu, A53_1_pmu, A53_2_pmu, A53_3_pmu};
+
+// the event number of a pmu_event.h name, -1 when there is none
+int pmu_event_lookup(const char *name)
+{
+    for (int i = 0; pmu_event_names[i].name != NULL; i++) {
+        if (strcmp(pmu_event_names[i].name, name) == 0)
+            return pmu_event_names[i].number;
+    }
+    return -1;
+}
+
+const char *pmu_event_name(int number)
+{
+    for (int i = 0; pmu_event_names[i].name != NULL; i++) {
+        if (pmu_event_names[i].number == number)
+            return pmu_event_names[i].name;
+    }
+    return "?";
+}
+
+const char *pmu_backend_name(enum pmu_backend backend)
+{
+    return backend < PMU_BACKENDS ? backend_names[backend] : "?";
+}
+
+static int sysreg_open(pmu_t *pmu)
+{
+#if defined __aarch64__
+    if (!(arm_perf_get_useren() & ARM_PERF_USERENR_EN))
+        return -1;
+
+    pin_to_core(pmu->core);
+    for (int i = 0; i < pmu->event_num; i++)
+        arm_perf_set_type(i, pmu->events[i].number);
+    arm_perf_enable_counter((1u << pmu->event_num) - 1);
+    arm_perf_set_ctrl(arm_perf_get_ctrl() | ARM_PERF_PMCR_E);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int mmio_open(pmu_t *pmu)
+{
+    PMU_interface *regs = (PMU_interface *) cs_register(core_pmus[pmu->core]);
+    // PMEVTYPER<n> at 0x400 + 4n
+    volatile uint32_t *types = (volatile uint32_t *) ((uint8_t *) regs + 0x400);
+
+    regs->lock_access = 0xc5acce55;
+    for (int i = 0; i < pmu->event_num; i++)
+        types[i] = pmu->events[i].number;
+    regs->ct_en_set = (1u << pmu->event_num) - 1;
+    regs->ctrl |= 0x1;
+    pmu->regs = regs;
+    return 0;
+}
+
+/*
+    Opens event_num events (pmu_event.h numbers) on backend for core.
+    Returns 0, or -1 when the backend is not available here or cannot
+    count that many events; a failure of an available backend is fatal.
+*/
+int pmu_open(pmu_t *pmu, enum pmu_backend backend, const int *events, int event_num, uint8_t core)
+{
+    int err = -1;
+
+    memset(pmu, 0, sizeof(*pmu));
+    if (event_num < 1 || event_num > PMU_MAX_EVENTS || core > 3)
+        return -1;
+    if (backend != PMU_PERF && event_num > PMU_HW_COUNTERS)
+        return -1;
+
+    pmu->backend = backend;
+    pmu->event_num = event_num;
+    pmu->core = core;
+    for (int i = 0; i < event_num; i++) {
+        snprintf(pmu->events[i].name, MAX_EVENT_NAME, "%s", pmu_event_name(events[i]));
+        pmu->events[i].number = events[i];
+    }
+
+    switch (backend) {
+    case PMU_PERF:
+        err = perf_open_user(event_num, pmu->events, pmu->perf_fds) ? -1 : 0;
+        if (!err)
+            pmu->fast = perf_mmap(event_num, pmu->perf_fds);
+        break;
+    case PMU_SYSREG:
+        err = sysreg_open(pmu);
+        break;
+    case PMU_MMIO:
+        err = mmio_open(pmu);
+        break;
+    default:
+        break;
+    }
+    return err;
+}
+
+// the current counts, cumulative since pmu_open() for perf, raw counters otherwise
+int pmu_read(pmu_t *pmu, uint64_t *values)
+{
+    switch (pmu->backend) {
+    case PMU_PERF:
+        return pmu->fast ? perf_read_fast((unsigned long long *) values, pmu->event_num, pmu->perf_fds)
+                         : perf_read((unsigned long long *) values, pmu->event_num, pmu->perf_fds);
+    case PMU_SYSREG:
+#if defined __aarch64__
+        for (int i = 0; i < pmu->event_num; i++) {
+            unsigned long long v;
+            arm_perf_read_counter(i, &v);
+            values[i] = v;
+        }
+#endif
+        return 0;
+    case PMU_MMIO: {
+        // PMEVCNTR<n> at 8n
+        volatile uint32_t *counts = (volatile uint32_t *) pmu->regs;
+        for (int i = 0; i < pmu->event_num; i++)
+            values[i] = counts[2 * i];
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+void pmu_close(pmu_t *pmu)
+{
+    switch (pmu->backend) {
+    case PMU_PERF:
+        perf_close(pmu->event_num, pmu->perf_fds);
+        break;
+    case PMU_SYSREG:
+#if defined __aarch64__
+        arm_perf_disable_counter((1u << pmu->event_num) - 1);
+#endif
+        break;
+    case PMU_MMIO:
+        pmu->regs->ct_en_clear = (1u << pmu->event_num) - 1;
+        cs_unregister(pmu->regs, sizeof(PMU_interface));
+        pmu->regs = NULL;
+        break;
+    default:
+        break;
+    }
+    pmu->event_num = 0;
+}
+
+// mean time of one pmu_read() over reads, in ns, also kept in read_ns
+double pmu_measure(pmu_t *pmu, int reads)
+{
+    uint64_t values[PMU_MAX_EVENTS];
+    struct timespec t_start, t_end;
+
+    pmu_read(pmu, values);
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (int i = 0; i < reads; i++)
+        pmu_read(pmu, values);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    pmu->read_ns = ((t_end.tv_sec - t_start.tv_sec) * 1e9 + (t_end.tv_nsec - t_start.tv_nsec)) / reads;
+    return pmu->read_ns;
+}
+
+/*
+    Opens every backend in turn, measures it and keeps the cheapest open.
+    The memory mapped PMU is only tried when /dev/mem can be opened, as
+    cs_register() exits otherwise. Each one is closed before the next, they
+    program the same counters, and the cheapest opened again. Returns the
+    backend, or -1 with none or when it no longer opens.
+*/
+int pmu_open_cheapest(pmu_t *pmu, const int *events, int event_num, uint8_t core)
+{
+    enum pmu_backend best = PMU_BACKENDS;
+    double best_ns = 0;
+
+    for (int b = 0; b < PMU_BACKENDS; b++) {
+        if (b == PMU_MMIO && access("/dev/mem", R_OK | W_OK) != 0)
+            continue;
+        if (pmu_open(pmu, b, events, event_num, core) != 0)
+            continue;
+        double ns = pmu_measure(pmu, 1000);
+        printf("# pmu %s: %.1f ns per read\n", pmu_backend_name(b), ns);
+        pmu_close(pmu);
+        if (best == PMU_BACKENDS || ns < best_ns) {
+            best = b;
+            best_ns = ns;
+        }
+    }
+    if (best == PMU_BACKENDS)
+        return -1;
+
+    if (pmu_open(pmu, best, events, event_num, core) != 0) {
+        fprintf(stderr, "# pmu %s: cannot be opened again\n", pmu_backend_name(best));
+        pmu->event_num = 0;
+        return -1;
+    }
+    pmu->read_ns = best_ns;
+    return best;
+}
@@ -1,11 +1,20 @@
 #include "pmu_counter.h"
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#if defined __aarch64__
+#include "arm_perf_v8.h"
+#endif
 
 
 int perf_ok = 0;
 
+/* the perf_mmap() page of every event, NULL without the userspace fast path */
+static struct perf_event_mmap_page **perf_pages = NULL;
+static int perf_page_num = 0;
+
 #define __NR_perf_event_open 241 // for __aarch64__
 
 /* perf_event_open() system call, not exported in libc */
@@ -14,7 +23,14 @@ int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_
 	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 }
 
-int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds)
+/*
+	Events go in groups of PERF_GROUP_SIZE, each with its own leader, so a
+	list longer than the hardware counters still opens. The kernel rotates
+	the groups over the counters; perf_read() scales the counts by
+	time_enabled / time_running. user_read asks for EL0 counter reads, the
+	arm64 rdpmc flag; a kernel that rejects it opens the events without.
+*/
+static int open_events(int event_num, PmuEvent *pmu_events, int *perf_fds, int user_read)
 {
 	struct perf_event_attr attr = { 0 };
 	unsigned long flags;
@@ -28,8 +44,10 @@ int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds)
 	attr.size = sizeof(attr);
 	attr.type = PERF_TYPE_RAW;
 	attr.config = 0;	/* see below */
-	attr.read_format = PERF_FORMAT_GROUP;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
 	attr.disabled = 0; /* initially enabled */
+	attr.inherit = 1; /* and the forked target, read() sums its counts in */
+	attr.config1 = user_read ? 0x2 : 0; /* rdpmc: arm64 PMU counters readable from EL0 */
 	//attr.pinned = 1;	/* pinned to PMU -> EINVAL */
 	//attr.exclusive = 1; /* exclusive use of PMU by this process -> EINVAL */
 
@@ -39,16 +57,21 @@ int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds)
 	flags = PERF_FLAG_FD_CLOEXEC;
 
 	for (ctr = 0; ctr < event_num; ctr++) { // for every events
-		/* 1st PMU counter is group leader */
-		if (ctr == 0) {
+		/* 1st PMU counter of every PERF_GROUP_SIZE is a group leader */
+		if (ctr % PERF_GROUP_SIZE == 0) {
 			group_fd = -1;	/* first in group */
 		} else {
-			group_fd = perf_fds[0];
+			group_fd = perf_fds[ctr - ctr % PERF_GROUP_SIZE];
 		}
 		// attr.config = perf_config[ctr];
 		attr.config = pmu_events[ctr].number; // number
 
 		fd = perf_event_open(&attr, pid, cpu, group_fd, flags);
+		if (fd == -1 && ctr == 0 && attr.config1 && (errno == EINVAL || errno == EOPNOTSUPP)) {
+			/* no user access here, perf_mmap() then finds no cap_user_rdpmc */
+			attr.config1 = 0;
+			fd = perf_event_open(&attr, pid, cpu, group_fd, flags);
+		}
 		if (fd == -1) {
 			err = errno;
 			if (err == EACCES) {
@@ -66,15 +89,35 @@ int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds)
 		perf_fds[ctr] = fd;
 	}
 
+	if (event_num > PERF_GROUP_SIZE)
+		printf("# %d events in %d groups, multiplexed and scaled\n", event_num,
+		       (event_num + PERF_GROUP_SIZE - 1) / PERF_GROUP_SIZE);
 	perf_ok = 1;
 	return 0;
 }
 
+int perf_open(int event_num, PmuEvent *pmu_events, int *perf_fds)
+{
+	return open_events(event_num, pmu_events, perf_fds, 0);
+}
 
-int perf_read(unsigned long long *values, int event_num, int *perf_fds)
+/* as perf_open(), for perf_mmap() and perf_read_fast() */
+int perf_open_user(int event_num, PmuEvent *pmu_events, int *perf_fds)
 {
-	unsigned long long buf[event_num + 2];
+	return open_events(event_num, pmu_events, perf_fds, 1);
+}
+
+
+/*
+	Reads every group. A count is scaled to the whole time its group was
+	enabled; running, when not NULL, gets the fraction of that time the
+	group of each event was on the counters, 1 without multiplexing.
+*/
+int perf_read_scaled(unsigned long long *values, double *running, int event_num, int *perf_fds)
+{
+	unsigned long long buf[PERF_GROUP_SIZE + 5];
 	int group_fd;
+	int group_num;
 	ssize_t exp;
 	ssize_t r;
 	int err;
@@ -82,38 +125,175 @@ int perf_read(unsigned long long *values, int event_num, int *perf_fds)
 	if (!perf_ok) {
 		for (int i = 0; i < event_num; i++) {
 			values[i] = 0;
+			if (running)
+				running[i] = 0;
 		}
 		return 0;
 	}
 
-	/* We except to read one more 64-bit values than counters,
-	 * the first value is the number of counters.
-	 * The buffer has space for two more values to detect format issues.
-	 */
-	exp = (event_num + 1) * sizeof(buf[0]);
+	for (int base = 0; base < event_num; base += PERF_GROUP_SIZE) {
+		group_num = event_num - base < PERF_GROUP_SIZE ? event_num - base : PERF_GROUP_SIZE;
 
-	group_fd = perf_fds[0];
+		/* We except to read three more 64-bit values than counters,
+		 * the number of counters, time enabled and time running.
+		 * The buffer has space for two more values to detect format issues.
+		 */
+		exp = (group_num + 3) * sizeof(buf[0]);
 
-	r = read(group_fd, buf, sizeof(buf));
-	if (r == -1) {
-		err = errno;
-		perror("perf_read");
-		return err;
-	}
-	if (r != exp) {
-		fprintf(stderr, "perf_trace: read %zd, expected %zd\n", r, exp);
-		return EINVAL;
+		group_fd = perf_fds[base];
+
+		r = read(group_fd, buf, sizeof(buf));
+		if (r == -1) {
+			err = errno;
+			perror("perf_read");
+			return err;
+		}
+		if (r != exp) {
+			fprintf(stderr, "perf_trace: read %zd, expected %zd\n", r, exp);
+			return EINVAL;
+		}
+		if (buf[0] != (unsigned long long) group_num) {
+			fprintf(stderr, "perf_trace: unexpected value %llu\n", buf[0]);
+			return EINVAL;
+		}
+
+		unsigned long long enabled = buf[1], on_pmu = buf[2];
+		for (int i = 0; i < group_num; i++) {
+			if (on_pmu == 0)
+				values[base + i] = 0;	/* never scheduled */
+			else if (on_pmu == enabled)
+				values[base + i] = buf[i + 3];
+			else
+				values[base + i] = (unsigned long long) ((double) buf[i + 3] * enabled / on_pmu);
+			if (running)
+				running[base + i] = enabled ? (double) on_pmu / enabled : 0;
+		}
 	}
-	if (buf[0] != event_num) {
-		fprintf(stderr, "perf_trace: unexpected value %llu\n", buf[0]);
-		return EINVAL;
+
+	return 0;
+}
+
+
+int perf_read(unsigned long long *values, int event_num, int *perf_fds)
+{
+	return perf_read_scaled(values, NULL, event_num, perf_fds);
+}
+
+
+/*
+	Maps the user page of every event, for perf_read_fast(). Only Linux
+	5.17 on grants direct counter reads on arm64, when
+	/proc/sys/kernel/perf_user_access is 1; each page then has
+	cap_user_rdpmc. Older kernels never set it, PMUSERENR set by
+	support/enable_arm_pmu.c or not, so they always take read(). Returns 1
+	when all events can be read from userspace, 0 when perf_read_fast()
+	will use read().
+*/
+int perf_mmap(int event_num, int *perf_fds)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	int fast = 1;
+
+	if (!perf_ok)
+		return 0;
+
+	perf_pages = calloc(event_num, sizeof(*perf_pages));
+	if (perf_pages == NULL) {
+		perror("perf_mmap");
+		exit(1);
 	}
+	perf_page_num = event_num;
 
 	for (int i = 0; i < event_num; i++) {
-		values[i] = buf[i+1];
+		void *page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, perf_fds[i], 0);
+		if (page == MAP_FAILED) {
+			perror("perf_mmap");
+			fast = 0;
+			continue;
+		}
+		perf_pages[i] = (struct perf_event_mmap_page *) page;
+		if (!perf_pages[i]->cap_user_rdpmc)
+			fast = 0;
 	}
 
+	/* the page has no time fields to scale multiplexed counts with */
+	if (event_num > PERF_GROUP_SIZE)
+		fast = 0;
+	printf("# perf counters read %s\n", fast ? "from userspace" : "with read()");
+	return fast;
+}
+
+/*
+	One event from its user page, with the seqlock protocol: lock changes
+	whenever the kernel updated the page or moved the event, so a read
+	between two equal lock values is consistent. Returns 0 when the event is
+	not on a counter now or not readable from userspace.
+*/
+static int perf_page_read(struct perf_event_mmap_page *pc, unsigned long long *value)
+{
+#if defined __aarch64__
+	unsigned long long pmc;
+	unsigned int seq, idx, width;
+	long long offset;
+
+	do {
+		seq = pc->lock;
+		__sync_synchronize();
+
+		idx = pc->index;
+		offset = pc->offset;
+		width = pc->pmc_width;
+		if (!pc->cap_user_rdpmc || idx == 0 || !arm_perf_read_counter(idx - 1, &pmc))
+			return 0;
+		/* the counter is pmc_width bits wide, sign extend it */
+		pmc = (unsigned long long) (((long long) (pmc << (64 - width))) >> (64 - width));
+
+		__sync_synchronize();
+	} while (pc->lock != seq);
+
+	*value = offset + pmc;
+	return 1;
+#else
+	(void) pc;
+	(void) value;
 	return 0;
+#endif
+}
+
+/*
+	perf_read() without a system call, after perf_mmap(). The counter
+	registers hold the counts of the calling task only, the inherited counts
+	of its children come with read(), so this suits deltas around a region
+	of the task that opened the counters. Falls back to perf_read() as soon
+	as one event cannot be read from userspace.
+*/
+int perf_read_fast(unsigned long long *values, int event_num, int *perf_fds)
+{
+	if (perf_pages == NULL || event_num > perf_page_num || event_num > PERF_GROUP_SIZE)
+		return perf_read(values, event_num, perf_fds);
+
+	for (int i = 0; i < event_num; i++) {
+		if (perf_pages[i] == NULL || !perf_page_read(perf_pages[i], &values[i]))
+			return perf_read(values, event_num, perf_fds);
+	}
+	return 0;
+}
+
+
+/* closes the events of perf_open() and the pages of perf_mmap() */
+void perf_close(int event_num, int *perf_fds)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	for (int i = 0; i < event_num; i++) {
+		if (perf_pages && i < perf_page_num && perf_pages[i])
+			munmap(perf_pages[i], page_size);
+		close(perf_fds[i]);
+	}
+	free(perf_pages);
+	perf_pages = NULL;
+	perf_page_num = 0;
+	perf_ok = 0;
 }
 
 
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "cs_soc.h"
+#include "zcu_cs.h"
+#include "cs_etm.h"
+#include "cs_config.h"
+#include "pmu_sampler.h"
+
+static void write_record(FILE *out, const void *data, size_t size)
+{
+    if (fwrite(data, size, 1, out) != 1) {
+        perror("pmu timeline write");
+        exit(1);
+    }
+}
+
+static inline void timespec_add_us(struct timespec *t, uint32_t us)
+{
+    t->tv_nsec += (long) us * 1000;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+/*
+    Sleeps to absolute deadlines, so the period does not drift with the
+    time a read takes. The Tsgen count is taken right before the read.
+*/
+static void *sampler_loop(void *arg)
+{
+    pmu_sampler_t *sampler = (pmu_sampler_t *) arg;
+    TSGEN_interface *tsgen = (TSGEN_interface *) cs_register(Tsgen);
+    uint64_t record[1 + sampler->event_num];
+    struct timespec next, now;
+    int last = 0;
+
+    pin_to_core(sampler->core);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!last) {
+        // one more sample once stopped, for the end of the run
+        last = sampler->stop;
+
+        record[0] = tsgen_count(tsgen);
+        if (perf_read((unsigned long long *) &record[1], sampler->event_num, sampler->perf_fds) != 0)
+            break;
+        write_record(sampler->out, record, sizeof(record));
+        sampler->samples++;
+
+        if (last)
+            break;
+        timespec_add_us(&next, sampler->period_us);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec)) {
+            sampler->late++;
+            next = now;
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    cs_unregister(tsgen, sizeof(TSGEN_interface));
+    return NULL;
+}
+
+/*
+    Starts sampling the perf_fds of perf_open() every period_us into out,
+    on its own thread pinned to core. Enables the Tsgen counter.
+*/
+void pmu_sampler_start(pmu_sampler_t *sampler, int event_num, PmuEvent *pmu_events, int *perf_fds,
+                       uint32_t period_us, const char *out, uint8_t core)
+{
+    pmu_timeline_header_t header = {0};
+
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->event_num = event_num;
+    sampler->perf_fds = perf_fds;
+    sampler->period_us = period_us;
+    sampler->core = core;
+    sampler->out = fopen(out, "wb");
+    if (sampler->out == NULL) {
+        perror(out);
+        exit(1);
+    }
+
+    header.magic = PMU_TIMELINE_MAGIC;
+    header.version = PMU_TIMELINE_VERSION;
+    header.event_num = event_num;
+    header.period_us = period_us;
+    header.tsgen_freq = cs_enable_tsgen();
+    write_record(sampler->out, &header, sizeof(header));
+    for (int i = 0; i < event_num; i++) {
+        uint32_t number = pmu_events[i].number;
+        write_record(sampler->out, &number, sizeof(number));
+    }
+
+    if (pthread_create(&sampler->thread, NULL, sampler_loop, sampler) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    printf("Sampling %d events every %u us to %s, Tsgen at %u Hz\n", event_num, period_us, out, header.tsgen_freq);
+}
+
+// takes a last sample and closes the timeline
+void pmu_sampler_stop(pmu_sampler_t *sampler)
+{
+    sampler->stop = 1;
+    pthread_join(sampler->thread, NULL);
+    fclose(sampler->out);
+
+    fprintf(stderr, "pmu sampler: %lu samples, %lu late\n", sampler->samples, sampler->late);
+}
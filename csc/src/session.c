@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "cs_etm.h"
+#include "cs_config.h"
+#include "drain.h"
+#include "pipeline.h"
+#include "subscriber.h"
+#include "session.h"
+#include "zcu_cs.h"
+
+extern ETM_interface *etms[4];
+
+// the relay copies this much of the drained trace to raw_path at a time
+#define SESSION_RELAY_SIZE (64 * 1024)
+
+static session_t *cur_session;
+
+// called by the decoder of each trace ID, see pipeline_id()
+static void session_event(const trace_event_t *event)
+{
+    session_t *s = cur_session;
+    int id = pipeline_id();
+
+    if (s == NULL || id <= 0)
+        return;
+    s->events[id]++;
+    if (event->type == EV_OVERFLOW)
+        s->overflows[id]++;
+    if (s->on_event)
+        s->on_event(s->ctx, id, event);
+}
+
+static const subscriber_t session_subscriber = {
+    .name = "session",
+    .on_event = session_event,
+    .on_finish = NULL,
+};
+
+void session_init(session_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->buf_addr = 0x00FFFC0000;  //OCM
+    s->buf_size = 1024 * 256;
+    s->core_mask = 0x1;
+    for (int i = 0; i < 4; i++) {
+        s->range_lo[i] = 0x400000;
+        s->range_hi[i] = 0x500000;
+    }
+    s->ts_period = -1;
+    s->drain_core = 2;
+    s->decode_mode = SINK_TEXT;
+}
+
+// traces core as well, in [lo, hi)
+void session_set_filter(session_t *s, int core, uint64_t lo, uint64_t hi)
+{
+    s->core_mask |= 1 << core;
+    s->range_lo[core] = lo;
+    s->range_hi[core] = hi;
+}
+
+typedef struct relay {
+    int in;
+    int out;
+    FILE *fp;
+} relay_t;
+
+// write all of data, a pipe may take it in pieces
+static void write_all(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("session write");
+            exit(1);
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+// tees the drained trace to raw_path on its way to the decoders
+static void *relay_loop(void *arg)
+{
+    relay_t *r = (relay_t *) arg;
+    static uint8_t buf[SESSION_RELAY_SIZE];
+    ssize_t n;
+
+    while ((n = read(r->in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("session read");
+            exit(1);
+        }
+        if (fwrite(buf, 1, n, r->fp) != (size_t) n)
+            perror("session raw file");
+        write_all(r->out, buf, n);
+    }
+    close(r->in);
+    close(r->out);
+    fclose(r->fp);
+    return NULL;
+}
+
+typedef struct decoder {
+    session_t *s;
+    int fd;
+    int n_ids;
+} decoder_t;
+
+static void *decode_loop(void *arg)
+{
+    decoder_t *d = (decoder_t *) arg;
+    session_t *s = d->s;
+    uint8_t mode = s->decode_prefix ? s->decode_mode : SINK_NONE;
+    char path[256];
+
+    // one ID is decoded to the sink of this thread
+    if (d->n_ids == 1 && mode != SINK_NONE) {
+        snprintf(path, sizeof(path), "%s_0.%s", s->decode_prefix, mode == SINK_BINARY ? "evt" : "txt");
+        sink_open(mode, path);
+    }
+    s->bytes = pipeline_decode(d->fd, d->n_ids, mode, s->decode_prefix);
+    if (d->n_ids == 1 && mode != SINK_NONE)
+        sink_close();
+    close(d->fd);
+    return NULL;
+}
+
+/*
+    Runs target on every core of core_mask under trace and returns once the
+    targets exited and their trace is decoded. Returns 0 when all targets
+    exited with 0.
+*/
+int session_run(session_t *s, char **target)
+{
+    static int subscribed;
+    pid_t target_pids[4];
+    struct timespec t_start, t_end;
+    pthread_t decoder_thread, relay_thread;
+    decoder_t decoder;
+    relay_t relay;
+    etr_drain_t drain;
+    int drain_fds[2], decode_fds[2];
+    int failed = 0;
+    int i;
+
+    if (!subscribed) {
+        subscriber_add(&session_subscriber);
+        subscribed = 1;
+    }
+    cur_session = s;
+    memset(s->events, 0, sizeof(s->events));
+    memset(s->overflows, 0, sizeof(s->overflows));
+
+    cs_config_etr_mp(s->buf_addr, s->buf_size);
+    cs_register_etms(s->core_mask);
+    cs_report_tmcs(0);
+    if (s->ts_period >= 0)
+        cs_enable_tsgen();
+    for (i = 0; i < 4; i++) {
+        if (s->core_mask & (1 << i)) {
+            config_etm_n(etms[i], s->stall, i + 1);
+            etm_set_sync(etms[i], s->sync);
+            if (s->cc_threshold)
+                etm_set_cci(etms[i], s->cc_threshold);
+            if (s->ts_period >= 0)
+                etm_set_timestamp(etms[i], s->ts_period);
+        }
+    }
+
+    // drain -> [relay to raw_path ->] decoders, through pipes
+    if (pipe(drain_fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    decode_fds[0] = drain_fds[0];
+    if (s->raw_path) {
+        if (pipe(decode_fds) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        relay.in = drain_fds[0];
+        relay.out = decode_fds[1];
+        relay.fp = fopen(s->raw_path, "wb");
+        if (relay.fp == NULL) {
+            perror(s->raw_path);
+            exit(1);
+        }
+        if (pthread_create(&relay_thread, NULL, relay_loop, &relay) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    decoder.s = s;
+    decoder.fd = decode_fds[0];
+    decoder.n_ids = 32 - __builtin_clz(s->core_mask);
+    if (pthread_create(&decoder_thread, NULL, decode_loop, &decoder) != 0) {
+        perror("pthread_create");
+        exit(1);
+    }
+    etr_drain_start_fd(&drain, s->buf_addr, s->buf_size, drain_fds[1], s->drain_core);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    for (i = 0; i < 4; i++) {
+        if (!(s->core_mask & (1 << i)))
+            continue;
+        target_pids[i] = fork();
+        if (target_pids[i] == 0) {
+            pin_to_core(i);
+            etm_set_contextid_cmp(etms[i], (uint64_t) getpid());
+            etm_register_range(etms[i], s->range_lo[i], s->range_hi[i], 1);
+            etm_enable(etms[i]);
+            execv(target[0], target);
+            perror("execv failed. Target application failed to start.");
+            exit(1);
+        } else if (target_pids[i] < 0) {
+            perror("fork");
+            exit(1);
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        if (s->core_mask & (1 << i)) {
+            int status;
+            waitpid(target_pids[i], &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                failed = 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    s->secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+    for (i = 0; i < 4; i++) {
+        if (s->core_mask & (1 << i)) {
+            etm_disable(etms[i]);
+            cs_unregister(etms[i], sizeof(ETM_interface));
+        }
+    }
+
+    // closes the write end, the relay and the decoders see the end of the trace
+    etr_drain_stop(&drain);
+    s->overwrites = drain.overwrites;
+    if (s->raw_path)
+        pthread_join(relay_thread, NULL);
+    pthread_join(decoder_thread, NULL);
+    cur_session = NULL;
+
+    return failed;
+}
+
+void session_print(const session_t *s)
+{
+    printf("Session of %.3f s, %lu bytes drained, %lu copies overwritten\n", s->secs, s->bytes, s->overwrites);
+    for (int id = 0; id < FRAME_IDS; id++) {
+        if (s->events[id] == 0)
+            continue;
+        printf("  ID %d: %lu events, %lu overflows\n", id, s->events[id], s->overflows[id]);
+    }
+}
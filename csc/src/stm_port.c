@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "zcu_cs.h"
+#include "stm_port.h"
+
+// maps ports first to first + n - 1 uncached, device memory for the stores to reach the STM in order
+void stm_open(stm_ports_t *ports, uint32_t first, uint32_t n)
+{
+    size_t page = getpagesize();
+    uint64_t start = STM_PORTS + (uint64_t) first * STM_PORT_SIZE;
+    uint64_t map_start = start & ~(uint64_t) (page - 1);
+
+    if (n == 0 || first >= STM_N_PORTS || n > STM_N_PORTS - first) {
+        fprintf(stderr, "STM ports %u to %u out of 0 to %u\n", first, first + n - 1, STM_N_PORTS - 1);
+        exit(1);
+    }
+    ports->map_size = (start - map_start + (size_t) n * STM_PORT_SIZE + page - 1) & ~(page - 1);
+    ports->map = mmap(NULL, ports->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cs_mem_fd(1), map_start);
+    if (ports->map == MAP_FAILED) {
+        perror("mmap STM stimulus ports");
+        exit(1);
+    }
+    ports->base = (volatile uint8_t *) ports->map + (start - map_start);
+    ports->first = first;
+    ports->n = n;
+}
+
+void stm_close(stm_ports_t *ports)
+{
+    munmap(ports->map, ports->map_size);
+    ports->map = NULL;
+    ports->base = NULL;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "buffer.h"
+#include "trace.h"
+#include "input.h"
+#include "sink.h"
+#include "subscriber.h"
+#include "archive.h"
+#include "trace_check.h"
+
+typedef struct id_stream {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} id_stream_t;
+
+static trace_check_t *cur_check;
+static int cur_id;
+
+static void count_event(const trace_event_t *event)
+{
+    if (event->type == EV_OVERFLOW)
+        cur_check->overflows[cur_id]++;
+    else if (event->type == EV_SYNC)
+        cur_check->syncs[cur_id]++;
+}
+
+static const subscriber_t check_subscriber = {
+    .name = "trace_check",
+    .on_event = count_event,
+    .on_finish = NULL,
+};
+
+static void append_id(void *ctx, int id, const uint8_t *data, size_t len)
+{
+    id_stream_t *s = &((id_stream_t *) ctx)[id];
+
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->data = (uint8_t *) realloc(s->data, s->cap);
+        if (s->data == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+}
+
+/*
+    Deformats a ring of size bytes, oldest frame first, and decodes the stream
+    of each trace ID with no output to count its overflows and syncs.
+*/
+void trace_check_ring(trace_check_t *check, const uint8_t *data, uint32_t size, uint32_t rwp, int full)
+{
+    static int subscribed;
+    id_stream_t *streams = (id_stream_t *) calloc(FRAME_IDS, sizeof(id_stream_t));
+    deformatter_t d;
+
+    memset(check, 0, sizeof(*check));
+    check->wrapped = full;
+
+    deformat_init(&d, 64 * 1024, append_id, streams);
+    d.keep_all = 1;
+    if (full) {
+        // a frame split by the wrap point is lost, it is not worth a copy here
+        deformat_stream(&d, data + rwp, size - rwp);
+        deformat_stream(&d, data, rwp);
+    } else {
+        deformat_stream(&d, data, rwp);
+    }
+    deformat_flush(&d);
+    check->padding = d.padding;
+    check->fsyncs = d.fsyncs;
+    deformat_free(&d);
+
+    if (!subscribed) {
+        sink_open(SINK_NONE, NULL);
+        subscriber_add(&check_subscriber);
+        subscribed = 1;
+    }
+    cur_check = check;
+    for (int id = 0; id < FRAME_IDS; id++) {
+        if (streams[id].len == 0)
+            continue;
+        check->bytes[id] = streams[id].len;
+        cur_id = id;
+        input_set_buffer(streams[id].data, streams[id].len);
+        trace_loop_dispatch(TRACE_DISPATCH_TABLE);
+        free(streams[id].data);
+    }
+    free(streams);
+}
+
+// trace_check_ring() on the ETR buffer of a stopped session, see cs_stop_etr()
+void trace_check_etr(trace_check_t *check, uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full)
+{
+    volatile uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
+    uint32_t *copy = (uint32_t *) malloc(buf_size);
+    uint32_t offset = (uint32_t) (rwp - buf_addr);
+
+    if (ptr == MAP_FAILED || copy == NULL) {
+        fprintf(stderr, "ETR buffer can't be read\n");
+        exit(1);
+    }
+    // device memory, word loads only, unless /dev/cs_mem maps it cached
+    if (buf_sync_for_cpu(buf_addr, buf_size))
+        memcpy(copy, (const uint32_t *) ptr, buf_size);
+    else
+        for (uint32_t i = 0; i < buf_size / 4; i++)
+            copy[i] = ptr[i];
+    munmap((void *) ptr, buf_size);
+
+    trace_check_ring(check, (uint8_t *) copy, buf_size, offset, full);
+    free(copy);
+}
+
+uint64_t trace_check_overflows(const trace_check_t *check)
+{
+    uint64_t n = 0;
+
+    for (int id = 0; id < FRAME_IDS; id++)
+        n += check->overflows[id];
+    return n;
+}
+
+/*
+    Bytes and bandwidth of each trace ID in a session of secs seconds, and
+    the lost-trace fraction: the share of its sync periods with an overflow.
+*/
+void trace_check_print(const trace_check_t *check, double secs)
+{
+    printf("Trace bytes per ID over %.3f s%s:\n", secs, check->wrapped ? ", the buffer wrapped so the oldest were lost" : "");
+    for (int id = 0; id < FRAME_IDS; id++) {
+        uint64_t periods = check->syncs[id] + check->overflows[id];
+
+        if (check->bytes[id] == 0)
+            continue;
+        printf("  ID %d: %lu bytes, %.3f MB/s, %lu overflows, %lu syncs, %.1f%% lost\n",
+               id, check->bytes[id], secs > 0 ? check->bytes[id] / secs / 1e6 : 0.0,
+               check->overflows[id], check->syncs[id],
+               periods ? 100.0 * check->overflows[id] / periods : 0.0);
+    }
+    printf("  padding %lu bytes, %lu FSYNC packets\n", check->padding, check->fsyncs);
+}
+
+/*
+    Reports a dump_buffer_ring() output, these numbers are what size the
+    ETR bandwidth of a multi-core session.
+*/
+void report_trace_ids(const char *dat_name, const char *ring_name, double secs)
+{
+    FILE *fp = fopen(ring_name, "r");
+    unsigned int size = 0, rwp = 0, full = 0;
+    trace_check_t check;
+
+    if (fp == NULL || fscanf(fp, "size %i rwp %i full %i", &size, &rwp, &full) != 3) {
+        fprintf(stderr, "%s can't be read\n", ring_name);
+        return;
+    }
+    fclose(fp);
+
+    uint32_t used = full ? size : rwp;
+    uint8_t *data = (uint8_t *) malloc(used + 1);
+    fp = fopen(dat_name, "r");
+    size_t got = fp ? fread(data, 1, used, fp) : 0;
+    if (fp && archive_is(data, got)) {
+        // compressed with -z: the whole archive, then its plain bytes
+        size_t comp = got, raw_size = 0;
+        uint8_t *raw;
+        while (!feof(fp)) {
+            data = (uint8_t *) realloc(data, comp + 65536);
+            comp += fread(data + comp, 1, 65536, fp);
+        }
+        raw = archive_unpack(data, comp, &raw_size);
+        free(data);
+        data = raw;
+        got = raw && raw_size == used ? used : 0;
+    }
+    if (fp == NULL || data == NULL || got != used) {
+        fprintf(stderr, "%s can't be read\n", dat_name);
+        exit(1);
+    }
+    fclose(fp);
+
+    trace_check_ring(&check, data, size, rwp, full);
+    free(data);
+    trace_check_print(&check, secs);
+}
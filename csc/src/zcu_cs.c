@@ -2,127 +2,250 @@
 #include "cs_soc.h"
 #include "cs_etm.h"
 #include "cs_pmu.h"
+#include "cs_mem.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 
 
-void* cs_register(enum component comp)
+// /dev/mem, opened once per process: with O_SYNC for registers, without for DRAM buffers
+int cs_mem_fd(int sync)
 {
-	void* ptr = NULL;
-    int fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (fd < 0) {
-        perror("Cannot open /dev/mem\n");
-        exit(1);
+    static int fds[2] = {-1, -1};
+    if (fds[sync] < 0) {
+        fds[sync] = open("/dev/mem", sync ? O_RDWR | O_SYNC : O_RDWR);
+        if (fds[sync] < 0) {
+            perror("Cannot open /dev/mem\n");
+            exit(1);
+        }
+    }
+    return fds[sync];
+}
+
+static int driver_fd = -2;
+static struct cs_mem_info driver_info;
+static struct cs_mem_alloc driver_alloc;
+
+static int covers(uint64_t base, uint64_t limit, uint64_t addr, uint64_t size)
+{
+    return addr >= base && size <= limit && addr - base <= limit - size;
+}
+
+static int driver_open(void)
+{
+    if (driver_fd == -2) {
+        driver_fd = open(CS_MEM_DEVICE, O_RDWR);
+        if (driver_fd >= 0 && ioctl(driver_fd, CS_MEM_INFO, &driver_info) < 0) {
+            perror("CS_MEM_INFO");
+            close(driver_fd);
+            driver_fd = -1;
+        }
     }
+    return driver_fd;
+}
+
+/*
+    /dev/cs_mem of support/cs_mem.c, opened once per process when the module
+    is loaded: the same offsets as /dev/mem, the debug window uncached and
+    the trace buffers cached. -1 without the module or when [addr, addr +
+    size) is in none of its windows, then /dev/mem it is.
+*/
+int cs_mem_driver_fd(uint64_t addr, uint64_t size)
+{
+    if (driver_open() < 0)
+        return -1;
+    if (covers(driver_info.cs_base, driver_info.cs_size, addr, size)
+            || covers(driver_info.buf_base, driver_info.buf_size, addr, size)
+            || covers(driver_alloc.addr, driver_alloc.size, addr, size))
+        return driver_fd;
+    return -1;
+}
+
+// size bytes of CMA through /dev/cs_mem, their bus address; 0 without the module or the memory
+uint64_t cs_mem_driver_alloc(uint64_t size)
+{
+    struct cs_mem_alloc req = { size, 0 };
+
+    if (driver_open() < 0 || driver_alloc.size)
+        return 0;
+    if (ioctl(driver_fd, CS_MEM_ALLOC, &req) < 0) {
+        perror("CS_MEM_ALLOC");
+        return 0;
+    }
+    driver_alloc = req;
+    return req.addr;
+}
+
+void cs_mem_driver_free(void)
+{
+    if (driver_fd < 0 || !driver_alloc.size)
+        return;
+    if (ioctl(driver_fd, CS_MEM_FREE) < 0)
+        perror("CS_MEM_FREE");
+    driver_alloc.size = 0;
+}
 
+// offset from CS_BASE and register block size of a component
+static off_t cs_offset(enum component comp, size_t *size)
+{
     switch(comp) {
+        case Tsgen:
+            *size = sizeof(TSGEN_interface);
+            return TSGEN;
         case Funnel0:
-            ptr = mmap(NULL, sizeof(Funnel_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + FUNNEL0);
-            break;
+            *size = sizeof(Funnel_interface);
+            return FUNNEL0;
         case Funnel1:
-            ptr = mmap(NULL, sizeof(Funnel_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + FUNNEL1);
-            break;
+            *size = sizeof(Funnel_interface);
+            return FUNNEL1;
         case Funnel2:
-            ptr = mmap(NULL, sizeof(Funnel_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + FUNNEL2);
-            break;
+            *size = sizeof(Funnel_interface);
+            return FUNNEL2;
         case Tmc1:
-            ptr = mmap(NULL, sizeof(TMC_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + TMC1);
-            break;
+            *size = sizeof(TMC_interface);
+            return TMC1;
         case Tmc2:
-            ptr = mmap(NULL, sizeof(TMC_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + TMC2);
-            break;
+            *size = sizeof(TMC_interface);
+            return TMC2;
         case Tmc3:
-            ptr = mmap(NULL, sizeof(TMC_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + TMC3);
-            break;
+            *size = sizeof(TMC_interface);
+            return TMC3;
         case Replic:
-            ptr = mmap(NULL, sizeof(Replicator_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + REPLIC);
-            break;
+            *size = sizeof(Replicator_interface);
+            return REPLIC;
         case Tpiu:
             printf("IMPORTANT NOTICE!\n");
             printf("If you are trying to use TPIU, then on ZCU102/Kria, you need to connect jumper J88\n");
             printf("Reference https://support.xilinx.com/s/article/66669?language=en_US\n");
-            ptr = mmap(NULL, sizeof(TPIU_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + TPIU);
-            break;
+            *size = sizeof(TPIU_interface);
+            return TPIU;
+        case Stm:
+            *size = sizeof(STM_interface);
+            return STM;
         case Cti0:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + CTI0);
-            break;
+            *size = sizeof(CTI_interface);
+            return CTI0;
         case Cti1:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + CTI1);
-            break;
+            *size = sizeof(CTI_interface);
+            return CTI1;
         case Cti2:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + CTI2);
-            break;
+            *size = sizeof(CTI_interface);
+            return CTI2;
         case A53_0_etm:
-            ptr = mmap(NULL, sizeof(ETM_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_0_ETM);
-            break; 
+            *size = sizeof(ETM_interface);
+            return A53_0_ETM;
         case A53_0_pmu:
-            ptr = mmap(NULL, sizeof(PMU_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_0_PMU);
-            break; 
+            *size = sizeof(PMU_interface);
+            return A53_0_PMU;
         case A53_0_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_0_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_0_CTI;
         case A53_0_debug:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_0_DEBUG);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_0_DEBUG;
         case A53_1_etm:
-            ptr = mmap(NULL, sizeof(ETM_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_1_ETM);
-            break; 
+            *size = sizeof(ETM_interface);
+            return A53_1_ETM;
         case A53_1_pmu:
-            ptr = mmap(NULL, sizeof(PMU_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_1_PMU);
-            break; 
+            *size = sizeof(PMU_interface);
+            return A53_1_PMU;
         case A53_1_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_1_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_1_CTI;
         case A53_1_debug:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_1_DEBUG);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_1_DEBUG;
         case A53_2_etm:
-            ptr = mmap(NULL, sizeof(ETM_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_2_ETM);
-            break; 
+            *size = sizeof(ETM_interface);
+            return A53_2_ETM;
         case A53_2_pmu:
-            ptr = mmap(NULL, sizeof(PMU_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_2_PMU);
-            break; 
+            *size = sizeof(PMU_interface);
+            return A53_2_PMU;
         case A53_2_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_2_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_2_CTI;
         case A53_2_debug:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_2_DEBUG);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_2_DEBUG;
         case A53_3_etm:
-            ptr = mmap(NULL, sizeof(ETM_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_3_ETM);
-            break; 
+            *size = sizeof(ETM_interface);
+            return A53_3_ETM;
         case A53_3_pmu:
-            ptr = mmap(NULL, sizeof(PMU_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_3_PMU);
-            break; 
+            *size = sizeof(PMU_interface);
+            return A53_3_PMU;
         case A53_3_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_3_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_3_CTI;
         case A53_3_debug:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + A53_3_DEBUG);
-            break; 
+            *size = sizeof(CTI_interface);
+            return A53_3_DEBUG;
         case R5_0_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + R5_0_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return R5_0_CTI;
         case R5_1_cti:
-            ptr = mmap(NULL, sizeof(CTI_interface), PROT_READ | PROT_WRITE, MAP_SHARED, fd, CS_BASE + R5_1_CTI);
-            break; 
+            *size = sizeof(CTI_interface);
+            return R5_1_CTI;
         default:
             fprintf(stderr, "Unimplemented component %d\n", comp);
             exit(1);
-            break;
     }
+}
+
+static uint8_t *cs_window = NULL;
+
+/*
+    Maps the whole CS_WINDOW_SIZE debug APB window with one mmap; every
+    cs_register() after it is a pointer into the mapping. cs_register()
+    opens the session itself, an explicit call only moves the cost.
+*/
+void cs_session_open(void)
+{
+    if (cs_window)
+        return;
+    int fd = cs_mem_driver_fd(CS_BASE, CS_WINDOW_SIZE);
+    void *ptr = mmap(NULL, CS_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd >= 0 ? fd : cs_mem_fd(1), CS_BASE);
+    if (ptr == MAP_FAILED) {
+        perror("mmap CoreSight window, mapping per component");
+        return;
+    }
+    cs_window = (uint8_t *) ptr;
+}
+
+// pointers from cs_register() are invalid after this
+void cs_session_close(void)
+{
+    if (cs_window) {
+        munmap(cs_window, CS_WINDOW_SIZE);
+        cs_window = NULL;
+    }
+}
 
+void* cs_register(enum component comp)
+{
+	void* ptr = NULL;
+    size_t size;
+    off_t offset = cs_offset(comp, &size);
+
+    cs_session_open();
+    if (cs_window)
+        return cs_window + offset;
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cs_mem_fd(1), CS_BASE + offset);
 	if (ptr == MAP_FAILED)
 		fprintf(stderr,"mmap to component %d failed!\n", comp);
-	close(fd);
-
-#ifdef DEBUG
-#endif
 
     return ptr;
-} 
\ No newline at end of file
+}
+
+// releases a cs_register() pointer, a no-op inside the session window
+void cs_unregister(void *ptr, size_t size)
+{
+    if (cs_window && (uint8_t *) ptr >= cs_window && (uint8_t *) ptr < cs_window + CS_WINDOW_SIZE)
+        return;
+    munmap(ptr, size);
+}
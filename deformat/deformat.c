@@ -7,6 +7,69 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the demultiplexer is shared with ctrace -F, see ETM_data_parser/src/frame.c
+#include "frame.h"
+// compressed trace archives, see ETM_data_parser/src/archive.c
+#include "archive.h"
+// STPv2 packets of the STM, see ETM_data_parser/src/stm.c
+#include "stm.h"
+
+// bytes collected per trace ID before they are written out
+#define OUT_BUF_SIZE (4 * 1024 * 1024)
+// an A-sync packet is 11 zero bytes and 0x80
+#define ASYNC_ZEROS 11
+// input frames per chunk with -j (4 MB), and buffering inside a chunk
+#define CHUNK_FRAMES (256 * 1024)
+#define CHUNK_OUT_SIZE (64 * 1024)
+
+typedef struct id_file {
+    FILE* fp;
+    FILE* idx;          // A-sync offsets, NULL without -i
+    archive_out_t* archive;     // with -z, written instead of fp
+    uint64_t offset;    // bytes written so far
+    size_t zeros;       // zero bytes at the end of what was written
+} id_file_t;
+
+/*
+    With -j, chunks of the input are deformatted in parallel, each starting
+    with an unknown ID. data[id] holds the bytes of a trace ID and
+    data[FRAME_IDS] those before the first ID byte of the chunk, which
+    belong to the ID the previous chunk ended with.
+*/
+typedef struct chunk {
+    size_t start;
+    size_t end;
+    uint8_t* data[FRAME_IDS + 1];
+    size_t len[FRAME_IDS + 1];
+    size_t cap[FRAME_IDS + 1];
+    int final_id;
+    size_t dropped;
+    size_t padding;
+    uint64_t padding_frames;
+    uint64_t fsyncs;
+    int done;
+} chunk_t;
+
+void usage(char* name) {
+    printf("Usage %s [-b] [-i] [-a] [-c] [-z] [-j threads] [-r ring_file] [-s stm_id] <number of active ETMs> <input file name>\n", name);
+    printf("  -b  binary output only, trc_N.dat without the trc_N.out hex text\n");
+    printf("  -i  index the A-sync packets of each ID, offsets into trc_N.dat as uint64_t in trc_N.idx\n");
+    printf("  -a  write every trace ID found, not only 1 to the number of ETMs\n");
+    printf("  -c  continuous mode: frames between FSYNC packets, start after the first one\n");
+    printf("  -j  deformat chunks of the input on this many threads, same output\n");
+    printf("  -r  ring file written with a wrapped ETR buffer (trace.ring), start at its oldest frame\n");
+    printf("  -z  write trc_N.dat as compressed archives, chunks start at an A-sync; implies -b\n");
+    printf("  -s  trace ID of the STM, its packets are also decoded to trc_N.stm\n");
+    exit(1);
+}
 
 // requires 2 positional arguments: the number of active ETMs and the input file name
 void parse_args(int argc, char *argv[], uint8_t* n_mp) {
@@ -19,46 +82,332 @@ void parse_args(int argc, char *argv[], uint8_t* n_mp) {
     return;
 }
 
+/*
+    Finds the 0x80 ending each A-sync packet; its zeros may have come with
+    the previous buffer of the same ID.
+*/
+void index_async(id_file_t* out, const uint8_t* data, size_t len) {
+    const uint8_t* end = data + len;
+    const uint8_t* p = data;
+    const uint8_t* q;
+    uint64_t at;
+    size_t z;
+
+    while ((q = memchr(p, 0x80, end - p)) != NULL) {
+        for(z=0; z<ASYNC_ZEROS && q - z > data && q[-z - 1] == 0; z++);
+        if (q - z == data)
+            z += out->zeros;
+        if (z >= ASYNC_ZEROS) {
+            at = out->offset + (q - data) - ASYNC_ZEROS;
+            fwrite(&at, sizeof(at), 1, out->idx);
+        }
+        p = q + 1;
+    }
+
+    for(z=0; z<len && data[len - z - 1] == 0; z++);
+    out->zeros = (z == len) ? out->zeros + len : z;
+}
+
 /* 
-    The ID starts from 1 to 4. Thus when indexing, the position is id-1.
+    The ID starts from 1 to 4. Thus the file of ID id is trc_<id-1>.
     The first ETM ID is 1 instead of 0, since potentially, the ID 0 might be reserved 
 */
-FILE* id2file(FILE** fps, int id) {
-    return fps[id - 1]; 
+static id_file_t* files[FRAME_IDS];
+static int with_index = 0;
+static int compress = 0;
+// the STM trace ID with -s, decoded as it is written
+static int stm_id = 0;
+static stm_decoder_t stm;
+
+id_file_t* open_id_file(int id) {
+    char sep_fname[32];
+    id_file_t* out;
+
+    if (files[id])
+        return files[id];
+
+    out = (id_file_t*) calloc(1, sizeof(id_file_t));
+    sprintf(sep_fname, "trc_%u.dat", id - 1);
+    out->fp = fopen(sep_fname, "wb");
+    if (out->fp == NULL) {
+        perror(sep_fname);
+        exit(1);
+    }
+    if (with_index) {
+        sprintf(sep_fname, "trc_%u.idx", id - 1);
+        out->idx = fopen(sep_fname, "wb");
+        if (out->idx == NULL) {
+            perror(sep_fname);
+            exit(1);
+        }
+    }
+    if (compress)
+        out->archive = archive_out_open(fileno(out->fp), ARCHIVE_ALIGN_ASYNC);
+    files[id] = out;
+    return out;
 }
 
-/* 
-    frame_buf is 16 bytes long. Only the entire 16bytes are recevied, the deformatting can start meaningfully.
-    the cur_id is consistent with ETM ID. 
+// flush callback of the deformatter, the files of IDs seen only with -a are opened here
+void write_id(void* ctx, int id, const uint8_t* data, size_t len) {
+    id_file_t* out = open_id_file(id);
+    (void) ctx;
+
+    if (out->archive)
+        archive_out_write(out->archive, data, len);
+    else if (fwrite(data, 1, len, out->fp) != len) {
+        perror("fwrite");
+        exit(1);
+    }
+    if (out->idx)
+        index_async(out, data, len);
+    if (id == stm_id)
+        stm_decode(&stm, data, len);
+    out->offset += len;
+}
+
+static const uint8_t* par_buf;
+static int par_ids;
+static int par_all;
+static chunk_t* chunks;
+static size_t n_chunks, next_chunk, written_chunks, window;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t chunk_cond = PTHREAD_COND_INITIALIZER;
+
+void append_chunk(void* ctx, int id, const uint8_t* data, size_t len) {
+    chunk_t* c = (chunk_t*) ctx;
+    int slot = (id == FRAME_ID_UNKNOWN) ? FRAME_IDS : id;
+
+    if (c->len[slot] + len > c->cap[slot]) {
+        c->cap[slot] = (c->len[slot] + len) * 2;
+        c->data[slot] = (uint8_t*) realloc(c->data[slot], c->cap[slot]);
+        if (c->data[slot] == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(c->data[slot] + c->len[slot], data, len);
+    c->len[slot] += len;
+}
+
+void* chunk_worker(void* arg) {
+    deformatter_t d;
+    chunk_t* c;
+    int id;
+    (void) arg;
+
+    while (1) {
+        pthread_mutex_lock(&chunk_lock);
+        while (next_chunk < n_chunks && next_chunk >= written_chunks + window)
+            pthread_cond_wait(&chunk_cond, &chunk_lock);
+        if (next_chunk >= n_chunks) {
+            pthread_mutex_unlock(&chunk_lock);
+            break;
+        }
+        c = &chunks[next_chunk++];
+        pthread_mutex_unlock(&chunk_lock);
+
+        deformat_init(&d, CHUNK_OUT_SIZE, append_chunk, c);
+        for(id=1; id<=par_ids; id++) {
+            deformat_keep_id(&d, id);
+        }
+        if (stm_id)
+            deformat_keep_id(&d, stm_id);
+        d.keep_all = par_all;
+        d.keep_unknown = 1;
+        deformat_stream(&d, par_buf + c->start, c->end - c->start);
+        deformat_flush(&d);
+        c->final_id = d.cur_id;
+        c->dropped = d.dropped;
+        c->padding = d.padding;
+        c->padding_frames = d.padding_frames;
+        c->fsyncs = d.fsyncs;
+        deformat_free(&d);
+
+        pthread_mutex_lock(&chunk_lock);
+        c->done = 1;
+        pthread_cond_broadcast(&chunk_cond);
+        pthread_mutex_unlock(&chunk_lock);
+    }
+
+    return NULL;
+}
+
+/*
+    Chunks are about CHUNK_FRAMES frames long. In continuous mode they are
+    cut at the next FSYNC packet, as frames do not have to start at a
+    multiple of FRAME_SIZE, otherwise at a frame-aligned offset.
+*/
+void split_chunks(size_t begin, size_t size, int continuous) {
+    size_t chunk_bytes = (size_t) CHUNK_FRAMES * FRAME_SIZE;
+    size_t pos = begin, next;
+
+    n_chunks = 0;
+    chunks = (chunk_t*) calloc((size - begin) / chunk_bytes + 1, sizeof(chunk_t));
+    while (pos < size) {
+        next = pos + chunk_bytes;
+        if (next >= size)
+            next = size;
+        else if (continuous)
+            next += frame_find_sync(par_buf + next, size - next);
+        chunks[n_chunks].start = pos;
+        chunks[n_chunks].end = next;
+        n_chunks++;
+        pos = next;
+    }
+}
+
+/*
+    Chunks are written in input order: the leading bytes of each go to the
+    ID the chunks before it ended with (total->cur_id on entry), so the files
+    come out as the serial deformatter writes them.
 */
-void proc_frame(FILE** fps, uint8_t* frame_buf, int* cur_id) {
+void deformat_parallel(const uint8_t* buf, size_t begin, size_t size, int n_mp, int keep_all, int continuous,
+                       int threads, deformatter_t* total) {
+    pthread_t* workers = (pthread_t*) malloc(sizeof(pthread_t) * threads);
+    int cur_id = total->cur_id;
+    size_t k;
     int i;
-    char aux = frame_buf[15];
-    for(i=0; i<8; i++) {
-        if ( (frame_buf[i*2] & 0x1) && (aux & (0x1 << i)) ) {
-            // new ID and the next byte corresponding to the old ID
-            if(i==7) {
-                printf("auxiliary fault!\n");
-                exit(0);
-            }
-            fwrite(&frame_buf[i*2 + 1], sizeof(uint8_t), 1, id2file(fps, *cur_id));
-            *cur_id = (frame_buf[i*2] & 0xfe) >> 1; 
-        } else if ( (frame_buf[i*2] & 0x1) && !(aux & (0x1 << i)) ) {
-            // new ID and the next byte corresponding to the new ID
-            *cur_id = (frame_buf[i*2] & 0xfe) >> 1;
-            if(i != 7) {
-                fwrite(&frame_buf[i*2 + 1], sizeof(uint8_t), 1, id2file(fps, *cur_id));
-            }
-        } else {
-            // Data byte
-            char dat = (frame_buf[i*2] & 0xfe) | ((aux & (0x1 << i)) >> i);
-            FILE* tar_fp = id2file(fps, *cur_id);
-            fwrite(&dat, sizeof(uint8_t), 1, tar_fp);
-            if(i != 7) {
-                fwrite(&frame_buf[i*2 + 1], sizeof(uint8_t), 1, tar_fp); 
+
+    par_buf = buf;
+    par_ids = n_mp;
+    par_all = keep_all;
+    split_chunks(begin, size, continuous);
+    next_chunk = 0;
+    written_chunks = 0;
+    // bounds the memory held by chunks waiting to be written
+    window = 2 * threads;
+
+    for(i=0; i<threads; i++) {
+        pthread_create(&workers[i], NULL, chunk_worker, NULL);
+    }
+
+    for(k=0; k<n_chunks; k++) {
+        chunk_t* c = &chunks[k];
+
+        pthread_mutex_lock(&chunk_lock);
+        while (!c->done)
+            pthread_cond_wait(&chunk_cond, &chunk_lock);
+        pthread_mutex_unlock(&chunk_lock);
+
+        if (c->len[FRAME_IDS]) {
+            if (cur_id != FRAME_ID_UNKNOWN && (files[cur_id] || (keep_all && cur_id != FRAME_ID_NULL && cur_id <= FRAME_ID_MAX)))
+                write_id(NULL, cur_id, c->data[FRAME_IDS], c->len[FRAME_IDS]);
+            else if (cur_id != FRAME_ID_UNKNOWN && (cur_id == FRAME_ID_NULL || cur_id > FRAME_ID_MAX))
+                total->padding += c->len[FRAME_IDS];
+            else
+                total->dropped += c->len[FRAME_IDS];
+        }
+        for(i=0; i<FRAME_IDS; i++) {
+            if (c->len[i])
+                write_id(NULL, i, c->data[i], c->len[i]);
+        }
+        if (c->final_id != FRAME_ID_UNKNOWN)
+            cur_id = c->final_id;
+        total->dropped += c->dropped;
+        total->padding += c->padding;
+        total->padding_frames += c->padding_frames;
+        total->fsyncs += c->fsyncs;
+
+        for(i=0; i<=FRAME_IDS; i++) {
+            free(c->data[i]);
+        }
+
+        pthread_mutex_lock(&chunk_lock);
+        written_chunks++;
+        pthread_cond_broadcast(&chunk_cond);
+        pthread_mutex_unlock(&chunk_lock);
+    }
+
+    for(i=0; i<threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(chunks);
+    total->cur_id = cur_id;
+}
+
+// a part of the input, a wrapped ring is read as two
+typedef struct segment {
+    size_t start;
+    size_t end;
+} segment_t;
+
+/*
+    Reads the "size", "rwp" and "full" lines of a ring file and returns the
+    segments of the input in trace order: from the write pointer to the end
+    and then from the start when the buffer wrapped, else up to the pointer.
+*/
+int ring_segments(const char* ring_name, size_t size, segment_t* segs) {
+    FILE* fp = fopen(ring_name, "r");
+    unsigned int ring_size = 0, rwp = 0, full = 0;
+    char key[16];
+    unsigned int value;
+
+    if (fp == NULL) {
+        perror(ring_name);
+        exit(1);
+    }
+    while (fscanf(fp, "%15s %i", key, &value) == 2) {
+        if (!strcmp(key, "size"))
+            ring_size = value;
+        else if (!strcmp(key, "rwp"))
+            rwp = value;
+        else if (!strcmp(key, "full"))
+            full = value;
+    }
+    fclose(fp);
+
+    if (rwp > size || (full && ring_size != size)) {
+        printf("%s does not match the input, %zu bytes\n", ring_name, size);
+        exit(1);
+    }
+
+    segs[0].start = 0;
+    segs[0].end = rwp;
+    if (!full || rwp == 0 || rwp == size) {
+        if (full)
+            segs[0].end = size;
+        return 1;
+    }
+    segs[0].start = rwp;
+    segs[0].end = size;
+    segs[1].start = 0;
+    segs[1].end = rwp;
+    printf("Ring wrapped, starting at 0x%x\n", rwp);
+    return 2;
+}
+
+/*
+    Deformats the segments one after the other. A frame split between the
+    end of one and the start of the next is put together in carry.
+*/
+void deformat_segments(deformatter_t* d, const uint8_t* buf, const segment_t* segs, int n_segs) {
+    uint8_t carry[2 * FRAME_SIZE];
+    size_t carry_len = 0, pos, n, used;
+    int i;
+
+    for(i=0; i<n_segs; i++) {
+        pos = segs[i].start;
+        if (carry_len) {
+            n = segs[i].end - pos;
+            if (n > sizeof(carry) - carry_len)
+                n = sizeof(carry) - carry_len;
+            memcpy(carry + carry_len, buf + pos, n);
+            used = deformat_stream(d, carry, carry_len + n);
+            if (used < carry_len) {
+                // a segment shorter than the rest of the frame
+                memmove(carry, carry + used, carry_len + n - used);
+                carry_len += n - used;
+                continue;
             }
+            pos += used - carry_len;
         }
+        used = deformat_stream(d, buf + pos, segs[i].end - pos);
+        pos += used;
+        carry_len = segs[i].end - pos;
+        memcpy(carry, buf + pos, carry_len);
     }
+    // a trailing partial frame is ignored, as with fread
 }
 
 void dat2out(char* ifname, char* ofname) {
@@ -79,45 +428,188 @@ void dat2out(char* ifname, char* ofname) {
 }
 
 
-// requires two positional arguments: the number of active ETMs and the input file name
 int main(int argc, char *argv[]) {
+    int binary_only = 0, keep_all = 0, continuous = 0, threads = 0;
+    int opt;
 
-    if (argc != 3) {
-        printf("Usage %s <number of active ETMs> <input file name>\n", argv[0]);
+    const char* ring_name = NULL;
+
+    while ((opt = getopt(argc, argv, "biaczj:r:s:")) != -1) {
+        if (opt == 'b')
+            binary_only = 1;
+        else if (opt == 'i')
+            with_index = 1;
+        else if (opt == 'a')
+            keep_all = 1;
+        else if (opt == 'c')
+            continuous = 1;
+        else if (opt == 'z')
+            compress = binary_only = 1;
+        else if (opt == 'j' && (threads = strtol(optarg, NULL, 0)) > 0)
+            continue;
+        else if (opt == 'r')
+            ring_name = optarg;
+        else if (opt == 's' && (stm_id = strtol(optarg, NULL, 0)) > 0)
+            continue;
+        else
+            usage(argv[0]);
+    }
+
+    if (argc - optind != 2)
+        usage(argv[0]);
+
+    uint8_t n_mp = strtol(argv[optind], NULL, 0);
+    char* fname = argv[optind + 1];
+
+    int fd = open(fname, O_RDONLY);
+    struct stat in_stat;
+    const uint8_t* in_buf;
+    deformatter_t d;
+    size_t size, begin, total_bytes = 0;
+    segment_t segs[2];
+    int n_segs = 1;
+    struct timespec t_start, t_end;
+    double secs;
+
+    if (fd < 0 || fstat(fd, &in_stat) < 0) {
+        perror(fname);
         exit(1);
     }
+    size = in_stat.st_size;
+    in_buf = NULL;
+    if (size) {
+        in_buf = (const uint8_t*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in_buf == MAP_FAILED) {
+            perror(fname);
+            exit(1);
+        }
+        madvise((void*) in_buf, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
 
-    uint8_t n_mp = strtol(argv[1], NULL, 0);
-    char* fname = argv[2];
+    // a compressed trace.dat is unpacked first, the ring file refers to the plain bytes
+    uint8_t* unpacked = NULL;
+    if (archive_is(in_buf, size)) {
+        size_t raw_size;
+        unpacked = archive_unpack(in_buf, size, &raw_size);
+        if (unpacked == NULL) {
+            printf("%s: corrupt archive\n", fname);
+            exit(1);
+        }
+        munmap((void*) in_buf, size);
+        in_buf = unpacked;
+        size = raw_size;
+        printf("Unpacked %s, %zu bytes\n", fname, size);
+    }
 
-    uint8_t frame_buf[16];
-    FILE* fp = fopen(fname, "rb");
-    int status;
-    int cur_id = -1;
+    if (n_mp > FRAME_ID_MAX) {
+        printf("At most %d ETMs, trace IDs above are reserved\n", FRAME_ID_MAX);
+        exit(1);
+    }
 
     // parse_args(argc, argv, &n_mp);
-    FILE** fps = (FILE**) malloc(sizeof(FILE*) * n_mp);
     int i;
-    for(i=0; i<n_mp; i++) {
-        char sep_fname[32];
-        sprintf(sep_fname, "trc_%u.dat", i);
-        fps[i] = fopen(sep_fname, "wb");
+    for(i=1; i<=n_mp; i++) {
+        open_id_file(i);
+    }
+    FILE* stm_out = NULL;
+    if (stm_id) {
+        char stm_fname[32];
+        if (stm_id <= n_mp || stm_id > FRAME_ID_MAX) {
+            printf("STM trace ID %d is an ETM ID or reserved\n", stm_id);
+            exit(1);
+        }
+        open_id_file(stm_id);
+        sprintf(stm_fname, "trc_%u.stm", stm_id - 1);
+        stm_out = fopen(stm_fname, "w");
+        if (stm_out == NULL) {
+            perror(stm_fname);
+            exit(1);
+        }
+        fprintf(stm_out, "# timestamp master channel packet data\n");
+        stm_init(&stm, stm_out);
     }
 
-    while(1) {
-        status = fread(frame_buf, sizeof(frame_buf), 1, fp);
-        if (status != 1) {
-            break;
+    segs[0].start = 0;
+    segs[0].end = size;
+    if (ring_name)
+        n_segs = ring_segments(ring_name, size, segs);
+
+    if (continuous) {
+        begin = segs[0].start + frame_find_sync(in_buf + segs[0].start, segs[0].end - segs[0].start);
+        if (begin == segs[0].end && n_segs == 2) {
+            // no FSYNC before the wrap point
+            segs[0] = segs[1];
+            n_segs = 1;
+            begin = frame_find_sync(in_buf, segs[0].end);
+        }
+        if (begin == segs[0].end)
+            printf("No FSYNC packet found\n");
+        else if (begin != segs[0].start)
+            printf("Skipped %zu bytes before the first FSYNC packet\n", begin - segs[0].start);
+        segs[0].start = begin;
+    }
+    for(i=0; i<n_segs; i++) {
+        total_bytes += segs[i].end - segs[i].start;
+    }
+
+    // chunks of a wrapped ring must not share a frame across the wrap point
+    if (threads && n_segs == 2 && (segs[0].end - segs[0].start) % FRAME_SIZE) {
+        printf("The ring does not wrap at a frame boundary, deformatting on one thread\n");
+        threads = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    deformat_init(&d, OUT_BUF_SIZE, write_id, NULL);
+    if (threads) {
+        for(i=0; i<n_segs; i++) {
+            deformat_parallel(in_buf, segs[i].start, segs[i].end, n_mp, keep_all, continuous, threads, &d);
         }
-        proc_frame(fps, frame_buf, &cur_id);
+    } else {
+        for(i=1; i<=n_mp; i++) {
+            deformat_keep_id(&d, i);
+        }
+        if (stm_id)
+            deformat_keep_id(&d, stm_id);
+        d.keep_all = keep_all;
+        deformat_segments(&d, in_buf, segs, n_segs);
+        deformat_flush(&d);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    if (unpacked)
+        free(unpacked);
+    else if (size)
+        munmap((void*) in_buf, size);
+
+    secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    printf("Deformatted %zu bytes in %.3f s, %.1f MB/s\n", total_bytes, secs,
+           secs > 0 ? total_bytes / secs / 1e6 : 0.0);
+    if (d.padding_frames || d.fsyncs)
+        printf("%lu padding frames and %lu FSYNC packets skipped\n", d.padding_frames, d.fsyncs);
+    if (d.dropped)
+        printf("%zu bytes dropped, their ID has no output file\n", d.dropped);
+    deformat_free(&d);
+    if (stm_out) {
+        printf("STM, trace ID %d: ", stm_id);
+        stm_report(&stm, stdout);
+        fclose(stm_out);
     }
 
-    for(i=0; i<n_mp; i++) {
-        fclose(fps[i]);
+    for(i=0; i<FRAME_IDS; i++) {
+        if (files[i] == NULL)
+            continue;
+        if (files[i]->archive)
+            archive_out_close(files[i]->archive);
+        fclose(files[i]->fp);
+        if (files[i]->idx)
+            fclose(files[i]->idx);
+        free(files[i]);
+        if (binary_only)
+            continue;
         char ifname[32];
         char ofname[32];
-        sprintf(ifname, "trc_%u.dat", i);
-        sprintf(ofname, "trc_%u.out", i);
+        sprintf(ifname, "trc_%u.dat", i - 1);
+        sprintf(ofname, "trc_%u.out", i - 1);
         dat2out(ifname, ofname);
     }
 
@@ -1,5 +1,6 @@
 from tools import derive_end_point
 import struct
+from tmg_format import tmg_wrap, tmg_unwrap, TMG_KIND_MSG
 import networkx as nx
 import pygraphviz as pgv
 
@@ -38,8 +39,9 @@ def binarize(msg, routine_name=None):
     core(ms_entry, None)
 
     ofile = f'{routine_name}.bin' if routine_name else 'msg.bin'
+    n_nodes = sum(1 for n in msg.nodes if msg.nodes[n]['mapped'])
     with open(ofile, 'wb') as f:
-        f.write(br)
+        f.write(tmg_wrap(br, TMG_KIND_MSG, n_nodes))
 
 def pad_br(br, n_bytes):
     for _ in range(n_bytes):
@@ -87,7 +89,7 @@ def reduced_visualize(g, fname='reduced.dot'):
 
 def bin2msg(fname):
     with open(fname, 'rb') as f:
-        data = f.read()
+        _, data = tmg_unwrap(f.read())
     iter = struct.iter_unpack('<I', data)
     data = list(item[0] for item in iter)
     
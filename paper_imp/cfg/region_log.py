@@ -0,0 +1,90 @@
+import argparse
+import struct
+
+# Region logs of tracee/include/region_log.h:
+#   header   magic 'RLOG', version, threads, names, overhead cycles, timer Hz, timestamp generator Hz, reserved
+#   names    region id, 28-byte name
+#   threads  tid, entries, dropped, reserved, 2 sync points (cycles, timer, timestamp), then the entries
+#   entry    cycles, region id, flags (1 enter, 2 exit)
+# The sync points map a thread's cycles onto the ETM timestamp base, or the generic timer without it.
+RLOG_MAGIC = 0x474f4c52
+RLOG_VERSION = 1
+RLOG_HEADER = '<8I'
+RLOG_NAME = '<I28s'
+RLOG_THREAD = '<4I6Q'
+RLOG_ENTRY = '<QII'
+RLOG_ENTER = 0x1
+RLOG_EXIT = 0x2
+
+def rlog_read(path):
+    """(header dict, {region: name}, [thread dict]) of a region log"""
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic, version, n_threads, n_names, overhead, timer_freq, tsgen_freq, _ = struct.unpack_from(RLOG_HEADER, data)
+    if magic != RLOG_MAGIC or version != RLOG_VERSION:
+        raise ValueError(f'{path} is not a region log')
+    header = {'overhead': overhead, 'timer_freq': timer_freq, 'tsgen_freq': tsgen_freq}
+    pos = struct.calcsize(RLOG_HEADER)
+    names = {}
+    for _ in range(n_names):
+        region, name = struct.unpack_from(RLOG_NAME, data, pos)
+        names[region] = name.split(b'\0')[0].decode()
+        pos += struct.calcsize(RLOG_NAME)
+    threads = []
+    for _ in range(n_threads):
+        tid, n_entries, dropped, _, c0, t0, s0, c1, t1, s1 = struct.unpack_from(RLOG_THREAD, data, pos)
+        pos += struct.calcsize(RLOG_THREAD)
+        entries = list(struct.iter_unpack(RLOG_ENTRY, data[pos:pos + n_entries * struct.calcsize(RLOG_ENTRY)]))
+        pos += n_entries * struct.calcsize(RLOG_ENTRY)
+        threads.append({'tid': tid, 'dropped': dropped, 'sync': [(c0, t0, s0), (c1, t1, s1)], 'entries': entries})
+    return header, names, threads
+
+def rlog_clock(header, thread, base='tsgen'):
+    """cycles -> ticks of base ('tsgen', the ETM timestamps, or 'timer') and its Hz, a line through the sync points"""
+    (c0, t0, s0), (c1, t1, s1) = thread['sync']
+    if base == 'tsgen' and s0 and s1 and header['tsgen_freq']:
+        x0, x1, freq = s0, s1, header['tsgen_freq']
+    else:
+        x0, x1, freq = t0, t1, header['timer_freq']
+    if c1 == c0:
+        raise ValueError(f'thread {thread["tid"]} has no end sync point, call rlog_thread_done()')
+    scale = (x1 - x0) / (c1 - c0)
+    return (lambda c: x0 + (c - c0) * scale), freq
+
+def rlog_regions(header, thread):
+    """(region, enter cycles, exit cycles, cycles less the overhead) of every closed region, nested ones too"""
+    regions, stack = [], []
+    for cycles, region, flags in thread['entries']:
+        if flags == RLOG_ENTER:
+            stack.append((region, cycles))
+        elif stack and stack[-1][0] == region:
+            _, enter = stack.pop()
+            regions.append((region, enter, cycles, max(cycles - enter - header['overhead'], 0)))
+    return regions
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Region times of a tracee region log')
+    parser.add_argument('log', help='the file of rlog_dump()')
+    parser.add_argument('--base', choices=['tsgen', 'timer'], default='tsgen', help='time base of the output')
+    parser.add_argument('--csv', help='one line per region: tid, region, name, enter and exit ticks, ns')
+    args = parser.parse_args()
+
+    header, names, threads = rlog_read(args.log)
+    print(f'{len(threads)} threads, overhead {header["overhead"]} cycles')
+    out = open(args.csv, 'w') if args.csv else None
+    if out:
+        out.write('tid,region,name,enter,exit,ns\n')
+    for thread in threads:
+        clock, freq = rlog_clock(header, thread, args.base)
+        per_region = {}
+        for region, enter, exit_, cycles in rlog_regions(header, thread):
+            ns = cycles * (clock(1) - clock(0)) / freq * 1e9
+            per_region.setdefault(region, []).append(ns)
+            if out:
+                out.write(f'{thread["tid"]},{region},{names.get(region, "")},{clock(enter):.0f},{clock(exit_):.0f},{ns:.0f}\n')
+        print(f'thread {thread["tid"]}: {len(thread["entries"])} entries, {thread["dropped"]} dropped')
+        for region, times in sorted(per_region.items()):
+            print(f'  {names.get(region, region)}: {len(times)} x, mean {sum(times) / len(times) / 1e3:.3f} us, '
+                  f'min {min(times) / 1e3:.3f} us, max {max(times) / 1e3:.3f} us')
+    if out:
+        out.close()
@@ -0,0 +1,74 @@
+import sys
+import struct
+from tmg_format import tmg_wrap, tmg_unwrap, TMG_KIND_CTMG, TMG_KIND_TTMSG
+
+# Compiled TMG, read by graph_load() of the R5 tracer (tracer/src/etm.c), in a tmg_format.py file:
+#   header      magic 'CTMG', version, number of nodes, entry node
+#   node_addr   one word per node
+#   succ_first  one word per node, its first record
+#   succ_count  one word per node
+#   succ        from the next 16 byte boundary, the records of each node in turn:
+#               successor address, nominal_t of the edge, tail_t of the successor, successor index
+# A hit then costs one run of records, the relay is the records of the next node.
+CTMG_MAGIC = 0x474d5443
+CTMG_VERSION = 2
+RELAY_MAX_SUCC = 16  # successors the tracer follows, see schedule_comparators()
+END = 0xffffffff
+
+def parse_ttmsg(data):
+    """Nodes of a binarize_relative_tail() graph, in file order: (offset, addr, tail_t, [(succ offset, nominal_t)])"""
+    words = list(w[0] for w in struct.iter_unpack('<I', data))
+    nodes = []
+    i = 0
+    while i < len(words):
+        offset, addr, tail_t = i * 4, words[i], words[i + 1]
+        i += 2
+        succs = []
+        while words[i] != END:
+            succs.append((words[i], words[i + 1]))
+            i += 2
+        i += 1
+        nodes.append((offset, addr, tail_t, succs))
+    return nodes
+
+def compile_tmg(nodes):
+    index = {n[0]: k for k, n in enumerate(nodes)}
+    by_offset = {n[0]: n for n in nodes}
+
+    first = []
+    n_records = 0
+    for _, addr, _, succs in nodes:
+        if len(succs) > RELAY_MAX_SUCC:
+            print(f'warning: node 0x{addr:x} has {len(succs)} successors, the tracer follows the first {RELAY_MAX_SUCC}',
+                  file=sys.stderr)
+        first.append(n_records)
+        n_records += len(succs)
+
+    br = bytearray()
+    br += struct.pack('<IIII', CTMG_MAGIC, CTMG_VERSION, len(nodes), 0)
+    br += struct.pack(f'<{len(nodes)}I', *(n[1] for n in nodes))
+    br += struct.pack(f'<{len(nodes)}I', *first)
+    br += struct.pack(f'<{len(nodes)}I', *(len(n[3]) for n in nodes))
+    while len(br) % 16:
+        br += struct.pack('<I', 0)
+
+    for _, _, _, succs in nodes:
+        for succ_offset, nominal_t in succs:
+            succ = by_offset[succ_offset]
+            br += struct.pack('<IIII', succ[1], nominal_t, succ[2], index[succ_offset])
+    return br
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print(f'usage: {sys.argv[0]} graph.ttmsg graph.ctmg', file=sys.stderr)
+        sys.exit(1)
+    with open(sys.argv[1], 'rb') as f:
+        kind, payload = tmg_unwrap(f.read())
+    if kind not in (None, TMG_KIND_TTMSG):
+        print(f'{sys.argv[1]} is not a .ttmsg graph', file=sys.stderr)
+        sys.exit(1)
+    nodes = parse_ttmsg(payload)
+    br = compile_tmg(nodes)
+    with open(sys.argv[2], 'wb') as f:
+        f.write(tmg_wrap(br, TMG_KIND_CTMG, len(nodes)))
+    print(f'{len(nodes)} nodes, {len(br)} bytes')
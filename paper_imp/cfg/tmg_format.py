@@ -0,0 +1,44 @@
+import struct
+
+# Container of the binary milestone graphs, read by tracee/src/tmg.c:
+#   header   magic 'TMGF', version, kind, number of nodes, payload words, checksum, 2 reserved words
+#   payload  the graph as the R5 tracer reads it, handed off without the header
+# Files without the header are still loaded, as raw payloads.
+TMG_MAGIC = 0x46474d54
+TMG_VERSION = 1
+TMG_KIND_MSG = 0    # binarize(): address, successor offsets, terminator
+TMG_KIND_TTMSG = 1  # binarize_relative_tail(): address, tail_t, (offset, nominal_t) pairs, terminator
+TMG_KIND_CTMG = 2   # tmg_compile.py
+TMG_KIND_BBC = 3    # ctrace -G: basic block and edge run counts, not for the R5
+TMG_HEADER = '<8I'
+
+def tmg_checksum(payload):
+    """Rotate-xor of the payload words, as tmg_checksum() of the tracee and the R5"""
+    c = 0
+    for (w,) in struct.iter_unpack('<I', payload):
+        c = (((c << 1) | (c >> 31)) & 0xffffffff) ^ w
+    return c
+
+def tmg_wrap(payload, kind, n_nodes):
+    return struct.pack(TMG_HEADER, TMG_MAGIC, TMG_VERSION, kind, n_nodes, len(payload) // 4,
+                       tmg_checksum(payload), 0, 0) + bytes(payload)
+
+def tmg_unwrap(data):
+    """(kind, payload) of a file, kind None for a raw payload"""
+    if len(data) < struct.calcsize(TMG_HEADER) or struct.unpack_from('<I', data)[0] != TMG_MAGIC:
+        return None, data
+    magic, version, kind, n_nodes, n_words, checksum, _, _ = struct.unpack_from(TMG_HEADER, data)
+    payload = data[struct.calcsize(TMG_HEADER):]
+    if version != TMG_VERSION or n_words * 4 != len(payload) or tmg_checksum(payload) != checksum:
+        raise ValueError('corrupt TMG file')
+    return kind, payload
+
+def bbc_read(payload):
+    """({id: (start, instructions, count)}, {(from, to): count}) of a ctrace -G payload"""
+    n_blocks, n_edges = struct.unpack_from('<2I', payload)
+    blocks, edges = {}, {}
+    for i, (lo, hi, length, clo, chi) in enumerate(struct.iter_unpack('<5I', payload[8:8 + n_blocks * 20])):
+        blocks[i] = (lo | hi << 32, length, clo | chi << 32)
+    for src, dst, clo, chi in struct.iter_unpack('<4I', payload[8 + n_blocks * 20:]):
+        edges[(src, dst)] = clo | chi << 32
+    return blocks, edges
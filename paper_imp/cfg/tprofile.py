@@ -3,6 +3,7 @@ import networkx as nx
 import struct
 from msg_binarize import bin2msg, reduced_visualize, pad_br
 from tools import derive_end_point
+from tmg_format import tmg_wrap, TMG_KIND_TTMSG
 
 def preprocess(fname):
     with open(fname, 'r') as f:
@@ -105,8 +106,9 @@ def binarize_relative_tail(msg, output_name=None):
         
     core(ms_entry, None, None)
 
+    n_nodes = sum(1 for n in msg.nodes if msg.nodes[n]['mapped'])
     with open(output_name, 'wb') as f:
-        f.write(br)
+        f.write(tmg_wrap(br, TMG_KIND_TTMSG, n_nodes))
 
 def binarize_relative(msg, output_name=None):
     ms_entry, _ = derive_end_point(msg)
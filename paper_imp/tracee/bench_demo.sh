@@ -0,0 +1,32 @@
+#!/bin/bash
+# ./bench over the demo applications, each with its timed graph for the tpa path.
+# Usage: ./bench_demo.sh [-n runs] [-p paths] [-a app_arg] [-d ctrace] [-o results.csv] [app ...]
+# The bench options go to every application, the results append to one CSV.
+
+cd "$(dirname "$0")"
+DEMO=../demo
+runs=10
+paths=
+arg=
+ctrace=
+csv=bench_demo.csv
+
+while getopts "n:p:a:d:o:" opt; do
+    case $opt in
+    n) runs=$OPTARG ;;
+    p) paths=$OPTARG ;;
+    a) arg=$OPTARG ;;
+    d) ctrace=$OPTARG ;;
+    o) csv=$OPTARG ;;
+    *) echo "Usage: $0 [-n runs] [-p paths] [-a app_arg] [-d ctrace] [-o results.csv] [app ...]"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+apps=${*:-"disparity mser sift tracking texture_synthesis"}
+
+[ -x ./bench ] || make bench || exit 1
+for app in $apps; do
+    graph=$DEMO/milestone_graphs/tmg/${app%_synthesis}.ttmsg
+    echo "=== $app"
+    ./bench -n "$runs" -o "$csv" -g "$graph" ${paths:+-p "$paths"} ${arg:+-a "$arg"} ${ctrace:+-d "$ctrace"} "$DEMO/application/$app"
+done
@@ -2,8 +2,11 @@
 #define ARGPARSE_H_
 
 #include <stdint.h>
+#include "session.h"
 enum ms_t { SEQUENCE, GRAPH };
-void parse_args(int argc, char *argv[], char *app, char **app_farg, char *milestone_path, ms_t* ms_mode, uint64_t* start_addr, uint64_t* end_addr);
+// -A alpha -B beta -T t_end -S throttle span -P budget period set the R5 session parameters, when r5 is given
+void parse_args(int argc, char *argv[], char *app, char **app_farg, char *milestone_path, ms_t* ms_mode, uint64_t* start_addr, uint64_t* end_addr,
+                r5_session_params_t* r5 = NULL);
 void parse_args_mp(int argc, char *argv[], char *app, char **app_farg, 
                     char *milestone_path, ms_t* ms_mode, uint64_t* start_addr, uint64_t* end_addr,
                     uint64_t* range_u, uint64_t* range_l, uint8_t* n_mp);
@@ -114,6 +114,14 @@ static inline void arm_perf_int_ack(unsigned int mask)
 	__asm__ volatile ("msr PMOVSCLR_EL0, %0" : : "r"(mask) : "memory");
 }
 
+/** Get USEREN (User Enable) Register, readable from EL0 */
+static inline unsigned int arm_perf_get_useren(void)
+{
+	unsigned int val;
+	__asm__ volatile ("mrs %0, PMUSERENR_EL0" : "=r"(val));
+	return val;
+}
+
 /** Set USEREN (User Enable) Register */
 static inline void arm_perf_set_useren(unsigned int val)
 {
@@ -136,6 +144,14 @@ static inline void arm_perf_int_mask(unsigned int mask)
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/** Performance Monitors Cycle Count Register */
+static inline unsigned long arm_perf_cycles(void)
+{
+	unsigned long val;
+	__asm__ volatile ("mrs %0, PMCCNTR_EL0" : "=r"(val));
+	return val;
+}
+
 /** Performance Monitors Event Count Register 0 */
 static inline unsigned int arm_perf_counter0(void)
 {
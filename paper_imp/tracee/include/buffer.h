@@ -5,7 +5,14 @@
 
 uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size);
 void clear_buffer(uint64_t buf_addr, uint32_t buf_size);
-void dump_buffer(uint64_t buf_addr, uint32_t buf_size);
+void dump_text(const char *dat_name, const char *out_name);
+void dump_buffer(uint64_t buf_addr, uint32_t buf_size, int text);
+void dump_buffer_ring(uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full);
+
+// where the R5 tracer reads the milestones
+#define MS_OCM_BASE 0xfffc0000
+void write_milestones(const uint32_t *ms, uint32_t ms_size);
+void write_milestones_tagged(const uint32_t *ms, uint32_t ms_size, uint32_t tag);
 
 
 #endif
\ No newline at end of file
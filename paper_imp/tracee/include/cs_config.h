@@ -1,8 +1,14 @@
 #ifndef CS_CONFIG_H
 #define CS_CONFIG_H
 
+#include "cs_soc.h"
+
 void cs_config_etr(uint64_t buf_addr, uint32_t buf_size);
 void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size);
+void cs_config_softfifo(void);
+void cs_config_sram(void);
+void cs_stop_tmc(TMC_interface *tmc, uint64_t *rwp, int *full);
+int cs_etf_held(void);
 void config_etm(void);
 void config_etm_n(ETM_interface* etm_n, int stall, int id);
 void config_etm_addr_event_test(ETM_interface*, uint64_t, uint64_t, uint64_t, uint64_t);
@@ -275,6 +275,17 @@ static inline void tmc_man_flush(TMC_interface *tmc)
     tmc->formatter_flush_ctrl |= 0x1 << 6;
 }
 
+static inline uint64_t tmc_get_write_pt(TMC_interface *tmc)
+{
+    return ((uint64_t) tmc->ram_write_pt_high << 32) | tmc->ram_write_pt;
+}
+
+// STS.Full, in Circular mode: the write pointer wrapped, the oldest data is at RWP
+static inline int tmc_full(TMC_interface *tmc)
+{
+    return tmc->status & 0x1;
+}
+
 void tmc_set_mode(TMC_interface *, enum tmc_mode);
 void tmc_set_size(TMC_interface *, uint32_t);
 void tmc_set_data_buf(TMC_interface *, uint64_t);
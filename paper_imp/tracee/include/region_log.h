@@ -0,0 +1,312 @@
+#ifndef REGION_LOG_H
+#define REGION_LOG_H
+
+/*
+    Cycle-counter region log, header only. Every thread logs into its own
+    preallocated array, an enter or exit costs a PMCCNTR_EL0 read and one
+    16-byte store, nothing is allocated or written out while it runs.
+
+        rlog_thread_init(capacity);     in every thread, before its first region
+        rlog_name(id, "phase");
+        rlog_calibrate();               the cost of an empty region, subtracted by the tools
+        rlog_enter(id); ... rlog_exit(id);
+        rlog_thread_done();             in every thread but the one that dumps
+        rlog_dump("app.rlog");
+
+    EL0 needs PMUSERENR_EL0.EN, see support/enable_arm_pmu.c. A thread
+    should stay on its core: the cycle counters of the cores are not in
+    step. The sync points of a thread pair its cycle count with the generic
+    timer and with the CoreSight timestamp generator, the time base of ETM
+    timestamps, at its start and end; cfg/region_log.py maps the cycles
+    onto both.
+
+    File, little endian:
+        rlog_header_t
+        rlog_name_t[n_names]
+        per thread: rlog_thread_header_t, then rlog_entry_t[n_entries]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "zcu_cs.h"
+#if defined(__aarch64__)
+#include "arm_perf_v8.h"
+#endif
+
+#define RLOG_MAGIC          0x474f4c52  // "RLOG"
+#define RLOG_VERSION        1
+#define RLOG_MAX_THREADS    64
+#define RLOG_MAX_NAMES      256
+#define RLOG_NAME_SIZE      28
+#define RLOG_ENTER          0x1
+#define RLOG_EXIT           0x2
+#define RLOG_CALIBRATE_RUNS 1000
+
+typedef struct rlog_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_threads;
+    uint32_t n_names;
+    uint32_t overhead;      // cycles of an empty region
+    uint32_t timer_freq;    // Hz of the generic timer, CNTFRQ_EL0
+    uint32_t tsgen_freq;    // Hz of the timestamp generator, 0 when it was not readable
+    uint32_t reserved;
+} rlog_header_t;
+
+typedef struct rlog_name {
+    uint32_t region;
+    char name[RLOG_NAME_SIZE];
+} rlog_name_t;
+
+typedef struct rlog_sync {
+    uint64_t cycles;
+    uint64_t timer;         // CNTVCT_EL0
+    uint64_t tsgen;         // the timestamp generator count, 0 when it was not readable
+} rlog_sync_t;
+
+typedef struct rlog_thread_header {
+    uint32_t tid;
+    uint32_t n_entries;
+    uint32_t dropped;       // entries past the capacity
+    uint32_t reserved;
+    rlog_sync_t sync[2];    // at rlog_thread_init() and at rlog_thread_done()
+} rlog_thread_header_t;
+
+typedef struct rlog_entry {
+    uint64_t cycles;
+    uint32_t region;
+    uint32_t flags;         // RLOG_ENTER or RLOG_EXIT
+} rlog_entry_t;
+
+typedef struct rlog_thread {
+    rlog_thread_header_t head;
+    rlog_entry_t *entries;
+    uint32_t capacity;
+} rlog_thread_t;
+
+// weak, so every file of a program that includes this shares one registry
+typedef struct rlog_registry {
+    rlog_thread_t *threads[RLOG_MAX_THREADS];
+    uint32_t n_threads;
+    rlog_name_t names[RLOG_MAX_NAMES];
+    uint32_t n_names;
+    uint32_t overhead;
+    volatile uint32_t *tsgen;
+    int tsgen_mapped;
+} rlog_registry_t;
+
+rlog_registry_t rlog_registry __attribute__((weak));
+__thread rlog_thread_t *rlog_self __attribute__((weak));
+
+static inline uint64_t rlog_cycles(void)
+{
+#if defined(__aarch64__)
+    // isb: the read is not taken before the instructions of the region
+    __asm__ volatile("isb" : : : "memory");
+    return arm_perf_cycles();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+static inline uint64_t rlog_timer(void)
+{
+#if defined(__aarch64__)
+    uint64_t val;
+    __asm__ volatile("isb; mrs %0, CNTVCT_EL0" : "=r"(val) : : "memory");
+    return val;
+#else
+    return rlog_cycles();
+#endif
+}
+
+static inline uint32_t rlog_timer_freq(void)
+{
+#if defined(__aarch64__)
+    uint64_t val;
+    __asm__ volatile("mrs %0, CNTFRQ_EL0" : "=r"(val));
+    return (uint32_t) val;
+#else
+    return 1000000000;
+#endif
+}
+
+// the timestamp generator through /dev/mem, once; without it the sync points have the timer only
+static inline volatile uint32_t *rlog_tsgen(void)
+{
+    rlog_registry_t *r = &rlog_registry;
+
+    if (!r->tsgen_mapped) {
+        int fd = open("/dev/mem", O_RDONLY | O_SYNC);
+        void *p = fd < 0 ? MAP_FAILED : mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, CS_BASE + TSGEN);
+        if (fd >= 0)
+            close(fd);
+        r->tsgen = p == MAP_FAILED ? NULL : (volatile uint32_t *) p;
+        r->tsgen_mapped = 1;
+    }
+    return r->tsgen;
+}
+
+static inline void rlog_sync(rlog_sync_t *s)
+{
+    volatile uint32_t *tsgen = rlog_tsgen();
+    uint32_t hi, lo;
+
+    s->timer = rlog_timer();
+    s->cycles = rlog_cycles();
+    s->tsgen = 0;
+    if (tsgen != NULL && (tsgen[0] & 0x1)) {
+        // CNTCV, the high word read again in case the low one wrapped
+        do {
+            hi = tsgen[3];
+            lo = tsgen[2];
+        } while (tsgen[3] != hi);
+        s->tsgen = ((uint64_t) hi << 32) | lo;
+    }
+}
+
+static inline void rlog_put(uint32_t region, uint32_t flags)
+{
+    uint64_t cycles = rlog_cycles();
+    rlog_thread_t *t = rlog_self;
+
+    if (t->head.n_entries < t->capacity) {
+        rlog_entry_t *e = &t->entries[t->head.n_entries++];
+        e->cycles = cycles;
+        e->region = region;
+        e->flags = flags;
+    } else {
+        t->head.dropped++;
+    }
+}
+
+static inline void rlog_enter(uint32_t region)
+{
+    rlog_put(region, RLOG_ENTER);
+}
+
+static inline void rlog_exit(uint32_t region)
+{
+    rlog_put(region, RLOG_EXIT);
+}
+
+/*
+    The log of the calling thread, capacity entries written once so no page
+    fault lands in a region. Starts the cycle counter.
+*/
+static inline void rlog_thread_init(uint32_t capacity)
+{
+    rlog_registry_t *r = &rlog_registry;
+    rlog_thread_t *t = (rlog_thread_t *) calloc(1, sizeof(rlog_thread_t));
+    uint32_t slot = __atomic_fetch_add(&r->n_threads, 1, __ATOMIC_RELAXED);
+
+    if (slot >= RLOG_MAX_THREADS) {
+        fprintf(stderr, "ERROR: more than %d threads in the region log\n", RLOG_MAX_THREADS);
+        exit(1);
+    }
+    if (t == NULL || (t->entries = (rlog_entry_t *) malloc(sizeof(rlog_entry_t) * (size_t) capacity)) == NULL) {
+        perror("region log");
+        exit(1);
+    }
+    memset(t->entries, 0, sizeof(rlog_entry_t) * (size_t) capacity);
+    t->capacity = capacity;
+    t->head.tid = (uint32_t) syscall(SYS_gettid);
+#if defined(__aarch64__)
+    if (!(arm_perf_get_useren() & ARM_PERF_USERENR_EN)) {
+        fprintf(stderr, "ERROR: PMU not accessible from EL0, load the module of support/enable_arm_pmu.c first\n");
+        exit(1);
+    }
+    arm_perf_enable_counter(ARM_PERF_MASK_CCNT);
+    arm_perf_set_ctrl(arm_perf_get_ctrl() | ARM_PERF_PMCR_E);
+#endif
+    rlog_sync(&t->head.sync[0]);
+    t->head.sync[1] = t->head.sync[0];
+    rlog_self = t;
+    r->threads[slot] = t;
+}
+
+// the end sync point of the calling thread, its log is kept for rlog_dump()
+static inline void rlog_thread_done(void)
+{
+    rlog_sync(&rlog_self->head.sync[1]);
+}
+
+static inline void rlog_name(uint32_t region, const char *name)
+{
+    rlog_registry_t *r = &rlog_registry;
+
+    if (r->n_names == RLOG_MAX_NAMES)
+        return;
+    r->names[r->n_names].region = region;
+    strncpy(r->names[r->n_names].name, name, RLOG_NAME_SIZE - 1);
+    r->n_names++;
+}
+
+/*
+    The smallest enter to exit distance of an empty region on the calling
+    thread, what every region carries on top of its own time. The runs go
+    through the log and are taken out of it again.
+*/
+static inline uint32_t rlog_calibrate(void)
+{
+    rlog_thread_t *t = rlog_self;
+    uint32_t n = t->head.n_entries, dropped = t->head.dropped;
+    uint64_t best = UINT64_MAX;
+
+    for (int i = 0; i < RLOG_CALIBRATE_RUNS; i++) {
+        t->head.n_entries = n;
+        rlog_enter(0);
+        rlog_exit(0);
+        if (t->head.n_entries == n + 2 && t->entries[n + 1].cycles - t->entries[n].cycles < best)
+            best = t->entries[n + 1].cycles - t->entries[n].cycles;
+    }
+    t->head.n_entries = n;
+    t->head.dropped = dropped;
+    rlog_registry.overhead = best == UINT64_MAX ? 0 : (uint32_t) best;
+    return rlog_registry.overhead;
+}
+
+// every thread log to path, the calling thread takes its end sync point first
+static inline void rlog_dump(const char *path)
+{
+    rlog_registry_t *r = &rlog_registry;
+    uint32_t n_threads = r->n_threads < RLOG_MAX_THREADS ? r->n_threads : RLOG_MAX_THREADS;
+    volatile uint32_t *tsgen = rlog_tsgen();
+    rlog_header_t h;
+    FILE *fp;
+
+    if (rlog_self != NULL)
+        rlog_thread_done();
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+    h.magic = RLOG_MAGIC;
+    h.version = RLOG_VERSION;
+    h.n_threads = n_threads;
+    h.n_names = r->n_names;
+    h.overhead = r->overhead;
+    h.timer_freq = rlog_timer_freq();
+    h.tsgen_freq = tsgen != NULL ? tsgen[8] : 0;    // CNTFID0
+    h.reserved = 0;
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(r->names, sizeof(rlog_name_t), r->n_names, fp);
+    for (uint32_t i = 0; i < n_threads; i++) {
+        rlog_thread_t *t = r->threads[i];
+        fwrite(&t->head, sizeof(t->head), 1, fp);
+        fwrite(t->entries, sizeof(rlog_entry_t), t->head.n_entries, fp);
+    }
+    fclose(fp);
+}
+
+#endif
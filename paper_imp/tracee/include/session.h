@@ -0,0 +1,27 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+// the session control block in OCM, laid out once for the R5 and the host
+#include "../../tracer/src/session_layout.h"
+
+// what the R5 gets at the start of a session, defaults as its parser_reset()
+typedef struct r5_session_params {
+	float alpha;
+	float beta;
+	uint32_t t_end;
+	uint32_t rwp_mode;
+	uint32_t flush_us;
+	uint32_t partial_reprogram;
+	uint32_t stream_mask;
+	uint32_t dual_r5;
+	uint32_t throttle_span;
+	uint32_t throttle_period;
+} r5_session_params_t;
+
+void r5_session_defaults(r5_session_params_t *p);
+void r5_session_start(const uint32_t *ms, uint32_t ms_size, const r5_session_params_t *p);
+int r5_session_wait(uint32_t state, unsigned int timeout_ms);
+void r5_session_counters(uint32_t *bytes, uint32_t *overflows);
+
+#endif
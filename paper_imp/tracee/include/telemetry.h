@@ -0,0 +1,7 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+// the milestone telemetry ring the R5 tracer fills in OCM, laid out once for both
+#include "../../tracer/src/telemetry_layout.h"
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TMG_H
+#define TMG_H
+
+#include <stdint.h>
+#include <stddef.h>
+// CTMG_* and RELAY_MAX_SUCC, as the R5 tracer reads the graph
+#include "../../tracer/src/graph_layout.h"
+
+// binary milestone graph files, the header of cfg/tmg_format.py
+#define TMG_MAGIC 0x46474d54    // "TMGF"
+#define TMG_VERSION 1
+#define TMG_KIND_MSG 0          // msg_binarize.py binarize()
+#define TMG_KIND_TTMSG 1        // tprofile.py binarize_relative_tail()
+#define TMG_KIND_CTMG 2         // tmg_compile.py
+#define TMG_RAW 0xffffffff      // no header, the kind was guessed from the words
+
+#define TMG_END 0xffffffff
+
+typedef struct tmg_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t n_nodes;
+    uint32_t n_words;
+    uint32_t checksum;
+    uint32_t reserved[2];
+} tmg_header_t;
+
+typedef struct tmg {
+    const uint32_t *words;  // the payload, what the R5 gets
+    uint32_t n_words;
+    uint32_t n_nodes;
+    uint32_t kind;
+    uint32_t format;        // TMG_KIND_* of the payload, also of a raw file
+    void *map;
+    size_t map_size;
+} tmg_t;
+
+uint32_t tmg_checksum(const uint32_t *words, uint32_t n_words);
+void tmg_load(const char *path, tmg_t *g);
+void tmg_unload(tmg_t *g);
+
+#endif
@@ -3,6 +3,8 @@
 #include "cs_config.h"
 #include "cs_soc.h"
 #include "pmu_event.h"
+#include "session.h"
+#include "tmg.h"
 #include "zcu_cs.h"
 #include <bits/stdc++.h>
 #include <fcntl.h>
@@ -18,66 +20,477 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
-#include <argparse.h>
+
+/*
+  Tracing overhead of one application. Every repetition runs it once on
+  each path in turn, so drift of the board spreads over all of them:
+    untraced  no ETM
+    softfifo  ETF1 in Software FIFO mode, polled by this process
+    sram      ETF1 -> ETF2 in Circular mode, its SRAM read back after the run
+    etr       ETF1 -> ETF2 -> ETR in Circular mode, 256 MB at 0xb0000000
+    tpa       the R5 monitors the graph of -g, ETR into its TCM
+  The time is from execl() to the exit of the application. The slowdown is
+  against the median untraced time; bytes/s is what the path took; overflows
+  are the ETM overflow packets ctrace -t counts in the trace with -d, the
+  stream FIFO overflows of the R5 on tpa. held counts the runs in which an
+  ETF filled up, wrapped the ones that lost their oldest trace.
+*/
 
 using namespace std;
 
 extern ETM_interface *etm;
+extern TMC_interface *tmc1;
+extern TMC_interface *tmc2;
+extern TMC_interface *tmc3;
 
-int main(int argc, char *argv[]) {
+enum path_t { UNTRACED, SOFTFIFO, SRAM, ETR, TPA, N_PATHS };
+static const char *path_names[N_PATHS] = {"untraced", "softfifo", "sram", "etr", "tpa"};
 
-  uint64_t buf_addr = 0xb0000000;
-  uint32_t buf_size = 256 * 1024 * 1024;
+struct run_t {
+  int status;
+  double secs;
+  uint64_t bytes;
+  long overflows; // -1: not counted
+  int held;
+  int wrapped;
+  int missed; // tpa: the R5 did not report the last milestone
+};
 
-  char app[256];
-  char *app_farg = NULL;
-  char ms_path[256];
-  uint64_t start_addr, end_addr;
-  ms_t ms_mode;
+static const uint64_t etr_addr = 0xb0000000;
+static const uint32_t etr_size = 256 * 1024 * 1024;
+static const uint64_t tpa_addr = R5_0_ATCM + 0x8000;
+static const uint32_t tpa_size = 8 * 1024 * 4;
+static const char *trace_path = "../output/bench.dat";
 
-  parse_args(argc, argv, app, &app_farg, ms_path, &ms_mode, &start_addr, &end_addr);
-  clear_buffer(buf_addr, buf_size);
+#define FIFO_POLL_READS 256 // RRD reads between checks of the application
 
-  // config Coresight infrascture
-  cs_config_etr(buf_addr, buf_size);
-  config_etm();
+static char app[256];
+static char *app_farg = NULL;
+static uint64_t start_addr = 0, end_addr = 0;
+static int stall = 0;
+static const char *ctrace = NULL;
+static tmg_t graph;
+static r5_session_params_t r5_params;
 
-  // child would execl the target application, parent would wait till finish and
-  // collect the results
-  pid_t pid = 0;
-  pid = fork();
-  if (pid == 0) {
+// softfifo words of a run, the ones past fifo_cap are counted only
+static uint32_t *fifo;
+static uint64_t fifo_cap = 64 * 1024 * 1024 / 4;
+static uint64_t fifo_words;
 
-    // pin child to core 0
-    cpu_set_t set;
-    CPU_ZERO(&set);
-    CPU_SET(0, &set);
-    sched_setaffinity(0, sizeof(cpu_set_t), &set);
-    sched_yield();
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-n runs] [-w warmup] [-p path,...] [-t stall] [-f fifo_MB] [-d ctrace] [-o results.csv]\n"
+          "          [-g graph] [-a arg] [-b start -e end] app\n"
+          "paths: untraced softfifo sram etr tpa, default all, tpa with -g only\n",
+          name);
+  exit(1);
+}
 
-    // ETM only trace child pid
-    uint64_t child_pid = getpid();
-    etm_set_contextid_cmp(etm, (uint64_t)child_pid);
+static double now_s(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
 
-    etm_register_start_stop_addr(etm, start_addr, end_addr);
-	etm_set_stall(etm, 0b1111); // for mser, we need this to be accurate
+static void pin_to(int core) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  sched_setaffinity(0, sizeof(cpu_set_t), &set);
+  sched_yield();
+}
 
-    // enable ETM and run the application
+// the CoreSight path of one run, the ETM last as config_etm() resets it
+static void setup_path(int path) {
+  switch (path) {
+  case SOFTFIFO:
+    cs_config_softfifo();
+    break;
+  case SRAM:
+    cs_config_sram();
+    break;
+  case ETR:
+    cs_config_etr(etr_addr, etr_size);
+    break;
+  case TPA:
+    cs_config_etr(tpa_addr, tpa_size);
+    break;
+  }
+  config_etm();
+  etm_set_stall(etm, stall);
+  cs_etf_held();
+}
+
+// the child: filters, the R5 session on tpa, then the application
+static void run_child(int path, double *t_exec) {
+  pin_to(0);
+  if (path != UNTRACED) {
+    etm_set_contextid_cmp(etm, (uint64_t)getpid());
+    if (start_addr != 0 && end_addr != 0)
+      etm_register_start_stop_addr(etm, start_addr, end_addr);
+    if (path == TPA) {
+      for (int i = 0; i < 4; i++)
+        etm_register_range(etm, 0, 0, 1);
+      r5_session_start(graph.words, graph.n_words, &r5_params);
+    }
     etm_enable(etm);
-    execl(app, app, app_farg, NULL);
-    fprintf(stderr, "ERROR: execl failed.\n");
+  }
+  *t_exec = now_s();
+  execl(app, app, app_farg, NULL);
+  fprintf(stderr, "ERROR: execl failed.\n");
+  exit(1);
+}
 
-  } else if (pid > 0) {
-    wait(NULL);
-    sleep(1);
-    etm_disable(etm);
-    dump_buffer(buf_addr, buf_size);
-    return 0;
+static void fifo_put(uint32_t word) {
+  if (fifo_words < fifo_cap)
+    fifo[fifo_words] = word;
+  fifo_words++;
+}
+
+// softfifo: RRD is read while the application runs, the flush brings out what ETF1 still holds
+static pid_t poll_fifo(pid_t pid, int *status) {
+  pid_t done = 0;
+
+  while (done == 0) {
+    for (int i = 0; i < FIFO_POLL_READS; i++) {
+      uint32_t word = tmc1->ram_read_data;
+      if (word != 0xffffffff)
+        fifo_put(word);
+    }
+    done = waitpid(pid, status, WNOHANG);
+  }
+  return done;
+}
+
+static void drain_fifo(void) {
+  tmc_man_flush(tmc1);
+  for (;;) {
+    uint32_t word = tmc1->ram_read_data;
+    if (word != 0xffffffff)
+      fifo_put(word);
+    else if (!(tmc1->formatter_flush_status & 0x1))
+      break;
+  }
+}
+
+static FILE *open_trace(void) {
+  FILE *fp = fopen(trace_path, "w");
+  if (fp == NULL) {
+    perror(trace_path);
+    exit(1);
+  }
+  return fp;
+}
+
+// the SRAM of ETF2 from its oldest word, through RRD
+static void write_sram(uint64_t rwp, int full) {
+  FILE *fp = open_trace();
+  uint32_t words = full ? tmc2->ram_size : (uint32_t)rwp / 4;
+
+  tmc2->ram_read_pt = full ? (uint32_t)rwp : 0;
+  for (uint32_t i = 0; i < words; i++) {
+    uint32_t word = tmc2->ram_read_data;
+    fwrite(&word, sizeof(word), 1, fp);
+  }
+  fclose(fp);
+}
+
+// the ETR buffer from its oldest frame, unrolled when it wrapped
+static void write_etr(uint32_t used, uint32_t offset, int full) {
+  static uint8_t *buf = NULL;
+  FILE *fp = open_trace();
+
+  if (buf == NULL)
+    buf = (uint8_t *)get_buf_ptr(etr_addr, etr_size);
+  if (full) {
+    fwrite(buf + offset, 1, etr_size - offset, fp);
+    fwrite(buf, 1, offset, fp);
   } else {
+    fwrite(buf, 1, used, fp);
+  }
+  fclose(fp);
+}
+
+// the overflows line of ctrace -t on the trace of the last run, -1 when it fails
+static long count_overflows(void) {
+  char cmd[512], line[512];
+  long overflows = -1;
+
+  snprintf(cmd, sizeof(cmd), "%s -t -m none -F 1 %s 2>&1", ctrace, trace_path);
+  FILE *p = popen(cmd, "r");
+  if (p == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), p) != NULL) {
+    const char *s = strstr(line, "overflows: ");
+    if (s != NULL)
+      overflows = strtol(s + strlen("overflows: "), NULL, 10);
+  }
+  if (pclose(p) != 0)
+    return -1;
+  return overflows;
+}
+
+static run_t run_once(int path) {
+  run_t r = {0, 0, 0, -1, 0, 0, 0};
+  int status = 0;
+  double t_end;
+  // where the child writes the time of its execl()
+  double *t_exec = (double *)mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (t_exec == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (path != UNTRACED)
+    setup_path(path);
+  fifo_words = 0;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    run_child(path, t_exec);
+  } else if (pid < 0) {
     perror("Fork failed\n");
-    return 1;
+    exit(1);
+  }
+  if (path == SOFTFIFO)
+    poll_fifo(pid, &status);
+  else
+    waitpid(pid, &status, 0);
+  t_end = now_s();
+  r.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  r.secs = t_end - *t_exec;
+  munmap(t_exec, sizeof(double));
+
+  uint64_t rwp;
+  int full;
+  uint32_t bytes, overflows;
+  switch (path) {
+  case SOFTFIFO:
+    etm_disable(etm);
+    drain_fifo();
+    r.bytes = fifo_words * 4;
+    r.wrapped = fifo_words > fifo_cap;
+    if (ctrace) {
+      FILE *fp = open_trace();
+      fwrite(fifo, sizeof(uint32_t), min(fifo_words, fifo_cap), fp);
+      fclose(fp);
+    }
+    break;
+  case SRAM:
+    etm_disable(etm);
+    cs_stop_tmc(tmc2, &rwp, &full);
+    r.bytes = full ? tmc2->ram_size * 4 : (uint32_t)rwp;
+    r.wrapped = full;
+    if (ctrace)
+      write_sram(rwp, full);
+    break;
+  case ETR:
+    etm_disable(etm);
+    cs_stop_tmc(tmc3, &rwp, &full);
+    r.bytes = full ? etr_size : rwp - etr_addr;
+    r.wrapped = full;
+    if (ctrace)
+      write_etr(r.bytes, (uint32_t)(rwp - etr_addr), full);
+    break;
+  case TPA:
+    r.missed = !r5_session_wait(SESSION_DONE, 1000);
+    etm_disable(etm);
+    r5_session_counters(&bytes, &overflows);
+    r.bytes = bytes;
+    r.overflows = r.missed ? -1 : overflows;
+    break;
+  }
+  if (path != UNTRACED) {
+    r.held = cs_etf_held();
+    if (ctrace && path != TPA)
+      r.overflows = count_overflows();
+  }
+  return r;
+}
+
+// nearest rank, v sorted
+static double percentile(const vector<double> &v, double q) {
+  size_t i = (size_t)ceil(q * v.size());
+  return v[i ? i - 1 : 0];
+}
+
+static double median_secs(const vector<run_t> &runs) {
+  vector<double> v;
+  for (const run_t &r : runs)
+    v.push_back(r.secs);
+  sort(v.begin(), v.end());
+  return v.empty() ? 0 : percentile(v, 0.5);
+}
+
+static void report(const vector<run_t> runs[N_PATHS], const bool selected[N_PATHS], double base) {
+  printf("\n%-9s %4s %4s %10s  %-31s %9s %10s %4s %7s %6s\n", "path", "runs", "fail", "median s",
+         "slowdown min/median/p90/max", "MB/s", "overflows", "held", "wrapped", "missed");
+  for (int p = 0; p < N_PATHS; p++) {
+    if (!selected[p])
+      continue;
+    vector<double> slow;
+    double secs = 0;
+    uint64_t bytes = 0;
+    long overflows = 0;
+    int fail = 0, held = 0, wrapped = 0, missed = 0, counted = 0;
+    for (const run_t &r : runs[p]) {
+      fail += r.status != 0;
+      held += r.held;
+      wrapped += r.wrapped;
+      missed += r.missed;
+      secs += r.secs;
+      bytes += r.bytes;
+      if (r.overflows >= 0) {
+        overflows += r.overflows;
+        counted++;
+      }
+      if (base > 0)
+        slow.push_back(r.secs / base);
+    }
+    sort(slow.begin(), slow.end());
+    char slowdown[64] = "-", ovf[32] = "-";
+    if (!slow.empty())
+      snprintf(slowdown, sizeof(slowdown), "%.3f/%.3f/%.3f/%.3f", slow.front(), percentile(slow, 0.5),
+               percentile(slow, 0.9), slow.back());
+    if (counted)
+      snprintf(ovf, sizeof(ovf), "%ld", overflows);
+    printf("%-9s %4zu %4d %10.6f  %-31s %9.2f %10s %4d %7d %6d\n", path_names[p], runs[p].size(), fail,
+           median_secs(runs[p]), slowdown, secs > 0 ? bytes / secs / 1e6 : 0.0, ovf, held, wrapped, missed);
+  }
+}
+
+static void write_csv(const char *csv, const vector<run_t> runs[N_PATHS], double base) {
+  struct stat st;
+  int fresh = stat(csv, &st) != 0 || st.st_size == 0;
+  FILE *fp = fopen(csv, "a");
+
+  if (fp == NULL) {
+    perror(csv);
+    exit(1);
+  }
+  if (fresh)
+    fprintf(fp, "app,path,run,status,secs,slowdown,bytes,overflows,held,wrapped,missed\n");
+  for (int p = 0; p < N_PATHS; p++) {
+    for (size_t i = 0; i < runs[p].size(); i++) {
+      const run_t &r = runs[p][i];
+      fprintf(fp, "%s,%s,%zu,%d,%.6f,%.4f,%lu,%ld,%d,%d,%d\n", app, path_names[p], i, r.status, r.secs,
+              base > 0 ? r.secs / base : 0.0, r.bytes, r.overflows, r.held, r.wrapped, r.missed);
+    }
+  }
+  fclose(fp);
+}
+
+static void parse_paths(char *list, bool selected[N_PATHS]) {
+  for (int p = 0; p < N_PATHS; p++)
+    selected[p] = false;
+  for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    int p;
+    for (p = 0; p < N_PATHS && strcmp(tok, path_names[p]) != 0; p++)
+      ;
+    if (p == N_PATHS) {
+      fprintf(stderr, "ERROR: unknown path %s\n", tok);
+      exit(1);
+    }
+    selected[p] = true;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int runs = 10, warmup = 1, opt;
+  char *paths = NULL, *graph_path = NULL;
+  const char *csv = NULL;
+  bool selected[N_PATHS];
+  vector<run_t> results[N_PATHS];
+
+  r5_session_defaults(&r5_params);
+  while ((opt = getopt(argc, argv, "n:w:p:t:f:d:o:g:a:b:e:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      warmup = atoi(optarg);
+      break;
+    case 'p':
+      paths = optarg;
+      break;
+    case 't':
+      stall = strtol(optarg, NULL, 0);
+      break;
+    case 'f':
+      fifo_cap = strtoull(optarg, NULL, 0) * 1024 * 1024 / 4;
+      break;
+    case 'd':
+      ctrace = optarg;
+      break;
+    case 'o':
+      csv = optarg;
+      break;
+    case 'g':
+      graph_path = optarg;
+      break;
+    case 'a':
+      app_farg = optarg;
+      break;
+    case 'b':
+      start_addr = strtol(optarg, NULL, 0);
+      break;
+    case 'e':
+      end_addr = strtol(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc || runs < 1 || stall < 0 || stall > 15 || fifo_cap == 0)
+    usage(argv[0]);
+  strncpy(app, argv[optind], sizeof(app) - 1);
+
+  if (paths != NULL) {
+    parse_paths(paths, selected);
+  } else {
+    for (int p = 0; p < N_PATHS; p++)
+      selected[p] = p != TPA || graph_path != NULL;
+  }
+  if (selected[TPA]) {
+    if (graph_path == NULL) {
+      fprintf(stderr, "ERROR: the tpa path needs a graph, -g\n");
+      exit(1);
+    }
+    tmg_load(graph_path, &graph);
+    if (graph.format == TMG_KIND_MSG) {
+      fprintf(stderr, "ERROR: %s has no timing, the R5 needs a .ttmsg or compiled graph\n", graph_path);
+      exit(1);
+    }
+  }
+  if (selected[SOFTFIFO]) {
+    fifo = (uint32_t *)malloc(fifo_cap * sizeof(uint32_t));
+    if (fifo == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+  }
+
+  // the application on core 0, this process and its polling on core 3
+  pin_to(3);
+  printf("application: %s, %d runs, %d warmup, stall %d\n", app, runs, warmup, stall);
+  for (int i = 0; i < warmup; i++)
+    run_once(UNTRACED);
+  for (int i = 0; i < runs; i++) {
+    for (int p = 0; p < N_PATHS; p++) {
+      if (!selected[p])
+        continue;
+      run_t r = run_once(p);
+      printf("run %d %s: status %d, %.6f s, %lu bytes\n", i, path_names[p], r.status, r.secs, r.bytes);
+      results[p].push_back(r);
+    }
   }
 
+  double base = selected[UNTRACED] ? median_secs(results[UNTRACED]) : 0;
+  report(results, selected, base);
+  if (csv != NULL)
+    write_csv(csv, results, base);
   return 0;
 }
@@ -1,19 +1,17 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
-#include <time.h>
 #include <sched.h>
-#include "zcu_cs.h"
-#include "cs_pmu.h"
 #include <stdlib.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
-#include <fcntl.h>
+#include "region_log.h"
 
 
 #define BUF_SIZE (2048*1024)
 #define ITER 50
 
+enum { R_ITER = 1, R_WRITE, R_READ, R_MIX };
+
 int buf[BUF_SIZE];
 
 int write_phase() {
@@ -43,23 +41,12 @@ int mix_phase() {
     return 0;
 }
 
-struct timespec ts;
-unsigned long ms [ITER]; 
-int ct=0;
-
-static inline void mslog() {
-	clock_gettime(CLOCK_REALTIME,&ts);
-	ms[ct] = (ts.tv_sec * 1000000000) + ts.tv_nsec;
-	ct++;
-}
-
-static inline void cclog(PMU_interface* pmu) {
-	ms[ct] = pmu->cc;
-	ct++; 
-} 
-	
-
 
+/*
+	The phases of every iteration as regions of the cycle-counter log,
+	written to pmcc.rlog for cfg/region_log.py. response.asap.ker still gets
+	the cycle count at the start of each iteration.
+*/
 int main() {
 
 	// set process to FIFO
@@ -71,52 +58,44 @@ int main() {
 			return 1;
 	}
 
-	// get linux time resolution
-	clock_getres(CLOCK_REALTIME, &ts);
-	printf("clock_rt resolution (nanosec)  %ld \n", ts.tv_nsec);
-
-	int policy;
-	policy = sched_getscheduler(0);
-	switch(policy) {
-		case SCHED_OTHER:
-			printf("other\n");
-			break;
-		case SCHED_RR:
-			printf("rr\n");
-			break;
-		case SCHED_FIFO:
-			printf("fifo\n");
-			break;
-		default:
-			printf("something else\n");
-			break;
-	}
+	// the cycle counters of the cores are not in step
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	sched_setaffinity(0, sizeof(cpu_set_t), &set);
 
+	rlog_thread_init(ITER * 8);
+	rlog_name(R_ITER, "iteration");
+	rlog_name(R_WRITE, "write_phase");
+	rlog_name(R_READ, "read_phase");
+	rlog_name(R_MIX, "mix_phase");
+	printf("region overhead %u cycles\n", rlog_calibrate());
 
-	// get PMCC
-	PMU_interface *pmu = (PMU_interface *) cs_register(A53_0_pmu);
-	uint64_t cc = pmu->cc;
-	printf("init cc %lu\n", cc);
-					
-    int k,i;
+	int k;
 	for(k=0; k<ITER; k++) {
-		//printf("%lu\n",pmu->cc);
-		cclog(pmu);
-		for(i=0; i< 1; i++) {
-				write_phase();
-				read_phase();
-				mix_phase();
-		}
-
+		rlog_enter(R_ITER);
+		rlog_enter(R_WRITE);
+		write_phase();
+		rlog_exit(R_WRITE);
+		rlog_enter(R_READ);
+		read_phase();
+		rlog_exit(R_READ);
+		rlog_enter(R_MIX);
+		mix_phase();
+		rlog_exit(R_MIX);
+		rlog_exit(R_ITER);
 	}
-	FILE *fptr = fopen("response.asap.ker","a");
+	rlog_dump("pmcc.rlog");
 
+	FILE *fptr = fopen("response.asap.ker","a");
+	if (fptr == NULL) {
+		perror("response.asap.ker");
+		return 1;
+	}
 	for(k=0;k<ITER-1;k++){
-		fprintf(fptr,"%lu\n",ms[k]);
-	
+		fprintf(fptr,"%lu\n",rlog_self->entries[k * 8].cycles);
 	}
 	fclose(fptr);
 
 	return 0;
 }
-
@@ -3,6 +3,8 @@
 #include "cs_config.h"
 #include "cs_soc.h"
 #include "pmu_event.h"
+#include "session.h"
+#include "tmg.h"
 #include "zcu_cs.h"
 #include <bits/stdc++.h>
 #include <fcntl.h>
@@ -26,50 +28,68 @@ using namespace std;
 
 extern ETM_interface *etm;
 
-tuple<uint32_t *, int> read_ms(string fname)
+static int hex_digit(char c)
 {
-  vector<uint32_t> v;
-  ifstream msfile(fname);
-  string str;
-  if (msfile.is_open())
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// comma-separated hex addresses of a milestone sequence, parsed in place from a read-only mapping
+tuple<uint32_t *, int> read_ms(const char *fname)
+{
+  struct stat st;
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
   {
-    while (getline(msfile, str, ','))
-    {
-      cout << str << endl;
-      v.push_back(stoul(str, nullptr, 16));
-    }
+    perror(fname);
+    exit(1);
   }
-  else
+  const char *text = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED)
   {
-    cout << "Milestone file faied to open" << endl;
+    perror(fname);
+    exit(1);
   }
-  size_t num_ms = v.size();
-  uint32_t *ms = (uint32_t *)malloc(sizeof(uint32_t) * v.size());
-  for (size_t i = 0; i < num_ms; i++)
+
+  size_t n_max = 1;
+  for (off_t i = 0; i < st.st_size; i++)
   {
-    ms[i] = v[i];
+    if (text[i] == ',')
+      n_max++;
   }
+  uint32_t *ms = (uint32_t *)malloc(sizeof(uint32_t) * n_max);
+  size_t num_ms = 0;
+  off_t i = 0;
+  while (i < st.st_size)
+  {
+    while (i < st.st_size && (text[i] == ',' || isspace((unsigned char)text[i])))
+      i++;
+    if (i == st.st_size)
+      break;
+    if (text[i] == '0' && i + 1 < st.st_size && (text[i + 1] == 'x' || text[i + 1] == 'X'))
+      i += 2;
+    uint32_t v = 0;
+    int digits = 0, d;
+    for (; i < st.st_size && (d = hex_digit(text[i])) >= 0; i++, digits++)
+      v = (v << 4) | d;
+    if (digits == 0 || digits > 8 || (i < st.st_size && text[i] != ',' && !isspace((unsigned char)text[i])))
+    {
+      fprintf(stderr, "ERROR: %s: bad milestone at byte %ld\n", fname, (long)i);
+      exit(1);
+    }
+    ms[num_ms++] = v;
+  }
+  munmap((void *)text, st.st_size);
+  printf("%zu milestones\n", num_ms);
   return make_pair(ms, num_ms);
 }
 
-int get_file_size(char *fname)
-{
-  FILE *fp = fopen(fname, "rb");
-  int sz;
-  fseek(fp, 0L, SEEK_END);
-  sz = ftell(fp);
-  return sz;
-}
-
-tuple<uint32_t *, int> read_msg(char *fname)
-{
-  int size = get_file_size(fname);
-  uint32_t *buf = (uint32_t *)malloc(size);
-  FILE *fp = fopen(fname, "rb");
-  fread(buf, sizeof(uint32_t), size / sizeof(uint32_t), fp);
-  return make_pair(buf, size / sizeof(uint32_t));
-}
-
 void write_ms_time(uint32_t *ms, uint32_t *ms_time, int ms_size)
 {
   ofstream msfile("ms_timing.txt");
@@ -139,8 +159,11 @@ int main(int argc, char *argv[])
   ms_t ms_mode;
   uint32_t *ms_ptr;
   uint32_t ms_size;
+  tmg_t graph;
+  r5_session_params_t r5_params;
 
-  parse_args(argc, argv, app, &app_farg, milestone_path, &ms_mode, &start_addr, &end_addr);
+  r5_session_defaults(&r5_params);
+  parse_args(argc, argv, app, &app_farg, milestone_path, &ms_mode, &start_addr, &end_addr, &r5_params);
 
   if (ms_mode == SEQUENCE)
   {
@@ -150,7 +173,15 @@ int main(int argc, char *argv[])
   else if (ms_mode == GRAPH)
   {
     printf("Graph milestone mode\n");
-    tie(ms_ptr, ms_size) = read_msg(milestone_path);
+    tmg_load(milestone_path, &graph);
+    if (graph.format == TMG_KIND_MSG)
+    {
+      fprintf(stderr, "ERROR: %s has no timing, the R5 needs a .ttmsg or compiled graph\n", milestone_path);
+      exit(1);
+    }
+    printf("%u nodes, %u words%s\n", graph.n_nodes, graph.n_words, graph.kind == TMG_RAW ? ", no header" : "");
+    ms_ptr = (uint32_t *)graph.words;
+    ms_size = graph.n_words;
   }
 
   // config Coresight infrascture
@@ -179,17 +210,7 @@ int main(int argc, char *argv[])
       etm_register_start_stop_addr(etm, start_addr, end_addr);
     }
 
-    // Write MS data to OCM so that RPU can read
-    int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    uint32_t *ms_buff =
-        (uint32_t *)mmap(0, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED,
-                         mem_fd, 0xfffc0000);
-
     uint32_t i;
-    for (i = 0; i < ms_size; ++i)
-      ms_buff[2 + i] = ms_ptr[i];
-    ms_buff[1] = ms_size;
-    ms_buff[0] = 0xdeadbeef;
 
     for (i = 0; i < 4; ++i)
     {
@@ -204,7 +225,19 @@ int main(int argc, char *argv[])
       }
     }
     printf("Driver finished config, wait for Tracer init...\n");
-    sleep(2);
+#ifdef R5
+    if (ms_mode == GRAPH)
+    {
+      // graph and parameters through the session block, returns once the R5 set the comparators
+      r5_session_start(ms_ptr, ms_size, &r5_params);
+    }
+    else
+#endif
+    {
+      // Write MS data to OCM so that RPU can read
+      write_milestones(ms_ptr, ms_size);
+      sleep(2);
+    }
 
     // set PMU event, but do not start counting. The counting should start by RPU responding to the 1st MS hit.
     //pmu_event_setup(ARM_PERF_EVENT_DC2W, ARM_PERF_EVENT_DC2R, 0,0,0,0);
@@ -212,7 +245,6 @@ int main(int argc, char *argv[])
     //arm_perf_set_ctrl(ARM_PERF_PMCR_E);
 
     // enable ETM and run the application
-    munmap((uint32_t*)0xfffc0000, getpagesize());
     etm_enable(etm);
     //int test0,test1;
     //test0 = arm_perf_counter0();
@@ -224,7 +256,13 @@ int main(int argc, char *argv[])
   else if (pid > 0)
   {
     wait(NULL);
-    sleep(1);
+#ifdef R5
+    // the R5 reports DONE once the last milestone is reached, at most 1 s as before
+    if (ms_mode == GRAPH)
+      r5_session_wait(SESSION_DONE, 1000);
+    else
+#endif
+      sleep(1);
     etm_disable(etm);
 
     // int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
@@ -241,7 +279,7 @@ int main(int argc, char *argv[])
     // }
 
     // write_ms_time(ms_ptr, ms_buff, ms_size);
-    dump_buffer(buf_addr, buf_size);
+    dump_buffer(buf_addr, buf_size, 1);
 #ifdef R5
     system("sed -i 's/0xDEADBEEF/0x00000000/g' ../output/trace_1.out");
 #endif
@@ -1,4 +1,6 @@
 #include "buffer.h"
+#include "session.h"
+#include "tmg.h"
 #include "cs_etm.h"
 #include "cs_config.h"
 #include "cs_soc.h"
@@ -37,17 +39,15 @@ int main(int argc, char *argv[])
 #else
   uint64_t buf_addr = 0xb0000000;
   uint32_t buf_size = 256 * 1024 * 1024;
-  clear_buffer(buf_addr, buf_size);
+  // not cleared, dump_buffer_ring() takes the valid data from the ETR write pointer
 #endif
 
   char app[256];
   char *app_farg = NULL;
-  char milestone_path[256];
+  char milestone_path[256] = "";
   uint64_t start_addr=0;
   uint64_t end_addr=0;
-  ms_t ms_mode;
-  uint32_t *ms_ptr;
-  uint32_t ms_size;
+  ms_t ms_mode = SEQUENCE;
   cpu_set_t set;
   uint64_t range_u = 0;
   uint64_t range_l = 0;
@@ -70,6 +70,35 @@ int main(int argc, char *argv[])
   config_etm_n(etms[2],0,3);
   config_etm_n(etms[3],0,4);
 
+#ifdef R5
+  // a graph (-g) is followed on the R5 for every core, each its own trace ID,
+  // its streams the core mask, the formatter is on
+  int r5_graph = ms_mode == GRAPH;
+  if (r5_graph)
+  {
+    tmg_t graph;
+    tmg_load(milestone_path, &graph);
+    if (graph.format == TMG_KIND_MSG)
+    {
+      fprintf(stderr, "ERROR: %s has no timing, the R5 needs a .ttmsg or compiled graph\n", milestone_path);
+      exit(1);
+    }
+    // the R5 sets the comparators to the milestones, before any child runs;
+    // all four pairs of every ETM, etm_register_range() shares one pool of four among them
+    for (int i = 0; i < n_mp; ++i)
+      for (int pair = 1; pair <= 4; ++pair)
+        etm_set_range(etms[i], pair, 0, 0, 1);
+    r5_session_params_t r5_params;
+    r5_session_defaults(&r5_params);
+    r5_params.stream_mask = (1 << n_mp) - 1;
+    r5_session_start(graph.words, graph.n_words, &r5_params);
+    printf("Graph of %u nodes, %u words for the R5, streams 0x%x\n", graph.n_nodes, graph.n_words, r5_params.stream_mask);
+    tmg_unload(&graph);
+  }
+#else
+  int r5_graph = 0;
+#endif
+
   // fork three children, each execute a target application
   // each child is pinned to different cores
   pid_t* pids = (pid_t*) malloc(sizeof(pid_t) * n_mp);
@@ -87,7 +116,10 @@ int main(int argc, char *argv[])
 
       uint64_t child_pid = getpid();
       etm_set_contextid_cmp(etms[i], (uint64_t)child_pid);
-      etm_register_range(etms[i], range_u, range_l, 1);
+      if (!r5_graph)
+      {
+        etm_register_range(etms[i], range_u, range_l, 1);
+      }
       etm_enable(etms[i]);
       execl(app, app, app_farg, NULL);
       fprintf(stderr, "ERROR: execl failed.\n");
@@ -110,9 +142,13 @@ int main(int argc, char *argv[])
   tmc_man_flush(tmc3);
   sleep(1); // wait TMC3 (aka ETR) drains the buffer
 
-  dump_buffer(buf_addr, buf_size);
 #ifdef R5
+  dump_buffer(buf_addr, buf_size, 1);
   system("sed -i 's/0xDEADBEEF/0x00000000/g' ../output/trace_1.out");
+#else
+  // the ETR buffer is a ring, where it starts replaces the end markers
+  tmc_disable(tmc3);
+  dump_buffer_ring(buf_addr, buf_size, tmc_get_write_pt(tmc3), tmc_full(tmc3));
 #endif
   return 0;
 }
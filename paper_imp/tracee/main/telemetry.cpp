@@ -0,0 +1,95 @@
+// Drains the R5 telemetry ring while the traced application runs,
+// one CSV line per milestone hit:
+//   seq,address,time,nominal_t,tail_t,real_t,decision,duty
+// ./telemetry [-o file] [-p poll_us]
+#include "telemetry.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) { stop = 1; }
+
+int main(int argc, char *argv[])
+{
+  FILE *out = stdout;
+  useconds_t poll_us = 100;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:p:")) != -1)
+  {
+    if (opt == 'o')
+    {
+      out = fopen(optarg, "w");
+      if (out == NULL)
+      {
+        perror(optarg);
+        exit(1);
+      }
+    }
+    else if (opt == 'p')
+    {
+      poll_us = strtoul(optarg, NULL, 0);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-o file] [-p poll_us]\n", argv[0]);
+      exit(1);
+    }
+  }
+  signal(SIGINT, on_signal);
+
+  int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+  if (mem_fd < 0)
+  {
+    perror("/dev/mem");
+    exit(1);
+  }
+  volatile telemetry_ring *ring =
+      (volatile telemetry_ring *)mmap(0, sizeof(telemetry_ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+                                      mem_fd, TELEMETRY_BASE);
+  if (ring == MAP_FAILED)
+  {
+    perror("mmap telemetry ring");
+    exit(1);
+  }
+
+  fprintf(stderr, "Waiting for the tracer ring at 0x%x\n", TELEMETRY_BASE);
+  while (ring->prod.magic != TELEMETRY_MAGIC && !stop)
+    usleep(poll_us);
+  uint32_t n_records = ring->prod.n_records;
+  uint32_t tail = ring->cons.tail;
+  ring->cons.reader = 1;
+
+  fprintf(out, "seq,address,time,nominal_t,tail_t,real_t,decision,duty\n");
+  while (!stop)
+  {
+    uint32_t done = ring->prod.done;
+    uint32_t head = ring->prod.head;
+    __sync_synchronize();
+    for (; tail != head; tail++)
+    {
+      volatile telemetry_record *rec = &ring->records[tail & (n_records - 1)];
+      fprintf(out, "%u,0x%x,%llu,%u,%u,%u,0x%x,%u\n", rec->seq, rec->address, (unsigned long long)rec->time,
+              rec->nominal_t, rec->tail_t, rec->real_t, rec->decision, (rec->decision >> TELEMETRY_DUTY_SHIFT) & 0x1ff);
+    }
+    __sync_synchronize();
+    ring->cons.tail = tail;
+    if (done)
+      break;
+    usleep(poll_us);
+  }
+  fflush(out);
+  fprintf(stderr, "%u records, %u dropped\n", tail, ring->prod.dropped);
+
+  munmap((void *)ring, sizeof(telemetry_ring));
+  close(mem_fd);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
@@ -4,9 +4,10 @@
 #include <argparse.h>
 #include <string.h>
 
-void parse_args(int argc, char *argv[], char *app, char **app_farg, char *milestone_path, ms_t* ms_mode, uint64_t* start_addr, uint64_t* end_addr) {
+void parse_args(int argc, char *argv[], char *app, char **app_farg, char *milestone_path, ms_t* ms_mode, uint64_t* start_addr, uint64_t* end_addr,
+                r5_session_params_t* r5) {
     int opt;
-    while ((opt = getopt(argc, argv, ":a:m:g:b:e:")) != -1) {
+    while ((opt = getopt(argc, argv, r5 ? ":a:m:g:b:e:A:B:T:S:P:" : ":a:m:g:b:e:")) != -1) {
         switch (opt) {
         case 'a':
             printf("First arg: %s\n", optarg);
@@ -29,6 +30,21 @@ void parse_args(int argc, char *argv[], char *app, char **app_farg, char *milest
         case 'e':
             *end_addr = strtol(optarg, NULL, 0);
             break;
+        case 'A':
+            r5->alpha = strtof(optarg, NULL);
+            break;
+        case 'B':
+            r5->beta = strtof(optarg, NULL);
+            break;
+        case 'T':
+            r5->t_end = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            r5->throttle_span = strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            r5->throttle_period = strtoul(optarg, NULL, 0);
+            break;
         default:
             break;
         }
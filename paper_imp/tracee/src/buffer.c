@@ -3,7 +3,11 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include "buffer.h"
+#include "telemetry.h"
+#include "tmg.h"
 
 uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size)
 {
@@ -20,55 +24,209 @@ uint32_t *get_buf_ptr(uint64_t buf_addr, uint32_t buf_size)
     return (uint32_t *) ptr;
 }
 
+/*
+    Fills the mapping with 64-byte runs of paired 64-bit stores, not one word
+    at a time. The mapping is device memory, so no memset: its DC ZVA faults.
+*/
+static void fill_buffer(uint32_t *ptr, uint32_t buf_size, uint32_t pattern)
+{
+    uint64_t value = ((uint64_t) pattern << 32) | pattern;
+    uint8_t *p = (uint8_t *) ptr;
+    uint32_t i = 0;
+#if defined(__aarch64__)
+    for(; i + 64 <= buf_size; i += 64) {
+        __asm__ volatile("stp %1, %1, [%0]\n\t"
+                         "stp %1, %1, [%0, #16]\n\t"
+                         "stp %1, %1, [%0, #32]\n\t"
+                         "stp %1, %1, [%0, #48]"
+                         : : "r" (p + i), "r" (value) : "memory");
+    }
+#endif
+    for(; i + 8 <= buf_size; i += 8) {
+	    *(volatile uint64_t *) (p + i) = value;
+    }
+    for(; i + 4 <= buf_size; i += 4) {
+	    *(volatile uint32_t *) (p + i) = pattern;
+    }
+}
+
 void clear_buffer(uint64_t buf_addr, uint32_t buf_size)
 {
     printf("Clearing Buffer...\n");
     uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
-    volatile uint32_t *buf = ptr;
-    for(uint32_t i=0; i<buf_size/4; i++) {
-	    *buf++ = 0;
-    }
+    fill_buffer(ptr, buf_size, 0);
     munmap(ptr, buf_size);
 }
 
-void dump_buffer(uint64_t buf_addr, uint32_t buf_size)
+// words copied out of the mapping at a time
+#define DUMP_BLOCK_WORDS (16 * 1024)
+
+/*
+    Copies a block of the buffer to cached memory, one uncached read per
+    word; the scans and writes then run on the copy.
+*/
+static void copy_block(uint32_t *dst, volatile uint32_t *src, uint32_t words)
+{
+    for(uint32_t i=0; i<words; i++) {
+        dst[i] = src[i];
+    }
+}
+
+/*
+    Writes the hex text of a binary trace file, one word per line.
+*/
+void dump_text(const char *dat_name, const char *out_name)
+{
+    FILE *in = fopen(dat_name, "r");
+    FILE *out = fopen(out_name, "w");
+    uint32_t block[DUMP_BLOCK_WORDS];
+    size_t n;
+
+    if(in == NULL || out == NULL) {
+	    printf("file can't be opened\n");
+	    exit(1);
+    }
+    while ((n = fread(block, sizeof(uint32_t), DUMP_BLOCK_WORDS, in)) > 0) {
+        for(size_t i=0; i<n; i++) {
+            fprintf(out, "0x%08X\n", block[i]);
+        }
+    }
+    fclose(in);
+    fclose(out);
+}
+
+/*
+    One pass over the buffer: trace.dat takes the words up to the first
+    0xdeadbeef, written a block at a time. With text, trace_1.out takes every
+    word up to five zeros in a row and trace_2.out is the text of trace.dat.
+*/
+void dump_buffer(uint64_t buf_addr, uint32_t buf_size, int text)
 {
     printf("Start dump trace to output\n");
     uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
-    volatile uint32_t *buf = ptr;
-    FILE *fp = fopen("../output/trace_1.out", "w+");
-    FILE *fp2 = fopen("../output/trace_2.out", "w");
+    FILE *fp = text ? fopen("../output/trace_1.out", "w+") : NULL;
     FILE *fp3 = fopen("../output/trace.dat", "w");
-    if(fp == NULL || fp2 == NULL || fp3 == NULL) {
+    if((text && fp == NULL) || fp3 == NULL) {
 	    printf("file can't be opened\n");
 	    exit(1);
     }
+    static uint32_t block[DUMP_BLOCK_WORDS];
+    uint32_t words = buf_size / 4;
     int ct = 0;
-    for(uint32_t i=0; i<buf_size/4; i++) {
-        fprintf(fp, "0x%08X\n", *buf);
-        if(!(*buf == 0)) {
-            ct = 0;
-        } else {
-            ct ++ ;
-            if(ct == 5)
-                break;
+    int zeros_done = !text, dat_done = 0;
+    for(uint32_t base=0; base<words && !(zeros_done && dat_done); base+=DUMP_BLOCK_WORDS) {
+        uint32_t n = words - base < DUMP_BLOCK_WORDS ? words - base : DUMP_BLOCK_WORDS;
+        uint32_t i;
+        copy_block(block, ptr + base, n);
+        for(i=0; i<n && !zeros_done; i++) {
+            fprintf(fp, "0x%08X\n", block[i]);
+            if(!(block[i] == 0)) {
+                ct = 0;
+            } else {
+                ct ++ ;
+                if(ct == 5)
+                    zeros_done = 1;
+            }
         }
-        buf++;
+        if (!dat_done) {
+            for(i=0; i<n && block[i] != 0xdeadbeef; i++);
+            fwrite(block, sizeof(uint32_t), i, fp3);
+            dat_done = i < n;
+        }
+    }
+    if (fp)
+        fclose(fp);
+    fclose(fp3);
+    munmap(ptr, buf_size);
+    if (text) {
+        dump_text("../output/trace.dat", "../output/trace_2.out");
+        printf("Write to output/trace_[1,2].out and trace.dat\n");
+    } else {
+        printf("Write to output/trace.dat\n");
     }
+}
 
-    buf = ptr;
-    for(uint32_t i=0; i<buf_size/4; i++) {
-        if ((uint32_t)*buf != 0xdeadbeef) {
-            fprintf(fp2, "0x%08X\n", *buf);
-            fwrite((void *)buf, sizeof(uint32_t), 1, fp3);
-	    buf++;
-        } else {
-            break;
-        }
+/*
+    For a buffer written by the ETR in Circular mode. Up to the write pointer
+    rwp, or the whole buffer once it wrapped (full), goes to ../output/trace.dat in
+    memory order. ../output/trace.ring records where the ring starts, so deformat -r
+    can read it from the oldest frame on; no end marker is needed.
+*/
+void dump_buffer_ring(uint64_t buf_addr, uint32_t buf_size, uint64_t rwp, int full)
+{
+    uint32_t offset = (uint32_t) (rwp - buf_addr);
+    uint32_t used = full ? buf_size : offset;
+
+    printf("Dumping %u bytes of trace to ../output/trace.dat, write pointer at 0x%x%s\n", used, offset,
+           full ? ", wrapped" : "");
+    if (offset > buf_size) {
+        printf("write pointer 0x%lx is outside of the buffer\n", rwp);
+        exit(1);
+    }
+
+    uint32_t *ptr = get_buf_ptr(buf_addr, buf_size);
+    FILE *fp = fopen("../output/trace.dat", "w");
+    FILE *fp2 = fopen("../output/trace.ring", "w");
+    if(fp == NULL || fp2 == NULL) {
+	    printf("file can't be opened\n");
+	    exit(1);
     }
-    printf("Write to output/trace_[1,2].out and trace.dat\n");
+
+    // one write of the mapping, no per-word loop
+    if (fwrite((void *)ptr, 1, used, fp) != used)
+        perror("fwrite");
+    fprintf(fp2, "size 0x%x\nrwp 0x%x\nfull %d\n", buf_size, offset, full);
+
     fclose(fp);
     fclose(fp2);
-    fclose(fp3);
     munmap(ptr, buf_size);
 }
+
+// words of src to device memory dst, in 64-bit stores where both allow
+static void copy_words(volatile uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+
+    if (((uintptr_t) dst & 7) && n) {
+        dst[0] = src[0];
+        i = 1;
+    }
+    for (; i + 2 <= n; i += 2) {
+        uint64_t v;
+        memcpy(&v, &src[i], sizeof(v));
+        *(volatile uint64_t *) &dst[i] = v;
+    }
+    if (i < n)
+        dst[i] = src[i];
+}
+
+/*
+    Copies the milestones to OCM for the R5 tracer: [0] tag once the rest is
+    written, [1] the word count, the words, then their tmg_checksum(),
+    which graph_cache() of the tracer verifies; up to its telemetry ring.
+    0xdeadbeef starts the tracer, a session of session.c leaves it at 0.
+*/
+void write_milestones_tagged(const uint32_t *ms, uint32_t ms_size, uint32_t tag)
+{
+    if (ms_size + 3 > (TELEMETRY_BASE - MS_OCM_BASE) / 4) {
+        fprintf(stderr, "ERROR: milestone graph of %u words does not fit the OCM\n", ms_size);
+        exit(1);
+    }
+    uint32_t map_size = ((ms_size + 3) * sizeof(uint32_t) + getpagesize() - 1) & ~(getpagesize() - 1);
+    uint32_t *ms_buff = get_buf_ptr(MS_OCM_BASE, map_size);
+
+    if (ms_buff == MAP_FAILED)
+        exit(1);
+    ms_buff[0] = 0;
+    copy_words(&ms_buff[2], ms, ms_size);
+    ms_buff[2 + ms_size] = tmg_checksum(ms, ms_size);
+    ms_buff[1] = ms_size;
+    __sync_synchronize();
+    ms_buff[0] = tag;
+    munmap(ms_buff, map_size);
+}
+
+void write_milestones(const uint32_t *ms, uint32_t ms_size)
+{
+    write_milestones_tagged(ms, ms_size, 0xdeadbeef);
+}
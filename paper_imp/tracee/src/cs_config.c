@@ -108,6 +108,89 @@ void cs_config_etr_mp(uint64_t buf_addr, uint32_t buf_size) {
 
 	return ;
 }
+
+// the components of the A53_0 paths, mapped once for the sessions of a process
+static void register_path(void) {
+	if (tmc2 != NULL)
+		return;
+	etm = (ETM_interface *) cs_register(A53_0_etm);
+	funnel1 = (Funnel_interface *) cs_register(Funnel1);
+	funnel2 = (Funnel_interface *) cs_register(Funnel2);
+	tmc1 = (TMC_interface *) cs_register(Tmc1);
+	tmc2 = (TMC_interface *) cs_register(Tmc2);
+}
+
+/*
+	TMC1 as a software FIFO: nothing is stored past ETF1, the trace is read
+	from its RRD register, 0xffffffff when there is no new word.
+*/
+void cs_config_softfifo(void) {
+	register_path();
+
+	funnel_unlock(funnel1);
+	funnel_unlock(funnel2);
+	funnel_config_port(funnel1, 0xff, 0);
+	funnel_config_port(funnel2, 0xff, 0);
+
+	tmc_unlock(tmc1);
+	tmc_disable(tmc1);
+	tmc1->formatter_flush_ctrl = 0x3;
+	tmc_set_mode(tmc1, Soft);
+	tmc_set_axi(tmc1, 0xf);
+	tmc_enable(tmc1);
+}
+
+/*
+	TMC1 as a hardware FIFO into TMC2 in Circular mode: the trace stays in
+	the SRAM of ETF2, read back through RRD after cs_stop_tmc().
+*/
+void cs_config_sram(void) {
+	register_path();
+
+	funnel_unlock(funnel1);
+	funnel_unlock(funnel2);
+	funnel_config_port(funnel1, 0xff, 0);
+	funnel_config_port(funnel2, 0xff, 0);
+
+	tmc_unlock(tmc1);
+	tmc_unlock(tmc2);
+	tmc_disable(tmc1);
+	tmc_disable(tmc2);
+	tmc_set_mode(tmc1, Hard);
+	tmc_set_mode(tmc2, Circular);
+	tmc1->formatter_flush_ctrl = 0x3;
+	tmc2->formatter_flush_ctrl = 0x3;
+	tmc_set_axi(tmc1, 0xf);
+	tmc_set_axi(tmc2, 0xf);
+	tmc_enable(tmc1);
+	tmc_enable(tmc2);
+}
+
+// flush and stop a TMC in Circular mode, the write pointer and Full tell where the data is
+void cs_stop_tmc(TMC_interface *tmc, uint64_t *rwp, int *full) {
+	tmc_man_flush(tmc);
+	while (tmc->formatter_flush_status & 0x1);	// FlInProg
+	tmc_disable(tmc);
+	*rwp = tmc_get_write_pt(tmc);
+	*full = tmc_full(tmc);
+}
+
+/*
+	Whether ETF1 or ETF2 filled up since the last call: an ETF that did held
+	the ATB back, that is when the ETM overflows or stalls. Reading the
+	latched fill level clears it, so call once before the session.
+*/
+int cs_etf_held(void) {
+	int held = 0;
+
+	register_path();
+	if (tmc1->latched_buf_fill_level >= tmc1->ram_size)
+		held = 1;
+	if (tmc2->latched_buf_fill_level >= tmc2->ram_size)
+		held = 1;
+	return held;
+}
+
 /*
 	a generic etm config, most functions are disabled, non-invasive
 */
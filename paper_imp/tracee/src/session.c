@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "buffer.h"
+#include "session.h"
+
+#define SESSION_READY_TIMEOUT_MS 5000  // the R5 may still print the results of the last session
+#define SESSION_START_TIMEOUT_MS 2000
+#define SESSION_POLL_US 10
+
+static volatile session_block *block = NULL;
+static volatile uint32_t *apu_ipi = NULL;
+
+static void session_map(void)
+{
+    if (block != NULL)
+        return;
+    block = (volatile session_block *) get_buf_ptr(SESSION_BASE, getpagesize());
+    apu_ipi = get_buf_ptr(IPI_APU_BASE, getpagesize());
+    if ((void *) block == MAP_FAILED || (void *) apu_ipi == MAP_FAILED) {
+        fprintf(stderr, "ERROR: cannot map the R5 session block\n");
+        exit(1);
+    }
+}
+
+static double now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+void r5_session_defaults(r5_session_params_t *p)
+{
+    p->alpha = 1.3;
+    p->beta = 1;
+    p->t_end = 0;
+    p->rwp_mode = 0;
+    p->flush_us = 0;
+    p->partial_reprogram = 1;
+    p->stream_mask = 0;
+    p->dual_r5 = 0;
+    p->throttle_span = 0;
+    p->throttle_period = 1000;
+}
+
+/*
+    Waits for the R5 to reach state, READY also accepts DONE and ERROR: the
+    R5 takes the next command in these as well. The APU IPI doorbell of the R5
+    is cleared, the state word decides. Returns 0 on timeout.
+*/
+int r5_session_wait(uint32_t state, unsigned int timeout_ms)
+{
+    double deadline;
+
+    session_map();
+    deadline = now_ms() + timeout_ms;
+    for (;;) {
+        if (apu_ipi[IPI_ISR / 4] & IPI_RPU0_BIT)
+            apu_ipi[IPI_ISR / 4] = IPI_RPU0_BIT;
+        if (block->r5.magic == SESSION_MAGIC
+            && (block->r5.state == state
+                || (state == SESSION_READY && (block->r5.state == SESSION_DONE || block->r5.state == SESSION_ERROR))))
+            return 1;
+        if (now_ms() > deadline)
+            return 0;
+        usleep(SESSION_POLL_US);
+    }
+}
+
+/*
+    Writes the graph and the parameters, rings the R5 and waits until it set
+    the first comparators, the ETM can be enabled on return.
+*/
+void r5_session_start(const uint32_t *ms, uint32_t ms_size, const r5_session_params_t *p)
+{
+    uint32_t seq;
+    double t_start = now_ms();
+
+    if (!r5_session_wait(SESSION_READY, SESSION_READY_TIMEOUT_MS)) {
+        fprintf(stderr, "ERROR: R5 tracer not ready (state %u), reset it by writing 2 to its running ctl\n",
+                block->r5.magic == SESSION_MAGIC ? block->r5.state : SESSION_BOOT);
+        exit(1);
+    }
+    write_milestones_tagged(ms, ms_size, 0);
+
+    block->host.command = SESSION_CMD_START;
+    block->host.graph_words = ms_size;
+    block->host.alpha_q16 = (uint32_t) (p->alpha * 65536);
+    block->host.beta_q16 = (uint32_t) (p->beta * 65536);
+    block->host.t_end = p->t_end;
+    block->host.rwp_mode = p->rwp_mode;
+    block->host.flush_us = p->flush_us;
+    block->host.partial_reprogram = p->partial_reprogram;
+    block->host.stream_mask = p->stream_mask;
+    block->host.dual_r5 = p->dual_r5;
+    block->host.throttle_span = p->throttle_span;
+    block->host.throttle_period = p->throttle_period;
+    seq = block->r5.handled + 1;
+    __sync_synchronize();
+    block->host.seq = seq;
+    __sync_synchronize();
+    apu_ipi[IPI_TRIG / 4] = IPI_RPU0_BIT;
+
+    double deadline = now_ms() + SESSION_START_TIMEOUT_MS;
+    while (!(block->r5.handled == seq && block->r5.state == SESSION_RUNNING)) {
+        if (block->r5.handled == seq && block->r5.state == SESSION_ERROR) {
+            fprintf(stderr, "ERROR: R5 tracer rejected the graph of session %u, size or checksum\n", seq);
+            exit(1);
+        }
+        if (now_ms() > deadline) {
+            fprintf(stderr, "ERROR: R5 tracer did not start session %u\n", seq);
+            exit(1);
+        }
+        usleep(SESSION_POLL_US);
+    }
+    if (apu_ipi[IPI_ISR / 4] & IPI_RPU0_BIT)
+        apu_ipi[IPI_ISR / 4] = IPI_RPU0_BIT;
+    printf("R5 session %u started in %.3f ms\n", seq, now_ms() - t_start);
+}
+
+// what the R5 read in its last session, valid once it reported DONE
+void r5_session_counters(uint32_t *bytes, uint32_t *overflows)
+{
+    session_map();
+    *bytes = block->r5.bytes;
+    *overflows = block->r5.overflows;
+}
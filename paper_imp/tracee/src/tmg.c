@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tmg.h"
+
+static void tmg_fail(const char *path, const char *what, uint32_t word)
+{
+    fprintf(stderr, "ERROR: %s: %s at word %u\n", path, what, word);
+    exit(1);
+}
+
+uint32_t tmg_checksum(const uint32_t *words, uint32_t n_words)
+{
+    uint32_t c = 0;
+    uint32_t i;
+
+    for (i = 0; i < n_words; ++i)
+        c = ((c << 1) | (c >> 31)) ^ words[i];
+    return c;
+}
+
+/*
+    Node lists of binarize() and binarize_relative_tail(): the address, the
+    tail_t if pair_words is 2, the successors as a byte offset of a node and
+    the nominal_t, then the terminator. Every offset must start a node.
+    Returns the number of nodes.
+*/
+static uint32_t check_node_list(const char *path, const uint32_t *w, uint32_t n, uint32_t pair_words)
+{
+    uint8_t *is_node = (uint8_t *) calloc(n + 1, 1);
+    uint32_t head_words = pair_words == 2 ? 2 : 1;
+    uint32_t i = 0, nodes = 0, wide = 0;
+
+    while (i < n) {
+        uint32_t succs = 0;
+
+        if (i + head_words > n)
+            tmg_fail(path, "truncated node", i);
+        is_node[i] = 1;
+        nodes++;
+        i += head_words;
+        while (i < n && w[i] != TMG_END) {
+            if (i + pair_words > n)
+                tmg_fail(path, "truncated successor", i);
+            i += pair_words;
+            succs++;
+        }
+        if (i >= n)
+            tmg_fail(path, "node without terminator", i);
+        if (succs > RELAY_MAX_SUCC)
+            wide++;
+        i++;
+    }
+    for (i = 0; i < n; ) {
+        i += head_words;
+        for (; w[i] != TMG_END; i += pair_words) {
+            uint32_t off = w[i];
+            if (off % 4 != 0 || off / 4 >= n || !is_node[off / 4])
+                tmg_fail(path, "successor offset not at a node", i);
+        }
+        i++;
+    }
+    if (wide)
+        fprintf(stderr, "warning: %s: %u nodes have more than %d successors, the tracer follows the first %d\n",
+                path, wide, RELAY_MAX_SUCC, RELAY_MAX_SUCC);
+    free(is_node);
+    return nodes;
+}
+
+// the layout of tmg_compile.py, returns the number of nodes
+static uint32_t check_ctmg(const char *path, const uint32_t *w, uint32_t n)
+{
+    uint32_t nodes, succ_w, records, k;
+
+    if (n < CTMG_HEADER_WORDS || w[0] != CTMG_MAGIC)
+        tmg_fail(path, "no compiled graph header", 0);
+    if (w[1] != CTMG_VERSION)
+        tmg_fail(path, "compiled graph version, recompile it with tmg_compile.py", 1);
+    nodes = w[2];
+    succ_w = (CTMG_HEADER_WORDS + 3 * nodes + 3) & ~3;
+    if (nodes == 0 || succ_w > n || (n - succ_w) % 4 != 0)
+        tmg_fail(path, "node tables do not fit", 2);
+    if (w[3] >= nodes)
+        tmg_fail(path, "entry node out of range", 3);
+    records = (n - succ_w) / 4;
+    for (k = 0; k < nodes; ++k) {
+        uint32_t first = w[CTMG_HEADER_WORDS + nodes + k];
+        uint32_t count = w[CTMG_HEADER_WORDS + 2 * nodes + k];
+        if (first > records || count > records - first)
+            tmg_fail(path, "successor records out of range", CTMG_HEADER_WORDS + nodes + k);
+    }
+    for (k = 0; k < records; ++k) {
+        if (w[succ_w + 4 * k + 3] >= nodes)
+            tmg_fail(path, "successor index out of range", succ_w + 4 * k + 3);
+    }
+    return nodes;
+}
+
+/*
+    Maps a graph file read-only and checks it before anything goes to the R5:
+    the header and its checksum if there is one, then the structure of the
+    payload. A file without the header is a raw .ttmsg or compiled graph.
+*/
+void tmg_load(const char *path, tmg_t *g)
+{
+    struct stat st;
+    const uint32_t *w;
+    uint32_t n, nodes;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (st.st_size < 4 || st.st_size % 4 != 0) {
+        fprintf(stderr, "ERROR: %s: %ld bytes, not a graph of words\n", path, (long) st.st_size);
+        exit(1);
+    }
+    memset(g, 0, sizeof(*g));
+    g->map_size = st.st_size;
+    g->map = mmap(NULL, g->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (g->map == MAP_FAILED) {
+        perror(path);
+        exit(1);
+    }
+    w = (const uint32_t *) g->map;
+    n = g->map_size / 4;
+
+    if (n >= sizeof(tmg_header_t) / 4 && w[0] == TMG_MAGIC) {
+        const tmg_header_t *h = (const tmg_header_t *) w;
+        if (h->version != TMG_VERSION)
+            tmg_fail(path, "container version", 1);
+        if (h->n_words != n - sizeof(tmg_header_t) / 4)
+            tmg_fail(path, "payload size", 4);
+        g->kind = h->kind;
+        g->format = h->kind;
+        g->n_nodes = h->n_nodes;
+        g->words = w + sizeof(tmg_header_t) / 4;
+        g->n_words = h->n_words;
+        if (tmg_checksum(g->words, g->n_words) != h->checksum)
+            tmg_fail(path, "checksum mismatch", 5);
+    } else {
+        g->kind = TMG_RAW;
+        g->format = w[0] == CTMG_MAGIC ? TMG_KIND_CTMG : TMG_KIND_TTMSG;
+        g->words = w;
+        g->n_words = n;
+    }
+
+    if (g->format == TMG_KIND_CTMG)
+        nodes = check_ctmg(path, g->words, g->n_words);
+    else if (g->format == TMG_KIND_TTMSG)
+        nodes = check_node_list(path, g->words, g->n_words, 2);
+    else if (g->format == TMG_KIND_MSG)
+        nodes = check_node_list(path, g->words, g->n_words, 1);
+    else
+        tmg_fail(path, "unknown graph kind", 2);
+    if (g->kind != TMG_RAW && nodes != g->n_nodes)
+        tmg_fail(path, "node count differs from the header", 3);
+    g->n_nodes = nodes;
+}
+
+void tmg_unload(tmg_t *g)
+{
+    munmap(g->map, g->map_size);
+    g->map = NULL;
+    g->words = NULL;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include "xil_printf.h"
+#include "xtime_l.h"
+
+static void uart_write(const char *s) {
+	for (; *s; ++s) {
+		if (*s != '\r')
+			putchar(*s);
+	}
+}
+
+void xil_vprintf(const char *fmt, va_list ap) {
+	char line[512];
+
+	vsnprintf(line, sizeof(line), fmt, ap);
+	uart_write(line);
+}
+
+void xil_printf(const char *fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	xil_vprintf(fmt, ap);
+	va_end(ap);
+}
+
+void print(const char *s) {
+	uart_write(s);
+}
+
+void XTime_GetTime(XTime *t) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*t = (now.tv_sec * 1000000000ull + now.tv_nsec) / (1000000000ull / COUNTS_PER_SECOND);
+}
@@ -0,0 +1,13 @@
+#ifndef XIL_CACHE_H
+#define XIL_CACHE_H
+
+#include <stdint.h>
+
+// one coherent memory on the host, the maintenance is only a barrier
+typedef intptr_t INTPTR;
+
+#define Xil_DCacheFlush()			__sync_synchronize()
+#define Xil_DCacheFlushRange(adr, len)		((void) (adr), (void) (len), __sync_synchronize())
+#define Xil_DCacheInvalidateRange(adr, len)	((void) (adr), (void) (len), __sync_synchronize())
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+// the UART of the tracer is stdout, without the \r of its line ends
+void xil_printf(const char *fmt, ...);
+void xil_vprintf(const char *fmt, va_list ap);
+void print(const char *s);
+
+#endif
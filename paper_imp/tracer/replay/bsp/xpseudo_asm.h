@@ -0,0 +1,6 @@
+#ifndef XPSEUDO_ASM_H
+#define XPSEUDO_ASM_H
+
+#define dmb()	__sync_synchronize()
+
+#endif
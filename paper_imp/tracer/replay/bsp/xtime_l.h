@@ -0,0 +1,14 @@
+#ifndef XTIME_L_H
+#define XTIME_L_H
+
+#include <stdint.h>
+
+// the global timer of the tracer as CLOCK_MONOTONIC, at the rate the tracer assumes
+typedef uint64_t XTime;
+
+#define COUNTS_PER_SECOND	100000000ull
+#define COUNTS_PER_USECOND	(COUNTS_PER_SECOND / 1000000)
+
+void XTime_GetTime(XTime *t);
+
+#endif
@@ -0,0 +1,316 @@
+/*
+	Host replay of the R5 tracer: trace.c, etm.c and parser.c run unchanged
+	in a thread, against plain memory at the CoreSight, IPI and OCM addresses
+	they use. The harness plays the host: it starts a session with the graph,
+	feeds a recorded trace.dat into etr_buffer as the ETR would and reads the
+	telemetry ring. The decisions are taken on host time, they follow the
+	replay rate (-p), not the rate of the recorded run.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "etm.h"
+#include "session.h"
+#include "telemetry.h"
+#include "tmg.h"
+
+#define DEVICE_BASE	CS_BASE				// up to the end of OCM
+#define DEVICE_SIZE	(0x100000000ull - CS_BASE)
+#define BUS_BASE	0x40000000			// DBALO in rwp_mode, etr_buffer as the ETR sees it
+#define FFCR_FLUSHMAN	(0x1 << 6)
+#define FEED_BLOCK	256				// words, divides ETR_BUFFER_SIZE
+#define SESSION_TIMEOUT_MS 2000
+
+extern volatile uint32_t *etr_buffer;
+extern volatile uint8_t running;
+extern uint32_t num_packets;
+extern uint32_t num_unknown_header;
+extern void start(void);
+
+static volatile uint32_t *etr_ffcr = (volatile uint32_t *) (CS_BASE + TMC3 + FFCR);
+static volatile uint32_t *etr_rrp = (volatile uint32_t *) (CS_BASE + TMC3 + TMCRRP);
+static volatile uint32_t *etr_rwp = (volatile uint32_t *) (CS_BASE + TMC3 + TMCRWP);
+static volatile uint32_t *etr_dbalo = (volatile uint32_t *) (CS_BASE + TMC3 + TMCDBALO);
+static volatile uint32_t *ocm_graph = (volatile uint32_t *) 0xfffc0000;
+static volatile session_block *block = (volatile session_block *) SESSION_BASE;
+static volatile uint32_t *rpu0_isr = (volatile uint32_t *) (IPI_RPU0_BASE + IPI_ISR);
+static volatile telemetry_ring *ring = (volatile telemetry_ring *) TELEMETRY_BASE;
+
+static volatile int stopped = 0;
+static telemetry_record *decisions = NULL;
+static uint32_t n_decisions = 0;
+static uint32_t max_decisions = 0;
+static uint32_t tail = 0;
+
+// check_stop_condition() of the tracer thread ends here, after report_results()
+void replay_stopped(void) {
+	__sync_synchronize();
+	stopped = 1;
+	pthread_exit(NULL);
+}
+
+static void *tracer_main(void *arg) {
+	running = 1;
+	start();
+	replay_stopped();
+	return NULL;
+}
+
+static double now_ms(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void map_device(void) {
+	void *p = mmap((void *) DEVICE_BASE, DEVICE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p != (void *) DEVICE_BASE) {
+		fprintf(stderr, "ERROR: cannot map the tracer addresses at 0x%x\n", DEVICE_BASE);
+		exit(1);
+	}
+}
+
+static uint32_t *read_trace(const char *path, uint32_t *n_words) {
+	FILE *fp = fopen(path, "rb");
+	uint32_t *words;
+	long size;
+
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	*n_words = size / 4;
+	words = malloc(*n_words * 4 + 4);
+	if (words == NULL || fread(words, 4, *n_words, fp) != *n_words) {
+		fprintf(stderr, "ERROR: cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(fp);
+	return words;
+}
+
+static void wait_state(uint32_t seq, uint32_t state) {
+	double deadline = now_ms() + SESSION_TIMEOUT_MS;
+
+	while (!(block->r5.magic == SESSION_MAGIC && block->r5.handled == seq && block->r5.state == state)) {
+		if (block->r5.magic == SESSION_MAGIC && block->r5.handled == seq && block->r5.state == SESSION_ERROR) {
+			fprintf(stderr, "ERROR: the tracer rejected the graph, size or checksum\n");
+			exit(1);
+		}
+		if (stopped || now_ms() > deadline) {
+			fprintf(stderr, "ERROR: the tracer did not reach state %u\n", state);
+			exit(1);
+		}
+		usleep(10);
+	}
+}
+
+// as r5_session_start() of the tracee, the doorbell is the RPU0 ISR bit itself
+static void start_session(const tmg_t *g, const session_host *p) {
+	uint32_t i, seq;
+
+	wait_state(0, SESSION_READY);
+	ocm_graph[0] = 0;
+	ocm_graph[1] = g->n_words;
+	for (i = 0; i < g->n_words; ++i)
+		ocm_graph[2 + i] = g->words[i];
+	ocm_graph[2 + g->n_words] = tmg_checksum(g->words, g->n_words);
+
+	block->host.command = SESSION_CMD_START;
+	block->host.graph_words = g->n_words;
+	block->host.alpha_q16 = p->alpha_q16;
+	block->host.beta_q16 = p->beta_q16;
+	block->host.t_end = p->t_end;
+	block->host.rwp_mode = p->rwp_mode;
+	block->host.flush_us = p->flush_us;
+	block->host.partial_reprogram = p->partial_reprogram;
+	block->host.stream_mask = p->stream_mask;
+	block->host.dual_r5 = 0;
+	block->host.throttle_span = p->throttle_span;
+	block->host.throttle_period = p->throttle_period;
+	seq = block->r5.handled + 1;
+	__sync_synchronize();
+	block->host.seq = seq;
+	__sync_synchronize();
+	*rpu0_isr |= IPI_APU_BIT;
+	wait_state(seq, SESSION_RUNNING);
+}
+
+// also the wait of the feed, the tracer may need the CPU
+static void drain_telemetry(void) {
+	uint32_t head = ring->prod.head;
+
+	__sync_synchronize();
+	for (; tail != head; ++tail) {
+		if (n_decisions == max_decisions) {
+			max_decisions = max_decisions ? max_decisions * 2 : TELEMETRY_RECORDS;
+			decisions = realloc(decisions, max_decisions * sizeof(telemetry_record));
+			if (decisions == NULL) {
+				fprintf(stderr, "ERROR: out of memory for the decisions\n");
+				exit(1);
+			}
+		}
+		decisions[n_decisions++] = *(telemetry_record *) &ring->records[tail & (TELEMETRY_RECORDS - 1)];
+	}
+	__sync_synchronize();
+	ring->cons.tail = tail;
+	sched_yield();
+}
+
+// the index of the word the tracer fetches next, in rwp_mode the read pointer it left
+static uint32_t rwp_fetched(void) {
+	return ((*etr_rrp - BUS_BASE) / 4) & (ETR_BUFFER_SIZE - 1);
+}
+
+/*
+	The words go into etr_buffer a block at a time as the ETR bursts them,
+	once the tracer freed the block: the sentinel of its last word written
+	back, or the read pointer moved past it. The first word goes last, the
+	tracer sees the block complete. At most rate MB/s, returns the ms from
+	the first block to the last word taken.
+*/
+static double feed(const uint32_t *words, uint32_t n, int rwp, double rate) {
+	uint32_t i, k, len, idx = 0;
+	double t0 = now_ms();
+
+	for (i = 0; i < n && !stopped; i += len) {
+		len = n - i < FEED_BLOCK ? n - i : FEED_BLOCK;
+		if (rwp) {
+			while (((idx - rwp_fetched()) & (ETR_BUFFER_SIZE - 1)) > ETR_BUFFER_SIZE - 1 - len && !stopped)
+				drain_telemetry();
+		} else {
+			while (etr_buffer[idx + len - 1] != 0xdeadbeef && !stopped)
+				drain_telemetry();
+		}
+		for (k = 1; k < len; ++k)
+			etr_buffer[idx + k] = words[i + k];
+		__sync_synchronize();
+		etr_buffer[idx] = words[i];
+		idx = (idx + len) & (ETR_BUFFER_SIZE - 1);
+		if (rwp) {
+			__sync_synchronize();
+			*etr_rwp = BUS_BASE + idx * 4;
+		}
+		if (rate > 0) {
+			while (now_ms() - t0 < (i + len) * 4 / (rate * 1e3))
+				drain_telemetry();
+		}
+	}
+
+	// all taken, then the tracer polls again: a manual flush is its way of waiting for data
+	if (rwp) {
+		while (rwp_fetched() != idx && !stopped)
+			drain_telemetry();
+	} else {
+		while (etr_buffer[(idx - 1) & (ETR_BUFFER_SIZE - 1)] != 0xdeadbeef && !stopped)
+			drain_telemetry();
+	}
+	double t1 = now_ms();
+	*etr_ffcr &= ~FFCR_FLUSHMAN;
+	while (!(*etr_ffcr & FFCR_FLUSHMAN) && !stopped)
+		drain_telemetry();
+	return t1 - t0;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-a alpha] [-b beta] [-t t_end] [-s stream_mask] [-S span_us] [-P period_us]\n"
+			"       [-f flush_us] [-r] [-n] [-p MB/s] [-v] trace.dat graph\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	session_host p;
+	tmg_t g;
+	uint32_t *words, n_words, i;
+	double alpha = 1.3, beta = 1, rate = 0, ms;
+	int verbose = 0, opt;
+	pthread_t tracer;
+
+	memset(&p, 0, sizeof(p));
+	p.partial_reprogram = 1;
+	p.throttle_period = 1000;
+	while ((opt = getopt(argc, argv, "a:b:t:s:S:P:f:rnp:v")) != -1) {
+		switch (opt) {
+		case 'a': alpha = atof(optarg); break;
+		case 'b': beta = atof(optarg); break;
+		case 't': p.t_end = strtoul(optarg, NULL, 0); break;
+		case 's': p.stream_mask = strtoul(optarg, NULL, 0); break;
+		case 'S': p.throttle_span = strtoul(optarg, NULL, 0); break;
+		case 'P': p.throttle_period = strtoul(optarg, NULL, 0); break;
+		case 'f': p.flush_us = strtoul(optarg, NULL, 0); break;
+		case 'r': p.rwp_mode = 1; break;
+		case 'n': p.partial_reprogram = 0; break;
+		case 'p': rate = atof(optarg); break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+	p.alpha_q16 = (uint32_t) (alpha * 65536);
+	p.beta_q16 = (uint32_t) (beta * 65536);
+
+	map_device();
+	tmg_load(argv[optind + 1], &g);
+	if (g.format == TMG_KIND_MSG) {
+		fprintf(stderr, "ERROR: %s is a plain MSG, the tracer needs a .ttmsg or a compiled graph\n", argv[optind + 1]);
+		exit(1);
+	}
+	if (g.n_words > MSG_OCM_SIZE) {
+		fprintf(stderr, "ERROR: graph of %u words, the tracer takes up to %d\n", g.n_words, MSG_OCM_SIZE);
+		exit(1);
+	}
+	words = read_trace(argv[optind], &n_words);
+	*etr_dbalo = BUS_BASE;
+	*etr_rrp = BUS_BASE;
+	*etr_rwp = BUS_BASE;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if (pthread_create(&tracer, NULL, tracer_main, NULL) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+	start_session(&g, &p);
+	if (!verbose)
+		ring->cons.reader = 1;	// the per-milestone UART log is skipped, as with tracee telemetry
+	ms = feed(words, n_words, p.rwp_mode, rate);
+	running = 0;
+	pthread_join(tracer, NULL);
+	drain_telemetry();
+
+	printf("DECISION BEGIN\n");
+	printf("seq,address,time,nominal_t,tail_t,real_t,decision,duty\n");
+	for (i = 0; i < n_decisions; ++i) {
+		telemetry_record *rec = &decisions[i];
+		printf("%u,0x%x,%llu,%u,%u,%u,0x%x,%u\n", rec->seq, rec->address, (unsigned long long) rec->time,
+				rec->nominal_t, rec->tail_t, rec->real_t, rec->decision, (rec->decision >> TELEMETRY_DUTY_SHIFT) & 0x1ff);
+	}
+	printf("DECISION END\n");
+
+	printf("REPLAY BEGIN\n");
+	printf("trace words,%u\n", n_words);
+	printf("packets,%u\n", num_packets);
+	printf("unknown headers,%u\n", num_unknown_header);
+	printf("milestones,%u\n", ring->prod.head + ring->prod.dropped);
+	printf("dropped records,%u\n", ring->prod.dropped);
+	printf("feed ms,%.3f\n", ms);
+	if (ms > 0) {
+		printf("MB/s,%.2f\n", n_words * 4 / (ms * 1e3));
+		printf("packets/s,%.0f\n", num_packets / (ms / 1e3));
+	}
+	printf("REPLAY END\n");
+	tmg_unload(&g);
+	free(words);
+	free(decisions);
+	return 0;
+}
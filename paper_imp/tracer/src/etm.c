@@ -1,65 +1,102 @@
 #include "etm.h"
+#include "telemetry.h"
+#include "latency.h"
+#include "mailbox.h"
+#include "session.h"
+#include "xil_cache.h"
+#ifdef TRACER_REPLAY
+#include <sched.h>
+#endif
 
-static volatile uint8_t *prog_ctrl = CS_BASE + A53_0_ETM + TRCPRGCTLR;
-static volatile uint8_t *trace_status = CS_BASE + A53_0_ETM + TRCSTATR;
-static volatile uint32_t *addr_cmp_7 = CS_BASE + A53_0_ETM + TRCACVR7;
-static volatile uint32_t *addr_cmp_6 = CS_BASE + A53_0_ETM + TRCACVR6;
-static volatile uint32_t *addr_cmp_5 = CS_BASE + A53_0_ETM + TRCACVR5;
-static volatile uint32_t *addr_cmp_4 = CS_BASE + A53_0_ETM + TRCACVR4;
-static volatile uint32_t *addr_cmp_3 = CS_BASE + A53_0_ETM + TRCACVR3;
-static volatile uint32_t *addr_cmp_2 = CS_BASE + A53_0_ETM + TRCACVR2;
-static volatile uint32_t *addr_cmp_1 = CS_BASE + A53_0_ETM + TRCACVR1;
-static volatile uint32_t *addr_cmp_0 = CS_BASE + A53_0_ETM + TRCACVR0;
-
-static volatile uint32_t * etr_ctrl = CS_BASE + TMC3 + TMCTRG;
-static volatile uint32_t * etr_ffcr = CS_BASE + TMC3 + FFCR;
-
-volatile uint32_t * milestones = 0xfffc0000;
+// register reg of the ETM of A53 core, the trace ID of core n is n + 1
+#define A53_ETM(core, reg) ((volatile uint32_t *) (uintptr_t) (CS_BASE + A53_0_ETM + (core) * 0x100000 + (reg)))
+
+// register reg of the ETR
+#define ETR(reg) ((volatile uint32_t *) (uintptr_t) (CS_BASE + TMC3 + (reg)))
+// the milestone table in OCM
+#define MILESTONES ((volatile uint32_t *) (uintptr_t) 0xfffc0000)
+
+static volatile uint32_t * etr_ctrl = ETR(TMCTRG);
+static volatile uint32_t * etr_ffcr = ETR(FFCR);
+static volatile uint32_t * etr_rrp = ETR(TMCRRP);
+static volatile uint32_t * etr_rwp = ETR(TMCRWP);
+static volatile uint32_t * etr_dbalo = ETR(TMCDBALO);
+
+volatile uint32_t * milestones = MILESTONES;
 uint32_t milestones_size = 0;
 uint32_t current_milestone = 0;
 uint32_t current_timestamp = 0;
-uint32_t milestone_graph [MSG_BUFFER_SIZE] = {0xffffffff};
-uint32_t g_nominal_time = 0;
+uint32_t milestone_graph [MSG_BUFFER_SIZE] __attribute__((aligned(16))) = {0xffffffff};
+static uint8_t graph_compiled = 0;
+static uint32_t ctmg_first_w;	// word offsets of succ_first, succ_count and the records
+static uint32_t ctmg_count_w;
+static uint32_t ctmg_succ_w;
+static volatile uint32_t *graph_src;	// the graph in OCM
+static uint8_t graph_paged = 0;
+static uint32_t graph_size;
+// nominal_t * alpha of every edge, at the word of its nominal_t / 2: no two are adjacent
+static uint32_t scaled_graph[MSG_BUFFER_SIZE / 2];
+static uint32_t page_tag[GRAPH_PAGES];
+uint32_t num_page_loads = 0;
+// the progress of each stream
+uint32_t g_nominal_time[TRACE_STREAMS] = {0};
+uint32_t g_scaled_time[TRACE_STREAMS] = {0};	// g_nominal_time * alpha, summed per edge
+uint32_t g_real_time[TRACE_STREAMS] = {0};
+static uint32_t behind_mask = 0;	// the streams behind their nominal time
+static uint32_t done_mask = 0;		// the streams past their last milestone
 uint32_t n_times[MS_LOG_SIZE] = {0};
 uint32_t n_times_pt = 0;
 uint32_t tail_times[MS_LOG_SIZE] = {0};
 uint32_t tail_times_pt = 0;
-uint32_t g_real_time = 0;
 uint32_t n_slack_ct = 0;
 uint32_t tail_violation_ct = 0;
 uint32_t p_slack_ct = 0;
-milestone_relay relay;
+milestone_relay relays[TRACE_STREAMS];
 milestone_relay tmp_relay;
+static uint32_t cmp_lo[TRACE_STREAMS][4];	// the range of each comparator pair, as programmed
+static uint32_t cmp_hi[TRACE_STREAMS][4];
+static uint32_t new_lo[4];
+static uint32_t new_hi[4];
+uint32_t num_reprograms = 0;
+uint32_t num_reprogram_skips = 0;
+XTime blind_ticks = 0;
+XTime blind_max = 0;
 
 extern volatile uint8_t running;
 extern volatile uint32_t bandwidth_control;
-extern volatile float alpha;
-extern volatile float beta;
+extern uint32_t alpha_q16;
 extern uint32_t margin;
+extern volatile uint32_t partial_reprogram;
+extern volatile uint32_t stream_mask;
+extern volatile uint32_t dual_r5;
+extern volatile uint32_t throttle_span;
+extern volatile uint32_t throttle_period;
+volatile uint32_t *bw_ctl = &bandwidth_control;	// R5_1 throttles through the R5_0 global address
 uint32_t resumes[256] = {0};
 uint32_t pauses[256] = {0};
 uint32_t resume_pt=0;
 uint32_t pause_pt=0;
+static uint32_t budget_duty = BUDGET_FULL;	// as published in the session block
+static uint32_t stream_duty[TRACE_STREAMS];	// the share a stream behind leaves the corunners
 
-void etm_reset() {
-	print("RPU ETM config reset.\n\r");
-	milestones = 0xfffc0000;
-	milestones_size = 0;
-	current_milestone = 0;
-	current_timestamp = 0;
-	g_nominal_time = 0;
+// the state of account_hit(), also what R5_1 resets per session
+void accounting_reset() {
+	int i;
+
+	behind_mask = 0;
 	n_times_pt = 0;
 	tail_times_pt = 0;
-	g_real_time = 0;
 	n_slack_ct = 0;
 	tail_violation_ct = 0;
 	p_slack_ct = 0;
 	resume_pt=0;
 	pause_pt=0;
-
-	int i;
-	for(i=0; i< MSG_BUFFER_SIZE; i++){
-		milestone_graph[i] = 0xffffffff;
+	budget_duty = BUDGET_FULL;
+	for(i=0; i<TRACE_STREAMS; i++){
+		g_nominal_time[i] = 0;
+		g_scaled_time[i] = 0;
+		g_real_time[i] = 0;
+		stream_duty[i] = BUDGET_FULL;
 	}
 	for(i=0; i<MS_LOG_SIZE; i++){
 		n_times[i] = 0;
@@ -71,15 +108,47 @@ void etm_reset() {
 	}
 }
 
+void etm_reset() {
+	print("RPU ETM config reset.\n\r");
+	accounting_reset();
+	milestones = MILESTONES;
+	milestones_size = 0;
+	current_milestone = 0;
+	current_timestamp = 0;
+	done_mask = 0;
+	graph_compiled = 0;
+	graph_paged = 0;
+	num_page_loads = 0;
+	num_reprograms = 0;
+	num_reprogram_skips = 0;
+	blind_ticks = 0;
+	blind_max = 0;
+
+	int i,j;
+	for(i=0; i<TRACE_STREAMS; i++){
+		for(j=0; j<4; j++){
+			cmp_lo[i][j] = 0xffffffff;
+			cmp_hi[i][j] = 0xffffffff;
+		}
+	}
+	for(i=0; i< MSG_BUFFER_SIZE; i++){
+		milestone_graph[i] = 0xffffffff;
+	}
+}
+
 
-void etm_disable() {
-	*prog_ctrl = 0x0;
-	while (!(*trace_status & 0x1));
+void etm_disable(uint32_t core) {
+	*A53_ETM(core, TRCPRGCTLR) = 0x0;
+#ifndef TRACER_REPLAY	// the registers are plain memory in tracer/replay, TRCSTATR never changes
+	while (!(*A53_ETM(core, TRCSTATR) & 0x1));
+#endif
 }
 
-void etm_enable() {
-	*prog_ctrl = 0x1;
-	while ((*trace_status) & 0x1);
+void etm_enable(uint32_t core) {
+	*A53_ETM(core, TRCPRGCTLR) = 0x1;
+#ifndef TRACER_REPLAY
+	while (*A53_ETM(core, TRCSTATR) & 0x1);
+#endif
 }
 
 void etr_disable() {
@@ -92,87 +161,376 @@ void etr_enable() {
 
 void etr_man_flush() {
 	*etr_ffcr |= (0x1 << 6);
+#ifdef TRACER_REPLAY
+	sched_yield();	// an idle poll, the harness that feeds the buffer may share the CPU
+#endif
 }
 
-void set_addr_cmp(uint32_t addr, int num) {
-	switch (num) {
-	case 0:
-		*addr_cmp_0 = addr;
-		*addr_cmp_1 = addr;
-		break;
-	case 1:
-		*addr_cmp_2 = addr;
-		*addr_cmp_3 = addr;
-		break;
-	case 2:
-		*addr_cmp_4 = addr;
-		*addr_cmp_5 = addr;
-		break;
-	case 3:
-		*addr_cmp_6 = addr;
-		*addr_cmp_7 = addr;
-		break;
-	default:
-		break;
-	}
-}
-
-void update_graph_milestone(uint32_t address) {
-	// potential bug, Trace on might emit at none traced range, so some opt should be done, like add a flag
-	etm_disable();
-	int i,j;
-	for(i=0; i< relay.n_valid; i++) {
-		if (relay.address[i] == address) {
-			g_nominal_time += relay.nominal_t[i];
-			n_times[n_times_pt++] = g_nominal_time;
-			tail_times[tail_times_pt++] = relay.tail_t[i];
-			if (g_real_time > g_nominal_time * alpha) {
-				if(bandwidth_control==1) {
-				pauses[pause_pt++] = n_times_pt - 1;
-				bandwidth_control = 0;
-				}
-			} else if (g_real_time < g_nominal_time * alpha - margin) {
-				if(bandwidth_control==0){
-				resumes[resume_pt++] = n_times_pt - 1;
-				bandwidth_control = 1;
+// RWP, RRP and DBALO hold bus addresses of the buffer, the R5 sees it at etr_buffer
+uint32_t etr_buffer_base() {
+	return *etr_dbalo;
+}
+
+uint32_t etr_write_pointer() {
+	return *etr_rwp;
+}
+
+void etr_set_read_pointer(uint32_t addr) {
+	*etr_rrp = addr;
+}
+
+// pair num of the ETM of core traces lo to hi, both included
+static void set_addr_range(uint32_t core, uint32_t lo, uint32_t hi, int num) {
+	if (num < 0 || num >= 4)
+		return;
+	cmp_lo[core][num] = lo;
+	cmp_hi[core][num] = hi;
+	*A53_ETM(core, TRCACVR0 + 16 * num) = lo;
+	*A53_ETM(core, TRCACVR1 + 16 * num) = hi;
+}
+
+void set_addr_cmp(uint32_t core, uint32_t addr, int num) {
+	set_addr_range(core, addr, addr, num);
+}
+
+/*
+	A graph that fits is copied into milestone_graph. A larger one is read
+	from OCM through graph_word(), milestone_graph then holds GRAPH_PAGES
+	pages of it, direct mapped, loaded on the first access. Either way all
+	of it is read once first, against the checksum the host wrote after it;
+	returns 0 on a mismatch, the graph is not used then.
+*/
+uint32_t graph_cache(volatile uint32_t *src, uint32_t size) {
+	uint32_t c = 0;
+	int i;
+
+	Xil_DCacheInvalidateRange((INTPTR) src, (size + 1) * 4);
+	for(i=0; i<size; i++){
+		c = ((c << 1) | (c >> 31)) ^ src[i];
+	}
+	if (c != src[size]) {
+		xil_printf("Graph checksum 0x%x, the host wrote 0x%x\n\r", c, src[size]);
+		return 0;
+	}
+
+	graph_src = src;
+	graph_size = size;
+	graph_paged = size > MSG_BUFFER_SIZE;
+	if (graph_paged) {
+		for(i=0; i<GRAPH_PAGES; i++){
+			page_tag[i] = 0xffffffff;
+		}
+		xil_printf("Graph of %d words paged, %d pages of %d words\n\r", size, GRAPH_PAGES, GRAPH_PAGE_WORDS);
+		return 1;
+	}
+	for(i=0; i<size; i++){
+		milestone_graph[i] = src[i];
+	}
+	return 1;
+}
+
+static inline uint32_t graph_word(uint32_t i) {
+	if (!graph_paged)
+		return milestone_graph[i];
+
+	uint32_t page = i / GRAPH_PAGE_WORDS;
+	uint32_t frame = page % GRAPH_PAGES;
+	uint32_t *dst = &milestone_graph[frame * GRAPH_PAGE_WORDS];
+	if (page_tag[frame] != page) {
+		volatile uint32_t *src = &graph_src[page * GRAPH_PAGE_WORDS];
+		int k;
+		Xil_DCacheInvalidateRange((INTPTR) src, GRAPH_PAGE_WORDS * 4);
+		for(k=0; k<GRAPH_PAGE_WORDS; k++){
+			dst[k] = src[k];
+		}
+		page_tag[frame] = page;
+		num_page_loads++;
+	}
+	return dst[i % GRAPH_PAGE_WORDS];
+}
+
+// the scaled nominal_t at word w, a paged graph has no room for them
+static inline uint32_t scaled_word(uint32_t w) {
+	return graph_paged ? Q16_SCALE(graph_word(w), alpha_q16) : scaled_graph[w / 2];
+}
+
+/*
+	Scales every edge once alpha_q16 is set, the hits then only read them.
+	A .ttmsg is a run of nodes: address, tail_t, (offset, nominal_t) per
+	successor and an 0xffffffff offset; a compiled graph a run of records.
+*/
+static void scale_graph(void) {
+	uint32_t w;
+
+	if (graph_paged)
+		return;
+	if (graph_compiled) {
+		for(w=ctmg_succ_w + 1; w<graph_size; w+=CTMG_SUCC_WORDS){
+			scaled_graph[w / 2] = Q16_SCALE(graph_word(w), alpha_q16);
+		}
+		return;
+	}
+	w = 0;
+	while (w + 2 < graph_size) {
+		for(w+=2; w + 1 < graph_size && graph_word(w) != 0xffffffff; w+=2){
+			scaled_graph[(w + 1) / 2] = Q16_SCALE(graph_word(w + 1), alpha_q16);
+		}
+		w++;
+	}
+}
+
+/*
+	Returns the address of the first milestone and its relay offset in entry:
+	the word offset of the node in a .ttmsg graph, the node index in a compiled one
+*/
+uint32_t graph_load(uint32_t *entry) {
+	if (graph_word(0) != CTMG_MAGIC) {
+		graph_compiled = 0;
+		scale_graph();
+		*entry = 0;
+		return graph_word(0);
+	}
+	if (graph_word(1) != CTMG_VERSION) {
+		xil_printf("Compiled graph version %d, expected %d, recompile it with tmg_compile.py\n\r", graph_word(1), CTMG_VERSION);
+		graph_compiled = 0;
+		*entry = 0;
+		return 0;
+	}
+	uint32_t n = graph_word(2);
+	graph_compiled = 1;
+	ctmg_first_w = CTMG_HEADER_WORDS + n;
+	ctmg_count_w = CTMG_HEADER_WORDS + 2 * n;
+	ctmg_succ_w = (CTMG_HEADER_WORDS + 3 * n + 3) & ~3;
+	*entry = graph_word(3);
+	scale_graph();
+	xil_printf("Compiled graph, %d nodes\n\r", n);
+	return graph_word(CTMG_HEADER_WORDS + *entry);
+}
+
+/*
+	The corunner share for a stream lag us behind: falls linearly to 0 at
+	throttle_span, up to 16 s; without a span any lag stops them.
+*/
+static uint32_t lag_duty(uint32_t lag) {
+	if (throttle_span == 0 || lag >= throttle_span || lag >= (1 << 24))
+		return 0;
+	return BUDGET_FULL - lag * BUDGET_FULL / throttle_span;
+}
+
+/*
+	A hit of stream s against its nominal time. A stream behind pauses the
+	corunners, they resume once no stream is behind and this one is ahead by
+	the margin; with one stream the compares of a single relay. Runs on
+	R5_1 in dual mode, real_t is then the time R5_0 measured. The budget
+	follows the stream furthest behind, bandwidth_control stays stop and go.
+*/
+void account_hit(uint32_t s, uint32_t address, uint32_t nominal_t, uint32_t scaled_t, uint32_t tail_t, uint32_t real_t) {
+	uint32_t decision = 0;
+
+	g_real_time[s] = real_t;
+	g_nominal_time[s] += nominal_t;
+	g_scaled_time[s] += scaled_t;
+	n_times[n_times_pt++] = g_nominal_time[s];
+	tail_times[tail_times_pt++] = tail_t;
+	if (g_real_time[s] > g_scaled_time[s]) {
+		behind_mask |= 1 << s;
+		stream_duty[s] = lag_duty(g_real_time[s] - g_scaled_time[s]);
+		if(*bw_ctl==1) {
+		pauses[pause_pt++] = n_times_pt - 1;
+		*bw_ctl = 0;
+		decision = TELEMETRY_PAUSE;
+		}
+	} else if (g_scaled_time[s] - g_real_time[s] > margin) {
+		behind_mask &= ~(1 << s);
+		if(*bw_ctl==0 && behind_mask==0){
+		resumes[resume_pt++] = n_times_pt - 1;
+		*bw_ctl = 1;
+		decision = TELEMETRY_RESUME;
+		}
+	}
+//	else if (g_real_time > relay.tail_t[i] * alpha ) {
+//		if(bandwidth_control==1){
+//		pauses[pause_pt++] = n_times_pt - 1;
+//		bandwidth_control = 0;
+//		}
+//	}
+	uint32_t duty = BUDGET_FULL;
+	int i;
+	for(i=0; i<TRACE_STREAMS; i++){
+		if ((behind_mask & (1 << i)) && stream_duty[i] < duty)
+			duty = stream_duty[i];
+	}
+	if (duty != budget_duty) {
+		budget_duty = duty;
+		session_set_budget(duty, throttle_period);
+	}
+	if (*bw_ctl)
+		decision |= TELEMETRY_BW_ON;
+	decision |= s << TELEMETRY_STREAM_SHIFT;
+	decision |= budget_duty << TELEMETRY_DUTY_SHIFT;
+	LATENCY_MARK(LAT_DECIDED);
+	telemetry_push(address, g_nominal_time[s], tail_t, g_real_time[s], decision);
+}
+
+// the hit of relay slot i of stream s, accounted here or posted to R5_1
+static void account_milestone(uint32_t s, uint32_t i) {
+	milestone_relay *relay = &relays[s];
+
+	if (dual_r5)
+		mailbox_post(MAILBOX_HIT, s, relay->address[i], relay->nominal_t[i], relay->scaled_t[i],
+				relay->tail_t[i], g_real_time[s]);
+	else
+		account_hit(s, relay->address[i], relay->nominal_t[i], relay->scaled_t[i],
+				relay->tail_t[i], g_real_time[s]);
+}
+
+/*
+	Up to 4 successors get a pair each. More are sorted and the three widest
+	gaps between them split them into 4 ranges, the narrowest cover; the
+	trace loop tells the successors apart by the address packets.
+*/
+static void schedule_comparators(uint32_t n) {
+	uint32_t sorted[RELAY_MAX_SUCC];
+	uint32_t cut[3] = {0, 0, 0};	// indices in sorted that start a new range
+	int k, m;
+
+	if (n <= 4) {
+		for(k=0; k<n; k++){
+			new_lo[k] = tmp_relay.address[k];
+			new_hi[k] = tmp_relay.address[k];
+		}
+		return;
+	}
+
+	for(k=0; k<n; k++){
+		uint32_t a = tmp_relay.address[k];
+		for(m=k; m>0 && sorted[m-1] > a; m--){
+			sorted[m] = sorted[m-1];
+		}
+		sorted[m] = a;
+	}
+	for(k=1; k<n; k++){
+		uint32_t gap = sorted[k] - sorted[k-1];
+		for(m=0; m<3; m++){
+			if (cut[m] == 0 || gap > sorted[cut[m]] - sorted[cut[m]-1]) {
+				int l;
+				for(l=2; l>m; l--){
+					cut[l] = cut[l-1];
 				}
+				cut[m] = k;
+				break;
 			}
-//			else if (g_real_time > relay.tail_t[i] * alpha ) {
-//				if(bandwidth_control==1){
-//				pauses[pause_pt++] = n_times_pt - 1;
-//				bandwidth_control = 0;
-//				}
-//			}
-			break;
 		}
 	}
-	for(j=0; j<4; j++){
-		uint32_t position = (relay.offset[i]) + 2 + 2 * j;
-		uint32_t val = milestone_graph[position];
-		if (val != 0xffffffff) {
-			uint32_t new_address = milestone_graph[val/4];
-			uint32_t new_offset = val/4;
-			tmp_relay.address[j] = new_address;
-			tmp_relay.offset[j] = new_offset;
-			tmp_relay.tail_t[j] = milestone_graph[new_offset + 1];
-			tmp_relay.nominal_t[j] = milestone_graph[position + 1];
-			set_addr_cmp(new_address, j);
-		} else {
-			break;
+	// cut in address order
+	for(k=1; k<3; k++){
+		uint32_t c = cut[k];
+		for(m=k; m>0 && cut[m-1] > c; m--){
+			cut[m] = cut[m-1];
+		}
+		cut[m] = c;
+	}
+	new_lo[0] = sorted[0];
+	for(k=0; k<3; k++){
+		new_hi[k] = sorted[cut[k]-1];
+		new_lo[k+1] = sorted[cut[k]];
+	}
+	new_hi[3] = sorted[n-1];
+}
+
+/*
+	The comparators can only be written while the ETM is idle, no trace is
+	generated from etm_disable() to etm_enable(). With partial_reprogram only
+	the pairs whose range changes are written, and a loop back to the same
+	milestones skips the disable/enable handshake altogether.
+*/
+static void reprogram_comparators(uint32_t core, uint32_t n) {
+	XTime t0, t1;
+	uint32_t changed = 0;
+	uint32_t pairs = n < 4 ? n : 4;
+	int k;
+
+	schedule_comparators(n);
+	for(k=0; k<pairs; k++){
+		if (!partial_reprogram || cmp_lo[core][k] != new_lo[k] || cmp_hi[core][k] != new_hi[k])
+			changed |= 1 << k;
+	}
+	if (!changed) {
+		num_reprogram_skips++;
+		return;
+	}
+
+	XTime_GetTime(&t0);
+	etm_disable(core);
+	for(k=0; k<pairs; k++){
+		if (changed & (1 << k))
+			set_addr_range(core, new_lo[k], new_hi[k], k);
+	}
+	etm_enable(core);
+	XTime_GetTime(&t1);
+
+	num_reprograms++;
+	blind_ticks += t1 - t0;
+	if (t1 - t0 > blind_max)
+		blind_max = t1 - t0;
+}
+
+// slot is the relay entry the trace of stream s, and of A53 core s, matched
+void update_graph_milestone(uint32_t s, uint32_t slot) {
+	// potential bug, Trace on might emit at none traced range, so some opt should be done, like add a flag
+	milestone_relay *relay = &relays[s];
+	int i,j;
+	account_milestone(s, slot);
+	if (graph_compiled) {
+		// one run of records, no chasing of successor offsets
+		uint32_t node = relay->offset[slot];
+		uint32_t n = graph_word(ctmg_count_w + node);
+		uint32_t rec = ctmg_succ_w + CTMG_SUCC_WORDS * graph_word(ctmg_first_w + node);
+		if (n > RELAY_MAX_SUCC)
+			n = RELAY_MAX_SUCC;
+		for(j=0; j<n; j++, rec += CTMG_SUCC_WORDS){
+			tmp_relay.address[j] = graph_word(rec);
+			tmp_relay.nominal_t[j] = graph_word(rec + 1);
+			tmp_relay.tail_t[j] = graph_word(rec + 2);
+			tmp_relay.offset[j] = graph_word(rec + 3);
+			tmp_relay.scaled_t[j] = scaled_word(rec + 1);
+		}
+	} else {
+		for(j=0; j<RELAY_MAX_SUCC; j++){
+			uint32_t position = (relay->offset[slot]) + 2 + 2 * j;
+			uint32_t val = graph_word(position);
+			if (val != 0xffffffff) {
+				uint32_t new_address = graph_word(val/4);
+				uint32_t new_offset = val/4;
+				tmp_relay.address[j] = new_address;
+				tmp_relay.offset[j] = new_offset;
+				tmp_relay.tail_t[j] = graph_word(new_offset + 1);
+				tmp_relay.nominal_t[j] = graph_word(position + 1);
+				tmp_relay.scaled_t[j] = scaled_word(position + 1);
+			} else {
+				break;
+			}
 		}
 	}
-	relay.n_valid = j;
-	etm_enable();
+	relay->n_valid = j;
+	reprogram_comparators(s, j);
+	LATENCY_MARK(LAT_REPROGRAMMED);
 
-	if (!relay.n_valid) { // this means the last milestone is reached
-		running = 0;
-		report_results();
+	if (!relay->n_valid) { // this means the last milestone is reached
+		done_mask |= 1 << s;
+		if (done_mask == (stream_mask ? stream_mask : 0x1)) {
+			if (dual_r5)
+				mailbox_post(MAILBOX_END, 0, 0, 0, 0, 0, 0);
+			running = 0;
+			report_results();
+		}
 	}
 
-	for(i=0;i<relay.n_valid;i++) {
-		relay.address[i] = tmp_relay.address[i];
-		relay.offset[i] = tmp_relay.offset[i];
-		relay.nominal_t[i] = tmp_relay.nominal_t[i];
-		relay.tail_t[i] = tmp_relay.tail_t[i];
+	for(i=0;i<relay->n_valid;i++) {
+		relay->address[i] = tmp_relay.address[i];
+		relay->offset[i] = tmp_relay.offset[i];
+		relay->nominal_t[i] = tmp_relay.nominal_t[i];
+		relay->tail_t[i] = tmp_relay.tail_t[i];
+		relay->scaled_t[i] = tmp_relay.scaled_t[i];
 	}
 }
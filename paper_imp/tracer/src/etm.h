@@ -2,6 +2,7 @@
 #define ETM_H
 
 #include "zcu_cs.h"
+#include "graph_layout.h"
 #include "xil_printf.h"
 #include "xtime_l.h"
 
@@ -83,29 +84,55 @@
 #define TRCCIDCCTLR 0x680
 
 #define MSG_BUFFER_SIZE (1024*2)
+// in words, the graph the host copies to OCM, up to the telemetry ring: after a tag, the size
+// and the words, their checksum (cfg/tmg_format.py)
+#define MSG_OCM_SIZE ((0xfffd0000 - 0xfffc0000) / 4 - 3)
 #define MS_LOG_SIZE (1500)
+// in words, the ETR buffer of tracee start.cpp -DR5 is 8 * 1024 * 4 bytes; a power of two
 #define ETR_BUFFER_SIZE (1024*8)
 
+// a graph larger than milestone_graph stays in OCM and is paged into it
+#define GRAPH_PAGE_WORDS 64
+#define GRAPH_PAGES (MSG_BUFFER_SIZE / GRAPH_PAGE_WORDS)
+
+// stream n is trace ID n + 1, from A53 core n; without the formatter only stream 0
+#define TRACE_STREAMS 4
+
 typedef struct milestone_relay {
 	uint8_t   n_valid;
-	uint32_t  address[4];
-	uint32_t  offset[4];
-	uint32_t  nominal_t[4];
-	uint32_t  tail_t[4];
+	uint32_t  address[RELAY_MAX_SUCC];
+	uint32_t  offset[RELAY_MAX_SUCC];
+	uint32_t  nominal_t[RELAY_MAX_SUCC];
+	uint32_t  tail_t[RELAY_MAX_SUCC];
+	uint32_t  scaled_t[RELAY_MAX_SUCC];	// nominal_t * alpha, for the regulation compares
 } milestone_relay;
 
+// alpha and beta in Q16.16, converted once in start()
+#define Q16_ONE (1 << 16)
+#define Q16_SCALE(v, q) ((uint32_t) (((uint64_t) (v) * (q)) >> 16))
+
 extern volatile uint32_t * milestones;
 extern volatile uint32_t *milestone_type;
 extern uint32_t milestones_size;
 extern uint32_t current_milestone;
 extern uint32_t current_timestamp;
 
-void etm_disable();
-void etm_enable();
+void etm_disable(uint32_t core);
+void etm_enable(uint32_t core);
 void etr_disable();
 void etr_enable();
 void etr_man_flush();
+uint32_t etr_buffer_base();
+uint32_t etr_write_pointer();
+void etr_set_read_pointer(uint32_t addr);
 
-void update_graph_milestone(uint32_t address);
+uint32_t graph_cache(volatile uint32_t *src, uint32_t size);
+uint32_t graph_load(uint32_t *entry);
+void set_addr_cmp(uint32_t core, uint32_t addr, int num);
+void accounting_reset();
+void account_hit(uint32_t s, uint32_t address, uint32_t nominal_t, uint32_t scaled_t, uint32_t tail_t, uint32_t real_t);
+void update_graph_milestone(uint32_t s, uint32_t slot);
+// trace.c, once the last milestone of every stream is reached
+void report_results(void);
 
 #endif
@@ -0,0 +1,17 @@
+#ifndef GRAPH_LAYOUT_H
+#define GRAPH_LAYOUT_H
+
+// the graph words the host copies to OCM, tracee/include/tmg.h includes it
+
+// compiled graph of cfg/tmg_compile.py: header, node_addr[n], succ_first[n], succ_count[n],
+// then from the next 16 byte boundary the successor records, 4 words each:
+// address, nominal_t, tail_t and index of the successor
+#define CTMG_MAGIC 0x474d5443
+#define CTMG_VERSION 2
+#define CTMG_HEADER_WORDS 4
+#define CTMG_SUCC_WORDS 4
+
+// successors followed per milestone, more than 4 share the comparator pairs as ranges
+#define RELAY_MAX_SUCC 16
+
+#endif
@@ -0,0 +1,72 @@
+#include "latency.h"
+
+#ifdef TRACER_LATENCY
+#include "xil_printf.h"
+
+static const char *stage_names[LAT_STAGES] = {"decoded", "timed", "decided", "reprogrammed"};
+static uint32_t hist[LAT_STAGES][LAT_BUCKETS];
+static uint32_t worst[LAT_STAGES];
+static uint32_t data_ccnt = 0;	// cycle count when the last trace word was fetched
+
+#ifdef TRACER_REPLAY
+#include <time.h>
+
+// tracer/replay has no PMCCNTR, the latencies are in ns of the host
+static inline uint32_t ccnt(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint32_t) (t.tv_sec * 1000000000ull + t.tv_nsec);
+}
+#else
+static inline uint32_t ccnt(void) {
+	uint32_t v;
+	__asm__ volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (v));
+	return v;
+}
+#endif
+
+// PMCCNTR on, counting every cycle
+void latency_init(void) {
+	int i, j;
+
+#ifndef TRACER_REPLAY
+	uint32_t pmcr;
+	__asm__ volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (pmcr));
+	pmcr = (pmcr | 0x5) & ~0x8;	// E, C reset, no divide by 64
+	__asm__ volatile("mcr p15, 0, %0, c9, c12, 0" : : "r" (pmcr));
+	__asm__ volatile("mcr p15, 0, %0, c9, c12, 1" : : "r" (0x80000000));
+#endif
+
+	for (i = 0; i < LAT_STAGES; ++i) {
+		worst[i] = 0;
+		for (j = 0; j < LAT_BUCKETS; ++j)
+			hist[i][j] = 0;
+	}
+}
+
+void latency_data(void) {
+	data_ccnt = ccnt();
+}
+
+void latency_mark(int stage) {
+	uint32_t cycles = ccnt() - data_ccnt;
+
+	hist[stage][cycles ? 31 - __builtin_clz(cycles) : 0]++;
+	if (cycles > worst[stage])
+		worst[stage] = cycles;
+}
+
+void latency_report(void) {
+	int i, j;
+
+	print("LATENCY BEGIN\n\r");
+	for (i = 0; i < LAT_STAGES; ++i) {
+		xil_printf("%s,worst,%d\n\r", stage_names[i], worst[i]);
+		for (j = 0; j < LAT_BUCKETS; ++j) {
+			if (hist[i][j])
+				xil_printf("%s,%d,%d\n\r", stage_names[i], 1 << j, hist[i][j]);
+		}
+	}
+	print("LATENCY END\n\r");
+}
+#endif
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+/*
+	Reaction latency of the tracer, built with -DTRACER_LATENCY: R5 cycles
+	from the trace word that completed a milestone packet to each stage of
+	its handling, in log2 buckets, printed by report_results().
+*/
+#define LAT_DECODED		0	// address packet decoded and matched
+#define LAT_TIMED		1	// register_timing() done
+#define LAT_DECIDED		2	// throttle decision taken
+#define LAT_REPROGRAMMED	3	// comparators of the next milestones set
+#define LAT_STAGES		4
+#define LAT_BUCKETS		32
+
+#ifdef TRACER_LATENCY
+void latency_init(void);
+void latency_data(void);
+void latency_mark(int stage);
+void latency_report(void);
+#define LATENCY_INIT()		latency_init()
+#define LATENCY_DATA()		latency_data()
+#define LATENCY_MARK(stage)	latency_mark(stage)
+#define LATENCY_REPORT()	latency_report()
+#else
+#define LATENCY_INIT()
+#define LATENCY_DATA()
+#define LATENCY_MARK(stage)
+#define LATENCY_REPORT()
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+#include "mailbox.h"
+#include "xil_cache.h"
+#include "xpseudo_asm.h"
+
+static mailbox *box = (mailbox *) MAILBOX_BASE;
+static uint32_t head = 0;		// R5_0
+static uint32_t tail_seen = 0;
+static uint32_t session = 0;
+static uint32_t tail = 0;		// R5_1
+
+static inline void flush(volatile void *p, uint32_t size) {
+	Xil_DCacheFlushRange((INTPTR) p, size);
+}
+
+static inline void invalidate(volatile void *p, uint32_t size) {
+	Xil_DCacheInvalidateRange((INTPTR) p, size);
+}
+
+// R5_0, a new session; R5_1 starts over from event 0 when it sees it
+void mailbox_init(uint32_t bw_addr, uint32_t margin, uint32_t throttle_span, uint32_t throttle_period) {
+	head = 0;
+	tail_seen = 0;
+	box->cons.tail = 0;
+	flush(&box->cons, sizeof(mailbox_consumer));
+
+	invalidate(&box->prod, sizeof(mailbox_producer));
+	session = box->prod.magic == MAILBOX_MAGIC ? box->prod.session + 1 : 1;
+	box->prod.head = 0;
+	box->prod.bw_addr = bw_addr;
+	box->prod.margin = margin;
+	box->prod.throttle_span = throttle_span;
+	box->prod.throttle_period = throttle_period;
+	box->prod.session = session;
+	box->prod.magic = MAILBOX_MAGIC;
+	flush(&box->prod, sizeof(mailbox_producer));
+}
+
+// R5_0, waits for room: a hit must not be lost to the regulation
+void mailbox_post(uint32_t type, uint32_t stream, uint32_t address, uint32_t nominal_t,
+		uint32_t scaled_t, uint32_t tail_t, uint32_t real_t) {
+	while (head - tail_seen >= MAILBOX_EVENTS) {
+		invalidate(&box->cons, sizeof(mailbox_consumer));
+		tail_seen = box->cons.tail;
+	}
+
+	mailbox_event *ev = &box->events[head & (MAILBOX_EVENTS - 1)];
+	ev->type = type;
+	ev->stream = stream;
+	ev->address = address;
+	ev->nominal_t = nominal_t;
+	ev->scaled_t = scaled_t;
+	ev->tail_t = tail_t;
+	ev->real_t = real_t;
+	flush(ev, sizeof(mailbox_event));
+
+	head++;
+	dmb();
+	box->prod.head = head;
+	flush(&box->prod, sizeof(mailbox_producer));
+}
+
+// R5_1, the session R5_0 last started, 0 before any
+uint32_t mailbox_session(void) {
+	invalidate(&box->prod, sizeof(mailbox_producer));
+	return box->prod.magic == MAILBOX_MAGIC ? box->prod.session : 0;
+}
+
+void mailbox_attach(uint32_t *bw_addr, uint32_t *margin, uint32_t *throttle_span, uint32_t *throttle_period) {
+	invalidate(&box->prod, sizeof(mailbox_producer));
+	*bw_addr = box->prod.bw_addr;
+	*margin = box->prod.margin;
+	*throttle_span = box->prod.throttle_span;
+	*throttle_period = box->prod.throttle_period;
+	tail = 0;
+}
+
+// R5_1, the next event or 0 if none is posted
+mailbox_event *mailbox_take(void) {
+	invalidate(&box->prod, sizeof(mailbox_producer));
+	if (box->prod.head == tail)
+		return 0;
+	dmb();
+	mailbox_event *ev = &box->events[tail & (MAILBOX_EVENTS - 1)];
+	invalidate(ev, sizeof(mailbox_event));
+	return ev;
+}
+
+void mailbox_release(void) {
+	tail++;
+	box->cons.tail = tail;
+	flush(&box->cons, sizeof(mailbox_consumer));
+}
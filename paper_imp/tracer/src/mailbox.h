@@ -0,0 +1,60 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+
+/*
+	Dual R5 mode: R5_0 decodes and posts every milestone hit here, R5_1
+	(regulator.c, built with -DTRACER_REGULATOR) does the slack accounting,
+	the throttling and the telemetry. Single producer, single consumer, each
+	side writing its own cache line of the header, as the telemetry ring.
+*/
+#define MAILBOX_BASE	0xfffe0400	// OCM, past the telemetry ring, clear of the ATF at 0xfffea000
+#define MAILBOX_MAGIC	0x584f424d	// "MBOX"
+#define MAILBOX_EVENTS	256			// a power of two
+
+#define MAILBOX_HIT		1
+#define MAILBOX_END		2			// the last milestone of every stream was reached
+
+typedef struct mailbox_producer {
+	uint32_t magic;
+	uint32_t session;	// counts the runs of R5_0
+	uint32_t head;		// events posted
+	uint32_t bw_addr;	// global address of bandwidth_control, in R5_0 TCM
+	uint32_t margin;
+	uint32_t throttle_span;
+	uint32_t throttle_period;
+	uint32_t reserved;
+} mailbox_producer;
+
+typedef struct mailbox_consumer {
+	uint32_t tail;		// events taken
+	uint32_t reserved[7];
+} mailbox_consumer;
+
+typedef struct mailbox_event {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t address;
+	uint32_t nominal_t;
+	uint32_t scaled_t;
+	uint32_t tail_t;
+	uint32_t real_t;	// cumulative real time of the stream, us
+	uint32_t reserved;
+} mailbox_event;
+
+typedef struct mailbox {
+	mailbox_producer prod;
+	mailbox_consumer cons;
+	mailbox_event events[MAILBOX_EVENTS];
+} mailbox;
+
+void mailbox_init(uint32_t bw_addr, uint32_t margin, uint32_t throttle_span, uint32_t throttle_period);
+void mailbox_post(uint32_t type, uint32_t stream, uint32_t address, uint32_t nominal_t,
+		uint32_t scaled_t, uint32_t tail_t, uint32_t real_t);
+uint32_t mailbox_session(void);
+void mailbox_attach(uint32_t *bw_addr, uint32_t *margin, uint32_t *throttle_span, uint32_t *throttle_period);
+mailbox_event *mailbox_take(void);
+void mailbox_release(void);
+
+#endif
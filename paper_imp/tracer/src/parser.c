@@ -4,6 +4,10 @@
 #include "xtime_l.h"
 #include "etm.h"
 #include "xil_cache.h"
+#include "telemetry.h"
+#include "latency.h"
+#include "mailbox.h"
+#include "session.h"
 
 volatile uint32_t etr_buffer_unused[ETR_BUFFER_SIZE] __attribute__((section(".trc_buf_zone")));
 volatile uint32_t * etr_buffer = &etr_buffer_unused[0]; //(uint32_t *) 0xB0000000;
@@ -12,13 +16,24 @@ volatile uint32_t bandwidth_control = 1;
 volatile float alpha = 1.3;
 volatile float beta = 1;
 volatile uint32_t t_end = 0;
+volatile uint32_t rwp_mode = 0;	// 1: follow the ETR write pointer, no 0xdeadbeef sentinels
+volatile uint32_t flush_us = 0;	// manual ETR flush after this long without data, 0 on every empty poll
+volatile uint32_t partial_reprogram = 1;	// 0 rewrites all comparators on every milestone
+volatile uint32_t stream_mask = 0;	// 0: one unformatted stream, else formatted, bit n for trace ID n + 1
+volatile uint32_t dual_r5 = 0;	// 1: R5_1 runs regulator.c, hits go to it through the mailbox
+volatile uint32_t throttle_span = 0;	// us behind at which the corunner budget is 0, 0: stop and go
+volatile uint32_t throttle_period = 1000;	// us, the period of the corunner budget
 uint32_t margin = 0;
+uint32_t alpha_q16 = 0;
 
 extern void trace_loop(void);
-extern milestone_relay relay;
+#ifdef TRACER_REPLAY
+extern void replay_stopped(void);
+#endif
+extern milestone_relay relays[TRACE_STREAMS];
 extern uint32_t milestone_graph[MSG_BUFFER_SIZE];
 
-uint32_t buffer_pointer; // pointer to individual bytes in etr_buffer
+uint32_t buffer_pointer; // byte offset in etr_buffer of the words the trace loop fetched
 uint32_t cur_word_index = 0 ;
 uint32_t rounds = 0;
 static uint32_t last_word = 0xdeadbeef;
@@ -32,7 +47,15 @@ void parser_reset() {
 	alpha = 1.3;
 	beta = 1;
 	t_end = 0;
+	rwp_mode = 0;
+	flush_us = 0;
+	partial_reprogram = 1;
+	stream_mask = 0;
+	dual_r5 = 0;
+	throttle_span = 0;
+	throttle_period = 1000;
 	margin = 0;
+	alpha_q16 = 0;
 	cur_word_index = 0 ;
 	rounds = 0;
 	last_word = 0xdeadbeef;
@@ -40,29 +63,30 @@ void parser_reset() {
 }
 
 
-void cache_graph(volatile uint32_t *src, uint32_t size, uint32_t *dst) {
-	int i=0;
-	for(i=0; i< size; i++) {
-		dst[i] = src[i];
-	}
-}
-
-void init_relay(milestone_relay *relay) {
+void init_relay(milestone_relay *relay, uint32_t address, uint32_t entry) {
 	relay -> n_valid      = 1;
-	relay -> address[0]   = milestone_graph[0];
-	relay -> offset[0]    = 0;
+	relay -> address[0]   = address;
+	relay -> offset[0]    = entry;
 	relay -> nominal_t[0] = 0;
 	relay -> tail_t[0]    = 0;
+	relay -> scaled_t[0]  = 0;
 }
 
 
 void check_stop_condition(void) {
 	if (running == 0) {
 		xil_printf("Running Stopped\n\r");
-		xil_printf("Buffer used: %d/%d\n\r", rounds * ETR_BUFFER_SIZE + buffer_pointer, ETR_BUFFER_SIZE);
+		xil_printf("Buffer used: %d/%d\n\r", rounds * ETR_BUFFER_SIZE * 4 + buffer_pointer, ETR_BUFFER_SIZE * 4);
 		Xil_DCacheFlush(); // if DCache not flushed, buffer dump would not work correctly. However not guarantee to work
-
-		while(running == 0);
+#ifdef TRACER_REPLAY
+		replay_stopped();	// the host harness takes over, does not return
+#endif
+
+		// a new session from the host resets the tracer as running = 2 does
+		while(running == 0) {
+			if (session_pending())
+				running = 2;
+		}
 		if(running==2) {
 			;
 		}
@@ -88,41 +112,95 @@ void start() {
     xil_printf("\n\r");
     xil_printf("TPAw0v Tracer. T-Graph Circular Buffer. Stack at 0x%x\n\r", &i);
     xil_printf("Global Tightly Couple Memory addr offset: 0xffe00000\n\r");
-    xil_printf("Tracer   ctl: %x, sizeof(Xtime)=%d\n\r", (uint32_t) &running, sizeof(XTime));
-    xil_printf("Corunner ctl: %x\n\r", (uint32_t) &bandwidth_control);
-    xil_printf("alpha    ctl: %x\n\r", (uint32_t) &alpha);
-    xil_printf("beta     ctl: %x\n\r", (uint32_t) &beta);
-    xil_printf("T_nom    ctl: %x\n\r", (uint32_t) &t_end);
-    print("Set alpha ,beta, t_end before run application!\n\r");
-    print("Can be set from host by devmem\n\r");
-    usleep(20000000);
+    xil_printf("Tracer   ctl: %x, sizeof(Xtime)=%d\n\r", (uint32_t) (uintptr_t) &running, sizeof(XTime));
+    xil_printf("Corunner ctl: %x\n\r", (uint32_t) (uintptr_t) &bandwidth_control);
+    xil_printf("alpha    ctl: %x\n\r", (uint32_t) (uintptr_t) &alpha);
+    xil_printf("beta     ctl: %x\n\r", (uint32_t) (uintptr_t) &beta);
+    xil_printf("T_nom    ctl: %x\n\r", (uint32_t) (uintptr_t) &t_end);
+    xil_printf("RWP mode ctl: %x\n\r", (uint32_t) (uintptr_t) &rwp_mode);
+    xil_printf("flush us ctl: %x\n\r", (uint32_t) (uintptr_t) &flush_us);
+    xil_printf("partial  ctl: %x\n\r", (uint32_t) (uintptr_t) &partial_reprogram);
+    xil_printf("streams  ctl: %x\n\r", (uint32_t) (uintptr_t) &stream_mask);
+    xil_printf("dual R5  ctl: %x\n\r", (uint32_t) (uintptr_t) &dual_r5);
+    xil_printf("span us  ctl: %x\n\r", (uint32_t) (uintptr_t) &throttle_span);
+    xil_printf("period   ctl: %x\n\r", (uint32_t) (uintptr_t) &throttle_period);
+    xil_printf("session  ctl: %x\n\r", SESSION_BASE);
+    print("Start a session through the control block, or set alpha, beta, t_end\n\r");
+    print("by devmem and write the graph with 0xdeadbeef first\n\r");
+    session_ready();
     xil_printf("Waiting for milestones to be set at 0x%x\n\r", &milestones[0]);
 
-    while(milestones[0] != 0xdeadbeef) {
-    	Xil_DCacheInvalidateRange(milestones, sizeof(uint32_t) * MSG_BUFFER_SIZE);
+    uint32_t beta_q16;
+    for (;;) {
+    	if (session_pending()) {
+    		session_host *host = session_take();
+    		alpha_q16 = host->alpha_q16;
+    		beta_q16 = host->beta_q16;
+    		t_end = host->t_end;
+    		rwp_mode = host->rwp_mode;
+    		flush_us = host->flush_us;
+    		partial_reprogram = host->partial_reprogram;
+    		stream_mask = host->stream_mask;
+    		dual_r5 = host->dual_r5;
+    		throttle_span = host->throttle_span;
+    		throttle_period = host->throttle_period;
+    		milestones_size = host->graph_words;
+    		xil_printf("Session %d started by the host\n\r", host->seq);
+    	} else {
+    		Xil_DCacheInvalidateRange(milestones, 32);
+    		if (milestones[0] != 0xdeadbeef)
+    			continue;
+    		// the only float use, the milestone path compares integers
+    		alpha_q16 = (uint32_t) (alpha * Q16_ONE);
+    		beta_q16 = (uint32_t) (beta * Q16_ONE);
+    		xil_printf("Read 0xdeadbeef, wait for hoster driver configuration\n\r");
+    		usleep(1000000);
+    		Xil_DCacheInvalidateRange(milestones, 32);
+    		milestones_size = milestones[1];
+    		milestones[0] = 0xffffffff;	// one try for each graph written
+    		Xil_DCacheFlushRange(milestones, 32);
+    	}
+    	if (milestones_size > MSG_OCM_SIZE) {
+    		xil_printf("milestones_size should be <= %d, the rest of OCM is the telemetry ring\n\r", MSG_OCM_SIZE);
+    	} else if (graph_cache(&milestones[2], milestones_size)) {
+    		break;
+    	} else {
+    		xil_printf("Graph checksum mismatch, the graph was not taken\n\r");
+    	}
+    	session_state(SESSION_ERROR);
     }
-    margin = (uint32_t) ((float) t_end * (1-beta));
-    xil_printf("Read 0xdeadbeef, wait for hoster driver configuration\n\r");
-    xil_printf("margin: %d\n\r", margin);
+    margin = beta_q16 < Q16_ONE ? Q16_SCALE(t_end, Q16_ONE - beta_q16) : 0;
+    xil_printf("margin: %d, alpha: %d/65536\n\r", margin, alpha_q16);
     if (margin == 0) {
     	xil_printf("margin is zero\n\r");
     } else {
     	xil_printf("margin is non-zero\n\r");
     }
 
-    usleep(1000000);
-
-    milestones_size = milestones[1];
     milestones = &milestones[2];
-
-    cache_graph(milestones, milestones_size, milestone_graph);
-    set_addr_cmp(milestone_graph[0], 0);  // before ETM starts, set the first address in trace range
-    init_relay(&relay);
-
-    if (milestones_size >= MSG_BUFFER_SIZE) {
-    	xil_printf("milestones_size should be < %d\n\r", MSG_BUFFER_SIZE);
+    uint32_t entry;
+    uint32_t first = graph_load(&entry);  // .ttmsg or compiled by cfg/tmg_compile.py
+    // before ETM starts, set the first address in trace range, of every traced core
+    stream_mask &= (1 << TRACE_STREAMS) - 1;
+    for (i = 0; i < TRACE_STREAMS; ++i) {
+    	if (stream_mask ? (stream_mask & (1 << i)) : i == 0) {
+    		set_addr_cmp(i, first, 0);
+    		init_relay(&relays[i], first, entry);
+    	}
     }
+    xil_printf("Streams: 0x%x%s\n\r", stream_mask, stream_mask ? ", deformatted" : "");
 
+    if (dual_r5) {
+    	// R5_0 TCM as R5_1 sees it
+    	mailbox_init(0xffe00000 + (uint32_t) (uintptr_t) &bandwidth_control, margin, throttle_span, throttle_period);
+    	xil_printf("Dual R5, hits posted to the mailbox at 0x%x\n\r", MAILBOX_BASE);
+    } else {
+    	telemetry_init();
+    	session_set_budget(BUDGET_FULL, throttle_period);
+    }
+    LATENCY_INIT();
+    session_state(SESSION_RUNNING);
+    xil_printf("Telemetry ring at 0x%x, %d records\n\r", TELEMETRY_BASE, TELEMETRY_RECORDS);
     print("hand off to trace loop.\n\r");
     print("\n\r");
 
@@ -135,6 +213,7 @@ void start() {
 }
 
 
+#if !defined(TRACER_REGULATOR) && !defined(TRACER_REPLAY)
 int main() {
 	init_platform();
 
@@ -150,5 +229,6 @@ int main() {
 
 	cleanup_platform();
 }
+#endif
 
 
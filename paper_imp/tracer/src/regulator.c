@@ -0,0 +1,84 @@
+/*
+	R5_1 side of the dual R5 mode, built as its own application with
+	-DTRACER_REGULATOR: takes the milestone hits R5_0 posts to the mailbox
+	and runs account_hit() on them, the slack, the throttling and the
+	telemetry, so the decoder on R5_0 only decodes.
+*/
+#ifdef TRACER_REGULATOR
+#include "platform.h"
+#include "xil_printf.h"
+#include "etm.h"
+#include "mailbox.h"
+#include "telemetry.h"
+#include "session.h"
+
+extern volatile uint32_t *bw_ctl;
+extern uint32_t margin;
+extern volatile uint32_t throttle_span;
+extern volatile uint32_t throttle_period;
+extern uint32_t n_times_pt;
+extern uint32_t pauses[256];
+extern uint32_t resumes[256];
+extern uint32_t pause_pt;
+extern uint32_t resume_pt;
+
+static void regulate(uint32_t session) {
+	uint32_t bw_addr, span, period;
+	uint32_t hits = 0;
+	mailbox_event *ev;
+	int i;
+
+	accounting_reset();
+	telemetry_init();
+	mailbox_attach(&bw_addr, &margin, &span, &period);
+	bw_ctl = (volatile uint32_t *) bw_addr;
+	throttle_span = span;
+	throttle_period = period;
+	session_set_budget(BUDGET_FULL, throttle_period);
+	xil_printf("Session %d, corunner ctl at 0x%x, margin %d, throttle span %d us\n\r", session, bw_addr, margin, span);
+
+	for (;;) {
+		if ((ev = mailbox_take()) == 0) {
+			if (mailbox_session() != session)
+				break;	// R5_0 was reset and started over
+			continue;
+		}
+		if (ev->type == MAILBOX_END) {
+			mailbox_release();
+			break;
+		}
+		account_hit(ev->stream, ev->address, ev->nominal_t, ev->scaled_t, ev->tail_t, ev->real_t);
+		mailbox_release();
+		hits++;
+	}
+
+	telemetry_done();
+	if (!telemetry_streamed()) {
+		print("REG BEGIN\n\r");
+		for(i=0; i<pause_pt; i++){
+			xil_printf("pause,%d\n\r",pauses[i]);
+		}
+		for(i=0;i<resume_pt; i++){
+			xil_printf("resume,%d\n\r",resumes[i]);
+		}
+		print("REG END\n\r");
+	}
+	xil_printf("Session %d done, %d hits\n\r", session, hits);
+}
+
+int main() {
+	uint32_t session, last = 0;
+
+	init_platform();
+	print("TPAw0v regulator on R5_1, waiting for R5_0 sessions\n\r");
+	last = mailbox_session();
+
+	while(1) {
+		while ((session = mailbox_session()) == last);
+		last = session;
+		regulate(session);
+	}
+
+	cleanup_platform();
+}
+#endif
@@ -0,0 +1,77 @@
+#include "session.h"
+#include "xil_cache.h"
+#include "xpseudo_asm.h"
+
+#define SESSION_FALLBACK_POLLS	1024	// OCM read without a doorbell, in case the IPI is not reachable
+
+static session_block *block = (session_block *) SESSION_BASE;
+static volatile uint32_t *rpu0_trig = (volatile uint32_t *) (IPI_RPU0_BASE + IPI_TRIG);
+static volatile uint32_t *rpu0_isr = (volatile uint32_t *) (IPI_RPU0_BASE + IPI_ISR);
+static uint32_t booted = 0;
+static uint32_t polls = 0;
+
+static inline void publish(void) {
+	dmb();
+	Xil_DCacheFlushRange((INTPTR) &block->r5, sizeof(session_r5));
+	*rpu0_trig = IPI_APU_BIT;
+}
+
+// a command left from before this boot is not taken
+void session_ready(void) {
+	if (!booted) {
+		Xil_DCacheInvalidateRange((INTPTR) &block->host, sizeof(session_host));
+		block->r5.handled = block->host.seq;
+		block->r5.session = 0;
+		*rpu0_isr = IPI_APU_BIT;
+		booted = 1;
+	}
+	block->r5.magic = SESSION_MAGIC;
+	block->r5.state = SESSION_READY;
+	publish();
+}
+
+// the host block is read on a doorbell, or every SESSION_FALLBACK_POLLS calls
+int session_pending(void) {
+	if (*rpu0_isr & IPI_APU_BIT) {
+		*rpu0_isr = IPI_APU_BIT;
+	} else if (++polls < SESSION_FALLBACK_POLLS) {
+		return 0;
+	}
+	polls = 0;
+	Xil_DCacheInvalidateRange((INTPTR) &block->host, sizeof(session_host));
+	return block->host.seq != block->r5.handled && block->host.command == SESSION_CMD_START;
+}
+
+/*
+	Read once more: seq is written last, but the lines of the block may have
+	been filled in any order by the invalidate that saw it.
+*/
+session_host *session_take(void) {
+	Xil_DCacheInvalidateRange((INTPTR) &block->host, sizeof(session_host));
+	block->r5.handled = block->host.seq;
+	block->r5.session++;
+	block->r5.bytes = 0;
+	block->r5.overflows = 0;
+	publish();
+	return &block->host;
+}
+
+void session_state(uint32_t state) {
+	block->r5.state = state;
+	publish();
+}
+
+// published with the next state
+void session_counters(uint32_t bytes, uint32_t overflows) {
+	block->r5.bytes = bytes;
+	block->r5.overflows = overflows;
+}
+
+// only the R5 that regulates writes it, R5_1 in dual mode, the other may have written it last session
+void session_set_budget(uint32_t duty, uint32_t period_us) {
+	Xil_DCacheInvalidateRange((INTPTR) &block->budget, sizeof(session_budget));
+	block->budget.duty = duty;
+	block->budget.period_us = period_us;
+	block->budget.updates++;
+	Xil_DCacheFlushRange((INTPTR) &block->budget, sizeof(session_budget));
+}
@@ -0,0 +1,13 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "session_layout.h"
+
+void session_ready(void);
+int session_pending(void);
+session_host *session_take(void);
+void session_state(uint32_t state);
+void session_counters(uint32_t bytes, uint32_t overflows);
+void session_set_budget(uint32_t duty, uint32_t period_us);
+
+#endif
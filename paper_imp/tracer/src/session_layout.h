@@ -0,0 +1,98 @@
+#ifndef SESSION_LAYOUT_H
+#define SESSION_LAYOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+	Session control block in OCM, replaces the devmem pokes and the fixed
+	sleeps of start(). The R5 owns the first cache line, the host the next
+	two: it writes the parameters, then bumps seq with the command and rings
+	the RPU0 IPI. Every state change of the R5 rings the APU IPI back; both
+	IPI sources are masked, the ISR bits are polled doorbells and the words
+	here stay the truth. The one layout, tracee/include/session.h includes it.
+*/
+#define SESSION_BASE	0xfffe3000	// OCM, past the mailbox
+#define SESSION_MAGIC	0x53534553	// "SESS"
+
+#define SESSION_BOOT	0
+#define SESSION_READY	1	// waiting for a start command
+#define SESSION_RUNNING	2	// first comparators set, the ETM may start
+#define SESSION_DONE	3	// last milestone reached, timings in OCM
+#define SESSION_ERROR	4	// the graph was not taken, bad size or checksum
+
+#define SESSION_CMD_START	1
+
+// ZynqMP IPI, the bit of an agent in the registers of the others
+#define IPI_APU_BASE	0xff300000
+#define IPI_RPU0_BASE	0xff310000
+#define IPI_TRIG		0x00
+#define IPI_ISR			0x10
+#define IPI_APU_BIT		0x001
+#define IPI_RPU0_BIT	0x100
+
+typedef struct session_r5 {
+	uint32_t magic;
+	uint32_t state;
+	uint32_t session;	// counts the started sessions
+	uint32_t handled;	// seq of the last command taken
+	uint32_t bytes;		// trace bytes the R5 read this session, set with DONE
+	uint32_t overflows;	// frame bytes lost to a full stream FIFO
+	uint32_t reserved[2];
+} session_r5;
+
+typedef struct session_host {
+	uint32_t seq;		// written last, a new value is a new command
+	uint32_t command;
+	uint32_t graph_words;	// at 0xfffc0008, as the legacy graph
+	uint32_t alpha_q16;
+	uint32_t beta_q16;
+	uint32_t t_end;
+	uint32_t rwp_mode;
+	uint32_t flush_us;
+	uint32_t partial_reprogram;
+	uint32_t stream_mask;
+	uint32_t dual_r5;
+	uint32_t throttle_span;		// us behind at which the corunners get no share, 0: stop and go
+	uint32_t throttle_period;	// us
+	uint32_t reserved[3];
+} session_host;
+
+/*
+	The corunner budget, written by the R5 that regulates (R5_1 in dual
+	mode): a corunner may access memory for duty / BUDGET_FULL of every
+	period_us. bandwidth_control still goes 0 whenever a stream is behind.
+*/
+#define BUDGET_FULL		256
+
+typedef struct session_budget {
+	uint32_t duty;
+	uint32_t period_us;
+	uint32_t updates;	// duty changes this session
+	uint32_t reserved[5];
+} session_budget;
+
+typedef struct session_block {
+	session_r5 r5;
+	session_host host;
+	session_budget budget;
+} session_block;
+
+#ifndef LAYOUT_ASSERT
+#ifdef __cplusplus
+#define LAYOUT_ASSERT(c, m) static_assert(c, m)
+#else
+#define LAYOUT_ASSERT(c, m) _Static_assert(c, m)
+#endif
+#endif
+
+// one cache line for the R5, two for the host, one for the budget
+LAYOUT_ASSERT(sizeof(session_r5) == 32, "session R5 line size");
+LAYOUT_ASSERT(sizeof(session_host) == 64, "session host lines size");
+LAYOUT_ASSERT(offsetof(session_host, throttle_period) == 48, "session host throttle_period offset");
+LAYOUT_ASSERT(sizeof(session_budget) == 32, "session budget line size");
+LAYOUT_ASSERT(offsetof(session_block, host) == 32, "session host offset");
+LAYOUT_ASSERT(offsetof(session_block, budget) == 96, "session budget offset");
+LAYOUT_ASSERT(sizeof(session_block) == 128, "session block size");
+
+#endif
@@ -0,0 +1,76 @@
+#include "telemetry.h"
+#include "xil_cache.h"
+#include "xpseudo_asm.h"
+#include "xil_printf.h"
+#include "xtime_l.h"
+
+static telemetry_ring *ring = (telemetry_ring *) TELEMETRY_BASE;
+static uint32_t head = 0;
+static uint32_t tail_seen = 0;
+static uint32_t seq = 0;
+
+// clears the magic first, a reader left from the last run waits for the new ring
+void telemetry_init(void) {
+	ring->prod.magic = 0;
+	Xil_DCacheFlushRange((INTPTR) &ring->prod, sizeof(telemetry_producer));
+
+	head = 0;
+	tail_seen = 0;
+	seq = 0;
+	ring->cons.tail = 0;
+	ring->cons.reader = 0;
+	Xil_DCacheFlushRange((INTPTR) &ring->cons, sizeof(telemetry_consumer));
+
+	ring->prod.n_records = TELEMETRY_RECORDS;
+	ring->prod.head = 0;
+	ring->prod.dropped = 0;
+	ring->prod.done = 0;
+	ring->prod.magic = TELEMETRY_MAGIC;
+	Xil_DCacheFlushRange((INTPTR) &ring->prod, sizeof(telemetry_producer));
+}
+
+static inline void publish(void) {
+	dmb();
+	ring->prod.head = head;
+	Xil_DCacheFlushRange((INTPTR) &ring->prod, sizeof(telemetry_producer));
+}
+
+// never waits for the reader, a full ring drops the record
+void telemetry_push(uint32_t address, uint32_t nominal_t, uint32_t tail_t, uint32_t real_t, uint32_t decision) {
+	XTime now;
+
+	if (head - tail_seen >= TELEMETRY_RECORDS) {
+		Xil_DCacheInvalidateRange((INTPTR) &ring->cons, sizeof(telemetry_consumer));
+		tail_seen = ring->cons.tail;
+		if (head - tail_seen >= TELEMETRY_RECORDS) {
+			ring->prod.dropped++;
+			seq++;
+			publish();
+			return;
+		}
+	}
+
+	telemetry_record *rec = &ring->records[head & (TELEMETRY_RECORDS - 1)];
+	XTime_GetTime(&now);
+	rec->seq = seq++;
+	rec->address = address;
+	rec->time = now;
+	rec->nominal_t = nominal_t;
+	rec->tail_t = tail_t;
+	rec->real_t = real_t;
+	rec->decision = decision;
+	Xil_DCacheFlushRange((INTPTR) rec, sizeof(telemetry_record));
+
+	head++;
+	publish();
+}
+
+void telemetry_done(void) {
+	ring->prod.done = 1;
+	publish();
+}
+
+uint32_t telemetry_streamed(void) {
+	Xil_DCacheInvalidateRange((INTPTR) &ring->cons, sizeof(telemetry_consumer));
+	return ring->cons.reader;
+}
@@ -0,0 +1,11 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "telemetry_layout.h"
+
+void telemetry_init(void);
+void telemetry_push(uint32_t address, uint32_t nominal_t, uint32_t tail_t, uint32_t real_t, uint32_t decision);
+void telemetry_done(void);
+uint32_t telemetry_streamed(void);
+
+#endif
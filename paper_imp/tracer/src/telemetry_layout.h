@@ -0,0 +1,72 @@
+#ifndef TELEMETRY_LAYOUT_H
+#define TELEMETRY_LAYOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+	Milestone telemetry ring in OCM, past the milestone graph the host copies
+	to 0xfffc0000. The R5 is the only producer and tracee/main/telemetry.cpp
+	the only consumer; each side writes its own cache line of the header.
+	The one layout of the ring, tracee/include/telemetry.h includes it.
+*/
+#define TELEMETRY_BASE		0xfffd0000
+#define TELEMETRY_MAGIC		0x454c4554	// "TELE"
+#define TELEMETRY_RECORDS	2048		// a power of two, 64 KB of records
+
+#define TELEMETRY_PAUSE		0x1
+#define TELEMETRY_RESUME	0x2
+#define TELEMETRY_BW_ON		0x100		// bandwidth_control after the decision
+#define TELEMETRY_STREAM_SHIFT	16		// the stream of the hit, trace ID - 1
+#define TELEMETRY_DUTY_SHIFT	20		// the corunner budget after the decision, of 256
+
+typedef struct telemetry_producer {
+	uint32_t magic;
+	uint32_t n_records;
+	uint32_t head;		// records written
+	uint32_t dropped;	// records lost to a full ring
+	uint32_t done;		// the last milestone was reached
+	uint32_t reserved[3];
+} telemetry_producer;
+
+typedef struct telemetry_consumer {
+	uint32_t tail;		// records read
+	uint32_t reader;	// a reader is attached, the UART log is skipped
+	uint32_t reserved[6];
+} telemetry_consumer;
+
+typedef struct telemetry_record {
+	uint32_t seq;		// milestone hit index
+	uint32_t address;
+	uint64_t time;		// XTime of the hit
+	uint32_t nominal_t;	// cumulative, us
+	uint32_t tail_t;
+	uint32_t real_t;	// cumulative, us
+	uint32_t decision;
+} telemetry_record;
+
+typedef struct telemetry_ring {
+	telemetry_producer prod;
+	telemetry_consumer cons;
+	telemetry_record records[TELEMETRY_RECORDS];
+} telemetry_ring;
+
+#ifndef LAYOUT_ASSERT
+#ifdef __cplusplus
+#define LAYOUT_ASSERT(c, m) static_assert(c, m)
+#else
+#define LAYOUT_ASSERT(c, m) _Static_assert(c, m)
+#endif
+#endif
+
+// the R5 and the host build this with different compilers, both must get the same offsets
+LAYOUT_ASSERT(sizeof(telemetry_producer) == 32, "telemetry producer is one cache line");
+LAYOUT_ASSERT(sizeof(telemetry_consumer) == 32, "telemetry consumer is one cache line");
+LAYOUT_ASSERT(offsetof(telemetry_record, time) == 8, "telemetry record time offset");
+LAYOUT_ASSERT(offsetof(telemetry_record, decision) == 28, "telemetry record decision offset");
+LAYOUT_ASSERT(sizeof(telemetry_record) == 32, "telemetry record size");
+LAYOUT_ASSERT(offsetof(telemetry_ring, cons) == 32, "telemetry consumer offset");
+LAYOUT_ASSERT(offsetof(telemetry_ring, records) == 64, "telemetry records offset");
+LAYOUT_ASSERT(sizeof(telemetry_ring) == 64 + TELEMETRY_RECORDS * 32, "telemetry ring size");
+
+#endif
@@ -2,13 +2,19 @@
 #include "etm.h"
 #include "xtime_l.h"
 #include "xil_cache.h"
+#include "telemetry.h"
+#include "latency.h"
+#include "session.h"
 
 extern uint32_t buffer_pointer;
 extern uint32_t cur_word_index;
 extern volatile uint32_t *etr_buffer;
 extern void check_stop_condition(void);
 extern volatile uint8_t running;
-extern uint32_t g_real_time;
+extern volatile uint32_t rwp_mode;
+extern volatile uint32_t flush_us;
+extern volatile uint32_t stream_mask;
+extern uint32_t g_real_time[TRACE_STREAMS];
 extern uint32_t n_slack_ct;
 extern uint32_t p_slack_ct;
 extern uint32_t n_times[MS_LOG_SIZE];
@@ -23,16 +29,63 @@ extern uint32_t resumes[256];
 extern uint32_t pauses[256];
 extern uint32_t resume_pt;
 extern uint32_t pause_pt;
-extern milestone_relay relay;
+extern milestone_relay relays[TRACE_STREAMS];
 extern uint32_t rounds;
+extern uint32_t num_reprograms;
+extern uint32_t num_page_loads;
+extern uint32_t num_reprogram_skips;
+extern XTime blind_ticks;
+extern XTime blind_max;
 
 static uint32_t unexpected_ms_hit = 0;
 static uint32_t timer_overflow_counter = 0;
-static uint32_t num_unknown_header = 0;
+uint32_t num_unknown_header = 0;	// read by tracer/replay
 static int32_t last_observed = -1;
 uint8_t in_range = 0;
 uint64_t prev_hit_addr = 0xffffffff;
 
+// the trace buffer word being decoded, see fetch_word()
+static uint32_t word_index = 0;		// next word to fetch
+static uint32_t window = 0;			// bytes of the fetched word not decoded yet, lowest first
+static uint8_t window_left = 0;
+static uint32_t words_ready = 0;	// rwp_mode: words up to the ETR write pointer not fetched yet
+static uint32_t buffer_base = 0;	// rwp_mode: bus address of etr_buffer[0]
+static int16_t pending_header = -1;	// a byte read by handle_async() that starts the next packet
+
+static uint32_t num_flushes = 0;
+#ifdef TRACER_REPLAY
+uint32_t num_packets = 0;	// headers decoded, read by tracer/replay
+#define COUNT_PACKET()	num_packets++
+#else
+#define COUNT_PACKET()
+#endif
+static uint32_t padding_bytes = 0;
+
+/*
+	With stream_mask set the ETR holds formatter frames. They are demuxed
+	into a FIFO per trace ID and the packets of each are decoded in turn,
+	with the decoder state of that stream swapped in.
+*/
+#define STREAM_FIFO_SIZE 512	// bytes, a power of two
+#define FRAME_ID_NONE 0xff
+
+typedef struct trace_stream {
+	uint8_t fifo[STREAM_FIFO_SIZE];
+	uint32_t fifo_in;
+	uint32_t fifo_out;
+	address_reg_t address_regs[3];
+	uint8_t in_range;
+	int16_t pending_header;
+} trace_stream;
+
+static trace_stream streams[TRACE_STREAMS];
+static uint32_t cur_stream = 0;
+static uint8_t frame_id = FRAME_ID_NONE;	// trace ID of the frame bytes
+static uint32_t num_frames = 0;
+static uint32_t fifo_overflows = 0;
+static XTime last_hit[TRACE_STREAMS];
+static uint32_t hit_mask = 0;		// the streams with a milestone hit
+
 //static void init_address_regs(void) {
 //	uint8_t i;
 //	for (i = 0; i < 3; ++i) {
@@ -50,6 +103,27 @@ void trace_reset() {
 	in_range = 0;
 	prev_hit_addr = 0xffffffff;
 	cur_address = 0;
+	word_index = 0;
+	window = 0;
+	window_left = 0;
+	words_ready = 0;
+	buffer_base = 0;
+	pending_header = -1;
+	num_flushes = 0;
+	padding_bytes = 0;
+	cur_stream = 0;
+	frame_id = FRAME_ID_NONE;
+	num_frames = 0;
+	fifo_overflows = 0;
+	hit_mask = 0;
+
+	int i;
+	for (i = 0; i < TRACE_STREAMS; ++i) {
+		streams[i].fifo_in = 0;
+		streams[i].fifo_out = 0;
+		streams[i].in_range = 0;
+		streams[i].pending_header = -1;
+	}
 }
 
 static void update_address_regs(uint64_t address, uint8_t is) {
@@ -83,6 +157,14 @@ void report_results(void) {
 		milestones[i] = milestone_timings[i];
 	}
 	Xil_DCacheFlushRange(milestones, sizeof(uint32_t) * MS_LOG_SIZE);
+	telemetry_done();
+	session_counters(rounds * ETR_BUFFER_SIZE * 4 + buffer_pointer, fifo_overflows);
+	session_state(SESSION_DONE);
+	if (telemetry_streamed()) {
+		// tracee telemetry has every hit and decision already
+		xil_printf("LOG streamed to the telemetry ring\n\r");
+		goto counters;
+	}
 	print("Results #ms,#ms+1,elapse(us)\n\r");
 	print("LOG BEGIN\n\r");
 	for (i = 1; i < current_timestamp; ++i) {
@@ -111,10 +193,25 @@ void report_results(void) {
 		xil_printf("resume,%d\n\r",resumes[i]);
 	}
 	print("REG END\n\r");
+counters:
+	LATENCY_REPORT();
 	xil_printf("negative slack ct    : %d\n\r", n_slack_ct);
 	xil_printf("num timer overflew   : %d\n\r", timer_overflow_counter);
 	xil_printf("unexpected milestones: %d\n\r", unexpected_ms_hit);
 	xil_printf("num unknown header   : %d\n\r", num_unknown_header);
+	xil_printf("num manual flushes   : %d\n\r", num_flushes);
+	xil_printf("padding bytes        : %d\n\r", padding_bytes);
+	xil_printf("ETM reprograms       : %d, %d skipped\n\r", num_reprograms, num_reprogram_skips);
+	xil_printf("graph page loads     : %d\n\r", num_page_loads);
+	if (stream_mask) {
+		xil_printf("frames               : %d, %d FIFO overflows\n\r", num_frames, fifo_overflows);
+		for (i = 0; i < TRACE_STREAMS; ++i) {
+			if (stream_mask & (1 << i))
+				xil_printf("stream %d real time   : %d us\n\r", i, g_real_time[i]);
+		}
+	}
+	xil_printf("blind window (ns)    : total %d, max %d\n\r",
+			(uint32_t) (blind_ticks * 1000 / COUNTS_PER_USECOND), (uint32_t) (blind_max * 1000 / COUNTS_PER_USECOND));
 	check_stop_condition();
 
 }
@@ -122,45 +219,248 @@ void report_results(void) {
 
 
 
-static void inc_buffer_pointer(uint32_t size) {
-	uint32_t i;
+/*
+	Flush policy while no data comes: a manual flush pushes out what the
+	formatter holds, but pads the buffer, so it is issued only after flush_us
+	without new data, then again every flush_us. Called from the wait loops
+	with the time the wait began; 0 flushes on every poll.
+*/
+static inline void idle_flush(XTime* idle_since) {
+	XTime now;
 
-	for (i = 0; i < size; ++i) {
-		buffer_pointer = (buffer_pointer + 1) % (ETR_BUFFER_SIZE);
+	if (flush_us) {
+		XTime_GetTime(&now);
+		if (now - *idle_since < (XTime) flush_us * COUNTS_PER_USECOND)
+			return;
+		*idle_since = now;
+	}
+	etr_man_flush();
+	num_flushes++;
+}
 
-		if (buffer_pointer % 4 == 0) {
-			uint32_t prev_word_pointer = (ETR_BUFFER_SIZE/4) - 1;
-			if (buffer_pointer / 4 > 0)
-				prev_word_pointer = (buffer_pointer / 4) - 1;
+/*
+	rwp_mode: how much is new comes from the ETR write pointer instead of
+	sentinels, nothing is written to the buffer. Once all words up to RWP
+	are fetched, RRP is moved there, the host sees how far the R5 got.
+*/
+static void wait_write_pointer(void) {
+	XTime idle_since;
+
+	if (buffer_base == 0)
+		buffer_base = etr_buffer_base();
+	etr_set_read_pointer(buffer_base + word_index * 4);
+
+	XTime_GetTime(&idle_since);
+	while (running) {
+		uint32_t wp = ((etr_write_pointer() - buffer_base) / 4) & (ETR_BUFFER_SIZE - 1);
+		words_ready = (wp - word_index) & (ETR_BUFFER_SIZE - 1);
+		if (words_ready)
+			break;
+		idle_flush(&idle_since);
+	}
+}
 
-			etr_buffer[prev_word_pointer] = 0xdeadbeef; // set back to deadbeef can achieve circular buffer
-			last_observed = prev_word_pointer;
+/*
+	The trace is consumed a word at a time: a word is fetched once it is no
+	longer 0xdeadbeef, its sentinel is written back right away and the
+	packets are decoded from the local copy (window), so the TCM word is
+	read and written once instead of once per byte.
+*/
+static void fetch_word(void) {
+	uint32_t word;
+
+	if (rwp_mode) {
+		if (words_ready == 0)
+			wait_write_pointer();
+		word = etr_buffer[word_index];
+		words_ready--;
+	} else if ((word = etr_buffer[word_index]) == 0xdeadbeef) {
+		XTime idle_since;
+
+		XTime_GetTime(&idle_since);
+		while ((word = etr_buffer[word_index]) == 0xdeadbeef && running) {
+			idle_flush(&idle_since);
 		}
+	}
 
-		if (buffer_pointer == 0)
-			rounds++;
+	if (running == 0) {
+		report_results();
 	}
+	LATENCY_DATA();
+
+	if (!rwp_mode)
+		etr_buffer[word_index] = 0xdeadbeef; // set back to deadbeef can achieve circular buffer
+	last_observed = word_index;
+	word_index = (word_index + 1) & (ETR_BUFFER_SIZE - 1);
+	if (word_index == 0)
+		rounds++;
+	buffer_pointer = word_index * 4;
+
+	window = word;
+	window_left = 4;
 }
 
-static uint32_t read_data(uint8_t* buffer, uint32_t bytes) {
-	uint32_t read;
+static void put_byte(uint8_t id, uint8_t byte) {
+	uint32_t s = id - 1;
+	trace_stream *st;
 
-	for (read = 0; read < bytes; ++read) {
-		while (etr_buffer[buffer_pointer / 4] == 0xdeadbeef && running) {
-			etr_man_flush();
+	if (id == 0 || s >= TRACE_STREAMS || !(stream_mask & (1 << s)))
+		return;
+	st = &streams[s];
+	if (st->fifo_in - st->fifo_out == STREAM_FIFO_SIZE) {
+		fifo_overflows++;
+		return;
+	}
+	st->fifo[st->fifo_in++ & (STREAM_FIFO_SIZE - 1)] = byte;
+}
+
+// the next 16 byte frame into the FIFOs, as proc_frame() of ETM_data_parser
+static void demux_frame(void) {
+	uint8_t frame[16];
+	uint8_t aux;
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		fetch_word();
+		frame[i * 4] = window & 0xff;
+		frame[i * 4 + 1] = (window >> 8) & 0xff;
+		frame[i * 4 + 2] = (window >> 16) & 0xff;
+		frame[i * 4 + 3] = window >> 24;
+	}
+	window_left = 0;
+	num_frames++;
+
+	aux = frame[15];
+	for (i = 0; i < 8; ++i) {
+		if ((frame[i * 2] & 0x1) && (aux & (0x1 << i))) {
+			// new ID, the next byte is of the old one
+			if (i != 7)
+				put_byte(frame_id, frame[i * 2 + 1]);
+			frame_id = frame[i * 2] >> 1;
+		} else if (frame[i * 2] & 0x1) {
+			// new ID, the next byte is of the new one
+			frame_id = frame[i * 2] >> 1;
+			if (i != 7)
+				put_byte(frame_id, frame[i * 2 + 1]);
+		} else {
+			put_byte(frame_id, (frame[i * 2] & 0xfe) | ((aux >> i) & 0x1));
+			if (i != 7)
+				put_byte(frame_id, frame[i * 2 + 1]);
 		}
+	}
+}
+
+static uint8_t stream_byte(void) {
+	trace_stream *st = &streams[cur_stream];
 
-		if (running == 0) {
-			report_results();
+	while (st->fifo_in == st->fifo_out)
+		demux_frame();
+	return st->fifo[st->fifo_out++ & (STREAM_FIFO_SIZE - 1)];
+}
+
+static void switch_stream(uint32_t s) {
+	trace_stream *st = &streams[cur_stream];
+
+	st->address_regs[0] = address_regs[0];
+	st->address_regs[1] = address_regs[1];
+	st->address_regs[2] = address_regs[2];
+	st->in_range = in_range;
+	st->pending_header = pending_header;
+
+	cur_stream = s;
+	st = &streams[s];
+	address_regs[0] = st->address_regs[0];
+	address_regs[1] = st->address_regs[1];
+	address_regs[2] = st->address_regs[2];
+	in_range = st->in_range;
+	pending_header = st->pending_header;
+}
+
+// at a packet boundary, round robin to the next stream with input
+static void next_stream(void) {
+	uint32_t k;
+
+	if (pending_header >= 0)
+		return;
+	while (running) {
+		for (k = 1; k <= TRACE_STREAMS; ++k) {
+			uint32_t s = (cur_stream + k) & (TRACE_STREAMS - 1);
+			trace_stream *st = &streams[s];
+			if (st->fifo_in != st->fifo_out || (s != cur_stream && st->pending_header >= 0)) {
+				if (s != cur_stream)
+					switch_stream(s);
+				return;
+			}
 		}
+		demux_frame();
+	}
+}
+
+static inline uint8_t next_byte(void) {
+	uint8_t byte;
+
+	if (stream_mask)
+		return stream_byte();
+	if (window_left == 0)
+		fetch_word();
+	byte = window & 0xFF;
+	window >>= 8;
+	window_left--;
+	return byte;
+}
+
+// skips payload bytes, whole words without decoding them
+static void inc_buffer_pointer(uint32_t size) {
+	if (stream_mask) {
+		while (size-- > 0)
+			stream_byte();
+		return;
+	}
+	while (size > 0 && window_left > 0) {
+		window >>= 8;
+		window_left--;
+		size--;
+	}
+	while (size >= 4) {
+		fetch_word();
+		window_left = 0;
+		size -= 4;
+	}
+	while (size > 0) {
+		next_byte();
+		size--;
+	}
+}
 
-		buffer[read] = (etr_buffer[buffer_pointer / 4] >> ((buffer_pointer % 4) * 8)) & 0xFF;
-		inc_buffer_pointer(1);
+static uint32_t read_data(uint8_t* buffer, uint32_t bytes) {
+	uint32_t read;
+
+	for (read = 0; read < bytes; ++read) {
+		buffer[read] = next_byte();
 	}
 
 	return read;
 }
 
+/*
+	An A-sync is 11 zero bytes and 0x80. The zero bytes of a flush are
+	padding, they are counted and the byte after them is the next header.
+*/
+static void handle_async_or_padding(void) {
+	uint32_t zeros = 1;
+	uint8_t byte;
+
+	while ((byte = next_byte()) == 0 && running)
+		zeros++;
+
+	if (byte == 0x80 && zeros >= 11) {
+		padding_bytes += zeros - 11;
+	} else {
+		padding_bytes += zeros;
+		pending_header = byte;
+	}
+}
+
 void handle_exception(void) {
 	uint8_t payload;
 
@@ -181,7 +481,7 @@ void handle_shortaddress(uint8_t header) {
 
 void handle_longaddress(uint8_t header) {
 	uint8_t payload[8];
-	uint8_t is;
+	uint8_t is = address_regs[0].is;
 	uint64_t address = address_regs[0].address;
 
 	switch (header) {
@@ -217,11 +517,14 @@ void handle_longaddress(uint8_t header) {
 		// now the newly hit ms is calculated as address, check if its the same as previous one, if so, it's in a loop
 		int i=0;
 		if (in_range) {
-			for(i = 0; i < relay.n_valid; i++) {
-				if (address >= relay.address[i] - 4 && address <= relay.address[i] + 4) {
+			milestone_relay *relay = &relays[cur_stream];
+			for(i = 0; i < relay->n_valid; i++) {
+				if (address >= relay->address[i] - 4 && address <= relay->address[i] + 4) {
+					LATENCY_MARK(LAT_DECODED);
 					register_timing();
+					LATENCY_MARK(LAT_TIMED);
 					addresses[cur_address++] = address;
-					update_graph_milestone(address);
+					update_graph_milestone(cur_stream, i);
 					in_range = 0;
 					break;
 				}
@@ -309,8 +612,12 @@ static inline void register_timing() {
 			milestone_timings[current_timestamp] = milestone_timings[current_timestamp] + (0xFFFFFFFF - milestone_timings[current_timestamp - 1]);
 			timer_overflow_counter++;
 		}
-		g_real_time += (milestone_timings[current_timestamp] - milestone_timings[current_timestamp-1]) / COUNTS_PER_USECOND ;
 	}
+	// per stream, from its own last hit
+	if (hit_mask & (1 << cur_stream))
+		g_real_time[cur_stream] += (milestone_timings[current_timestamp] - last_hit[cur_stream]) / COUNTS_PER_USECOND ;
+	hit_mask |= 1 << cur_stream;
+	last_hit[cur_stream] = milestone_timings[current_timestamp];
 	current_timestamp ++ ;
 }
 
@@ -320,12 +627,20 @@ static inline void register_timing() {
 void trace_loop(void) {
 	uint8_t header;
 	while (running==1) {
-		read_data(&header, 1);
+		if (stream_mask)
+			next_stream();
+		if (pending_header >= 0) {
+			header = pending_header;
+			pending_header = -1;
+		} else {
+			read_data(&header, 1);
+		}
+		COUNT_PACKET();
 //		dbg_buf[dbg_buf_pt++] = header;
 //		dbg_buf_pt %= 128;
 		switch (header) {
 			case Async:
-			inc_buffer_pointer(11);
+			handle_async_or_padding();
 			break;
 
 			/*
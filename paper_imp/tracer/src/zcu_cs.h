@@ -45,7 +45,10 @@
 #define A53_3_PMU 0x730000
 #define A53_3_ETM 0x740000
 
+#define TMCRRP 0x014
+#define TMCRWP 0x018
 #define TMCTRG 0x01C
+#define TMCDBALO 0x118
 #define FFCR 0x304
 
 #endif
@@ -0,0 +1,340 @@
+/*
+    cs_mem: the CoreSight debug window and the ETR trace buffer for csc,
+    without /dev/mem
+
+    /dev/mem needs CONFIG_STRICT_DEVMEM off and maps the buffer uncached,
+    so every word of a dump is a bus read. This device maps the same
+    physical ranges, the registers as device memory and the buffer
+    cacheable, and cleans or invalidates the buffer on request. See
+    csc/include/cs_mem.h for the interface.
+
+    CS_MEM_ALLOC takes a buffer of any size from CMA instead (cma= on the
+    kernel command line sizes the pool), nothing reserved at boot. Its
+    address is the bus address the ETR is programmed with, the physical
+    address as long as no SMMU translates the ETR. It is freed when the
+    file is closed, with the ETR stopped first if it still writes there.
+    CS_MEM_FREE frees it earlier, unless it is still mapped.
+
+        make -C support
+        insmod support/cs_mem.ko buf_base=0xfffc0000 buf_size=0x40000
+
+    The defaults are the ZynqMP debug window and the OCM, the buffer of the
+    start_* programs.
+*/
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/io.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/dma-mapping.h>
+
+#include "cs_mem.h"
+
+#if !defined(__aarch64__)
+#error Module can only be compiled on Aarch64.
+#endif
+
+static unsigned long cs_base = 0xFE800000;
+module_param(cs_base, ulong, 0444);
+MODULE_PARM_DESC(cs_base, "physical address of the CoreSight window (CS_BASE)");
+static unsigned long cs_size = 0x800000;
+module_param(cs_size, ulong, 0444);
+MODULE_PARM_DESC(cs_size, "bytes of the CoreSight window (CS_WINDOW_SIZE)");
+static unsigned long buf_base = 0xFFFC0000;
+module_param(buf_base, ulong, 0444);
+MODULE_PARM_DESC(buf_base, "physical address of the trace buffer, memory no driver owns");
+static unsigned long buf_size = 0x40000;
+module_param(buf_size, ulong, 0444);
+MODULE_PARM_DESC(buf_size, "bytes of the trace buffer");
+static unsigned long etr_offset = 0x170000;
+module_param(etr_offset, ulong, 0444);
+MODULE_PARM_DESC(etr_offset, "offset of the ETR (TMC3) in the CoreSight window");
+
+/* TMC registers */
+#define TMC_CTL 0x020
+#define TMC_DBALO 0x118
+#define TMC_DBAHI 0x11c
+
+/* the CS_MEM_ALLOC buffer of an open file */
+struct cs_mem_file {
+        struct mutex lock;      /* the fields below */
+        struct page *page;
+        dma_addr_t addr;
+        size_t size;
+        int mapped;             /* VMAs of the buffer, remap_pfn_range() takes no page references */
+};
+
+static const struct file_operations cs_mem_fops;
+static struct miscdevice cs_mem_dev = {
+        .minor = MISC_DYNAMIC_MINOR,
+        .name = "cs_mem",
+        .fops = &cs_mem_fops,
+        .mode = 0600,
+};
+
+/* the buffer in the kernel, cacheable as the user mappings: maintenance by VA reaches them all */
+static void *buf_virt;
+
+static int within(phys_addr_t start, unsigned long size, unsigned long base, unsigned long limit)
+{
+        return start >= base && size <= limit && start - base <= limit - size;
+}
+
+/* to the point of coherency, the ETR does not snoop the caches */
+static void sync_range(unsigned long offset, unsigned long size, int for_cpu)
+{
+        unsigned long line, p, end;
+        u64 ctr;
+
+        asm volatile("mrs %0, ctr_el0" : "=r" (ctr));
+        line = 4UL << ((ctr >> 16) & 0xf);     /* DminLine */
+        p = ((unsigned long) buf_virt + offset) & ~(line - 1);
+        end = (unsigned long) buf_virt + offset + size;
+        for (; p < end; p += line) {
+                if (for_cpu)
+                        asm volatile("dc civac, %0" : : "r" (p) : "memory");
+                else
+                        asm volatile("dc cvac, %0" : : "r" (p) : "memory");
+        }
+        asm volatile("dsb sy" : : : "memory");
+}
+
+/* a buffer is only freed once the ETR no longer writes to it */
+static void stop_etr_at(dma_addr_t addr, size_t size)
+{
+        void __iomem *etr = ioremap(cs_base + etr_offset, PAGE_SIZE);
+        u64 dba;
+
+        if (!etr)
+                return;
+        dba = readl(etr + TMC_DBALO) | ((u64) readl(etr + TMC_DBAHI) << 32);
+        if ((readl(etr + TMC_CTL) & 0x1) && dba >= addr && dba < addr + size) {
+                printk(KERN_WARNING "CS_MEM stopping the ETR, its buffer is freed\n");
+                writel(0, etr + TMC_CTL);
+        }
+        iounmap(etr);
+}
+
+static void free_alloc(struct cs_mem_file *f)
+{
+        if (!f->page)
+                return;
+        stop_etr_at(f->addr, f->size);
+        dma_free_pages(cs_mem_dev.this_device, f->size, f->page, f->addr, DMA_FROM_DEVICE);
+        f->page = NULL;
+}
+
+/* copies to and from user space outside f->lock, a fault there takes the mmap lock */
+static long alloc(struct cs_mem_file *f, unsigned long arg)
+{
+        struct cs_mem_alloc req;
+        long ret = 0;
+
+        if (copy_from_user(&req, (void __user *) arg, sizeof(req)))
+                return -EFAULT;
+
+        mutex_lock(&f->lock);
+        if (f->page || !req.size) {
+                ret = -EINVAL;
+        } else {
+                f->size = PAGE_ALIGN(req.size);
+                f->page = dma_alloc_pages(cs_mem_dev.this_device, f->size, &f->addr, DMA_FROM_DEVICE, GFP_KERNEL);
+                if (!f->page)
+                        ret = -ENOMEM;
+                req.addr = f->addr;
+        }
+        mutex_unlock(&f->lock);
+        if (ret)
+                return ret;
+
+        if (copy_to_user((void __user *) arg, &req, sizeof(req))) {
+                mutex_lock(&f->lock);
+                if (!f->mapped)
+                        free_alloc(f);
+                mutex_unlock(&f->lock);
+                return -EFAULT;
+        }
+        return 0;
+}
+
+static long cs_mem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+        struct cs_mem_file *f = file->private_data;
+        struct cs_mem_info info;
+        struct cs_mem_sync sync;
+        long ret;
+
+        switch (cmd) {
+        case CS_MEM_INFO:
+                info.cs_base = cs_base;
+                info.cs_size = cs_size;
+                info.buf_base = buf_base;
+                info.buf_size = buf_size;
+                if (copy_to_user((void __user *) arg, &info, sizeof(info)))
+                        return -EFAULT;
+                return 0;
+        case CS_MEM_SYNC_FOR_CPU:
+        case CS_MEM_SYNC_FOR_DEVICE:
+                if (copy_from_user(&sync, (void __user *) arg, sizeof(sync)))
+                        return -EFAULT;
+                mutex_lock(&f->lock);
+                if (f->page && within(sync.addr, sync.size, f->addr, f->size)) {
+                        if (cmd == CS_MEM_SYNC_FOR_CPU)
+                                dma_sync_single_for_cpu(cs_mem_dev.this_device, sync.addr, sync.size, DMA_FROM_DEVICE);
+                        else
+                                dma_sync_single_for_device(cs_mem_dev.this_device, sync.addr, sync.size, DMA_FROM_DEVICE);
+                        mutex_unlock(&f->lock);
+                        return 0;
+                }
+                mutex_unlock(&f->lock);
+                if (!within(sync.addr, sync.size, buf_base, buf_size))
+                        return -EINVAL;
+                sync_range(sync.addr - buf_base, sync.size, cmd == CS_MEM_SYNC_FOR_CPU);
+                return 0;
+        case CS_MEM_ALLOC:
+                return alloc(f, arg);
+        case CS_MEM_FREE:
+                mutex_lock(&f->lock);
+                ret = f->mapped ? -EBUSY : 0;
+                if (!ret)
+                        free_alloc(f);
+                mutex_unlock(&f->lock);
+                return ret;
+        default:
+                return -ENOTTY;
+        }
+}
+
+/* open on fork and split, close on munmap: the buffer is not freed under a mapping */
+static void cs_mem_vm_open(struct vm_area_struct *vma)
+{
+        struct cs_mem_file *f = vma->vm_private_data;
+
+        mutex_lock(&f->lock);
+        f->mapped++;
+        mutex_unlock(&f->lock);
+}
+
+static void cs_mem_vm_close(struct vm_area_struct *vma)
+{
+        struct cs_mem_file *f = vma->vm_private_data;
+
+        mutex_lock(&f->lock);
+        f->mapped--;
+        mutex_unlock(&f->lock);
+}
+
+static const struct vm_operations_struct cs_mem_vm_ops = {
+        .open = cs_mem_vm_open,
+        .close = cs_mem_vm_close,
+};
+
+static int cs_mem_mmap(struct file *file, struct vm_area_struct *vma)
+{
+        struct cs_mem_file *f = file->private_data;
+        phys_addr_t start = (phys_addr_t) vma->vm_pgoff << PAGE_SHIFT;
+        unsigned long size = vma->vm_end - vma->vm_start;
+        int ret;
+
+        mutex_lock(&f->lock);
+        if (f->page && within(start, size, f->addr, f->size)) {
+                ret = remap_pfn_range(vma, vma->vm_start, page_to_pfn(f->page) + ((start - f->addr) >> PAGE_SHIFT),
+                                      size, vma->vm_page_prot);
+                if (!ret) {
+                        vma->vm_ops = &cs_mem_vm_ops;
+                        vma->vm_private_data = f;
+                        f->mapped++;
+                }
+                mutex_unlock(&f->lock);
+                return ret;
+        }
+        mutex_unlock(&f->lock);
+
+        if (within(start, size, cs_base, cs_size))
+                vma->vm_page_prot = pgprot_device(vma->vm_page_prot);
+        else if (!within(start, size, buf_base, buf_size))
+                return -EINVAL;
+
+        return remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot);
+}
+
+static int cs_mem_open(struct inode *inode, struct file *file)
+{
+        struct cs_mem_file *f = kzalloc(sizeof(struct cs_mem_file), GFP_KERNEL);
+
+        if (!f)
+                return -ENOMEM;
+        mutex_init(&f->lock);
+        file->private_data = f;
+        return 0;
+}
+
+/* after the last munmap, every VMA holds the file */
+static int cs_mem_release(struct inode *inode, struct file *file)
+{
+        struct cs_mem_file *f = file->private_data;
+
+        free_alloc(f);
+        mutex_destroy(&f->lock);
+        kfree(f);
+        return 0;
+}
+
+static const struct file_operations cs_mem_fops = {
+        .owner = THIS_MODULE,
+        .open = cs_mem_open,
+        .release = cs_mem_release,
+        .unlocked_ioctl = cs_mem_ioctl,
+        .mmap = cs_mem_mmap,
+};
+
+
+static int __init
+init(void)
+{
+        int ret;
+
+        if (!PAGE_ALIGNED(cs_base) || !PAGE_ALIGNED(cs_size) || !PAGE_ALIGNED(buf_base) || !PAGE_ALIGNED(buf_size)
+            || !buf_size || !cs_size) {
+                printk(KERN_ERR "CS_MEM windows must be whole pages\n");
+                return -EINVAL;
+        }
+
+        buf_virt = memremap(buf_base, buf_size, MEMREMAP_WB);
+        if (!buf_virt) {
+                printk(KERN_ERR "CS_MEM cannot map the trace buffer at 0x%lx\n", buf_base);
+                return -ENOMEM;
+        }
+
+        ret = misc_register(&cs_mem_dev);
+        if (ret) {
+                memunmap(buf_virt);
+                return ret;
+        }
+        /* the ETR of the ZynqMP addresses 40 bits */
+        ret = dma_coerce_mask_and_coherent(cs_mem_dev.this_device, DMA_BIT_MASK(40));
+        if (ret) {
+                misc_deregister(&cs_mem_dev);
+                memunmap(buf_virt);
+                return ret;
+        }
+
+        printk(KERN_INFO "CS_MEM CoreSight 0x%lx+0x%lx, trace buffer 0x%lx+0x%lx\n", cs_base, cs_size, buf_base, buf_size);
+        return 0;
+}
+
+static void __exit
+leave(void)
+{
+        misc_deregister(&cs_mem_dev);
+        memunmap(buf_virt);
+}
+
+MODULE_DESCRIPTION("CoreSight window and cacheable ETR buffer for csc");
+MODULE_LICENSE("GPL");
+module_init(init);
+module_exit(leave);
@@ -0,0 +1,101 @@
+#!/bin/bash
+# Decoder throughput of every stage on generated trace, one line per stage
+# and mix. Usage: ./bench.sh [-s size] [-F ids] [-j threads] [-m mixes] [-o results.csv]
+# The stages that are not built are skipped, make them first.
+
+cd "$(dirname "$0")"
+ROOT=$(cd .. && pwd)
+CTRACE=$ROOT/ETM_data_parser/ctrace
+OFFLINE=$ROOT/paper_imp/trc_parser_offline/ctrace
+DEFORMAT=$ROOT/deformat/deformat
+REPLAY=$ROOT/paper_imp/tracer/replay/replay
+
+size=16m
+ids=2
+threads=$(nproc)
+mixes="atom address context overflow timestamp mixed r5"
+csv=
+
+while getopts "s:F:j:m:o:" opt; do
+    case $opt in
+    s) size=$OPTARG ;;
+    F) ids=$OPTARG ;;
+    j) threads=$OPTARG ;;
+    m) mixes=$OPTARG ;;
+    o) csv=$OPTARG ;;
+    *) echo "Usage: $0 [-s size] [-F ids] [-j threads] [-m \"mix ...\"] [-o results.csv]"; exit 1 ;;
+    esac
+done
+
+[ -x ./tracegen ] || make tracegen || exit 1
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+rev=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+now() { date +%s.%N; }
+
+# stage mix bytes packets command...: runs the command with its output in $work/out, prints the rates
+run() {
+    local stage=$1 mix=$2 bytes=$3 packets=$4
+    shift 4
+    local t0 t1
+    t0=$(now)
+    if ! "$@" >"$work/out" 2>"$work/err"; then
+        printf "%-18s %-10s failed: %s\n" "$stage" "$mix" "$(tail -1 "$work/err")"
+        return
+    fi
+    t1=$(now)
+    awk -v s="$stage" -v m="$mix" -v b="$bytes" -v p="$packets" -v t0="$t0" -v t1="$t1" \
+        -v csv="$csv" -v rev="$rev" 'BEGIN {
+        secs = t1 - t0
+        printf "%-18s %-10s %8.1f MB %8.3f s %9.1f MB/s %12.0f packets/s\n", s, m, b / 1e6, secs, b / secs / 1e6, p / secs
+        if (csv != "")
+            printf "%s,%s,%s,%d,%d,%.6f,%.1f,%.0f\n", rev, s, m, b, p, secs, b / secs / 1e6, p / secs >> csv
+    }'
+}
+
+[ -n "$csv" ] && [ ! -s "$csv" ] && echo "rev,stage,mix,bytes,packets,secs,MB/s,packets/s" > "$csv"
+echo "tracegen -s $size -F $ids, $threads threads, rev $rev"
+
+for mix in $mixes; do
+    # the raw stream is the first ID of the formatted one, the same seed
+    ./tracegen -m "$mix" -s "$size" -g "$work/graph.ttmsg" "$work/raw.dat" > "$work/raw.txt" || exit 1
+    ./tracegen -m "$mix" -s "$size" -F "$ids" "$work/fmt.dat" > "$work/fmt.txt" || exit 1
+    raw_bytes=$(stat -c %s "$work/raw.dat")
+    fmt_bytes=$(stat -c %s "$work/fmt.dat")
+    raw_packets=$(awk '/^total:/ { print $4 }' "$work/raw.txt")
+    fmt_packets=$(awk '/^total:/ { print $4 }' "$work/fmt.txt")
+
+    if [ -x "$DEFORMAT" ]; then
+        run deformat "$mix" "$fmt_bytes" "$fmt_packets" sh -c "cd '$work' && '$DEFORMAT' -b $ids fmt.dat"
+        run deformat-j "$mix" "$fmt_bytes" "$fmt_packets" sh -c "cd '$work' && '$DEFORMAT' -b -j $threads $ids fmt.dat"
+    fi
+    if [ -x "$CTRACE" ]; then
+        run ctrace "$mix" "$raw_bytes" "$raw_packets" "$CTRACE" -m none "$work/raw.dat"
+        run ctrace-binary "$mix" "$raw_bytes" "$raw_packets" "$CTRACE" -m binary -o /dev/null "$work/raw.dat"
+        run ctrace-text "$mix" "$raw_bytes" "$raw_packets" "$CTRACE" -o /dev/null "$work/raw.dat"
+        run ctrace-stream "$mix" "$raw_bytes" "$raw_packets" "$CTRACE" -m none -s "$work/raw.dat"
+        run ctrace-j "$mix" "$raw_bytes" "$raw_packets" "$CTRACE" -m none -j "$threads" "$work/raw.dat"
+        run ctrace-F "$mix" "$fmt_bytes" "$fmt_packets" "$CTRACE" -m none -F "$ids" "$work/fmt.dat"
+    fi
+    if [ -x "$OFFLINE" ]; then
+        # the text input of the original parser, one 0x%08X word per line
+        od -An -v -tx4 -w4 "$work/raw.dat" | awk '{ printf "0x%s\n", toupper($1) }' > "$work/raw.out"
+        run trc_parser_offline "$mix" "$raw_bytes" "$raw_packets" "$OFFLINE" -m none "$work/raw.out"
+    fi
+    # the R5 decoder has no timestamps, context IDs, cycle counts and the like, it only keeps sync on r5
+    if [ -x "$REPLAY" ] && [ "$mix" = r5 ]; then
+        # the graph is never reached, every packet goes through the R5 decoder
+        run r5-replay "$mix" "$raw_bytes" "$raw_packets" "$REPLAY" "$work/raw.dat" "$work/graph.ttmsg"
+        unknown=$(awk -F, '/^unknown headers,/ { print $2 }' "$work/out")
+        if [ "${unknown:-0}" != 0 ]; then
+            echo "r5-replay: $unknown unknown headers, the R5 decoder lost sync"
+            exit 1
+        fi
+    fi
+    rm -f "$work"/trc_* "$work/raw.out"
+done
+
+# table against switch dispatch on the last mix, the decoder reports the rates itself
+[ -x "$CTRACE" ] && "$CTRACE" -b 3 "$work/raw.dat" 2>&1 | grep -E "^(table|switch)"
+exit 0
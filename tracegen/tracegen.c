@@ -0,0 +1,537 @@
+/*
+    Synthetic ETMv4 trace for the decoder benchmarks: the packets the
+    decoders here read (see ETM_data_parser/src/trace.c) in a chosen mix,
+    raw as deformat writes trc_N.dat, or in formatter frames of several
+    trace IDs interleaved in bursts as the ETR writes trace.dat.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_IDS 16
+// an A-sync packet is 11 zero bytes and 0x80
+#define ASYNC_ZEROS 11
+// bytes of one ID between periodic A-sync packets, as TRCSYNCPR sets it
+#define DEFAULT_SYNC_PERIOD 4096
+// bytes of one ID per burst in the formatted output
+#define DEFAULT_BURST 64
+// the code the addresses point into, 4 MB at the load address of the demos
+#define CODE_BASE 0x400000ull
+#define CODE_SIZE (4ull << 20)
+#define N_CONTEXTS 8
+#define TMG_END 0xffffffff
+
+enum packet_kind {
+    P_ATOM,
+    P_ADDR,
+    P_CONTEXT,
+    P_TIMESTAMP,
+    P_EXCEPTION,
+    P_CYCLECOUNT,
+    P_EVENT,
+    P_OVERFLOW,
+    P_KINDS
+};
+
+static const char* kind_names[P_KINDS] = {
+    "atom", "addr", "ctx", "ts", "exc", "cc", "event", "ovf"
+};
+
+typedef struct mix {
+    const char* name;
+    unsigned int weights[P_KINDS];
+    int r5;                 // only the packets the R5 tracer decodes
+} mix_t;
+
+// weights of atom, addr, ctx, ts, exc, cc, event, ovf
+static const mix_t mixes[] = {
+    {"atom",      {90,  8,  0,  0,  2,  0,  0, 0}},
+    {"address",   {30, 64,  1,  1,  4,  0,  0, 0}},
+    {"context",   {40, 30, 25,  2,  3,  0,  0, 0}},
+    {"overflow",  {70, 20,  2,  2,  2,  0,  0, 4}},
+    {"timestamp", {45, 15,  1, 30,  1,  8,  0, 0}},
+    {"mixed",     {55, 24,  3,  5,  3,  5,  4, 1}},
+    // format 1 atoms, short and long addresses, as the R5 tracer of paper_imp reads them
+    {"r5",        {90, 10,  0,  0,  0,  0,  0, 0}, 1},
+};
+
+typedef struct stream {
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    size_t pos;             // bytes already put into frames
+    size_t last_sync;
+    uint64_t rng;
+    uint64_t pc;
+    uint64_t ts;
+    uint32_t contexts[N_CONTEXTS];
+    uint64_t packets;
+    uint64_t counts[P_KINDS];
+    uint64_t syncs;
+} stream_t;
+
+static unsigned int weights[P_KINDS];
+static unsigned int weight_sum;
+static size_t sync_period = DEFAULT_SYNC_PERIOD;
+static int cycle_counts;
+static int r5_only;
+
+static uint8_t atom_headers[64];
+static int n_atom_headers;
+
+void usage(char* name) {
+    printf("Usage %s [-m mix] [-w kind:weight,...] [-s bytes] [-F ids] [-b burst] [-p period] [-S seed] [-g graph] <output file>\n", name);
+    printf("  -m  packet mix: atom, address, context, overflow, timestamp, mixed (default) or r5\n");
+    printf("  -w  weights of the kinds atom, addr, ctx, ts, exc, cc, event, ovf, on top of -m\n");
+    printf("  -s  bytes of trace per ID (default 16 MB), k and m suffixes\n");
+    printf("  -F  formatter frames of trace IDs 1 to ids, else the raw stream of one ID\n");
+    printf("  -b  bytes of an ID per burst of frames, on average (default %d)\n", DEFAULT_BURST);
+    printf("  -p  bytes between periodic A-sync packets (default %d)\n", DEFAULT_SYNC_PERIOD);
+    printf("  -S  seed of the generator, the same seed gives the same trace\n");
+    printf("  -g  write a one-node .ttmsg graph the trace never reaches, the replay of the R5 decoder needs one\n");
+    exit(1);
+}
+
+static uint64_t next_rand(stream_t* s) {
+    // xorshift64*
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return s->rng * 0x2545f4914f6cdd1dull;
+}
+
+static uint32_t rand_below(stream_t* s, uint32_t n) {
+    return (uint32_t) ((next_rand(s) >> 32) % n);
+}
+
+static void put(stream_t* s, uint8_t byte) {
+    if (s->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1 << 20;
+        s->buf = (uint8_t*) realloc(s->buf, s->cap);
+        if (s->buf == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->buf[s->len++] = byte;
+}
+
+// the 7 bit groups of value with continuation bits, the last of max_bytes takes last_bits
+static void put_continued(stream_t* s, uint64_t value, int max_bytes, int last_bits) {
+    int i;
+
+    for (i = 0; i < max_bytes - 1 && value >= 0x80; i++) {
+        put(s, (uint8_t) ((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    put(s, (uint8_t) (i == max_bytes - 1 ? value & ((1u << last_bits) - 1) : value));
+}
+
+static void put_async(stream_t* s) {
+    int i;
+
+    for (i = 0; i < ASYNC_ZEROS; i++)
+        put(s, 0x00);
+    put(s, 0x80);
+    s->packets++;
+    s->syncs++;
+}
+
+static void put_traceinfo(stream_t* s) {
+    put(s, 0x01);
+    if (cycle_counts) {
+        // INFO and CYCT sections, a cycle count threshold of 4
+        put(s, 0x09);
+        put(s, 0x01);
+        put(s, 0x04);
+    } else {
+        put(s, 0x01);
+        put(s, 0x00);
+    }
+    s->packets++;
+}
+
+// 64-bit IS0 long address, the branch targets are word aligned
+static void put_long_address(stream_t* s, uint8_t header) {
+    uint64_t a = s->pc;
+
+    put(s, header);
+    put(s, (a >> 2) & 0x7f);
+    put(s, (a >> 9) & 0x7f);
+    put(s, (a >> 16) & 0xff);
+    put(s, (a >> 24) & 0xff);
+    put(s, (a >> 32) & 0xff);
+    put(s, (a >> 40) & 0xff);
+    put(s, (a >> 48) & 0xff);
+    put(s, (a >> 56) & 0xff);
+}
+
+static void put_context_payload(stream_t* s) {
+    uint32_t cid = s->contexts[rand_below(s, N_CONTEXTS)];
+
+    if (rand_below(s, 4) == 0) {
+        put(s, 0xc0);       // VMID and context ID
+        put(s, (uint8_t) (1 + rand_below(s, 3)));
+    } else {
+        put(s, 0x80);
+    }
+    put(s, cid & 0xff);
+    put(s, (cid >> 8) & 0xff);
+    put(s, (cid >> 16) & 0xff);
+    put(s, (cid >> 24) & 0xff);
+}
+
+static void new_target(stream_t* s) {
+    s->pc = CODE_BASE + ((uint64_t) rand_below(s, CODE_SIZE / 4) << 2);
+}
+
+// periodic synchronization: A-sync, TraceInfo and the address to resume at
+static void put_sync(stream_t* s) {
+    put_async(s);
+    put_traceinfo(s);
+    put_long_address(s, 0x9d);
+    s->packets++;
+    s->counts[P_ADDR]++;
+    s->last_sync = s->len;
+}
+
+static void put_packet(stream_t* s, int kind) {
+    uint32_t r;
+
+    s->counts[kind]++;
+    s->packets++;
+    switch (kind) {
+    case P_ATOM:
+        put(s, atom_headers[rand_below(s, n_atom_headers)]);
+        break;
+    case P_ADDR:
+        r = rand_below(s, 10);
+        if (r < 6) {
+            // a near branch, short address with the low 9 or 17 bits
+            int two = r >= 3;
+            s->pc = (s->pc & ~(two ? 0x1ffffull : 0x1ffull))
+                    | ((uint64_t) rand_below(s, two ? 1 << 15 : 1 << 7) << 2);
+            put(s, 0x95);
+            put(s, (uint8_t) (((s->pc >> 2) & 0x7f) | (two ? 0x80 : 0)));
+            if (two)
+                put(s, (s->pc >> 9) & 0xff);
+        } else if (r < 9 || r5_only) {
+            new_target(s);
+            put_long_address(s, 0x9d);
+        } else {
+            // one of the last three addresses, the decoder looks it up
+            put(s, (uint8_t) (0x90 + rand_below(s, 3)));
+        }
+        break;
+    case P_CONTEXT:
+        r = rand_below(s, 4);
+        if (r == 0) {
+            new_target(s);
+            put_long_address(s, 0x85);  // address with context
+        } else {
+            put(s, 0x81);
+        }
+        put_context_payload(s);
+        break;
+    case P_TIMESTAMP:
+        s->ts += 1 + rand_below(s, 5000);
+        if (rand_below(s, 2)) {
+            put(s, 0x03);
+            put_continued(s, s->ts, 9, 8);
+            put_continued(s, 1 + rand_below(s, 1 << 14), 3, 6);
+        } else {
+            put(s, 0x02);
+            put_continued(s, s->ts, 9, 8);
+        }
+        break;
+    case P_EXCEPTION:
+        if (rand_below(s, 3) == 0) {
+            put(s, 0x07);   // exception return
+            break;
+        }
+        // IRQ, then the preferred return address as its own packet
+        put(s, 0x06);
+        put(s, (0x0e << 1) | 0x1);
+        new_target(s);
+        put_long_address(s, 0x9d);
+        s->packets++;
+        break;
+    case P_CYCLECOUNT:
+        r = rand_below(s, 3);
+        if (r == 0) {
+            put(s, (uint8_t) (0x10 + rand_below(s, 16)));
+        } else if (r == 1) {
+            put(s, 0x0c);
+            put(s, (uint8_t) rand_below(s, 256));
+        } else {
+            put(s, 0x0e);
+            put_continued(s, 1 + rand_below(s, 1 << 19), 3, 6);
+        }
+        break;
+    case P_EVENT:
+        put(s, (uint8_t) (0x71 + rand_below(s, 15)));
+        break;
+    case P_OVERFLOW:
+        // as handle_async() reads it, the trace resumes at the next sync
+        put(s, 0x00);
+        put(s, 0x05);
+        put_sync(s);
+        break;
+    }
+}
+
+static void generate(stream_t* s, size_t size) {
+    put_sync(s);
+    while (s->len < size) {
+        uint32_t r = rand_below(s, weight_sum);
+        int kind = 0;
+
+        while (r >= weights[kind]) {
+            r -= weights[kind];
+            kind++;
+        }
+        put_packet(s, kind);
+        if (s->len - s->last_sync >= sync_period)
+            put_sync(s);
+    }
+}
+
+static void init_atom_headers(void) {
+    static const uint8_t ranges[][2] = {
+        {0xf6, 0xf7}, {0xd8, 0xdb}, {0xf8, 0xff}, {0xdc, 0xdf},
+        {0xd5, 0xd7}, {0xf5, 0xf5}, {0xc0, 0xd4}, {0xe0, 0xf4},
+    };
+    size_t i;
+    int h;
+
+    for (i = 0; i < (r5_only ? 1 : sizeof(ranges) / sizeof(ranges[0])); i++) {
+        for (h = ranges[i][0]; h <= ranges[i][1]; h++)
+            atom_headers[n_atom_headers++] = (uint8_t) h;
+    }
+}
+
+static size_t parse_size(const char* arg) {
+    char* end;
+    size_t size = strtoul(arg, &end, 0);
+
+    if (*end == 'k' || *end == 'K')
+        size <<= 10;
+    else if (*end == 'm' || *end == 'M')
+        size <<= 20;
+    return size;
+}
+
+static void set_weights(const char* arg, char* name) {
+    char buf[256], *tok, *save;
+    int k;
+
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char* colon = strchr(tok, ':');
+        if (colon == NULL)
+            usage(name);
+        *colon = '\0';
+        for (k = 0; k < P_KINDS && strcmp(tok, kind_names[k]); k++);
+        if (k == P_KINDS)
+            usage(name);
+        weights[k] = strtoul(colon + 1, NULL, 0);
+    }
+}
+
+/*
+    Formatter frames: 7 odd data bytes, 8 even bytes carrying an ID with
+    bit 0 set or data with bit 0 in the auxiliary byte 15. An ID byte whose
+    auxiliary bit is set gives the following byte to the previous ID, which
+    lets the ID change after a byte in an odd slot.
+*/
+typedef struct framer {
+    FILE* fp;
+    uint8_t frame[16];
+    int slot;
+    int cur_id;
+    uint64_t frames;
+} framer_t;
+
+static void frame_done(framer_t* f) {
+    if (fwrite(f->frame, 1, 16, f->fp) != 16) {
+        perror("fwrite");
+        exit(1);
+    }
+    memset(f->frame, 0, sizeof(f->frame));
+    f->slot = 0;
+    f->frames++;
+}
+
+static void frame_switch(framer_t* f, int id) {
+    if (f->slot & 1) {
+        // the data byte before goes after the ID byte, still of the old ID
+        f->frame[f->slot] = f->frame[f->slot - 1] | (f->frame[15] >> ((f->slot - 1) / 2) & 0x1);
+        f->frame[f->slot - 1] = (uint8_t) ((id << 1) | 1);
+        f->frame[15] |= 1 << ((f->slot - 1) / 2);
+    } else {
+        f->frame[f->slot] = (uint8_t) ((id << 1) | 1);
+        f->frame[15] &= ~(1 << (f->slot / 2));
+    }
+    f->slot++;
+    f->cur_id = id;
+    if (f->slot == 15)
+        frame_done(f);
+}
+
+static void frame_put(framer_t* f, int id, uint8_t byte) {
+    if (id != f->cur_id)
+        frame_switch(f, id);
+    if (f->slot & 1) {
+        f->frame[f->slot] = byte;
+    } else {
+        f->frame[f->slot] = byte & 0xfe;
+        f->frame[15] |= (byte & 0x1) << (f->slot / 2);
+    }
+    if (++f->slot == 15)
+        frame_done(f);
+}
+
+// the rest of the last frame goes to the null ID
+static void frame_finish(framer_t* f) {
+    if (f->slot == 0)
+        return;
+    frame_switch(f, 0);
+    while (f->slot != 0)
+        frame_put(f, 0, 0);
+}
+
+// writes a one-node graph at an address outside CODE_BASE, the R5 decodes without a milestone hit
+static void write_graph(const char* path) {
+    uint32_t words[3] = { (uint32_t) (CODE_BASE - 4), 0, TMG_END };
+    FILE* fp = fopen(path, "wb");
+
+    if (fp == NULL || fwrite(words, sizeof(words), 1, fp) != 1) {
+        perror(path);
+        exit(1);
+    }
+    fclose(fp);
+}
+
+int main(int argc, char *argv[]) {
+    const char* graph = NULL;
+    const char* weight_arg = NULL;
+    const mix_t* mix = &mixes[5];
+    size_t size = 16 << 20, burst = DEFAULT_BURST;
+    uint64_t seed = 1, packets = 0, bytes = 0;
+    stream_t streams[MAX_IDS];
+    int n_ids = 0, opt, i, k;
+    size_t m;
+
+    while ((opt = getopt(argc, argv, "m:w:s:F:b:p:S:g:")) != -1) {
+        if (opt == 'm') {
+            for (m = 0; m < sizeof(mixes) / sizeof(mixes[0]) && strcmp(optarg, mixes[m].name); m++);
+            if (m == sizeof(mixes) / sizeof(mixes[0]))
+                usage(argv[0]);
+            mix = &mixes[m];
+        } else if (opt == 'w')
+            weight_arg = optarg;
+        else if (opt == 's')
+            size = parse_size(optarg);
+        else if (opt == 'F' && (n_ids = strtol(optarg, NULL, 0)) >= 1 && n_ids <= MAX_IDS)
+            continue;
+        else if (opt == 'b' && (burst = strtoul(optarg, NULL, 0)) > 0)
+            continue;
+        else if (opt == 'p' && (sync_period = strtoul(optarg, NULL, 0)) > 0)
+            continue;
+        else if (opt == 'S')
+            seed = strtoull(optarg, NULL, 0);
+        else if (opt == 'g')
+            graph = optarg;
+        else
+            usage(argv[0]);
+    }
+    if (argc - optind != 1 || size == 0)
+        usage(argv[0]);
+
+    memcpy(weights, mix->weights, sizeof(weights));
+    if (weight_arg)
+        set_weights(weight_arg, argv[0]);
+    for (k = 0; k < P_KINDS; k++)
+        weight_sum += weights[k];
+    if (weight_sum == 0)
+        usage(argv[0]);
+    cycle_counts = weights[P_CYCLECOUNT] != 0;
+    r5_only = mix->r5;
+    init_atom_headers();
+
+    memset(streams, 0, sizeof(streams));
+    for (i = 0; i < (n_ids ? n_ids : 1); i++) {
+        stream_t* s = &streams[i];
+        s->rng = (seed + 1) * 0x9e3779b97f4a7c15ull + i;
+        next_rand(s);
+        for (k = 0; k < N_CONTEXTS; k++)
+            s->contexts[k] = 1000 + rand_below(s, 30000);
+        s->ts = 1 + rand_below(s, 1 << 30);
+        new_target(s);
+        generate(s, size);
+        packets += s->packets;
+        bytes += s->len;
+    }
+
+    FILE* fp = fopen(argv[optind], "wb");
+    if (fp == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (n_ids == 0) {
+        if (fwrite(streams[0].buf, 1, streams[0].len, fp) != streams[0].len) {
+            perror("fwrite");
+            exit(1);
+        }
+    } else {
+        framer_t f;
+        int left = n_ids;
+
+        memset(&f, 0, sizeof(f));
+        f.fp = fp;
+        f.cur_id = -1;
+        // round robin over the IDs, bursts of burst / 2 to 3 * burst / 2 bytes
+        while (left) {
+            for (i = 0; i < n_ids; i++) {
+                stream_t* s = &streams[i];
+                size_t n = burst / 2 + rand_below(s, burst + 1);
+
+                if (s->pos == s->len)
+                    continue;
+                if (n == 0)
+                    n = 1;
+                if (n > s->len - s->pos)
+                    n = s->len - s->pos;
+                for (m = 0; m < n; m++)
+                    frame_put(&f, i + 1, s->buf[s->pos + m]);
+                s->pos += n;
+                if (s->pos == s->len)
+                    left--;
+            }
+        }
+        frame_finish(&f);
+        printf("%lu frames, %lu bytes formatted\n", f.frames, f.frames * 16);
+    }
+    fclose(fp);
+
+    printf("mix %s:", mix->name);
+    for (k = 0; k < P_KINDS; k++)
+        printf(" %s:%u", kind_names[k], weights[k]);
+    printf("\n");
+    for (i = 0; i < (n_ids ? n_ids : 1); i++) {
+        stream_t* s = &streams[i];
+        printf("id %d: %zu bytes, %lu packets, %lu syncs,", n_ids ? i + 1 : 1, s->len, s->packets, s->syncs);
+        for (k = 0; k < P_KINDS; k++)
+            printf(" %s %lu", kind_names[k], s->counts[k]);
+        printf("\n");
+        free(s->buf);
+    }
+    printf("total: %lu bytes %lu packets\n", bytes, packets);
+
+    if (graph)
+        write_graph(graph);
+    return 0;
+}